@@ -14,6 +14,7 @@
 #include <asset_loader.h>
 #include <texture_asset.h>
 #include <mesh_asset.h>
+#include <mesh_optimizer.h>
 #include <material_asset.h>
 
 #define TINYGLTF_IMPLEMENTATION
@@ -35,13 +36,151 @@ namespace fs = std::filesystem;
 using namespace assets;
 
 
+//mesh optimization totals of the whole bake
+struct OptimizeReport {
+	size_t meshCount = 0;
+	size_t verticesBefore = 0;
+	size_t verticesAfter = 0;
+	size_t triangles = 0;
+	uint64_t transformedBefore = 0;
+	uint64_t transformedAfter = 0;
+	uint64_t coveredBefore = 0;
+	uint64_t shadedBefore = 0;
+	uint64_t coveredAfter = 0;
+	uint64_t shadedAfter = 0;
+	double milliseconds = 0;
+
+	void add(const assets::MeshOptimizeStats& stats, double ms);
+	void print() const;
+};
+
 struct ConverterState {
 	fs::path asset_path;
 	fs::path export_path;
+	//split meshes into meshlets for cluster culling, optional in the mesh format
+	bool buildMeshlets = true;
+	//weld vertices and reorder triangles/vertices for the gpu caches
+	bool optimizeMeshes = true;
+	//write the 16 byte quantized vertex format instead of 32 bit floats
+	bool quantizeVertices = true;
+	//write 16 bit indices when the mesh has few enough vertices
+	bool shortIndices = true;
+	//simplified lod levels appended to the index buffer
+	bool buildLods = true;
+	//filled while the meshes are converted
+	mutable OptimizeReport optimizeReport;
 
 	fs::path convert_to_export_relative(fs::path path)const;
 };
 
+void OptimizeReport::add(const assets::MeshOptimizeStats& stats, double ms)
+{
+	meshCount++;
+	verticesBefore += stats.vertexCountBefore;
+	verticesAfter += stats.vertexCountAfter;
+	triangles += stats.triangleCount;
+	transformedBefore += stats.cacheBefore.verticesTransformed;
+	transformedAfter += stats.cacheAfter.verticesTransformed;
+	coveredBefore += stats.overdrawBefore.pixelsCovered;
+	shadedBefore += stats.overdrawBefore.pixelsShaded;
+	coveredAfter += stats.overdrawAfter.pixelsCovered;
+	shadedAfter += stats.overdrawAfter.pixelsShaded;
+	milliseconds += ms;
+}
+
+void OptimizeReport::print() const
+{
+	if (meshCount == 0) return;
+
+	auto ratio = [](double a, double b) { return b == 0 ? 0.0 : a / b; };
+
+	std::cout << "mesh optimization summary: " << meshCount << " meshes, " << triangles << " triangles, took " << milliseconds << "ms" << std::endl;
+	std::cout << "	vertices " << verticesBefore << " -> " << verticesAfter << std::endl;
+	std::cout << "	ACMR " << ratio(transformedBefore, triangles) << " -> " << ratio(transformedAfter, triangles) << std::endl;
+	std::cout << "	ATVR " << ratio(transformedBefore, verticesBefore) << " -> " << ratio(transformedAfter, verticesAfter) << std::endl;
+	std::cout << "	overdraw " << ratio(shadedBefore, coveredBefore) << " -> " << ratio(shadedAfter, coveredAfter) << std::endl;
+}
+
+//weld, vertex cache, overdraw and vertex fetch optimization before the mesh is packed
+void optimize_baked_mesh(const std::string& meshname, std::vector<assets::Vertex_f32_PNCV>& _vertices, std::vector<uint32_t>& _indices, const ConverterState& convState)
+{
+	if (!convState.optimizeMeshes || _indices.empty()) return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	assets::MeshOptimizeStats stats = assets::optimize_mesh(_vertices, _indices);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	double ms = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1000000.0;
+
+	std::cout << "optimized mesh " << meshname << " took " << ms << "ms"
+		<< ": vertices " << stats.vertexCountBefore << " -> " << stats.vertexCountAfter
+		<< ", ACMR " << stats.cacheBefore.acmr << " -> " << stats.cacheAfter.acmr
+		<< ", ATVR " << stats.cacheBefore.atvr << " -> " << stats.cacheAfter.atvr
+		<< ", overdraw " << stats.overdrawBefore.overdraw << " -> " << stats.overdrawAfter.overdraw << std::endl;
+
+	convState.optimizeReport.add(stats, ms);
+}
+
+//build the meshlets, convert to the vertex/index formats picked by the flags and pack the mesh file
+//meshinfo.bounds has to be filled, quantized positions are relative to it
+assets::AssetFile pack_baked_mesh(MeshInfo& meshinfo, std::vector<assets::Vertex_f32_PNCV>& _vertices, std::vector<uint32_t>& _indices, const ConverterState& convState)
+{
+	std::vector<assets::Meshlet> _meshlets;
+	if (convState.buildMeshlets)
+	{
+		_meshlets = assets::build_meshlets(_vertices.data(), _vertices.size(), _indices.data(), _indices.size());
+	}
+	meshinfo.meshletBufferSize = _meshlets.size() * sizeof(assets::Meshlet);
+
+	//lods go after the meshlets, so the meshlets only cover level 0
+	meshinfo.lods.clear();
+	if (convState.buildLods && _indices.size() > 0)
+	{
+		meshinfo.lods = assets::build_lod_chain(_vertices, _indices);
+
+		std::cout << "lod chain of " << meshinfo.originalFile << ":";
+		for (auto& lod : meshinfo.lods)
+		{
+			std::cout << " " << lod.indexCount / 3 << " (" << lod.error << ")";
+		}
+		std::cout << std::endl;
+	}
+
+	std::vector<assets::Vertex_P16N8C8V16> quantizedVertices;
+	char* vertexData = (char*)_vertices.data();
+	if (convState.quantizeVertices)
+	{
+		quantizedVertices = assets::quantize_vertices(_vertices.data(), _vertices.size(), meshinfo.bounds);
+
+		meshinfo.vertexFormat = assets::VertexFormat::P16N8C8V16;
+		meshinfo.vertexBuferSize = quantizedVertices.size() * sizeof(assets::Vertex_P16N8C8V16);
+		vertexData = (char*)quantizedVertices.data();
+	}
+	else {
+		meshinfo.vertexFormat = assets::VertexFormat::PNCV_F32;
+		meshinfo.vertexBuferSize = _vertices.size() * sizeof(assets::Vertex_f32_PNCV);
+	}
+
+	//indices are relative to the mesh, so 16 bits are enough up to 65536 vertices
+	std::vector<uint16_t> shortIndices;
+	char* indexData = (char*)_indices.data();
+	if (convState.shortIndices && _vertices.size() <= 65536)
+	{
+		shortIndices.assign(_indices.begin(), _indices.end());
+
+		meshinfo.indexSize = sizeof(uint16_t);
+		meshinfo.indexBuferSize = shortIndices.size() * sizeof(uint16_t);
+		indexData = (char*)shortIndices.data();
+	}
+	else {
+		meshinfo.indexSize = sizeof(uint32_t);
+		meshinfo.indexBuferSize = _indices.size() * sizeof(uint32_t);
+	}
+
+	return assets::pack_mesh(&meshinfo, vertexData, indexData, _meshlets.size() > 0 ? (char*)_meshlets.data() : nullptr);
+}
+
 bool convert_image(const fs::path& input, const fs::path& output)
 {
 	int texWidth, texHeight, texChannels;
@@ -209,7 +348,7 @@ void extract_mesh_from_obj(std::vector<tinyobj::shape_t>& shapes, tinyobj::attri
 	}
 }
 
-bool convert_mesh(const fs::path& input, const fs::path& output)
+bool convert_mesh(const fs::path& input, const fs::path& output, const ConverterState& convState)
 {
 	//attrib will contain the assets::Vertex_f32_PNCV arrays of the file
 	tinyobj::attrib_t attrib;
@@ -245,26 +384,23 @@ bool convert_mesh(const fs::path& input, const fs::path& output)
 	}
 
 	using VertexFormat = assets::Vertex_f32_PNCV;
-	auto VertexFormatEnum = assets::VertexFormat::PNCV_F32;
 
 	std::vector<VertexFormat> _vertices;
 	std::vector<uint32_t> _indices;
 
 	extract_mesh_from_obj(shapes, attrib, _indices, _vertices);
 
+	//obj faces come unindexed, welding brings the shared vertices back
+	optimize_baked_mesh(input.stem().string(), _vertices, _indices, convState);
 
 	MeshInfo meshinfo;
-	meshinfo.vertexFormat = VertexFormatEnum;
-	meshinfo.vertexBuferSize = _vertices.size() * sizeof(VertexFormat);
-	meshinfo.indexBuferSize = _indices.size() * sizeof(uint32_t);
-	meshinfo.indexSize = sizeof(uint32_t);
 	meshinfo.originalFile = input.string();	
 
 	meshinfo.bounds = assets::calculateBounds(_vertices.data(), _vertices.size());
 	//pack mesh file
 	auto start = std::chrono::high_resolution_clock::now();
 
-	assets::AssetFile newFile = assets::pack_mesh(&meshinfo, (char*)_vertices.data(), (char*)_indices.data());
+	assets::AssetFile newFile = pack_baked_mesh(meshinfo, _vertices, _indices, convState);
 	
 	auto  end = std::chrono::high_resolution_clock::now();
 
@@ -493,7 +629,6 @@ bool extract_gltf_meshes(tinygltf::Model& model, const fs::path& input, const fs
 
 
 		using VertexFormat = assets::Vertex_f32_PNCV;
-		auto VertexFormatEnum = assets::VertexFormat::PNCV_F32;
 
 		std::vector<VertexFormat> _vertices;
 		std::vector<uint32_t> _indices;
@@ -510,17 +645,15 @@ bool extract_gltf_meshes(tinygltf::Model& model, const fs::path& input, const fs
 			extract_gltf_indices(primitive, model, _indices);
 			extract_gltf_vertices(primitive, model, _vertices);
 
+			optimize_baked_mesh(meshname, _vertices, _indices, convState);
+
 
 			MeshInfo meshinfo;
-			meshinfo.vertexFormat = VertexFormatEnum;
-			meshinfo.vertexBuferSize = _vertices.size() * sizeof(VertexFormat);
-			meshinfo.indexBuferSize = _indices.size() * sizeof(uint32_t);
-			meshinfo.indexSize = sizeof(uint32_t);
 			meshinfo.originalFile = input.string();
 
 			meshinfo.bounds = assets::calculateBounds(_vertices.data(), _vertices.size());
 
-			assets::AssetFile newFile = assets::pack_mesh(&meshinfo, (char*)_vertices.data(), (char*)_indices.data());
+			assets::AssetFile newFile = pack_baked_mesh(meshinfo, _vertices, _indices, convState);
 
 			fs::path meshpath = outputFolder / (meshname + ".mesh");
 
@@ -943,7 +1076,6 @@ void extract_assimp_meshes(const aiScene* scene, const fs::path& input, const fs
 		auto mesh = scene->mMeshes[meshindex];
 
 		using VertexFormat = assets::Vertex_f32_PNCV;
-		auto VertexFormatEnum = assets::VertexFormat::PNCV_F32;
 
 		std::vector<VertexFormat> _vertices;
 		std::vector<uint32_t> _indices;
@@ -1024,16 +1156,14 @@ void extract_assimp_meshes(const aiScene* scene, const fs::path& input, const fs
 			}
 		}
 
+		optimize_baked_mesh(meshname, _vertices, _indices, convState);
+
 		MeshInfo meshinfo;
-		meshinfo.vertexFormat = VertexFormatEnum;
-		meshinfo.vertexBuferSize = _vertices.size() * sizeof(VertexFormat);
-		meshinfo.indexBuferSize = _indices.size() * sizeof(uint32_t);
-		meshinfo.indexSize = sizeof(uint32_t);
 		meshinfo.originalFile = input.string();
 
 		meshinfo.bounds = assets::calculateBounds(_vertices.data(), _vertices.size());
 
-		assets::AssetFile newFile = assets::pack_mesh(&meshinfo, (char*)_vertices.data(), (char*)_indices.data());
+		assets::AssetFile newFile = pack_baked_mesh(meshinfo, _vertices, _indices, convState);
 
 		fs::path meshpath = outputFolder / (meshname + ".mesh");
 
@@ -1163,6 +1293,31 @@ int main(int argc, char* argv[])
 		convstate.asset_path = path;
 		convstate.export_path = exported_dir;
 
+		//optional flags after the asset directory
+		for (int i = 2; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--no-meshlets") == 0)
+			{
+				convstate.buildMeshlets = false;
+			}
+			if (strcmp(argv[i], "--no-optimize") == 0)
+			{
+				convstate.optimizeMeshes = false;
+			}
+			if (strcmp(argv[i], "--f32-vertices") == 0)
+			{
+				convstate.quantizeVertices = false;
+			}
+			if (strcmp(argv[i], "--u32-indices") == 0)
+			{
+				convstate.shortIndices = false;
+			}
+			if (strcmp(argv[i], "--no-lods") == 0)
+			{
+				convstate.buildLods = false;
+			}
+		}
+
 		for (auto& p : fs::recursive_directory_iterator(directory))
 		{
 			std::cout << "File: " << p << std::endl;
@@ -1191,7 +1346,7 @@ int main(int argc, char* argv[])
 			//	std::cout << "found a mesh" << std::endl;
 			//
 			//	export_path.replace_extension(".mesh");
-			//	convert_mesh(p.path(), export_path);
+			//	convert_mesh(p.path(), export_path, convstate);
 			//}
 			if (p.path().extension() == ".gltf")
 			{
@@ -1258,6 +1413,8 @@ int main(int argc, char* argv[])
 				}
 			}
 		}
+
+		convstate.optimizeReport.print();
 	}
 
 	return 0;
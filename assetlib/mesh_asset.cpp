@@ -2,6 +2,9 @@
 #include "json.hpp"
 #include "lz4.h"
 #include <iostream>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
 
 assets::VertexFormat parse_format(const char* f) {
 
@@ -13,6 +16,10 @@ assets::VertexFormat parse_format(const char* f) {
 	{
 		return assets::VertexFormat::P32N8C8V16;
 	}
+	else if (strcmp(f, "P16N8C8V16") == 0)
+	{
+		return assets::VertexFormat::P16N8C8V16;
+	}
 	else
 	{
 		return assets::VertexFormat::Unknown;
@@ -56,15 +63,38 @@ assets::MeshInfo assets::read_mesh_info(AssetFile* file)
 	//transit string data to enum class 
 	std::string vertexFormat = metadata["vertex_format"];
 	info.vertexFormat = parse_format(vertexFormat.c_str());
+
+	//meshlets are optional, older mesh files dont have them
+	if (metadata.contains("meshlet_buffer_size"))
+	{
+		info.meshletBufferSize = metadata["meshlet_buffer_size"];
+	}
+	else {
+		info.meshletBufferSize = 0;
+	}
+
+	//lods are optional too, stored as [firstIndex, indexCount, error]
+	info.lods.clear();
+	if (metadata.contains("lods"))
+	{
+		for (auto& lod : metadata["lods"])
+		{
+			MeshLod level;
+			level.firstIndex = lod[0];
+			level.indexCount = lod[1];
+			level.error = lod[2];
+			info.lods.push_back(level);
+		}
+	}
     return info;
 }
 
-void assets::unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer)
+void assets::unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer, char* meshletBuffer)
 {
 	//decompressing into staging temporal vector. 
 	//TODO: streaming decompress directly on the buffers
 	std::vector<char> decompressedBuffer;
-	decompressedBuffer.resize(info->vertexBuferSize + info->indexBuferSize);
+	decompressedBuffer.resize(info->vertexBuferSize + info->indexBuferSize + info->meshletBufferSize);
 
 	LZ4_decompress_safe(sourcebuffer, decompressedBuffer.data(), static_cast<int>(sourceSize), static_cast<int>(decompressedBuffer.size()));
 
@@ -73,9 +103,15 @@ void assets::unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t source
 
 	//copy index buffer
 	memcpy(indexBuffer, decompressedBuffer.data() + info->vertexBuferSize, info->indexBuferSize);
+
+	//copy meshlet buffer, stored after the indices
+	if (meshletBuffer && info->meshletBufferSize > 0)
+	{
+		memcpy(meshletBuffer, decompressedBuffer.data() + info->vertexBuferSize + info->indexBuferSize, info->meshletBufferSize);
+	}
 }
 
-assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* indexData)
+assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* indexData, char* meshletData)
 {
     AssetFile file;
 	file.type[0] = 'M';
@@ -92,11 +128,25 @@ assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* inde
 	{
 		metadata["vertex_format"] = "PNCV_F32";
 	}
+	else if (info->vertexFormat == VertexFormat::P16N8C8V16)
+	{
+		metadata["vertex_format"] = "P16N8C8V16";
+	}
 	metadata["vertex_buffer_size"] = info->vertexBuferSize;
 	metadata["index_buffer_size"] = info->indexBuferSize;
 	metadata["index_size"] = info->indexSize;
 	metadata["original_file"] = info->originalFile;
 
+	if (info->lods.size() > 0)
+	{
+		nlohmann::json lods = nlohmann::json::array();
+		for (auto& lod : info->lods)
+		{
+			lods.push_back({ lod.firstIndex, lod.indexCount, lod.error });
+		}
+		metadata["lods"] = lods;
+	}
+
 	std::vector<float> boundsData;
 	boundsData.resize(7);
 
@@ -112,7 +162,17 @@ assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* inde
 
 	metadata["bounds"] = boundsData;
 
-	size_t fullsize = info->vertexBuferSize + info->indexBuferSize;
+	if (!meshletData)
+	{
+		info->meshletBufferSize = 0;
+	}
+	if (info->meshletBufferSize > 0)
+	{
+		metadata["meshlet_buffer_size"] = info->meshletBufferSize;
+		metadata["meshlet_count"] = info->meshletBufferSize / sizeof(Meshlet);
+	}
+
+	size_t fullsize = info->vertexBuferSize + info->indexBuferSize + info->meshletBufferSize;
 
 	std::vector<char> merged_buffer;
 	merged_buffer.resize(fullsize);
@@ -123,6 +183,11 @@ assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* inde
 	//copy index buffer
 	memcpy(merged_buffer.data() + info->vertexBuferSize, indexData, info->indexBuferSize);
 
+	//copy meshlet buffer
+	if (info->meshletBufferSize > 0)
+	{
+		memcpy(merged_buffer.data() + info->vertexBuferSize + info->indexBuferSize, meshletData, info->meshletBufferSize);
+	}
 
 	//compress buffer and copy it into the file struct
 	size_t compressStaging = LZ4_compressBound(static_cast<int>(fullsize));
@@ -186,3 +251,307 @@ assets::MeshBounds assets::calculateBounds(Vertex_f32_PNCV* vertices, size_t cou
 
 	return bounds;
 }
+
+std::vector<assets::Meshlet> assets::build_meshlets(Vertex_f32_PNCV* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount, size_t maxVertices, size_t maxTriangles)
+{
+	std::vector<Meshlet> meshlets;
+	if (indexCount < 3) return meshlets;
+
+	//last meshlet that used every vertex, avoids a set lookup per corner
+	std::vector<uint32_t> vertexOwner(vertexCount, UINT32_MAX);
+	std::vector<uint32_t> meshletVertices;
+	meshletVertices.reserve(maxVertices);
+
+	uint32_t firstIndex = 0;
+	uint32_t triangleCount = 0;
+
+	auto finish_meshlet = [&](uint32_t endIndex) {
+		Meshlet meshlet = {};
+		meshlet.firstIndex = firstIndex;
+		meshlet.indexCount = endIndex - firstIndex;
+		meshlet.vertexCount = static_cast<uint32_t>(meshletVertices.size());
+
+		//bounding sphere around the center of the cluster aabb
+		float minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t v : meshletVertices)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				minPos[c] = std::min(minPos[c], vertices[v].position[c]);
+				maxPos[c] = std::max(maxPos[c], vertices[v].position[c]);
+			}
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			meshlet.center[c] = (minPos[c] + maxPos[c]) * 0.5f;
+		}
+		float r2 = 0;
+		for (uint32_t v : meshletVertices)
+		{
+			float dx = vertices[v].position[0] - meshlet.center[0];
+			float dy = vertices[v].position[1] - meshlet.center[1];
+			float dz = vertices[v].position[2] - meshlet.center[2];
+			r2 = std::max(r2, dx * dx + dy * dy + dz * dz);
+		}
+		meshlet.radius = std::sqrt(r2);
+
+		//normal cone from the face normals
+		//the winding of the baked index buffer is flipped, so faces are oriented using the authored vertex normals
+		std::vector<float> faceNormals;
+		faceNormals.reserve(meshlet.indexCount);
+		float axis[3] = { 0, 0, 0 };
+		for (uint32_t i = meshlet.firstIndex; i < endIndex; i += 3)
+		{
+			const float* p0 = vertices[indices[i + 0]].position;
+			const float* p1 = vertices[indices[i + 1]].position;
+			const float* p2 = vertices[indices[i + 2]].position;
+
+			float e0[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e1[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+
+			float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length <= 0.f)
+			{
+				continue;//degenerate triangle
+			}
+			float vn[3] = { 0, 0, 0 };
+			for (int k = 0; k < 3; k++)
+			{
+				const float* corner = vertices[indices[i + k]].normal;
+				vn[0] += corner[0]; vn[1] += corner[1]; vn[2] += corner[2];
+			}
+			float facing = (n[0] * vn[0] + n[1] * vn[1] + n[2] * vn[2]) < 0.f ? -1.f : 1.f;
+			for (int c = 0; c < 3; c++)
+			{
+				n[c] = n[c] / length * facing;
+				axis[c] += n[c];
+				faceNormals.push_back(n[c]);
+			}
+		}
+
+		float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		float minDot = 1.f;
+		if (axisLength > 0.f && faceNormals.size() > 0)
+		{
+			for (int c = 0; c < 3; c++) axis[c] /= axisLength;
+
+			for (size_t f = 0; f < faceNormals.size(); f += 3)
+			{
+				float d = faceNormals[f + 0] * axis[0] + faceNormals[f + 1] * axis[1] + faceNormals[f + 2] * axis[2];
+				minDot = std::min(minDot, d);
+			}
+		}
+		else {
+			minDot = -1.f;
+		}
+
+		meshlet.coneAxis[0] = axis[0];
+		meshlet.coneAxis[1] = axis[1];
+		meshlet.coneAxis[2] = axis[2];
+		//cone spread wider than ~84 degrees cant cull anything useful, disable the test
+		if (minDot <= 0.1f)
+		{
+			meshlet.coneCutoff = 1.f;
+		}
+		else {
+			meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+		}
+
+		meshlets.push_back(meshlet);
+
+		meshletVertices.clear();
+		triangleCount = 0;
+		firstIndex = endIndex;
+	};
+
+	for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		uint32_t meshletID = static_cast<uint32_t>(meshlets.size());
+
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			if (vertexOwner[indices[i + k]] != meshletID) newVertices++;
+		}
+		//corners of the same triangle can share a vertex
+		if (indices[i] == indices[i + 1] && vertexOwner[indices[i]] != meshletID) newVertices--;
+		if ((indices[i + 2] == indices[i] || indices[i + 2] == indices[i + 1]) && vertexOwner[indices[i + 2]] != meshletID) newVertices--;
+
+		if (meshletVertices.size() + newVertices > maxVertices || triangleCount + 1 > maxTriangles)
+		{
+			finish_meshlet(i);
+			meshletID = static_cast<uint32_t>(meshlets.size());
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = indices[i + k];
+			if (vertexOwner[v] != meshletID)
+			{
+				vertexOwner[v] = meshletID;
+				meshletVertices.push_back(v);
+			}
+		}
+		triangleCount++;
+	}
+
+	if (triangleCount > 0)
+	{
+		finish_meshlet(static_cast<uint32_t>(indexCount - indexCount % 3));
+	}
+
+	return meshlets;
+}
+
+uint16_t assets::pack_half(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(float));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	//nan and inf
+	if (((bits >> 23) & 0xff) == 0xff)
+	{
+		return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	}
+	//overflow to inf
+	if (exponent >= 31)
+	{
+		return static_cast<uint16_t>(sign | 0x7c00);
+	}
+	//denormal or zero
+	if (exponent <= 0)
+	{
+		if (exponent < -10) return static_cast<uint16_t>(sign);
+
+		mantissa |= 0x800000;
+		uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		//round to nearest
+		if ((mantissa >> (shift - 1)) & 1) half++;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	//round to nearest, a carry into the exponent is still the right value
+	if (mantissa & 0x1000) half++;
+	return static_cast<uint16_t>(half);
+}
+
+float assets::unpack_half(uint16_t h)
+{
+	uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+
+	uint32_t bits;
+	if (exponent == 0)
+	{
+		if (mantissa == 0)
+		{
+			bits = sign;
+		}
+		else {
+			//normalize the denormal
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+		}
+	}
+	else if (exponent == 0x1f)
+	{
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+
+void assets::pack_oct_normal(const float* normal, uint8_t* oct)
+{
+	float n[3] = { normal[0], normal[1], normal[2] };
+	float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+	if (l1 <= 0)
+	{
+		n[2] = 1;
+		l1 = 1;
+	}
+	for (int i = 0; i < 3; i++) n[i] /= l1;
+
+	float x = n[0];
+	float y = n[1];
+	//lower hemisphere folds over the diagonals
+	if (n[2] < 0)
+	{
+		x = (1.f - std::abs(n[1])) * (n[0] >= 0.f ? 1.f : -1.f);
+		y = (1.f - std::abs(n[0])) * (n[1] >= 0.f ? 1.f : -1.f);
+	}
+
+	oct[0] = static_cast<uint8_t>(std::round(std::clamp(x * 0.5f + 0.5f, 0.f, 1.f) * 255.f));
+	oct[1] = static_cast<uint8_t>(std::round(std::clamp(y * 0.5f + 0.5f, 0.f, 1.f) * 255.f));
+}
+
+void assets::unpack_oct_normal(const uint8_t* oct, float* normal)
+{
+	float x = oct[0] / 255.f * 2.f - 1.f;
+	float y = oct[1] / 255.f * 2.f - 1.f;
+	float z = 1.f - std::abs(x) - std::abs(y);
+	float t = std::clamp(-z, 0.f, 1.f);
+
+	x += x >= 0.f ? -t : t;
+	y += y >= 0.f ? -t : t;
+
+	float length = std::sqrt(x * x + y * y + z * z);
+	normal[0] = x / length;
+	normal[1] = y / length;
+	normal[2] = z / length;
+}
+
+std::vector<assets::Vertex_P16N8C8V16> assets::quantize_vertices(const Vertex_f32_PNCV* vertices, size_t count, const MeshBounds& bounds)
+{
+	std::vector<Vertex_P16N8C8V16> quantized(count);
+
+	float boxMin[3];
+	float invSize[3];
+	for (int c = 0; c < 3; c++)
+	{
+		boxMin[c] = bounds.origin[c] - bounds.extents[c];
+		float size = bounds.extents[c] * 2.f;
+		invSize[c] = size > 0 ? 1.f / size : 0.f;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const Vertex_f32_PNCV& v = vertices[i];
+		Vertex_P16N8C8V16& q = quantized[i];
+
+		for (int c = 0; c < 3; c++)
+		{
+			float unorm = std::clamp((v.position[c] - boxMin[c]) * invSize[c], 0.f, 1.f);
+			q.position[c] = static_cast<uint16_t>(std::round(unorm * 65535.f));
+
+			q.color[c] = static_cast<uint8_t>(std::round(std::clamp(v.color[c], 0.f, 1.f) * 255.f));
+		}
+		q.color[3] = 255;
+
+		pack_oct_normal(v.normal, q.normal);
+
+		q.uv[0] = pack_half(v.uv[0]);
+		q.uv[1] = pack_half(v.uv[1]);
+	}
+
+	return quantized;
+}
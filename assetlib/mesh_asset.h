@@ -17,16 +17,27 @@ namespace assets {
 	struct Vertex_P32N8C8V16 {
 
 		float position[3];
-		uint8_t normal[3];
+		uint8_t normal[3];//unorm, n * 0.5 + 0.5
 		uint8_t color[3];
-		float uv[2];
+		uint16_t uv[2];//half float
+	};
+	//compact vertex, 16 bytes
+	//position at 16 bits unorm inside the mesh bounds box (origin - extents, origin + extents)
+	//octahedral normal at 8 bits, color at 8 bits, uvs at 16 bits float
+	struct Vertex_P16N8C8V16 {
+
+		uint16_t position[3];
+		uint8_t normal[2];//octahedral encoded
+		uint8_t color[4];//rgb, a unused
+		uint16_t uv[2];//half float
 	};
 
 	enum class VertexFormat : uint32_t
 	{
 		Unknown = 0,
 		PNCV_F32, //everything at 32 bits
-		P32N8C8V16 //position at 32 bits, normal at 8 bits, color at 8 bits, uvs at 16 bits float
+		P32N8C8V16, //position at 32 bits, normal at 8 bits, color at 8 bits, uvs at 16 bits float
+		P16N8C8V16 //position quantized at 16 bits, octahedral normal at 8 bits, color at 8 bits, uvs at 16 bits float
 	};
 
 	//mesh bounds include cube and sphere
@@ -37,6 +48,31 @@ namespace assets {
 		float extents[3];//cube bounds
 	};
 
+	//meshlet: a small cluster of triangles stored as a contiguous range of the index buffer
+	//bounds and normal cone are in mesh space, used for per-cluster culling on gpu
+	struct Meshlet {
+		float center[3];//bounding sphere center
+		float radius;
+		float coneAxis[3];//average facing direction of the cluster triangles
+		float coneCutoff;//sin of the cone spread, >= 1 means the cone test is disabled
+		uint32_t firstIndex;//index offset inside the mesh index buffer
+		uint32_t indexCount;
+		uint32_t vertexCount;//unique vertices referenced by the cluster
+		uint32_t padding;
+	};
+
+	//index range of a lod level inside the mesh index buffer, every level shares the vertex buffer
+	struct MeshLod {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;//simplification error relative to the mesh size
+	};
+
+	constexpr size_t MESH_MAX_LODS = 4;
+
+	//default cluster limits, 124 triangles keeps primitive count under 128 for mesh shader friendly sizes
+	constexpr size_t MESHLET_MAX_VERTICES = 64;
+	constexpr size_t MESHLET_MAX_TRIANGLES = 124;
 
 	struct MeshInfo {
 		uint64_t vertexBuferSize;
@@ -46,6 +82,11 @@ namespace assets {
 		char indexSize;
 		CompressionMode compressionMode;
 		std::string originalFile;// original file path
+		//optional meshlet array, 0 when the mesh was baked without meshlets
+		uint64_t meshletBufferSize{ 0 };
+		//lod levels, level 0 first. empty means a single level covering the whole index buffer
+		//meshlets only cover level 0
+		std::vector<MeshLod> lods;
 	};
 
 	//transit assert meta file info to mesh info
@@ -55,10 +96,27 @@ namespace assets {
 	
 	//decompression mesh binaryBlob:sourcebuffer,
 	//get vertex buffer size based on MeshInfo
-	void unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer);
-	//compress vertex data and index data to binary blob
-	AssetFile pack_mesh(MeshInfo* info, char* vertexData, char* indexData);
+	//meshletBuffer can be null if the caller doesnt need the meshlets
+	void unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer, char* meshletBuffer = nullptr);
+	//compress vertex data, index data and optional meshlet data to binary blob
+	AssetFile pack_mesh(MeshInfo* info, char* vertexData, char* indexData, char* meshletData = nullptr);
 
 	//calculate mesh bounds size( origin,radius and extent)
 	MeshBounds calculateBounds(Vertex_f32_PNCV* vertices, size_t count);
+
+	//float <-> half float, round to nearest
+	uint16_t pack_half(float f);
+	float unpack_half(uint16_t h);
+
+	//unit normal <-> 2 byte octahedral encoding
+	void pack_oct_normal(const float* normal, uint8_t* oct);
+	void unpack_oct_normal(const uint8_t* oct, float* normal);
+
+	//quantize to the compact format, positions are relative to the bounds box
+	std::vector<Vertex_P16N8C8V16> quantize_vertices(const Vertex_f32_PNCV* vertices, size_t count, const MeshBounds& bounds);
+
+	//split a 32 bit triangle list into meshlets, greedy in index order
+	//triangles are not reordered, so every meshlet is a contiguous range of the index buffer
+	std::vector<Meshlet> build_meshlets(Vertex_f32_PNCV* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+		size_t maxVertices = MESHLET_MAX_VERTICES, size_t maxTriangles = MESHLET_MAX_TRIANGLES);
 }
\ No newline at end of file
@@ -0,0 +1,833 @@
+#include "mesh_optimizer.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+	//hash and compare vertices by their bytes, positions with -0 and 0 dont weld but thats rare
+	struct VertexHasher {
+		const assets::Vertex_f32_PNCV* vertices;
+
+		size_t operator()(uint32_t index) const
+		{
+			//fnv-1a
+			const unsigned char* data = reinterpret_cast<const unsigned char*>(&vertices[index]);
+			size_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < sizeof(assets::Vertex_f32_PNCV); i++)
+			{
+				hash ^= data[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+	};
+
+	struct VertexEqual {
+		const assets::Vertex_f32_PNCV* vertices;
+
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			return memcmp(&vertices[a], &vertices[b], sizeof(assets::Vertex_f32_PNCV)) == 0;
+		}
+	};
+
+	//fifo cache step, returns 1 on a miss
+	inline uint32_t update_cache(uint32_t v, std::vector<uint32_t>& cacheTime, uint32_t& timestamp, size_t cacheSize)
+	{
+		if (timestamp - cacheTime[v] > cacheSize)
+		{
+			cacheTime[v] = timestamp++;
+			return 1;
+		}
+		return 0;
+	}
+
+	//unnormalized face normal (length is twice the area), turned to agree with the vertex normals
+	//so the result doesnt depend on the winding, the baker flips the gltf winding
+	inline void oriented_normal(const assets::Vertex_f32_PNCV& a, const assets::Vertex_f32_PNCV& b, const assets::Vertex_f32_PNCV& c, float* n)
+	{
+		float e1[3] = { b.position[0] - a.position[0], b.position[1] - a.position[1], b.position[2] - a.position[2] };
+		float e2[3] = { c.position[0] - a.position[0], c.position[1] - a.position[1], c.position[2] - a.position[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+		float facing = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			facing += n[i] * (a.normal[i] + b.normal[i] + c.normal[i]);
+		}
+		if (facing < 0)
+		{
+			n[0] = -n[0];
+			n[1] = -n[1];
+			n[2] = -n[2];
+		}
+	}
+
+	//edge function of the rasterizer, positive when p is on the left of a->b
+	inline float edge(float ax, float ay, float bx, float by, float px, float py)
+	{
+		return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+	}
+
+	//symmetric 4x4 error quadric of the simplifier
+	struct Quadric {
+		double a00, a01, a02, a03;
+		double a11, a12, a13;
+		double a22, a23;
+		double a33;
+		//sum of the plane weights, the error is divided by it
+		double weight;
+	};
+
+	inline void add_quadric(Quadric& q, const Quadric& o)
+	{
+		q.a00 += o.a00; q.a01 += o.a01; q.a02 += o.a02; q.a03 += o.a03;
+		q.a11 += o.a11; q.a12 += o.a12; q.a13 += o.a13;
+		q.a22 += o.a22; q.a23 += o.a23;
+		q.a33 += o.a33;
+		q.weight += o.weight;
+	}
+
+	//squared distance to the plane n.p + d = 0, weighted
+	inline Quadric plane_quadric(double nx, double ny, double nz, double d, double weight)
+	{
+		Quadric q;
+		q.a00 = nx * nx * weight; q.a01 = nx * ny * weight; q.a02 = nx * nz * weight; q.a03 = nx * d * weight;
+		q.a11 = ny * ny * weight; q.a12 = ny * nz * weight; q.a13 = ny * d * weight;
+		q.a22 = nz * nz * weight; q.a23 = nz * d * weight;
+		q.a33 = d * d * weight;
+		q.weight = weight;
+		return q;
+	}
+
+	//weighted mean of the squared plane distances, so the error stays a squared length whatever the weights
+	inline double quadric_error(const Quadric& q, const float* p)
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double error = q.a00 * x * x + 2 * q.a01 * x * y + 2 * q.a02 * x * z + 2 * q.a03 * x
+			+ q.a11 * y * y + 2 * q.a12 * y * z + 2 * q.a13 * y
+			+ q.a22 * z * z + 2 * q.a23 * z
+			+ q.a33;
+		if (q.weight > 0) error /= q.weight;
+		return error < 0 ? 0 : error;
+	}
+
+	inline void triangle_normal(const float* p0, const float* p1, const float* p2, double* n)
+	{
+		double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+
+	constexpr int OVERDRAW_GRID = 256;
+
+	//facing is decided by the caller, any winding is accepted here
+	void rasterize(const float* v0, const float* v1, const float* v2, std::vector<float>& depth, uint32_t& covered, uint32_t& shaded)
+	{
+		float area = edge(v0[0], v0[1], v1[0], v1[1], v2[0], v2[1]);
+		if (area < 0)
+		{
+			std::swap(v1, v2);
+			area = -area;
+		}
+		//degenerate on the grid
+		if (area == 0) return;
+
+		int minx = std::max(0, static_cast<int>(std::floor(std::min({ v0[0], v1[0], v2[0] }))));
+		int miny = std::max(0, static_cast<int>(std::floor(std::min({ v0[1], v1[1], v2[1] }))));
+		int maxx = std::min(OVERDRAW_GRID - 1, static_cast<int>(std::ceil(std::max({ v0[0], v1[0], v2[0] }))));
+		int maxy = std::min(OVERDRAW_GRID - 1, static_cast<int>(std::ceil(std::max({ v0[1], v1[1], v2[1] }))));
+
+		float invArea = 1.f / area;
+		for (int y = miny; y <= maxy; y++)
+		{
+			for (int x = minx; x <= maxx; x++)
+			{
+				//sample at pixel center
+				float px = x + 0.5f;
+				float py = y + 0.5f;
+
+				float w0 = edge(v1[0], v1[1], v2[0], v2[1], px, py);
+				float w1 = edge(v2[0], v2[1], v0[0], v0[1], px, py);
+				float w2 = edge(v0[0], v0[1], v1[0], v1[1], px, py);
+				if (w0 < 0 || w1 < 0 || w2 < 0) continue;
+
+				float z = (w0 * v0[2] + w1 * v1[2] + w2 * v2[2]) * invArea;
+
+				float& d = depth[y * OVERDRAW_GRID + x];
+				if (d == FLT_MAX) covered++;
+				if (z < d)
+				{
+					shaded++;
+					d = z;
+				}
+			}
+		}
+	}
+}
+
+size_t assets::weld_vertices(std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<Vertex_f32_PNCV> welded;
+	welded.reserve(vertices.size());
+
+	std::unordered_map<uint32_t, uint32_t, VertexHasher, VertexEqual> table(vertices.size(), VertexHasher{ vertices.data() }, VertexEqual{ vertices.data() });
+
+	//only referenced vertices survive, in index order
+	for (uint32_t index : indices)
+	{
+		if (remap[index] != UINT32_MAX) continue;
+
+		auto it = table.emplace(index, static_cast<uint32_t>(welded.size()));
+		if (it.second)
+		{
+			welded.push_back(vertices[index]);
+		}
+		remap[index] = it.first->second;
+	}
+
+	//welding can collapse triangles, drop them
+	size_t writeIndex = 0;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		uint32_t a = remap[indices[i + 0]];
+		uint32_t b = remap[indices[i + 1]];
+		uint32_t c = remap[indices[i + 2]];
+		if (a == b || b == c || a == c) continue;
+
+		indices[writeIndex++] = a;
+		indices[writeIndex++] = b;
+		indices[writeIndex++] = c;
+	}
+	indices.resize(writeIndex);
+
+	vertices = std::move(welded);
+	return vertices.size();
+}
+
+void assets::optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* clusters, size_t cacheSize)
+{
+	size_t faceCount = indexCount / 3;
+	if (clusters)
+	{
+		clusters->clear();
+		clusters->push_back(0);
+	}
+	if (faceCount == 0) return;
+
+	//vertex -> triangle adjacency
+	std::vector<uint32_t> triangleCount(vertexCount, 0);
+	for (size_t i = 0; i < faceCount * 3; i++)
+	{
+		triangleCount[indices[i]]++;
+	}
+	std::vector<uint32_t> triangleOffset(vertexCount, 0);
+	std::exclusive_scan(triangleCount.begin(), triangleCount.end(), triangleOffset.begin(), 0u);
+
+	std::vector<uint32_t> triangleList(faceCount * 3);
+	{
+		std::vector<uint32_t> cursor = triangleOffset;
+		for (size_t i = 0; i < faceCount * 3; i++)
+		{
+			triangleList[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	//live triangles left for every vertex
+	std::vector<uint32_t> live = triangleCount;
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<uint8_t> emitted(faceCount, 0);
+
+	std::vector<uint32_t> deadEnd;
+	deadEnd.reserve(faceCount * 3);
+
+	std::vector<uint32_t> result;
+	result.reserve(faceCount * 3);
+
+	uint32_t timestamp = static_cast<uint32_t>(cacheSize) + 1;
+	size_t scanCursor = 0;
+
+	auto next_live_vertex = [&]() -> int64_t {
+		for (; scanCursor < vertexCount; scanCursor++)
+		{
+			if (live[scanCursor] > 0) return static_cast<int64_t>(scanCursor);
+		}
+		return -1;
+	};
+
+	int64_t fanning = next_live_vertex();
+	while (fanning >= 0)
+	{
+		//emit every remaining triangle around the fanning vertex
+		size_t candidateStart = deadEnd.size();
+		uint32_t first = triangleOffset[fanning];
+		for (uint32_t k = first; k < first + triangleCount[fanning]; k++)
+		{
+			uint32_t t = triangleList[k];
+			if (emitted[t]) continue;
+
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t v = indices[t * 3 + c];
+				result.push_back(v);
+				deadEnd.push_back(v);
+				live[v]--;
+				update_cache(v, cacheTime, timestamp, cacheSize);
+			}
+			emitted[t] = 1;
+		}
+
+		//oldest candidate that is still going to be in cache after its remaining triangles
+		int64_t best = -1;
+		int64_t bestPriority = -1;
+		for (size_t c = candidateStart; c < deadEnd.size(); c++)
+		{
+			uint32_t v = deadEnd[c];
+			if (live[v] == 0) continue;
+
+			int64_t priority = 0;
+			if (timestamp - cacheTime[v] + 2 * live[v] <= cacheSize)
+			{
+				priority = timestamp - cacheTime[v];
+			}
+			if (priority > bestPriority)
+			{
+				best = v;
+				bestPriority = priority;
+			}
+		}
+
+		if (best < 0)
+		{
+			//dead end, go back through the recent vertices and then scan in input order
+			while (!deadEnd.empty())
+			{
+				uint32_t v = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[v] > 0)
+				{
+					best = v;
+					break;
+				}
+			}
+			if (best < 0)
+			{
+				best = next_live_vertex();
+			}
+			if (best >= 0 && clusters)
+			{
+				clusters->push_back(static_cast<uint32_t>(result.size() / 3));
+			}
+		}
+		fanning = best;
+	}
+
+	memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+}
+
+void assets::optimize_overdraw(uint32_t* indices, size_t indexCount, const Vertex_f32_PNCV* vertices, size_t vertexCount, const std::vector<uint32_t>& clusters, float threshold)
+{
+	size_t faceCount = indexCount / 3;
+	if (faceCount == 0 || clusters.empty()) return;
+
+	//split the hard clusters while the running acmr is already good enough
+	std::vector<uint32_t> softClusters;
+	{
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		uint32_t timestamp = static_cast<uint32_t>(VERTEX_CACHE_SIZE) + 1;
+
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			uint32_t start = clusters[c];
+			uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(faceCount);
+			if (start >= end) continue;
+
+			//acmr of the whole hard cluster
+			timestamp += VERTEX_CACHE_SIZE + 1;
+			uint32_t clusterMisses = 0;
+			for (uint32_t t = start; t < end; t++)
+			{
+				for (int i = 0; i < 3; i++)
+				{
+					clusterMisses += update_cache(indices[t * 3 + i], cacheTime, timestamp, VERTEX_CACHE_SIZE);
+				}
+			}
+			float clusterThreshold = threshold * (static_cast<float>(clusterMisses) / static_cast<float>(end - start));
+
+			softClusters.push_back(start);
+
+			timestamp += VERTEX_CACHE_SIZE + 1;
+			uint32_t runningMisses = 0;
+			uint32_t runningFaces = 0;
+			for (uint32_t t = start; t < end; t++)
+			{
+				for (int i = 0; i < 3; i++)
+				{
+					runningMisses += update_cache(indices[t * 3 + i], cacheTime, timestamp, VERTEX_CACHE_SIZE);
+				}
+				runningFaces++;
+
+				if (t + 1 < end && static_cast<float>(runningMisses) / static_cast<float>(runningFaces) <= clusterThreshold)
+				{
+					softClusters.push_back(t + 1);
+					timestamp += VERTEX_CACHE_SIZE + 1;
+					runningMisses = 0;
+					runningFaces = 0;
+				}
+			}
+		}
+	}
+
+	size_t clusterCount = softClusters.size();
+
+	//mesh centroid
+	float meshCentroid[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < faceCount * 3; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			meshCentroid[c] += vertices[indices[i]].position[c];
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		meshCentroid[c] /= static_cast<float>(faceCount * 3);
+	}
+
+	//sort key: how much the cluster faces away from the mesh center, area weighted
+	std::vector<float> sortKey(clusterCount, 0);
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		uint32_t start = softClusters[c];
+		uint32_t end = c + 1 < clusterCount ? softClusters[c + 1] : static_cast<uint32_t>(faceCount);
+
+		float area = 0;
+		float centroid[3] = { 0, 0, 0 };
+		float normal[3] = { 0, 0, 0 };
+		for (uint32_t t = start; t < end; t++)
+		{
+			const float* p0 = vertices[indices[t * 3 + 0]].position;
+			const float* p1 = vertices[indices[t * 3 + 1]].position;
+			const float* p2 = vertices[indices[t * 3 + 2]].position;
+
+			float n[3];
+			oriented_normal(vertices[indices[t * 3 + 0]], vertices[indices[t * 3 + 1]], vertices[indices[t * 3 + 2]], n);
+			float triArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int i = 0; i < 3; i++)
+			{
+				centroid[i] += (p0[i] + p1[i] + p2[i]) / 3.f * triArea;
+				normal[i] += n[i];
+			}
+			area += triArea;
+		}
+
+		float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (area <= 0 || normalLength <= 0) continue;
+
+		float key = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			key += (centroid[i] / area - meshCentroid[i]) * (normal[i] / normalLength);
+		}
+		sortKey[c] = key;
+	}
+
+	std::vector<uint32_t> order(clusterCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return sortKey[a] > sortKey[b];
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(faceCount * 3);
+	for (uint32_t c : order)
+	{
+		uint32_t start = softClusters[c];
+		uint32_t end = c + 1 < clusterCount ? softClusters[c + 1] : static_cast<uint32_t>(faceCount);
+		result.insert(result.end(), indices + start * 3, indices + end * 3);
+	}
+
+	memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+}
+
+void assets::optimize_vertex_fetch(std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<Vertex_f32_PNCV> ordered;
+	ordered.reserve(vertices.size());
+
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = static_cast<uint32_t>(ordered.size());
+			ordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	vertices = std::move(ordered);
+}
+
+assets::VertexCacheStats assets::analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+	VertexCacheStats stats = {};
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<uint8_t> used(vertexCount, 0);
+	uint32_t timestamp = static_cast<uint32_t>(cacheSize) + 1;
+	uint32_t uniqueVertices = 0;
+
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t v = indices[i];
+		stats.verticesTransformed += update_cache(v, cacheTime, timestamp, cacheSize);
+		if (!used[v])
+		{
+			used[v] = 1;
+			uniqueVertices++;
+		}
+	}
+
+	size_t faceCount = indexCount / 3;
+	stats.acmr = faceCount == 0 ? 0 : static_cast<float>(stats.verticesTransformed) / static_cast<float>(faceCount);
+	stats.atvr = uniqueVertices == 0 ? 0 : static_cast<float>(stats.verticesTransformed) / static_cast<float>(uniqueVertices);
+
+	return stats;
+}
+
+assets::OverdrawStats assets::analyze_overdraw(const uint32_t* indices, size_t indexCount, const Vertex_f32_PNCV* vertices, size_t vertexCount)
+{
+	OverdrawStats stats = {};
+	if (indexCount < 3 || vertexCount == 0) return stats;
+
+	//fit the mesh in a unit cube keeping the proportions
+	float minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			minPos[c] = std::min(minPos[c], vertices[i].position[c]);
+			maxPos[c] = std::max(maxPos[c], vertices[i].position[c]);
+		}
+	}
+	float extent = std::max({ maxPos[0] - minPos[0], maxPos[1] - minPos[1], maxPos[2] - minPos[2] });
+	float scale = extent > 0 ? 1.f / extent : 0.f;
+
+	std::vector<float> depth(OVERDRAW_GRID * OVERDRAW_GRID);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int flip = 0; flip < 2; flip++)
+		{
+			std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+			for (size_t i = 0; i + 2 < indexCount; i += 3)
+			{
+				//backface test in view space, the viewer is at -z
+				float n[3];
+				oriented_normal(vertices[indices[i + 0]], vertices[indices[i + 1]], vertices[indices[i + 2]], n);
+				float viewNormalZ = flip ? -n[(axis + 2) % 3] : n[(axis + 2) % 3];
+				if (viewNormalZ >= 0) continue;
+
+				float projected[3][3];
+				for (int k = 0; k < 3; k++)
+				{
+					const float* p = vertices[indices[i + k]].position;
+					float x = (p[(axis + 0) % 3] - minPos[(axis + 0) % 3]) * scale;
+					float y = (p[(axis + 1) % 3] - minPos[(axis + 1) % 3]) * scale;
+					float z = (p[(axis + 2) % 3] - minPos[(axis + 2) % 3]) * scale;
+					//look from the other side, rotation around y so the winding stays meaningful
+					if (flip)
+					{
+						x = 1.f - x;
+						z = 1.f - z;
+					}
+					projected[k][0] = x * OVERDRAW_GRID;
+					projected[k][1] = y * OVERDRAW_GRID;
+					projected[k][2] = z;
+				}
+				rasterize(projected[0], projected[1], projected[2], depth, stats.pixelsCovered, stats.pixelsShaded);
+			}
+		}
+	}
+
+	stats.overdraw = stats.pixelsCovered == 0 ? 0 : static_cast<float>(stats.pixelsShaded) / static_cast<float>(stats.pixelsCovered);
+	return stats;
+}
+
+std::vector<uint32_t> assets::simplify_mesh(const Vertex_f32_PNCV* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+	size_t targetIndexCount, float targetError, float* resultError)
+{
+	std::vector<uint32_t> result(indices, indices + indexCount);
+	if (resultError) *resultError = 0;
+
+	float minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (uint32_t index : result)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			minPos[c] = std::min(minPos[c], vertices[index].position[c]);
+			maxPos[c] = std::max(maxPos[c], vertices[index].position[c]);
+		}
+	}
+	float extent = std::max({ maxPos[0] - minPos[0], maxPos[1] - minPos[1], maxPos[2] - minPos[2] });
+	if (result.size() < 3 || extent <= 0) return result;
+
+	double errorLimit = static_cast<double>(targetError) * extent;
+	errorLimit *= errorLimit;
+
+	//area weighted plane quadrics of the triangles around every vertex
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (size_t i = 0; i + 2 < result.size(); i += 3)
+	{
+		const float* p0 = vertices[result[i + 0]].position;
+		double n[3];
+		triangle_normal(p0, vertices[result[i + 1]].position, vertices[result[i + 2]].position, n);
+
+		double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length <= 0) continue;
+		n[0] /= length;
+		n[1] /= length;
+		n[2] /= length;
+
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		Quadric q = plane_quadric(n[0], n[1], n[2], d, length * 0.5);
+		for (int k = 0; k < 3; k++)
+		{
+			add_quadric(quadrics[result[i + k]], q);
+		}
+	}
+
+	//an edge without its opposite half edge is a border or a uv seam, keep its vertices in place
+	std::vector<uint8_t> locked(vertexCount, 0);
+	{
+		std::unordered_set<uint64_t> halfEdges;
+		halfEdges.reserve(result.size());
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			uint64_t a = result[i];
+			uint64_t b = result[i % 3 == 2 ? i - 2 : i + 1];
+			halfEdges.insert((a << 32) | b);
+		}
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			uint64_t a = result[i];
+			uint64_t b = result[i % 3 == 2 ? i - 2 : i + 1];
+			if (halfEdges.find((b << 32) | a) == halfEdges.end())
+			{
+				locked[a] = 1;
+				locked[b] = 1;
+			}
+		}
+	}
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double error;
+	};
+
+	std::vector<uint32_t> triangleCount(vertexCount);
+	std::vector<uint32_t> triangleOffset(vertexCount);
+	std::vector<uint32_t> triangleList;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint8_t> dirty(vertexCount);
+	std::vector<Collapse> collapses;
+	double maxError = 0;
+
+	//every pass collapses a set of independent edges, cheapest first, then rebuilds the index buffer
+	while (result.size() > targetIndexCount)
+	{
+		size_t faceCount = result.size() / 3;
+
+		std::fill(triangleCount.begin(), triangleCount.end(), 0);
+		for (uint32_t index : result)
+		{
+			triangleCount[index]++;
+		}
+		std::exclusive_scan(triangleCount.begin(), triangleCount.end(), triangleOffset.begin(), 0u);
+		triangleList.resize(result.size());
+		{
+			std::vector<uint32_t> cursor = triangleOffset;
+			for (size_t i = 0; i < result.size(); i++)
+			{
+				triangleList[cursor[result[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			uint32_t a = result[i];
+			uint32_t b = result[i % 3 == 2 ? i - 2 : i + 1];
+
+			Quadric q = quadrics[a];
+			add_quadric(q, quadrics[b]);
+
+			if (!locked[a]) collapses.push_back({ a, b, quadric_error(q, vertices[b].position) });
+			if (!locked[b]) collapses.push_back({ b, a, quadric_error(q, vertices[a].position) });
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.error < y.error;
+		});
+
+		std::iota(remap.begin(), remap.end(), 0u);
+		std::fill(dirty.begin(), dirty.end(), 0);
+
+		size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+		size_t trianglesRemoved = 0;
+		size_t collapseCount = 0;
+
+		for (const Collapse& c : collapses)
+		{
+			if (c.error > errorLimit) break;
+			if (dirty[c.from] || dirty[c.to]) continue;
+
+			//moving from onto to must not flip any of the triangles that survive
+			bool flips = false;
+			uint32_t removed = 0;
+			for (uint32_t k = triangleOffset[c.from]; k < triangleOffset[c.from] + triangleCount[c.from]; k++)
+			{
+				uint32_t t = triangleList[k];
+				uint32_t* tri = &result[t * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+				{
+					removed++;
+					continue;
+				}
+
+				const float* p[3];
+				const float* moved[3];
+				for (int v = 0; v < 3; v++)
+				{
+					p[v] = vertices[tri[v]].position;
+					moved[v] = tri[v] == c.from ? vertices[c.to].position : p[v];
+				}
+				double before[3];
+				double after[3];
+				triangle_normal(p[0], p[1], p[2], before);
+				triangle_normal(moved[0], moved[1], moved[2], after);
+				if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0)
+				{
+					flips = true;
+					break;
+				}
+			}
+			if (flips) continue;
+
+			remap[c.from] = c.to;
+			add_quadric(quadrics[c.to], quadrics[c.from]);
+			maxError = std::max(maxError, c.error);
+
+			//the triangles around both ends changed, dont touch them again this pass
+			for (uint32_t end : { c.from, c.to })
+			{
+				for (uint32_t k = triangleOffset[end]; k < triangleOffset[end] + triangleCount[end]; k++)
+				{
+					uint32_t t = triangleList[k];
+					dirty[result[t * 3 + 0]] = 1;
+					dirty[result[t * 3 + 1]] = 1;
+					dirty[result[t * 3 + 2]] = 1;
+				}
+			}
+
+			collapseCount++;
+			trianglesRemoved += removed;
+			if (trianglesRemoved >= trianglesToRemove) break;
+		}
+
+		if (collapseCount == 0) break;
+
+		size_t writeIndex = 0;
+		for (size_t t = 0; t < faceCount; t++)
+		{
+			uint32_t a = remap[result[t * 3 + 0]];
+			uint32_t b = remap[result[t * 3 + 1]];
+			uint32_t c = remap[result[t * 3 + 2]];
+			if (a == b || b == c || a == c) continue;
+
+			result[writeIndex++] = a;
+			result[writeIndex++] = b;
+			result[writeIndex++] = c;
+		}
+		result.resize(writeIndex);
+	}
+
+	if (resultError) *resultError = static_cast<float>(std::sqrt(maxError) / extent);
+	return result;
+}
+
+std::vector<assets::MeshLod> assets::build_lod_chain(const std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices, size_t maxLods, float reduction, float maxError)
+{
+	std::vector<MeshLod> lods;
+	lods.push_back({ 0, static_cast<uint32_t>(indices.size()), 0.f });
+
+	std::vector<uint32_t> previous = indices;
+	while (lods.size() < maxLods)
+	{
+		size_t target = static_cast<size_t>(previous.size() / 3 * reduction) * 3;
+		if (target < 3) break;
+
+		//coarser levels can drift further from the surface
+		float levelError = maxError * static_cast<float>(1u << (lods.size() - 1));
+
+		float error = 0;
+		std::vector<uint32_t> level = simplify_mesh(vertices.data(), vertices.size(), previous.data(), previous.size(), target, levelError, &error);
+
+		//stuck on locked vertices or the error limit, not worth another level
+		if (level.empty() || level.size() > previous.size() * 0.85f) break;
+
+		optimize_vertex_cache(level.data(), level.size(), vertices.size(), nullptr);
+
+		//errors of the levels add up since every level is simplified from the previous one
+		lods.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(level.size()), lods.back().error + error });
+		indices.insert(indices.end(), level.begin(), level.end());
+
+		previous = std::move(level);
+	}
+
+	return lods;
+}
+
+assets::MeshOptimizeStats assets::optimize_mesh(std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices, bool measureOverdraw)
+{
+	MeshOptimizeStats stats = {};
+	stats.vertexCountBefore = vertices.size();
+	stats.cacheBefore = analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+	if (measureOverdraw)
+	{
+		stats.overdrawBefore = analyze_overdraw(indices.data(), indices.size(), vertices.data(), vertices.size());
+	}
+
+	weld_vertices(vertices, indices);
+
+	std::vector<uint32_t> clusters;
+	optimize_vertex_cache(indices.data(), indices.size(), vertices.size(), &clusters);
+
+	optimize_overdraw(indices.data(), indices.size(), vertices.data(), vertices.size(), clusters);
+
+	optimize_vertex_fetch(vertices, indices);
+
+	stats.vertexCountAfter = vertices.size();
+	stats.triangleCount = indices.size() / 3;
+	stats.cacheAfter = analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+	if (measureOverdraw)
+	{
+		stats.overdrawAfter = analyze_overdraw(indices.data(), indices.size(), vertices.data(), vertices.size());
+	}
+	return stats;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <mesh_asset.h>
+#include <vector>
+
+namespace assets {
+
+	//post transform cache size used by the reordering and the stats, fifo model
+	constexpr size_t VERTEX_CACHE_SIZE = 16;
+	//overdraw pass can make acmr this much worse in exchange of better triangle order
+	constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+	struct VertexCacheStats {
+		uint32_t verticesTransformed;//cache misses
+		float acmr;//average cache miss ratio, transformed vertices per triangle (0.5 best, 3 worst)
+		float atvr;//average transform to vertex ratio, transformed vertices per unique vertex (1 best)
+	};
+
+	struct OverdrawStats {
+		uint32_t pixelsCovered;
+		uint32_t pixelsShaded;
+		float overdraw;//shaded / covered (1 best)
+	};
+
+	//before and after numbers of a single optimize_mesh call
+	struct MeshOptimizeStats {
+		size_t vertexCountBefore;
+		size_t vertexCountAfter;
+		size_t triangleCount;
+		VertexCacheStats cacheBefore;
+		VertexCacheStats cacheAfter;
+		OverdrawStats overdrawBefore;
+		OverdrawStats overdrawAfter;
+	};
+
+	//merge vertices that are bit identical and remove unreferenced vertices and degenerate triangles
+	//returns the new vertex count
+	size_t weld_vertices(std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices);
+
+	//tipsify reorder of the triangles for the post transform cache (Sander, Nehab, Barczak 2007)
+	//clusters gets the first triangle of every run that restarted from a dead end, can be null
+	void optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* clusters, size_t cacheSize = VERTEX_CACHE_SIZE);
+
+	//sort the triangle clusters so outward facing clusters are drawn first and occlude the rest
+	//clusters are the hard boundaries from optimize_vertex_cache, split further while the acmr stays under threshold
+	void optimize_overdraw(uint32_t* indices, size_t indexCount, const Vertex_f32_PNCV* vertices, size_t vertexCount, const std::vector<uint32_t>& clusters, float threshold = OVERDRAW_THRESHOLD);
+
+	//reorder the vertices in first use order of the index buffer so fetches are linear
+	void optimize_vertex_fetch(std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices);
+
+	VertexCacheStats analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = VERTEX_CACHE_SIZE);
+
+	//software rasterization of the mesh from the 6 axis directions
+	OverdrawStats analyze_overdraw(const uint32_t* indices, size_t indexCount, const Vertex_f32_PNCV* vertices, size_t vertexCount);
+
+	//quadric error edge collapse (Garland, Heckbert 1997) down to targetIndexCount
+	//vertices are only collapsed onto each other so the result indexes the same vertex buffer
+	//border and uv seam vertices are locked, collapses stop once the error goes over targetError (relative to the mesh size)
+	std::vector<uint32_t> simplify_mesh(const Vertex_f32_PNCV* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+		size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+	//append simplified levels to indices, each one about reduction times the previous level
+	//returns the ranges of every level, level 0 is the original index buffer
+	std::vector<MeshLod> build_lod_chain(const std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices,
+		size_t maxLods = MESH_MAX_LODS, float reduction = 0.5f, float maxError = 0.01f);
+
+	//full baker pipeline: weld, vertex cache, overdraw, vertex fetch
+	//overdraw stats rasterize the mesh twice, skip them with measureOverdraw = false
+	MeshOptimizeStats optimize_mesh(std::vector<Vertex_f32_PNCV>& vertices, std::vector<uint32_t>& indices, bool measureOverdraw = true);
+}
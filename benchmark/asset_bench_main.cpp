@@ -0,0 +1,276 @@
+#include <asset_loader.h>
+#include <mesh_asset.h>
+#include <texture_asset.h>
+#include <prefab_asset.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//every allocation of the process goes through here, so a call can be charged with the ones it made
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace {
+
+	//minimum time spent on a single measurement
+	constexpr double MIN_BENCH_MS = 250.0;
+
+	//runs function until MIN_BENCH_MS passed, bytes is what one call reads or writes
+	void measure(const std::string& name, size_t bytes, const std::function<void()>& function)
+	{
+		//pack_mesh logs every call, keep it out of the numbers
+		std::stringstream sink;
+		std::streambuf* coutBuffer = std::cout.rdbuf(sink.rdbuf());
+
+		//first call warms the caches and any lazy allocation
+		function();
+
+		uint64_t calls = 0;
+		uint64_t allocationsStart = g_allocations.load();
+		auto start = std::chrono::high_resolution_clock::now();
+		double elapsed = 0;
+		while (elapsed < MIN_BENCH_MS || calls < 3)
+		{
+			function();
+			calls++;
+			elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			sink.str({});
+		}
+		uint64_t allocations = g_allocations.load() - allocationsStart;
+
+		std::cout.rdbuf(coutBuffer);
+
+		double msPerCall = elapsed / calls;
+		double mbPerSecond = (double(bytes) / (1024.0 * 1024.0)) / (msPerCall / 1000.0);
+		double allocationsPerCall = double(allocations) / calls;
+
+		std::printf("%-40s %12.4f ms %12.1f MB/s %10.1f allocs\n", name.c_str(), msPerCall, mbPerSecond, allocationsPerCall);
+	}
+
+	//a wavy grid, positions and normals vary like a real mesh so lz4 does not see a constant stream
+	std::vector<assets::Vertex_f32_PNCV> make_vertices(size_t count, std::mt19937& rng)
+	{
+		std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+		std::vector<assets::Vertex_f32_PNCV> vertices(count);
+		size_t side = std::max<size_t>(2, static_cast<size_t>(std::sqrt(double(count))));
+		for (size_t i = 0; i < count; i++)
+		{
+			float x = float(i % side);
+			float z = float(i / side);
+			assets::Vertex_f32_PNCV& v = vertices[i];
+			v.position[0] = x;
+			v.position[1] = std::sin(x * 0.1f) * std::cos(z * 0.1f) + noise(rng);
+			v.position[2] = z;
+			v.normal[0] = 0; v.normal[1] = 1; v.normal[2] = 0;
+			v.color[0] = 1; v.color[1] = 1; v.color[2] = 1;
+			v.uv[0] = x / side;
+			v.uv[1] = z / side;
+		}
+		return vertices;
+	}
+
+	std::vector<uint32_t> make_indices(size_t vertexCount)
+	{
+		size_t side = std::max<size_t>(2, static_cast<size_t>(std::sqrt(double(vertexCount))));
+		std::vector<uint32_t> indices;
+		for (size_t z = 0; z + 1 < side && (z + 1) * side < vertexCount; z++)
+		{
+			for (size_t x = 0; x + 1 < side; x++)
+			{
+				uint32_t i0 = static_cast<uint32_t>(z * side + x);
+				uint32_t i1 = i0 + 1;
+				uint32_t i2 = static_cast<uint32_t>(i0 + side);
+				uint32_t i3 = i2 + 1;
+				indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+			}
+		}
+		return indices;
+	}
+
+	void bench_mesh(size_t vertexCount, std::mt19937& rng, const std::string& tempFile)
+	{
+		std::string label = std::to_string(vertexCount) + " verts";
+
+		std::vector<assets::Vertex_f32_PNCV> vertices = make_vertices(vertexCount, rng);
+		std::vector<uint32_t> indices = make_indices(vertexCount);
+
+		measure("calculateBounds " + label, vertices.size() * sizeof(assets::Vertex_f32_PNCV), [&]() {
+			volatile float radius = assets::calculateBounds(vertices.data(), vertices.size()).radius;
+			(void)radius;
+		});
+
+		assets::MeshInfo info;
+		info.vertexBuferSize = vertices.size() * sizeof(assets::Vertex_f32_PNCV);
+		info.indexBuferSize = indices.size() * sizeof(uint32_t);
+		info.vertexFormat = assets::VertexFormat::PNCV_F32;
+		info.indexSize = sizeof(uint32_t);
+		info.originalFile = "synthetic";
+		info.bounds = assets::calculateBounds(vertices.data(), vertices.size());
+		info.compressionMode = assets::CompressionMode::LZ4;
+
+		size_t rawSize = info.vertexBuferSize + info.indexBuferSize;
+
+		assets::AssetFile file;
+		measure("pack_mesh " + label, rawSize, [&]() {
+			file = assets::pack_mesh(&info, (char*)vertices.data(), (char*)indices.data());
+		});
+
+		std::vector<char> vertexOut(info.vertexBuferSize);
+		std::vector<char> indexOut(info.indexBuferSize);
+		measure("unpack_mesh " + label, rawSize, [&]() {
+			assets::unpack_mesh(&info, file.binaryBlob.data(), file.binaryBlob.size(), vertexOut.data(), indexOut.data());
+		});
+
+		size_t fileSize = file.json.size() + file.binaryBlob.size();
+		measure("save_binaryfile " + label, fileSize, [&]() {
+			assets::save_binaryfile(tempFile.c_str(), file);
+		});
+
+		assets::AssetFile loaded;
+		measure("load_binaryfile " + label, fileSize, [&]() {
+			assets::load_binaryfile(tempFile.c_str(), loaded);
+		});
+	}
+
+	void bench_texture(uint32_t size, std::mt19937& rng)
+	{
+		std::string label = std::to_string(size) + "^2";
+
+		//full mip chain, one page per level
+		assets::TextureInfo info;
+		info.textureFormat = assets::TextureFormat::RGBA8;
+		info.compressionMode = assets::CompressionMode::LZ4;
+		info.originalFile = "synthetic";
+		info.textureSize = 0;
+		for (uint32_t w = size, h = size; w > 0 && h > 0; w /= 2, h /= 2)
+		{
+			assets::PageInfo page;
+			page.width = w;
+			page.height = h;
+			page.originalSize = w * h * 4;
+			page.compressedSize = 0;
+			info.pages.push_back(page);
+			info.textureSize += page.originalSize;
+		}
+
+		//gradients with a bit of noise, compresses like a photo texture rather than a flat color
+		std::uniform_int_distribution<int> noise(0, 7);
+		std::vector<uint8_t> pixels(info.textureSize);
+		for (size_t i = 0; i < pixels.size(); i++)
+		{
+			size_t texel = i / 4;
+			pixels[i] = static_cast<uint8_t>((texel % size) + (texel / size) * (i % 4) + noise(rng));
+		}
+
+		assets::AssetFile file;
+		measure("pack_texture " + label, info.textureSize, [&]() {
+			assets::TextureInfo packInfo = info;
+			file = assets::pack_texture(&packInfo, pixels.data());
+		});
+		assets::TextureInfo packed = assets::read_texture_info(&file);
+
+		std::vector<char> destination(info.textureSize);
+		measure("unpack_texture " + label, info.textureSize, [&]() {
+			assets::unpack_texture(&packed, file.binaryBlob.data(), file.binaryBlob.size(), destination.data());
+		});
+
+		//the last page is the one that walks over every other page header
+		int lastPage = static_cast<int>(packed.pages.size()) - 1;
+		measure("unpack_texture_page 0 " + label, packed.pages[0].originalSize, [&]() {
+			assets::unpack_texture_page(&packed, 0, file.binaryBlob.data(), destination.data());
+		});
+		measure("unpack_texture_page last " + label, packed.pages[lastPage].originalSize, [&]() {
+			assets::unpack_texture_page(&packed, lastPage, file.binaryBlob.data(), destination.data());
+		});
+	}
+
+	void bench_prefab(size_t nodeCount)
+	{
+		std::string label = std::to_string(nodeCount) + " nodes";
+
+		assets::PrefabInfo info;
+		for (uint64_t node = 0; node < nodeCount; node++)
+		{
+			info.node_matrices[node] = static_cast<int>(info.matrices.size());
+			info.matrices.push_back({ 1,0,0,0, 0,1,0,0, 0,0,1,0, float(node),0,0,1 });
+			info.node_names[node] = "node_" + std::to_string(node);
+			if (node > 0)
+			{
+				info.node_parents[node] = (node - 1) / 4;
+			}
+			info.node_meshes[node] = { "materials/material_" + std::to_string(node % 64) + ".mat", "meshes/mesh_" + std::to_string(node) + ".mesh" };
+		}
+
+		assets::AssetFile file = assets::pack_prefab(info);
+		size_t fileSize = file.json.size() + file.binaryBlob.size();
+
+		measure("read_prefab_info " + label, fileSize, [&]() {
+			assets::PrefabInfo read = assets::read_prefab_info(&file);
+			(void)read;
+		});
+	}
+}
+
+//asset_bench [--quick]
+//synthetic meshes, textures and prefabs at several sizes, time per call, MB/s and heap allocations per call
+int main(int argc, char* argv[])
+{
+	bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+
+	std::mt19937 rng(0);
+	std::string tempFile = (std::filesystem::temp_directory_path() / "asset_bench.bin").string();
+
+	std::printf("%-40s %15s %17s %17s\n", "", "time/call", "throughput", "allocs/call");
+
+	std::vector<size_t> meshSizes = quick ? std::vector<size_t>{ 1024, 65536 } : std::vector<size_t>{ 1024, 65536, 1048576 };
+	for (size_t count : meshSizes)
+	{
+		bench_mesh(count, rng, tempFile);
+	}
+
+	std::vector<uint32_t> textureSizes = quick ? std::vector<uint32_t>{ 256, 1024 } : std::vector<uint32_t>{ 256, 1024, 4096 };
+	for (uint32_t size : textureSizes)
+	{
+		bench_texture(size, rng);
+	}
+
+	std::vector<size_t> prefabSizes = quick ? std::vector<size_t>{ 16, 1024 } : std::vector<size_t>{ 16, 1024, 16384 };
+	for (size_t count : prefabSizes)
+	{
+		bench_prefab(count);
+	}
+
+	std::filesystem::remove(tempFile);
+	return 0;
+}
@@ -0,0 +1,292 @@
+#include <benchmark.h>
+#include <vk_engine.h>
+#include <vk_profiler.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include "json.hpp"
+#include "logger.h"
+
+namespace {
+
+	//nearest rank, values has to be sorted
+	double percentile(const std::vector<double>& values, double p)
+	{
+		if (values.empty()) return 0;
+		size_t rank = static_cast<size_t>(p / 100.0 * (values.size() - 1) + 0.5);
+		return values[std::min(rank, values.size() - 1)];
+	}
+
+	nlohmann::json summarize(std::vector<double> values)
+	{
+		nlohmann::json summary;
+		std::sort(values.begin(), values.end());
+
+		double total = 0;
+		for (double v : values)
+		{
+			total += v;
+		}
+
+		summary["count"] = values.size();
+		summary["mean"] = values.empty() ? 0.0 : total / values.size();
+		summary["p50"] = percentile(values, 50);
+		summary["p95"] = percentile(values, 95);
+		summary["p99"] = percentile(values, 99);
+		summary["max"] = values.empty() ? 0.0 : values.back();
+		return summary;
+	}
+
+	bool load_run(const std::string& path, nlohmann::json& run)
+	{
+		std::ifstream file(path);
+		if (!file.is_open())
+		{
+			LOG_ERROR("Failed to open benchmark run {}", path);
+			return false;
+		}
+
+		run = nlohmann::json::parse(file, nullptr, false);
+		if (run.is_discarded() || !run.contains("summary"))
+		{
+			LOG_ERROR("{} is not a benchmark run", path);
+			return false;
+		}
+		return true;
+	}
+}
+
+void BenchmarkRecorder::record(VulkanEngine& engine)
+{
+	BenchmarkFrame frame;
+	frame.frametime = engine.stats.frametime;
+	frame.cpuWait = engine.stats.cpuWait;
+	frame.gpuWait = engine.stats.gpuWait;
+	for (auto& [k, v] : engine._profiler->cpuTiming)
+	{
+		frame.cpu[std::string(k)] = v;
+	}
+	frame.gpu = engine._profiler->timing;
+	frame.objects = engine.stats.objects;
+	frame.drawcalls = engine.stats.drawcalls;
+	frame.draws = engine.stats.draws;
+	frame.triangles = engine.stats.triangles;
+	frame.heapAllocations = engine.stats.heapAllocations;
+	frame.heapBytes = engine.stats.heapBytes;
+	frame.deviceAllocations = engine.stats.deviceAllocations;
+	for (auto& [k, v] : engine._profiler->cpuAllocations)
+	{
+		frame.allocations[std::string(k)] = v.allocations;
+	}
+
+	auto record_pass = [&](const std::string& name, MeshpassType type) {
+		PassStats& pass = engine.stats.passes[type];
+		frame.passes[name + "/inputPrimitives"] = double(pass.inputPrimitives);
+		frame.passes[name + "/vertexInvocations"] = double(pass.vertexInvocations);
+		frame.passes[name + "/clippingPrimitives"] = double(pass.clippingPrimitives);
+		frame.passes[name + "/fragmentInvocations"] = double(pass.fragmentInvocations);
+		frame.passes[name + "/instances"] = pass.instances;
+		frame.passes[name + "/visibleInstances"] = pass.visibleInstances;
+		frame.passes[name + "/culledInstances"] = pass.instances - std::min(pass.visibleInstances, pass.instances);
+		frame.passes[name + "/indirectCommands"] = pass.indirectCommands;
+		frame.passes[name + "/indirectDraws"] = pass.indirectDraws;
+	};
+	record_pass("forward", MeshpassType::Forward);
+	record_pass("transparent", MeshpassType::Transparency);
+	record_pass("shadow", MeshpassType::DirectionalShadow);
+
+	frames.push_back(std::move(frame));
+}
+
+bool BenchmarkRecorder::write(const std::string& path, const VulkanEngine& engine) const
+{
+	if (frames.empty())
+	{
+		LOG_ERROR("No frames recorded, nothing to write");
+		return false;
+	}
+
+	nlohmann::json run;
+
+	nlohmann::json config;
+	config["prefab"] = engine._scenePrefab;
+	config["grid"] = engine._sceneGrid;
+	config["spacing"] = engine._sceneSpacing;
+	config["scale"] = engine._sceneScale;
+	config["cameraPath"] = engine._cameraPathFile;
+	config["framesInFlight"] = engine._framesInFlight;
+	config["frames"] = frames.size();
+	config["trackAllocations"] = alloctrack::enabled();
+	run["config"] = config;
+
+	//metric name -> values of every frame, timings are ms
+	std::map<std::string, std::vector<double>> series;
+
+	nlohmann::json frameArray = nlohmann::json::array();
+	for (const BenchmarkFrame& frame : frames)
+	{
+		nlohmann::json f;
+		f["frametime"] = frame.frametime;
+		f["cpuWait"] = frame.cpuWait;
+		f["gpuWait"] = frame.gpuWait;
+		f["cpu"] = frame.cpu;
+		f["gpu"] = frame.gpu;
+		f["objects"] = frame.objects;
+		f["drawcalls"] = frame.drawcalls;
+		f["draws"] = frame.draws;
+		f["triangles"] = frame.triangles;
+		f["passes"] = frame.passes;
+		if (alloctrack::enabled())
+		{
+			f["heapAllocations"] = frame.heapAllocations;
+			f["heapBytes"] = frame.heapBytes;
+			f["deviceAllocations"] = frame.deviceAllocations;
+			f["allocations"] = frame.allocations;
+		}
+		frameArray.push_back(f);
+
+		series["frametime"].push_back(frame.frametime);
+		series["cpuWait"].push_back(frame.cpuWait);
+		series["gpuWait"].push_back(frame.gpuWait);
+		for (auto& [k, v] : frame.cpu)
+		{
+			series["cpu/" + k].push_back(v);
+		}
+		for (auto& [k, v] : frame.gpu)
+		{
+			series["gpu/" + k].push_back(v);
+		}
+		series["objects"].push_back(frame.objects);
+		series["drawcalls"].push_back(frame.drawcalls);
+		series["draws"].push_back(frame.draws);
+		series["triangles"].push_back(frame.triangles);
+		for (auto& [k, v] : frame.passes)
+		{
+			series["pass/" + k].push_back(v);
+		}
+		if (alloctrack::enabled())
+		{
+			series["heapAllocations"].push_back(frame.heapAllocations);
+			series["heapBytes"].push_back(double(frame.heapBytes));
+			series["deviceAllocations"].push_back(frame.deviceAllocations);
+			for (auto& [k, v] : frame.allocations)
+			{
+				series["alloc/" + k].push_back(double(v));
+			}
+		}
+	}
+	run["frames"] = frameArray;
+
+	nlohmann::json summary;
+	for (auto& [k, v] : series)
+	{
+		summary[k] = summarize(v);
+	}
+	run["summary"] = summary;
+
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		LOG_ERROR("Failed to write benchmark run {}", path);
+		return false;
+	}
+	file << run.dump(1, '\t');
+
+	LOG_SUCCESS("Wrote {} frames to {}, frametime p50 {:.3f} ms p99 {:.3f} ms", frames.size(), path,
+		summary["frametime"]["p50"].get<double>(), summary["frametime"]["p99"].get<double>());
+	return true;
+}
+
+int compare_runs(const std::string& baseRun, const std::string& newRun, double thresholdPercent)
+{
+	nlohmann::json base, current;
+	if (!load_run(baseRun, base) || !load_run(newRun, current))
+	{
+		return -1;
+	}
+
+	//counts change with the scene, not with the code being measured
+	auto is_counter = [](const std::string& name) {
+		return name == "objects" || name == "drawcalls" || name == "draws" || name == "triangles";
+	};
+	//culling changes move them, listed so the effect of a change on the gpu work shows
+	auto is_pass_counter = [](const std::string& name) {
+		return name.rfind("pass/", 0) == 0;
+	};
+	//the goal is zero per frame, any growth is a regression
+	auto is_allocation = [](const std::string& name) {
+		return name == "heapAllocations" || name == "heapBytes" || name == "deviceAllocations" || name.rfind("alloc/", 0) == 0;
+	};
+
+	int regressions = 0;
+	double scale = 1.0 + thresholdPercent / 100.0;
+
+	for (auto& [name, baseSummary] : base["summary"].items())
+	{
+		if (!current["summary"].contains(name))
+		{
+			LOG_WARNING("{} is missing from {}", name, newRun);
+			continue;
+		}
+		const nlohmann::json& newSummary = current["summary"][name];
+
+		if (is_counter(name))
+		{
+			if (baseSummary["p50"] != newSummary["p50"])
+			{
+				LOG_WARNING("{} differs, {} -> {}, the runs did not draw the same scene", name,
+					baseSummary["p50"].get<double>(), newSummary["p50"].get<double>());
+			}
+			continue;
+		}
+
+		if (is_pass_counter(name))
+		{
+			if (baseSummary["p50"] != newSummary["p50"])
+			{
+				LOG_INFO("{} p50 {} -> {}", name, baseSummary["p50"].get<double>(), newSummary["p50"].get<double>());
+			}
+			continue;
+		}
+
+		if (is_allocation(name))
+		{
+			double before = baseSummary["p50"].get<double>();
+			double after = newSummary["p50"].get<double>();
+			if (after > before)
+			{
+				LOG_ERROR("REGRESSION {} p50 {} -> {} per frame", name, before, after);
+				regressions++;
+			}
+			continue;
+		}
+
+		bool regressed = false;
+		for (const char* stat : { "p50", "p95" })
+		{
+			double before = baseSummary[stat].get<double>();
+			double after = newSummary[stat].get<double>();
+			//ignore noise on zones that barely take any time
+			if (after > before * scale && after - before > 0.01)
+			{
+				LOG_ERROR("REGRESSION {} {} {:.3f} ms -> {:.3f} ms (+{:.1f}%)", name, stat, before, after, (after / std::max(before, 1e-6) - 1.0) * 100.0);
+				regressed = true;
+			}
+		}
+
+		if (regressed)
+		{
+			regressions++;
+		}
+		else
+		{
+			LOG_INFO("{} p50 {:.3f} ms -> {:.3f} ms", name, baseSummary["p50"].get<double>(), newSummary["p50"].get<double>());
+		}
+	}
+
+	if (regressions == 0)
+	{
+		LOG_SUCCESS("No regressions past {}%", thresholdPercent);
+	}
+	return regressions;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+class VulkanEngine;
+
+//everything the benchmark keeps of one frame
+struct BenchmarkFrame {
+	float frametime;
+	float cpuWait;
+	float gpuWait;
+	//CpuScopeTimer zones of this frame
+	std::unordered_map<std::string, double> cpu;
+	//VulkanScopeTimer zones, they lag a few frames behind since the queries are read back late
+	std::unordered_map<std::string, double> gpu;
+	int objects;
+	int drawcalls;
+	int draws;
+	int triangles;
+	//0 and empty unless the engine was built with DUDU_TRACK_ALLOCATIONS
+	int heapAllocations;
+	uint64_t heapBytes;
+	int deviceAllocations;
+	//heap allocations inside every CpuScopeTimer zone
+	std::unordered_map<std::string, uint64_t> allocations;
+	//pipeline statistics and cull results of every mesh pass, keyed pass/counter. they lag like the gpu zones
+	std::unordered_map<std::string, double> passes;
+};
+
+class BenchmarkRecorder {
+public:
+	//copy the stats and profiler timings of the frame the engine just drew
+	void record(VulkanEngine& engine);
+
+	//config, every frame, and mean/p50/p95/p99/max of every metric
+	bool write(const std::string& path, const VulkanEngine& engine) const;
+
+	std::vector<BenchmarkFrame> frames;
+};
+
+//flags the timings whose p50 or p95 grew more than thresholdPercent from baseRun to newRun
+//and the allocation counts whose p50 grew at all, the pass counters are only listed
+//returns the number of regressions, -1 when a file can't be read
+int compare_runs(const std::string& baseRun, const std::string& newRun, double thresholdPercent);
@@ -0,0 +1,117 @@
+#include <vk_engine.h>
+#include <benchmark.h>
+#include <vk_trace.h>
+#include <string>
+#include <cstdlib>
+
+//benchmark [--frames N] [--warmup N] [--camera-path file] [--scene prefab] [--grid N] [--spacing S] [--scale S] [--out file]
+//--trace file [--trace-start N] [--trace-frames N] also writes a chrome trace, from the first measured frame by default
+//benchmark --compare base.json new.json [--threshold percent]
+int main(int argc, char* argv[])
+{
+	VulkanEngine engine;
+	engine._headless = true;
+	engine._headlessFrames = 1000;
+
+	int warmup = 100;
+	std::string outPath = "benchmark.json";
+	double threshold = 5.0;
+	std::string compareBase, compareNew;
+	std::string tracePath;
+	int traceStart = -1;
+	int traceFrames = 10;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--frames" && i + 1 < argc)
+		{
+			engine._headlessFrames = std::atoi(argv[++i]);
+		}
+		else if (arg == "--warmup" && i + 1 < argc)
+		{
+			warmup = std::atoi(argv[++i]);
+		}
+		else if (arg == "--camera-path" && i + 1 < argc)
+		{
+			engine._cameraPathFile = argv[++i];
+		}
+		else if (arg == "--scene" && i + 1 < argc)
+		{
+			engine._scenePrefab = argv[++i];
+		}
+		else if (arg == "--grid" && i + 1 < argc)
+		{
+			engine._sceneGrid = std::atoi(argv[++i]);
+		}
+		else if (arg == "--spacing" && i + 1 < argc)
+		{
+			engine._sceneSpacing = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--scale" && i + 1 < argc)
+		{
+			engine._sceneScale = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--out" && i + 1 < argc)
+		{
+			outPath = argv[++i];
+		}
+		else if (arg == "--compare" && i + 2 < argc)
+		{
+			compareBase = argv[++i];
+			compareNew = argv[++i];
+		}
+		else if (arg == "--threshold" && i + 1 < argc)
+		{
+			threshold = std::atof(argv[++i]);
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+		}
+		else if (arg == "--trace-start" && i + 1 < argc)
+		{
+			traceStart = std::atoi(argv[++i]);
+		}
+		else if (arg == "--trace-frames" && i + 1 < argc)
+		{
+			traceFrames = std::atoi(argv[++i]);
+		}
+	}
+
+	//no engine needed to compare two runs
+	if (!compareBase.empty())
+	{
+		int regressions = compare_runs(compareBase, compareNew, threshold);
+		return regressions == 0 ? 0 : 1;
+	}
+
+	if (!tracePath.empty())
+	{
+		vktrace::configure(tracePath, traceStart < 0 ? warmup : traceStart, traceFrames);
+	}
+
+	//update_objects flags random objects, same seed so runs do the same work
+	srand(0);
+
+	engine.init();
+
+	//the camera path spans warmup and measured frames, the warmup ones are not recorded
+	int measured = engine._headlessFrames;
+	engine._headlessFrames = warmup + measured;
+
+	BenchmarkRecorder recorder;
+	recorder.frames.reserve(measured);
+	engine.run_headless([&](int frame) {
+		if (frame >= warmup)
+		{
+			recorder.record(engine);
+		}
+		});
+
+	bool written = recorder.write(outPath, engine);
+
+	engine.cleanup();
+
+	return written ? 0 : 1;
+}
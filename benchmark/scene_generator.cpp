@@ -0,0 +1,146 @@
+#include <scene_generator.h>
+#include <vk_engine.h>
+#include <cstring>
+#include "Tracy.hpp"
+
+namespace {
+
+	//distinct non null vulkan handles the sort keys can hash, never passed to vulkan
+	template<typename T>
+	T fake_handle(uint64_t value)
+	{
+		static_assert(sizeof(T) == sizeof(uint64_t), "64 bit handles only");
+		T handle;
+		std::memcpy(&handle, &value, sizeof(handle));
+		return handle;
+	}
+}
+
+void SceneGenerator::init(RenderScene& _scene, const SceneGeneratorConfig& _config)
+{
+	scene = &_scene;
+	config = _config;
+	rng.seed(config.seed);
+
+	opaquePass.pipeline = fake_handle<VkPipeline>(1);
+	shadowPass.pipeline = fake_handle<VkPipeline>(2);
+	transparentPass.pipeline = fake_handle<VkPipeline>(3);
+
+	opaqueTemplate.passShaders.clear(nullptr);
+	opaqueTemplate.passShaders[MeshpassType::Forward] = &opaquePass;
+	opaqueTemplate.passShaders[MeshpassType::DirectionalShadow] = &shadowPass;
+	opaqueTemplate.defaultParameters = nullptr;
+	opaqueTemplate.transparency = assets::TransparencyMode::Opaque;
+
+	transparentTemplate.passShaders.clear(nullptr);
+	transparentTemplate.passShaders[MeshpassType::Transparency] = &transparentPass;
+	transparentTemplate.defaultParameters = nullptr;
+	transparentTemplate.transparency = assets::TransparencyMode::Transparent;
+
+	//every 8th material is transparent, like the glass and foliage of the real scenes
+	materials.resize(config.materialCount);
+	for (uint32_t i = 0; i < config.materialCount; i++)
+	{
+		vkutil::Material& material = materials[i];
+		material.original = (i % 8 == 7) ? &transparentTemplate : &opaqueTemplate;
+		material.passSets.clear(fake_handle<VkDescriptorSet>(i + 1));
+		material.parameters = nullptr;
+	}
+
+	//index counts from a small prop to a large one, the batching only looks at the counts
+	std::uniform_int_distribution<uint32_t> triangles(12, 20000);
+	meshes.resize(config.meshCount);
+	for (Mesh& mesh : meshes)
+	{
+		uint32_t indexCount = triangles(rng) * 3;
+		mesh._indices.resize(indexCount);
+		mesh._vertices.resize(indexCount / 2);
+		mesh.bounds.origin = glm::vec3(0);
+		mesh.bounds.extents = glm::vec3(1);
+		mesh.bounds.radius = 1.7f;
+		mesh.bounds.valid = true;
+	}
+}
+
+glm::mat4 SceneGenerator::random_transform()
+{
+	std::uniform_real_distribution<float> position(-1000.f, 1000.f);
+	return glm::translate(glm::vec3{ position(rng), position(rng) * 0.1f, position(rng) });
+}
+
+MeshObject SceneGenerator::random_object()
+{
+	std::uniform_int_distribution<uint32_t> meshIndex(0, config.meshCount - 1);
+	std::uniform_int_distribution<uint32_t> materialIndex(0, config.materialCount - 1);
+
+	MeshObject object;
+	object.mesh = &meshes[meshIndex(rng)];
+	object.material = &materials[materialIndex(rng)];
+	object.customSortKey = 0;
+	object.transformMatrix = random_transform();
+	object.bounds = object.mesh->bounds;
+	object.bDrawForwardPass = true;
+	object.bDrawShadowPass = true;
+	return object;
+}
+
+void SceneGenerator::populate()
+{
+	ZoneScopedNC("Generate Scene", tracy::Color::Blue);
+
+	std::vector<MeshObject> objects;
+	objects.reserve(config.instanceCount);
+	for (uint32_t i = 0; i < config.instanceCount; i++)
+	{
+		objects.push_back(random_object());
+	}
+
+	uint32_t first = static_cast<uint32_t>(scene->renderables.size());
+	scene->register_object_batch(objects.data(), static_cast<uint32_t>(objects.size()));
+
+	live.reserve(live.size() + objects.size());
+	for (uint32_t i = 0; i < config.instanceCount; i++)
+	{
+		live.push_back({ first + i });
+	}
+
+	//what merge_meshes does after the engine loads a scene, lets the multibatches join
+	for (DrawMesh& mesh : scene->meshes)
+	{
+		mesh.isMerged = true;
+	}
+}
+
+void SceneGenerator::step()
+{
+	ZoneScopedNC("Scene Churn", tracy::Color::Blue);
+
+	//removals first, so the adds can reuse their handles after the next build_batches
+	uint32_t removeCount = std::min(static_cast<uint32_t>(config.removeRate * config.instanceCount), static_cast<uint32_t>(live.size()));
+	for (uint32_t i = 0; i < removeCount; i++)
+	{
+		std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+		size_t index = pick(rng);
+
+		scene->remove_object(live[index]);
+		live[index] = live.back();
+		live.pop_back();
+	}
+
+	uint32_t moveCount = static_cast<uint32_t>(config.transformChurn * live.size());
+	if (!live.empty())
+	{
+		std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+		for (uint32_t i = 0; i < moveCount; i++)
+		{
+			scene->update_transform(live[pick(rng)], random_transform());
+		}
+	}
+
+	uint32_t addCount = static_cast<uint32_t>(config.addRate * config.instanceCount);
+	for (uint32_t i = 0; i < addCount; i++)
+	{
+		MeshObject object = random_object();
+		live.push_back(scene->register_object(&object));
+	}
+}
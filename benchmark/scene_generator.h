@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vk_scene.h>
+#include <vk_mesh.h>
+#include <material_system.h>
+#include <random>
+#include <vector>
+
+struct SceneGeneratorConfig {
+	uint32_t meshCount{ 64 };
+	uint32_t materialCount{ 16 };
+	uint32_t instanceCount{ 10000 };
+	//fraction of the live objects moved with update_transform every step
+	float transformChurn{ 0.01f };
+	//fraction of instanceCount registered and removed every step
+	float addRate{ 0.f };
+	float removeRate{ 0.f };
+	uint32_t seed{ 0 };
+};
+
+//fills a RenderScene with procedural objects, no gpu and no assets needed
+//meshes only have indices and materials point at fake pipelines, enough for the batching and the pass refresh
+class SceneGenerator {
+public:
+	void init(RenderScene& scene, const SceneGeneratorConfig& config);
+
+	//register instanceCount objects in one register_object_batch, on a scene with no removed objects
+	void populate();
+
+	//move, add and remove objects as the config says, build_batches is left to the caller
+	void step();
+
+	size_t live_objects() const { return live.size(); }
+private:
+	MeshObject random_object();
+	glm::mat4 random_transform();
+
+	RenderScene* scene{ nullptr };
+	SceneGeneratorConfig config;
+	std::mt19937 rng;
+
+	//sized once in init, the scene keeps pointers to them
+	std::vector<Mesh> meshes;
+	std::vector<vkutil::Material> materials;
+	vkutil::ShaderPass opaquePass;
+	vkutil::ShaderPass shadowPass;
+	vkutil::ShaderPass transparentPass;
+	vkutil::EffectTemplate opaqueTemplate;
+	vkutil::EffectTemplate transparentTemplate;
+
+	std::vector<Handle<RenderObject>> live;
+};
@@ -0,0 +1,136 @@
+#include <scene_generator.h>
+#include <vk_engine.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include "logger.h"
+
+namespace {
+
+	double elapsed_ms(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	size_t batch_count(RenderScene& scene)
+	{
+		return scene._forwardPass.batches.size() + scene._shadowPass.batches.size() + scene._transparentForwardPass.batches.size();
+	}
+
+	//one scene size: full build, then frames of churn and incremental builds
+	void run(SceneGeneratorConfig config, int frames)
+	{
+		RenderScene scene;
+		scene.init();
+
+		SceneGenerator generator;
+		generator.init(scene, config);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		generator.populate();
+		double registerTime = elapsed_ms(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		scene.build_batches();
+		scene.clear_dirty_objects();
+		double buildTime = elapsed_ms(start);
+
+		LOG_INFO("{} objects{}, {} meshes, {} materials: register {:.2f} ms, first build {:.2f} ms, {} batches",
+			config.instanceCount, config.instanceCount > MAX_OBJECTS ? " (over MAX_OBJECTS)" : "", config.meshCount, config.materialCount,
+			registerTime, buildTime, batch_count(scene));
+
+		std::vector<double> stepTimes, refreshTimes;
+		size_t changed = 0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			start = std::chrono::high_resolution_clock::now();
+			generator.step();
+			stepTimes.push_back(elapsed_ms(start));
+
+			changed += scene.dirtyObjects.size();
+
+			start = std::chrono::high_resolution_clock::now();
+			scene.build_batches();
+			scene.clear_dirty_objects();
+			refreshTimes.push_back(elapsed_ms(start));
+		}
+
+		if (frames == 0) return;
+
+		std::sort(refreshTimes.begin(), refreshTimes.end());
+		double stepTotal = 0, refreshTotal = 0;
+		for (double t : stepTimes) stepTotal += t;
+		for (double t : refreshTimes) refreshTotal += t;
+
+		LOG_INFO("  {} frames, {} live objects: churn {:.3f} ms, build_batches mean {:.3f} ms p50 {:.3f} ms p95 {:.3f} ms, {:.0f} changed objects/s",
+			frames, generator.live_objects(), stepTotal / frames, refreshTotal / frames,
+			refreshTimes[refreshTimes.size() / 2], refreshTimes[std::min(refreshTimes.size() - 1, refreshTimes.size() * 95 / 100)],
+			refreshTotal > 0 ? changed / (refreshTotal / 1000.0) : 0.0);
+	}
+}
+
+//scene_stress [--meshes N] [--materials N] [--instances N] [--churn F] [--add F] [--remove F] [--frames N] [--seed N] [--sweep]
+//--sweep runs the same config at several instance counts up to twice MAX_OBJECTS
+int main(int argc, char* argv[])
+{
+	SceneGeneratorConfig config;
+	int frames = 100;
+	bool sweep = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--meshes" && i + 1 < argc)
+		{
+			config.meshCount = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--materials" && i + 1 < argc)
+		{
+			config.materialCount = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--instances" && i + 1 < argc)
+		{
+			config.instanceCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "--churn" && i + 1 < argc)
+		{
+			config.transformChurn = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--add" && i + 1 < argc)
+		{
+			config.addRate = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--remove" && i + 1 < argc)
+		{
+			config.removeRate = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			frames = std::atoi(argv[++i]);
+		}
+		else if (arg == "--seed" && i + 1 < argc)
+		{
+			config.seed = std::atoi(argv[++i]);
+		}
+		else if (arg == "--sweep")
+		{
+			sweep = true;
+		}
+	}
+
+	if (sweep)
+	{
+		for (uint32_t count : { 1000u, 10000u, 50000u, 100000u, uint32_t(MAX_OBJECTS), uint32_t(MAX_OBJECTS) * 2 })
+		{
+			config.instanceCount = count;
+			run(config, frames);
+		}
+	}
+	else
+	{
+		run(config, frames);
+	}
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+﻿#include <alloc_tracker.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "Tracy.hpp"
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace {
+	std::atomic<uint64_t> heapAllocations{ 0 };
+	std::atomic<uint64_t> heapBytes{ 0 };
+	std::atomic<uint64_t> deviceAllocations{ 0 };
+	std::atomic<uint64_t> deviceBytes{ 0 };
+
+	void VKAPI_PTR on_device_allocate(VmaAllocator, uint32_t, VkDeviceMemory, VkDeviceSize size, void*)
+	{
+		deviceAllocations.fetch_add(1, std::memory_order_relaxed);
+		deviceBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+
+#ifdef DUDU_TRACK_ALLOCATIONS
+	void* counted_malloc(size_t size)
+	{
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		heapBytes.fetch_add(size, std::memory_order_relaxed);
+
+		void* ptr = std::malloc(size ? size : 1);
+		//tracy shows them per zone in its memory view
+		if (ptr) TracyAlloc(ptr, size);
+		return ptr;
+	}
+
+	void* counted_aligned_malloc(size_t size, std::align_val_t align)
+	{
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		heapBytes.fetch_add(size, std::memory_order_relaxed);
+
+		size_t alignment = static_cast<size_t>(align);
+#ifdef _WIN32
+		void* ptr = _aligned_malloc(size ? size : 1, alignment);
+#else
+		//aligned_alloc wants a size that is a multiple of the alignment
+		void* ptr = std::aligned_alloc(alignment, ((size ? size : 1) + alignment - 1) / alignment * alignment);
+#endif
+		if (ptr) TracyAlloc(ptr, size);
+		return ptr;
+	}
+
+	void counted_free(void* ptr)
+	{
+		TracyFree(ptr);
+		std::free(ptr);
+	}
+
+	void counted_aligned_free(void* ptr)
+	{
+		TracyFree(ptr);
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		std::free(ptr);
+#endif
+	}
+#endif
+}
+
+#ifdef DUDU_TRACK_ALLOCATIONS
+//the array forms default to these
+void* operator new(size_t size)
+{
+	void* ptr = counted_malloc(size);
+	if (!ptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return counted_malloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	counted_free(ptr);
+}
+
+//over-aligned types, they need the matching aligned free
+void* operator new(size_t size, std::align_val_t align)
+{
+	void* ptr = counted_aligned_malloc(size, align);
+	if (!ptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	return counted_aligned_malloc(size, align);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	counted_aligned_free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+	counted_aligned_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	counted_aligned_free(ptr);
+}
+#endif
+
+namespace alloctrack {
+
+	bool enabled()
+	{
+#ifdef DUDU_TRACK_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	Counters heap()
+	{
+		return { heapAllocations.load(std::memory_order_relaxed), heapBytes.load(std::memory_order_relaxed) };
+	}
+
+	Counters device()
+	{
+		return { deviceAllocations.load(std::memory_order_relaxed), deviceBytes.load(std::memory_order_relaxed) };
+	}
+
+	void fill_vma_callbacks(VmaDeviceMemoryCallbacks& callbacks)
+	{
+		callbacks.pfnAllocate = &on_device_allocate;
+		callbacks.pfnFree = nullptr;
+		callbacks.pUserData = nullptr;
+	}
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include <vk_types.h>
+#include <cstdint>
+
+//heap and device memory allocation counters, opt in with the DUDU_TRACK_ALLOCATIONS cmake option
+//the global operator new is replaced to count, built without it every counter stays at 0
+namespace alloctrack {
+
+	struct Counters {
+		uint64_t allocations{ 0 };
+		uint64_t bytes{ 0 };
+
+		Counters operator-(const Counters& other) const { return { allocations - other.allocations, bytes - other.bytes }; }
+	};
+
+	//true when built with DUDU_TRACK_ALLOCATIONS
+	bool enabled();
+
+	//totals since the start of the process, from every thread
+	Counters heap();
+	//vkAllocateMemory calls made by vma, not the buffers and images suballocated in them
+	Counters device();
+
+	//hooks the device memory counters into vma, set before vmaCreateAllocator
+	void fill_vma_callbacks(VmaDeviceMemoryCallbacks& callbacks);
+}
@@ -5,10 +5,13 @@
 
 #include <array>
 #include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "imgui.h"
 #include "imgui_stdlib.h"
 #include "imgui_internal.h"
-#include <shared_mutex>
 
 enum class CVarType : char
 {
@@ -22,27 +25,64 @@ class CVarParameter
 public:
 	friend class CVarSystemImpl;
 
-	int32_t arrayIndex;
+	int32_t arrayIndex{ -1 };
 
 	CVarType type;
 	CVarFlags flags;
 	std::string name;
 	std::string description;
+
+	//sets of cvars nobody listens to skip the listener lock
+	std::atomic<bool> hasListeners{ false };
 };
 
 template<typename T>
 struct CVarStorage
 {
 	T initial;
-	T current;
+	std::atomic<T> current;
+	CVarParameter* parameter;
+};
+
+//strings are not atomic, a set publishes a new copy and readers keep the one they loaded
+template<>
+struct CVarStorage<std::string>
+{
+	std::string initial;
+	std::shared_ptr<const std::string> current;
 	CVarParameter* parameter;
 };
 
+template<typename T>
+T LoadCurrent(const CVarStorage<T>& storage)
+{
+	return storage.current.load(std::memory_order_relaxed);
+}
+
+std::string LoadCurrent(const CVarStorage<std::string>& storage)
+{
+	return *std::atomic_load(&storage.current);
+}
+
+//returns true when the value changed
+template<typename T>
+bool ExchangeCurrent(CVarStorage<T>& storage, const T& value)
+{
+	return storage.current.exchange(value) != value;
+}
+
+bool ExchangeCurrent(CVarStorage<std::string>& storage, const std::string& value)
+{
+	std::shared_ptr<const std::string> old = std::atomic_exchange(&storage.current, std::make_shared<const std::string>(value));
+	return !old || *old != value;
+}
+
 template<typename T>
 struct CVarArray
 {
 	CVarStorage<T>* cvars{nullptr};
-	int32_t lastCVar{ 0 };
+	//published after the storage is filled, the editor reads it without the lock
+	std::atomic<int32_t> lastCVar{ 0 };
 
 	CVarArray(size_t size)
 	{
@@ -55,44 +95,22 @@ struct CVarArray
 		return &cvars[index];
 	}
 
-	T* GetCurrentPtr(int32_t index)
-	{
-		return &cvars[index].current;
-	};
-
 	T GetCurrent(int32_t index)
 	{
-		return cvars[index].current;
+		return LoadCurrent(cvars[index]);
 	};
 
-	void SetCurrent(const T& val, int32_t index)
-	{
-		cvars[index].current = val;
-	}
-
-	int Add(const T& value, CVarParameter* param)
-	{
-		int index = lastCVar;
-
-		cvars[index].current = value;
-		cvars[index].initial = value;
-		cvars[index].parameter = param;
-
-		param->arrayIndex = index;
-		lastCVar++; 
-		return index;
-	}
-
+	//called with the registry lock held
 	int Add(const T& initialValue, const T& currentValue, CVarParameter* param)
 	{
-		int index = lastCVar;
+		int index = lastCVar.load(std::memory_order_relaxed);
 
-		cvars[index].current = currentValue;
+		ExchangeCurrent(cvars[index], currentValue);
 		cvars[index].initial = initialValue;
 		cvars[index].parameter = param;
 
 		param->arrayIndex = index;
-		lastCVar++;
+		lastCVar.store(index + 1, std::memory_order_release);
 
 		return index;
 	}
@@ -115,9 +133,9 @@ public:
 
 	CVarParameter* CreateStringCVar(const char* name, const char* description, const char* defaultValue, const char* currentValue) override final;
 	
-	double* GetFloatCVar(StringUtils::StringHash hash) override final;
-	int32_t* GetIntCVar(StringUtils::StringHash hash) override final;
-	const char* GetStringCVar(StringUtils::StringHash hash) override final;
+	std::optional<double> GetFloatCVar(StringUtils::StringHash hash) override final;
+	std::optional<int32_t> GetIntCVar(StringUtils::StringHash hash) override final;
+	std::optional<std::string> GetStringCVar(StringUtils::StringHash hash) override final;
 	
 
 	void SetFloatCVar(StringUtils::StringHash hash, double value) override final;
@@ -126,6 +144,10 @@ public:
 
 	void SetStringCVar(StringUtils::StringHash hash, const char* value) override final;
 
+	uint32_t AddListener(StringUtils::StringHash hash, CVarListener&& listener) override final;
+
+	void RemoveListener(uint32_t id) override final;
+
 	void DrawImguiEditor() override final;
 
 	void EditParameter(CVarParameter* p, float textWidth);
@@ -145,31 +167,19 @@ public:
 	template<typename T>
 	CVarArray<T>* GetCVarArray();
 
-	template<>
-	CVarArray<int32_t>* GetCVarArray()
-	{
-		return &intCVars2;
-	}
-	template<>
-	CVarArray<double>* GetCVarArray()
-	{
-		return &floatCVars;
-	}
-	template<>
-	CVarArray<std::string>* GetCVarArray()
-	{
-		return &stringCVars;
-	}
+	//type of the values held by a CVarArray<T>
+	template<typename T>
+	static CVarType GetCVarType();
 
 	//templated get-set cvar versions for syntax sugar
 	template<typename T>
-	T* GetCVarCurrent(uint32_t namehash) {
+	std::optional<T> GetCVarCurrent(uint32_t namehash) {
 		CVarParameter* par = GetCVar(namehash);
-		if (!par) {
-			return nullptr;
+		if (!par || par->type != GetCVarType<T>()) {
+			return std::nullopt;
 		}
 		else {
-			return GetCVarArray<T>()->GetCurrentPtr(par->arrayIndex);
+			return GetCVarArray<T>()->GetCurrent(par->arrayIndex);
 		}
 	}
 
@@ -177,12 +187,31 @@ public:
 	void SetCVarCurrent(uint32_t namehash, const T& value)
 	{
 		CVarParameter* cvar = GetCVar(namehash);
-		if (cvar)
+		if (cvar && cvar->type == GetCVarType<T>())
+		{
+			SetCurrentByIndex<T>(cvar->arrayIndex, value);
+		}
+	}
+
+	//every write goes through here so the listeners see it
+	template<typename T>
+	void SetCurrentByIndex(int32_t index, const T& value)
+	{
+		CVarStorage<T>* storage = GetCVarArray<T>()->GetCurrentStorage(index);
+		if (ExchangeCurrent(*storage, value) && storage->parameter->hasListeners.load(std::memory_order_acquire))
 		{
-			GetCVarArray<T>()->SetCurrent(value, cvar->arrayIndex);
+			NotifyListeners(storage->parameter);
 		}
 	}
 
+	//index of the cvar in its array, -1 when it does not exist or has another type
+	template<typename T>
+	int32_t FindIndex(uint32_t namehash)
+	{
+		CVarParameter* par = GetCVar(namehash);
+		return (par && par->type == GetCVarType<T>()) ? par->arrayIndex : -1;
+	}
+
 	static CVarSystemImpl* Get()
 	{
 		return static_cast<CVarSystemImpl*>(CVarSystem::Get());
@@ -190,28 +219,81 @@ public:
 
 private:
 
-	std::shared_mutex mutex_;
+	using CVarRegistry = std::unordered_map<uint32_t, CVarParameter*>;
+
+	struct Listener {
+		uint32_t id;
+		CVarParameter* parameter;
+		std::shared_ptr<CVarListener> callback;
+	};
+
+	CVarParameter* InitCVar(const char* name, const char* description, CVarType type);
+
+	//makes the cvar visible to lookups, once its storage is filled
+	void PublishCVar(CVarParameter* param);
+
+	void NotifyListeners(CVarParameter* p);
 
-	CVarParameter* InitCVar(const char* name, const char* description);
+	//readers load the current map without locking. creating a cvar copies it under the mutex and publishes the copy,
+	//an old map is freed once the last reader holding it is done
+	std::shared_ptr<const CVarRegistry> registry{ std::make_shared<const CVarRegistry>() };
+	std::mutex registryMutex;
 
-	std::unordered_map<uint32_t, CVarParameter> savedCVars;
+	//parameters never move, the registry and the arrays point into it
+	std::deque<CVarParameter> savedCVars;
+
+	std::mutex listenerMutex;
+	std::vector<Listener> listeners;
+	uint32_t lastListenerId{ 0 };
 
 	std::vector<CVarParameter*> cachedEditParameters;
 };
 
-double* CVarSystemImpl::GetFloatCVar(StringUtils::StringHash hash)
+template<>
+CVarArray<int32_t>* CVarSystemImpl::GetCVarArray()
+{
+	return &intCVars2;
+}
+template<>
+CVarArray<double>* CVarSystemImpl::GetCVarArray()
+{
+	return &floatCVars;
+}
+template<>
+CVarArray<std::string>* CVarSystemImpl::GetCVarArray()
+{
+	return &stringCVars;
+}
+
+template<>
+CVarType CVarSystemImpl::GetCVarType<int32_t>()
+{
+	return CVarType::INT;
+}
+template<>
+CVarType CVarSystemImpl::GetCVarType<double>()
+{
+	return CVarType::FLOAT;
+}
+template<>
+CVarType CVarSystemImpl::GetCVarType<std::string>()
+{
+	return CVarType::STRING;
+}
+
+std::optional<double> CVarSystemImpl::GetFloatCVar(StringUtils::StringHash hash)
 {
 	return GetCVarCurrent<double>(hash);
 }
 
-int32_t* CVarSystemImpl::GetIntCVar(StringUtils::StringHash hash)
+std::optional<int32_t> CVarSystemImpl::GetIntCVar(StringUtils::StringHash hash)
 {
 	return GetCVarCurrent<int32_t>(hash);
 }
 
-const char* CVarSystemImpl::GetStringCVar(StringUtils::StringHash hash)
+std::optional<std::string> CVarSystemImpl::GetStringCVar(StringUtils::StringHash hash)
 {
-	return GetCVarCurrent<std::string>(hash)->c_str();
+	return GetCVarCurrent<std::string>(hash);
 }
 
 
@@ -224,12 +306,12 @@ CVarSystem* CVarSystem::Get()
 
 CVarParameter* CVarSystemImpl::GetCVar(StringUtils::StringHash hash)
 {
-	std::shared_lock lock(mutex_);
-	auto it = savedCVars.find(hash);
+	std::shared_ptr<const CVarRegistry> current = std::atomic_load(&registry);
+	auto it = current->find(hash);
 
-	if (it != savedCVars.end())
+	if (it != current->end())
 	{
-		return &(*it).second;
+		return it->second;
 	}
 
 	return nullptr;
@@ -250,16 +332,65 @@ void CVarSystemImpl::SetStringCVar(StringUtils::StringHash hash, const char* val
 	SetCVarCurrent<std::string>(hash, value);
 }
 
+uint32_t CVarSystemImpl::AddListener(StringUtils::StringHash hash, CVarListener&& listener)
+{
+	CVarParameter* param = GetCVar(hash);
+	if (!param) return 0;
+
+	std::lock_guard lock(listenerMutex);
+	Listener entry;
+	entry.id = ++lastListenerId;
+	entry.parameter = param;
+	entry.callback = std::make_shared<CVarListener>(std::move(listener));
+	listeners.push_back(std::move(entry));
+
+	param->hasListeners.store(true, std::memory_order_release);
+	return lastListenerId;
+}
+
+void CVarSystemImpl::RemoveListener(uint32_t id)
+{
+	std::lock_guard lock(listenerMutex);
+	auto it = std::find_if(listeners.begin(), listeners.end(), [&](const Listener& l) { return l.id == id; });
+	if (it == listeners.end()) return;
+
+	CVarParameter* param = it->parameter;
+	listeners.erase(it);
+
+	bool stillListened = std::any_of(listeners.begin(), listeners.end(), [&](const Listener& l) { return l.parameter == param; });
+	param->hasListeners.store(stillListened, std::memory_order_release);
+}
+
+void CVarSystemImpl::NotifyListeners(CVarParameter* p)
+{
+	//called outside the lock, a listener can read or set cvars and add listeners
+	std::vector<std::shared_ptr<CVarListener>> callbacks;
+	{
+		std::lock_guard lock(listenerMutex);
+		for (Listener& l : listeners)
+		{
+			if (l.parameter == p)
+			{
+				callbacks.push_back(l.callback);
+			}
+		}
+	}
+
+	for (auto& callback : callbacks)
+	{
+		(*callback)(p->name.c_str());
+	}
+}
+
 
 CVarParameter* CVarSystemImpl::CreateFloatCVar(const char* name, const char* description, double defaultValue, double currentValue)
 {
-	std::unique_lock lock(mutex_);
-	CVarParameter* param = InitCVar(name, description);
+	std::lock_guard lock(registryMutex);
+	CVarParameter* param = InitCVar(name, description, CVarType::FLOAT);
 	if (!param) return nullptr;
 
-	param->type = CVarType::FLOAT;
-
 	GetCVarArray<double>()->Add(defaultValue, currentValue, param);
+	PublishCVar(param);
 
 	return param;
 }
@@ -268,13 +399,12 @@ CVarParameter* CVarSystemImpl::CreateFloatCVar(const char* name, const char* des
 
 CVarParameter* CVarSystemImpl::CreateIntCVar(const char* name, const char* description, int32_t defaultValue, int32_t currentValue)
 {
-	std::unique_lock lock(mutex_);
-	CVarParameter* param = InitCVar(name, description);
+	std::lock_guard lock(registryMutex);
+	CVarParameter* param = InitCVar(name, description, CVarType::INT);
 	if (!param) return nullptr;
 
-	param->type = CVarType::INT;
-
 	GetCVarArray<int32_t>()->Add(defaultValue, currentValue, param);
+	PublishCVar(param);
 
 	return param;
 }
@@ -283,31 +413,39 @@ CVarParameter* CVarSystemImpl::CreateIntCVar(const char* name, const char* descr
 
 CVarParameter* CVarSystemImpl::CreateStringCVar(const char* name, const char* description, const char* defaultValue, const char* currentValue)
 {
-	std::unique_lock lock(mutex_);
-	CVarParameter* param = InitCVar(name, description);
+	std::lock_guard lock(registryMutex);
+	CVarParameter* param = InitCVar(name, description, CVarType::STRING);
 	if (!param) return nullptr;
 
-	param->type = CVarType::STRING;
-
 	GetCVarArray<std::string>()->Add(defaultValue, currentValue, param);
+	PublishCVar(param);
 
 	return param;
 }
 
-CVarParameter* CVarSystemImpl::InitCVar(const char* name, const char* description)
+CVarParameter* CVarSystemImpl::InitCVar(const char* name, const char* description, CVarType type)
 {
 	
-	uint32_t namehash = StringUtils::StringHash{ name };
-	savedCVars[namehash] = CVarParameter{};
-
-	CVarParameter& newParam = savedCVars[namehash];
+	CVarParameter& newParam = savedCVars.emplace_back();
 
 	newParam.name = name;
 	newParam.description = description;
+	newParam.type = type;
+	newParam.flags = CVarFlags::None;
 
 	return &newParam;
 }
 
+void CVarSystemImpl::PublishCVar(CVarParameter* param)
+{
+	//type and array index are set before this, lookups use both
+	uint32_t namehash = StringUtils::StringHash{ param->name.c_str() };
+
+	auto next = std::make_shared<CVarRegistry>(*std::atomic_load(&registry));
+	(*next)[namehash] = param;
+	std::atomic_store(&registry, std::shared_ptr<const CVarRegistry>(std::move(next)));
+}
+
 AutoCVar_Float::AutoCVar_Float(const char* name, const char* description, double defaultValue, CVarFlags flags)
 {
 	CVarParameter* cvar = CVarSystem::Get()->CreateFloatCVar(name, description, defaultValue, defaultValue);
@@ -319,15 +457,11 @@ template<typename T>
 T GetCVarCurrentByIndex(int32_t index) {
 	return CVarSystemImpl::Get()->GetCVarArray<T>()->GetCurrent(index);
 }
-template<typename T>
-T* PtrGetCVarCurrentByIndex(int32_t index) {
-	return CVarSystemImpl::Get()->GetCVarArray<T>()->GetCurrentPtr(index);
-}
 
 
 template<typename T>
 void SetCVarCurrentByIndex(int32_t index,const T& data) {
-	CVarSystemImpl::Get()->GetCVarArray<T>()->SetCurrent(data, index);
+	CVarSystemImpl::Get()->SetCurrentByIndex<T>(index, data);
 }
 
 
@@ -336,22 +470,11 @@ double AutoCVar_Float::Get()
 	return GetCVarCurrentByIndex<CVarType>(index);
 }
 
-double* AutoCVar_Float::GetPtr()
-{
-	return PtrGetCVarCurrentByIndex<CVarType>(index);
-}
-
 float AutoCVar_Float::GetFloat()
 {
 	return static_cast<float>(Get());
 }
 
-float* AutoCVar_Float::GetFloatPtr()
-{
-	float* result = reinterpret_cast<float*>(GetPtr());
-	return result;
-}
-
 void AutoCVar_Float::Set(double f)
 {
 	SetCVarCurrentByIndex<CVarType>(index, f);
@@ -369,11 +492,6 @@ int32_t AutoCVar_Int::Get()
 	return GetCVarCurrentByIndex<CVarType>(index);
 }
 
-int32_t* AutoCVar_Int::GetPtr()
-{
-	return PtrGetCVarCurrentByIndex<CVarType>(index);
-}
-
 void AutoCVar_Int::Set(int32_t val)
 {
 	SetCVarCurrentByIndex<CVarType>(index, val);
@@ -393,9 +511,9 @@ AutoCVar_String::AutoCVar_String(const char* name, const char* description, cons
 	index = cvar->arrayIndex;
 }
 
-const char* AutoCVar_String::Get()
+std::string AutoCVar_String::Get()
 {
-	return GetCVarCurrentByIndex<CVarType>(index).c_str();
+	return GetCVarCurrentByIndex<CVarType>(index);
 };
 
 void AutoCVar_String::Set(std::string&& val)
@@ -403,6 +521,50 @@ void AutoCVar_String::Set(std::string&& val)
 	SetCVarCurrentByIndex<CVarType>(index,val);
 }
 
+template<typename T>
+int32_t CVarHandle<T>::resolve()
+{
+	int32_t i = index.load(std::memory_order_relaxed);
+	if (i < 0)
+	{
+		i = CVarSystemImpl::Get()->FindIndex<T>(hash);
+		index.store(i, std::memory_order_relaxed);
+	}
+	return i;
+}
+
+template struct CVarHandle<double>;
+template struct CVarHandle<int32_t>;
+
+double CVarHandle_Float::Get()
+{
+	int32_t i = resolve();
+	return i < 0 ? 0.0 : GetCVarCurrentByIndex<double>(i);
+}
+
+float CVarHandle_Float::GetFloat()
+{
+	return static_cast<float>(Get());
+}
+
+void CVarHandle_Float::Set(double val)
+{
+	int32_t i = resolve();
+	if (i >= 0) SetCVarCurrentByIndex<double>(i, val);
+}
+
+int32_t CVarHandle_Int::Get()
+{
+	int32_t i = resolve();
+	return i < 0 ? 0 : GetCVarCurrentByIndex<int32_t>(i);
+}
+
+void CVarHandle_Int::Set(int32_t val)
+{
+	int32_t i = resolve();
+	if (i >= 0) SetCVarCurrentByIndex<int32_t>(i, val);
+}
+
 
 void CVarSystemImpl::DrawImguiEditor()
 {
@@ -566,7 +728,7 @@ void CVarSystemImpl::EditParameter(CVarParameter* p, float textWidth)
 
 				if (ImGui::Checkbox("", &bCheckbox))
 				{
-					GetCVarArray<int32_t>()->SetCurrent(bCheckbox ? 1 : 0, p->arrayIndex);
+					SetCurrentByIndex<int32_t>(p->arrayIndex, bCheckbox ? 1 : 0);
 				}
 				ImGui::PopID();
 			}
@@ -574,7 +736,12 @@ void CVarSystemImpl::EditParameter(CVarParameter* p, float textWidth)
 			{
 				Label(p->name.c_str(), textWidth);
 				ImGui::PushID(p->name.c_str());
-				ImGui::InputInt("", GetCVarArray<int32_t>()->GetCurrentPtr(p->arrayIndex));
+				//edit a copy, the value can change on another thread
+				int32_t value = GetCVarArray<int32_t>()->GetCurrent(p->arrayIndex);
+				if (ImGui::InputInt("", &value))
+				{
+					SetCurrentByIndex<int32_t>(p->arrayIndex, value);
+				}
 				ImGui::PopID();
 			}
 		}
@@ -591,13 +758,19 @@ void CVarSystemImpl::EditParameter(CVarParameter* p, float textWidth)
 		{
 			Label(p->name.c_str(), textWidth);
 			ImGui::PushID(p->name.c_str());
+			double value = GetCVarArray<double>()->GetCurrent(p->arrayIndex);
+			bool edited = false;
 			if (dragFlag)
 			{
-				ImGui::InputDouble("", GetCVarArray<double>()->GetCurrentPtr(p->arrayIndex), 0, 0, "%.3f");
+				edited = ImGui::InputDouble("", &value, 0, 0, "%.3f");
 			}
 			else
 			{
-				ImGui::InputDouble("", GetCVarArray<double>()->GetCurrentPtr(p->arrayIndex), 0, 0, "%.3f");
+				edited = ImGui::InputDouble("", &value, 0, 0, "%.3f");
+			}
+			if (edited)
+			{
+				SetCurrentByIndex<double>(p->arrayIndex, value);
 			}
 			ImGui::PopID();
 		}
@@ -609,14 +782,19 @@ void CVarSystemImpl::EditParameter(CVarParameter* p, float textWidth)
 		{
 			std::string displayFormat = p->name + "= %s";
 			ImGui::PushID(p->name.c_str());
-			ImGui::Text(displayFormat.c_str(), GetCVarArray<std::string>()->GetCurrent(p->arrayIndex));
+			ImGui::Text(displayFormat.c_str(), GetCVarArray<std::string>()->GetCurrent(p->arrayIndex).c_str());
 
 			ImGui::PopID();
 		}
 		else
 		{
 			Label(p->name.c_str(), textWidth);
-			ImGui::InputText("", GetCVarArray<std::string>()->GetCurrentPtr(p->arrayIndex));
+			ImGui::PushID(p->name.c_str());
+			std::string value = GetCVarArray<std::string>()->GetCurrent(p->arrayIndex);
+			if (ImGui::InputText("", &value))
+			{
+				SetCurrentByIndex<std::string>(p->arrayIndex, value);
+			}
 
 			ImGui::PopID();
 		}
@@ -3,6 +3,9 @@
 #pragma once
 
 #include <string_utils.h>
+#include <atomic>
+#include <functional>
+#include <optional>
 
 class CVarParameter;
 
@@ -16,6 +19,10 @@ enum class CVarFlags : uint32_t
 	EditCheckbox = 1 << 8,
 	EditFloatDrag = 1 << 9,
 };
+
+//runs on the thread that changed the cvar, after the new value is stored
+using CVarListener = std::function<void(const char* name)>;
+
 class CVarSystem
 {
 
@@ -23,13 +30,15 @@ public:
 	static CVarSystem* Get();
 
 	//pimpl
+	//every cvar call is safe from any thread. lookups by name go through the registry, hot paths keep a CVarHandle
 	virtual CVarParameter* GetCVar(StringUtils::StringHash hash) = 0;
 
-	virtual double* GetFloatCVar(StringUtils::StringHash hash) = 0;
+	//empty when the cvar does not exist
+	virtual std::optional<double> GetFloatCVar(StringUtils::StringHash hash) = 0;
 
-	virtual int32_t* GetIntCVar(StringUtils::StringHash hash) = 0;
+	virtual std::optional<int32_t> GetIntCVar(StringUtils::StringHash hash) = 0;
 
-	virtual const char* GetStringCVar(StringUtils::StringHash hash) = 0;
+	virtual std::optional<std::string> GetStringCVar(StringUtils::StringHash hash) = 0;
 
 	virtual void SetFloatCVar(StringUtils::StringHash hash, double value) = 0;
 
@@ -43,6 +52,11 @@ public:
 	virtual CVarParameter* CreateIntCVar(const char* name, const char* description, int32_t defaultValue, int32_t currentValue) = 0;
 	
 	virtual CVarParameter* CreateStringCVar(const char* name, const char* description, const char* defaultValue, const char* currentValue) = 0;
+
+	//called each time the value changes, returns the id to remove it with or 0 when the cvar does not exist
+	virtual uint32_t AddListener(StringUtils::StringHash hash, CVarListener&& listener) = 0;
+
+	virtual void RemoveListener(uint32_t id) = 0;
 	
 	virtual void DrawImguiEditor() = 0;
 };
@@ -60,9 +74,7 @@ struct AutoCVar_Float : AutoCVar<double>
 	AutoCVar_Float(const char* name, const char* description, double defaultValue, CVarFlags flags = CVarFlags::None);
 
 	double Get();
-	double* GetPtr();
 	float GetFloat();
-	float* GetFloatPtr();
 	void Set(double val);
 };
 
@@ -70,7 +82,6 @@ struct AutoCVar_Int : AutoCVar<int32_t>
 {
 	AutoCVar_Int(const char* name, const char* description, int32_t defaultValue, CVarFlags flags = CVarFlags::None);
 	int32_t Get();
-	int32_t* GetPtr();
 	void Set(int32_t val);
 
 	void Toggle();
@@ -80,6 +91,40 @@ struct AutoCVar_String : AutoCVar<std::string>
 {
 	AutoCVar_String(const char* name, const char* description, const char* defaultValue, CVarFlags flags = CVarFlags::None);
 
-	const char* Get();
+	//a copy, another thread may replace the value meanwhile
+	std::string Get();
 	void Set(std::string&& val);
 };
+
+//a cvar owned by another file, found by name on first use and then read by index like an AutoCVar
+template<typename T>
+struct CVarHandle
+{
+	explicit CVarHandle(const char* name) : hash(StringUtils::StringHash{ name }.computedHash) {}
+
+	//false while no cvar of that name and type exists, Get returns 0 then
+	bool valid() { return resolve() >= 0; }
+protected:
+	int32_t resolve();
+
+	uint32_t hash;
+	//-1 until resolved, handles can be built before the cvar registers during static init
+	std::atomic<int32_t> index{ -1 };
+};
+
+struct CVarHandle_Float : CVarHandle<double>
+{
+	using CVarHandle::CVarHandle;
+
+	double Get();
+	float GetFloat();
+	void Set(double val);
+};
+
+struct CVarHandle_Int : CVarHandle<int32_t>
+{
+	using CVarHandle::CVarHandle;
+
+	int32_t Get();
+	void Set(int32_t val);
+};
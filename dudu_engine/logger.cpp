@@ -0,0 +1,246 @@
+﻿#include "logger.h"
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include "fmt/color.h"
+#include "fmt/chrono.h"
+
+namespace {
+
+	struct LogRing {
+		static constexpr uint32_t CAPACITY = 256;
+
+		std::array<LogRecord, CAPACITY> records;
+		//head is only written by the owning thread, tail only by the thread draining
+		std::atomic<uint32_t> head{ 0 };
+		std::atomic<uint32_t> tail{ 0 };
+		//the thread exited, the ring goes away once it is drained
+		std::atomic<bool> retired{ false };
+	};
+
+	struct LogState {
+		std::mutex ringLock;
+		std::vector<std::shared_ptr<LogRing>> rings;
+
+		//one drain at a time, the writer thread or a flush
+		std::mutex drainLock;
+		std::vector<LogRecord> pending;
+		std::FILE* binaryFile{ nullptr };
+
+		std::thread writer;
+		std::atomic<bool> running{ false };
+	};
+
+	//not a global, a static constructor may log before this file is initialized
+	LogState& state()
+	{
+		static LogState logState;
+		return logState;
+	}
+
+	struct RingHolder {
+		std::shared_ptr<LogRing> ring;
+		~RingHolder()
+		{
+			if (ring)
+			{
+				ring->retired = true;
+			}
+		}
+	};
+	thread_local RingHolder threadRing;
+
+	LogRing& this_thread_ring()
+	{
+		if (!threadRing.ring)
+		{
+			threadRing.ring = std::make_shared<LogRing>();
+			std::lock_guard<std::mutex> guard(state().ringLock);
+			state().rings.push_back(threadRing.ring);
+		}
+		return *threadRing.ring;
+	}
+
+	void print_record(const LogRecord& record)
+	{
+		auto time = std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(record.time));
+		fmt::print("[{:%M:%S}]", time);
+
+		switch (record.type)
+		{
+		case LogType::Fatal:
+			fmt::print(fg(fmt::color::crimson) | fmt::emphasis::bold,
+				"[FATAL]   ");
+			break;
+		case LogType::Error:
+			fmt::print(fg(fmt::color::crimson),
+				"[ERROR]   ");
+			break;
+		case LogType::Warning:
+			fmt::print(fg(fmt::color::yellow),
+				"[WARNING] ");
+			break;
+		case LogType::Success:
+			fmt::print(fg(fmt::color::light_green),
+				"[SUCCESS] ");
+			break;
+		case LogType::Info:
+			fmt::print(fg(fmt::color::white),
+				"[INFO]    ");
+			break;
+		}
+		fmt::print("{}\n", std::string_view(record.text, record.length));
+	}
+
+	void write_binary(std::FILE* file, const LogRecord& record)
+	{
+		uint8_t type = static_cast<uint8_t>(record.type);
+		std::fwrite(&record.time, sizeof(record.time), 1, file);
+		std::fwrite(&type, sizeof(type), 1, file);
+		std::fwrite(&record.length, sizeof(record.length), 1, file);
+		std::fwrite(record.text, 1, record.length, file);
+	}
+
+	//returns the number of records written
+	size_t drain(bool console)
+	{
+		LogState& s = state();
+		std::lock_guard<std::mutex> guard(s.drainLock);
+
+		std::vector<std::shared_ptr<LogRing>> rings;
+		{
+			std::lock_guard<std::mutex> ringGuard(s.ringLock);
+			rings = s.rings;
+			//a retired ring gets no more records, once empty it can go
+			s.rings.erase(std::remove_if(s.rings.begin(), s.rings.end(), [](const std::shared_ptr<LogRing>& ring) {
+				return ring->retired && ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+			}), s.rings.end());
+		}
+
+		s.pending.clear();
+		for (auto& ring : rings)
+		{
+			uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+			uint32_t head = ring->head.load(std::memory_order_acquire);
+			for (uint32_t i = tail; i != head; i++)
+			{
+				s.pending.push_back(ring->records[i % LogRing::CAPACITY]);
+			}
+			ring->tail.store(head, std::memory_order_release);
+		}
+		if (s.pending.empty())
+		{
+			return 0;
+		}
+
+		//every ring is in order, merged they interleave by time
+		std::stable_sort(s.pending.begin(), s.pending.end(), [](const LogRecord& a, const LogRecord& b) {
+			return a.time < b.time;
+		});
+
+		for (const LogRecord& record : s.pending)
+		{
+			if (console)
+			{
+				print_record(record);
+			}
+			if (s.binaryFile)
+			{
+				write_binary(s.binaryFile, record);
+			}
+		}
+		//one flush per batch instead of one per line
+		std::fflush(stdout);
+		if (s.binaryFile)
+		{
+			std::fflush(s.binaryFile);
+		}
+		return s.pending.size();
+	}
+}
+
+LogHandler::LogHandler()
+{
+	start_time = std::chrono::system_clock::now();
+
+	LogState& s = state();
+	s.running = true;
+	s.writer = std::thread([this]() {
+		while (state().running.load(std::memory_order_acquire))
+		{
+			if (drain(console.load(std::memory_order_relaxed)) == 0)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			}
+		}
+	});
+}
+
+LogHandler::~LogHandler()
+{
+	LogState& s = state();
+	s.running = false;
+	if (s.writer.joinable())
+	{
+		s.writer.join();
+	}
+	flush();
+
+	std::lock_guard<std::mutex> guard(s.drainLock);
+	if (s.binaryFile)
+	{
+		std::fclose(s.binaryFile);
+		s.binaryFile = nullptr;
+	}
+}
+
+bool LogHandler::open_binary_file(const std::string& path)
+{
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		return false;
+	}
+
+	LogState& s = state();
+	std::lock_guard<std::mutex> guard(s.drainLock);
+	if (s.binaryFile)
+	{
+		std::fclose(s.binaryFile);
+	}
+	s.binaryFile = file;
+	return true;
+}
+
+void LogHandler::flush()
+{
+	drain(console.load(std::memory_order_relaxed));
+}
+
+LogRecord& LogHandler::begin_record()
+{
+	LogRing& ring = this_thread_ring();
+	uint32_t head = ring.head.load(std::memory_order_relaxed);
+	while (head - ring.tail.load(std::memory_order_acquire) >= LogRing::CAPACITY)
+	{
+		//the writer is behind, or gone at shutdown
+		if (state().running.load(std::memory_order_acquire))
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			flush();
+		}
+	}
+	return ring.records[head % LogRing::CAPACITY];
+}
+
+void LogHandler::end_record()
+{
+	LogRing& ring = *threadRing.ring;
+	ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
@@ -1,18 +1,40 @@
 ﻿#pragma once
 #include <string_view>
-#include "fmt/core.h"
-#include "fmt/os.h"
-#include "fmt/color.h"
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
 #include <chrono>
-#include <fmt/chrono.h>
+#include "fmt/format.h"
+
+//levels under DUDU_LOG_LEVEL are compiled out, their arguments are not evaluated
+//0 everything, 1 warnings and up, 2 errors and fatal only
+#ifndef DUDU_LOG_LEVEL
+#define DUDU_LOG_LEVEL 0
+#endif
+
 //Format Output Log Message
 #define LOG_FATAL(message,...) LogHandler::Get().log(LogType::Fatal,message, ##__VA_ARGS__);
+#if DUDU_LOG_LEVEL <= 2
 #define LOG_ERROR(message,...) LogHandler::Get().log(LogType::Error,message, ##__VA_ARGS__);
-#define LOG_INFO(message,...) LogHandler::Get().log(LogType::Info,message, ##__VA_ARGS__);
+#else
+#define LOG_ERROR(message,...)
+#endif
+#if DUDU_LOG_LEVEL <= 1
 #define LOG_WARNING(message,...) LogHandler::Get().log(LogType::Warning,message, ##__VA_ARGS__);
+#else
+#define LOG_WARNING(message,...)
+#endif
+#if DUDU_LOG_LEVEL <= 0
+#define LOG_INFO(message,...) LogHandler::Get().log(LogType::Info,message, ##__VA_ARGS__);
 #define LOG_SUCCESS(message,...) LogHandler::Get().log(LogType::Success,message, ##__VA_ARGS__);
+#else
+#define LOG_INFO(message,...)
+#define LOG_SUCCESS(message,...)
+#endif
 
-enum class LogType {
+enum class LogType : uint8_t {
 	Fatal,
 	Error,
 	Info,
@@ -20,63 +42,49 @@ enum class LogType {
 	Success
 };
 
+//info and success share the lowest level
+constexpr int log_level(LogType type)
+{
+	return type == LogType::Fatal ? 3 : type == LogType::Error ? 2 : type == LogType::Warning ? 1 : 0;
+}
+
+//formatted on the calling thread, longer messages are cut
+constexpr size_t LOG_MESSAGE_SIZE = 496;
+
+struct LogRecord {
+	uint64_t time;//nanoseconds since set_time
+	LogType type;
+	uint16_t length;
+	char text[LOG_MESSAGE_SIZE];
+};
+
+//the calling thread formats into its own ring and moves on, a writer thread prints the records
+//the rings are single producer single consumer, nothing locks on the logging path
+//binary file records are: uint64 time, uint8 type, uint16 length, then length bytes of text
 class LogHandler {
 public:
 	template <typename... Args>
-	inline static void print(std::string_view message, Args... args)
+	inline void log(LogType type, std::string_view message, const Args&... args)
 	{
-		fmt::print((message), args...);
-		fmt::print("\n");
-	}
-
-	template <typename... Args>
-	inline static void log(LogType type,std::string_view message, Args... args)
-	{
-		//show time
-		print_time();
-		//show message type
-		switch (type)
+		if (log_level(type) < level.load(std::memory_order_relaxed))
 		{
-		case LogType::Fatal:
-			fmt::print(fg(fmt::color::crimson) | fmt::emphasis::bold,
-				"[FATAL]   ");
-			break;
-		case LogType::Error:
-			fmt::print(fg(fmt::color::crimson),
-				"[ERROR]   ");
-			break;
-		case LogType::Warning:
-			fmt::print(fg(fmt::color::yellow),
-				"[WARNING] ");
-			break;
-		case LogType::Success:
-			fmt::print(fg(fmt::color::light_green),
-				"[SUCCESS] ");
-			break;
-		case LogType::Info:
-			fmt::print(fg(fmt::color::white),
-				"[INFO]    ");
-			break;
-		}		
-		//show message info
-		print(message, args...);
+			return;
+		}
+
+		LogRecord& record = begin_record();
+		record.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now() - start_time).count());
+		record.type = type;
+		auto result = fmt::format_to_n(record.text, LOG_MESSAGE_SIZE, message, args...);
+		record.length = static_cast<uint16_t>(std::min(result.size, LOG_MESSAGE_SIZE));
+		end_record();
 
 		if (type == LogType::Fatal)
 		{
+			flush();
 			abort();
 		}
 	}
 
-
-	inline static void print_time() {
-		std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-
-		auto time_point = now - LogHandler::Get().start_time;
-
-		
-		fmt::print("[{:%M:%S}]", time_point);
-	}
-
 	inline static LogHandler& Get() {
 		static LogHandler handler{};
 		return handler;
@@ -86,5 +94,32 @@ public:
 		start_time = std::chrono::system_clock::now();
 	}
 
+	//runtime filter on top of DUDU_LOG_LEVEL
+	void set_level(LogType type) {
+		level = log_level(type);
+	}
+
+	//console output can be turned off when a binary file is written
+	void set_console(bool enabled) {
+		console = enabled;
+	}
+
+	//every record from now on is also appended to path, false when it can't be opened
+	bool open_binary_file(const std::string& path);
+
+	//blocks until every record logged before the call is written
+	void flush();
+
+	~LogHandler();
+
 	std::chrono::time_point<std::chrono::system_clock> start_time;
-};
\ No newline at end of file
+private:
+	LogHandler();
+
+	//slot in the ring of this thread, waits while the ring is full
+	LogRecord& begin_record();
+	void end_record();
+
+	std::atomic<int> level{ 0 };
+	std::atomic<bool> console{ true };
+};
@@ -1,12 +1,79 @@
 #include <vk_engine.h>
+#include <vk_trace.h>
+#include "logger.h"
+#include <string>
+#include <cstdlib>
 
 int main(int argc, char* argv[])
 {
 	VulkanEngine engine;
 
+	//--headless [--frames N] [--camera-path file], or --record-path file to save the camera of a windowed run
+	//--trace file [--trace-start N] [--trace-frames N] writes a chrome trace of that frame range
+	//--log-level info|warning|error, --log-file file also writes the log as binary records
+	std::string tracePath;
+	int traceStart = 0;
+	int traceFrames = 10;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--headless")
+		{
+			engine._headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			engine._headlessFrames = std::atoi(argv[++i]);
+		}
+		else if (arg == "--camera-path" && i + 1 < argc)
+		{
+			engine._cameraPathFile = argv[++i];
+		}
+		else if (arg == "--record-path" && i + 1 < argc)
+		{
+			engine._recordPathFile = argv[++i];
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+		}
+		else if (arg == "--trace-start" && i + 1 < argc)
+		{
+			traceStart = std::atoi(argv[++i]);
+		}
+		else if (arg == "--trace-frames" && i + 1 < argc)
+		{
+			traceFrames = std::atoi(argv[++i]);
+		}
+		else if (arg == "--log-level" && i + 1 < argc)
+		{
+			std::string level = argv[++i];
+			LogHandler::Get().set_level(level == "error" ? LogType::Error : level == "warning" ? LogType::Warning : LogType::Info);
+		}
+		else if (arg == "--log-file" && i + 1 < argc)
+		{
+			if (!LogHandler::Get().open_binary_file(argv[++i]))
+			{
+				LOG_ERROR("Failed to open the log file {}", argv[i]);
+			}
+		}
+	}
+
+	if (!tracePath.empty())
+	{
+		vktrace::configure(tracePath, traceStart, traceFrames);
+	}
+
 	engine.init();	
 	
-	engine.run();	
+	if (engine._headless)
+	{
+		engine.run_headless();
+	}
+	else
+	{
+		engine.run();
+	}
 
 	engine.cleanup();	
 
@@ -3,8 +3,9 @@
 #include <vk_shaders.h>
 #include "logger.h"
 #include "vk_engine.h"
+#include <algorithm>
 //build compute pipeline
-VkPipeline ComputePipelineBuilder::build_pipeline(VkDevice device)
+VkPipeline ComputePipelineBuilder::build_pipeline(VkDevice device, VkPipelineCache cache)
 {
 	VkComputePipelineCreateInfo pipelineInfo{};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -16,7 +17,7 @@ VkPipeline ComputePipelineBuilder::build_pipeline(VkDevice device)
 
 	VkPipeline newPipeline;
 	if (vkCreateComputePipelines(
-		device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
+		device, cache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
 		LOG_FATAL("Failed to build compute pipeline");
 		return VK_NULL_HANDLE;
 	}
@@ -26,7 +27,7 @@ VkPipeline ComputePipelineBuilder::build_pipeline(VkDevice device)
 	}
 }
 // build graphics pipeline
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache)
 {
 	//vertex input stage
 	_vertexInputInfo = vkinit::vertex_input_state_create_info();
@@ -96,7 +97,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
 	//its easy to error out on create graphics pipeline, so we handle it a bit better than the common VK_CHECK case
 	VkPipeline newPipeline;
 	if (vkCreateGraphicsPipelines(
-		device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
+		device, cache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
 		LOG_FATAL("Failed to build graphics pipeline");
 		return VK_NULL_HANDLE;
 	}
@@ -129,10 +130,120 @@ void PipelineBuilder::setShaders(ShaderEffect* effect)
 void vkutil::MaterialSystem::init(VulkanEngine* owner)
 {
 	engine = owner;
+	bindless = engine->_useBindless;
+	if (bindless)
+	{
+		init_bindless();
+	}
 	build_default_templates();
 }
 
-ShaderEffect* build_effect(VulkanEngine* eng,std::string_view vertexShader, std::string_view fragmentShader) {
+void vkutil::MaterialSystem::init_bindless()
+{
+	maxBindlessTextures = std::min(MAX_BINDLESS_TEXTURES, engine->_maxBindlessTextures);
+
+	//binding 0: every material texture, only the registered ones are written
+	//binding 1: material parameters, indexed by the material index in the object data
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = maxBindlessTextures;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	//textures get written while older frames still use the set
+	VkDescriptorBindingFlags bindingFlags[2] = {
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+		0
+	};
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {};
+	flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	flagsInfo.bindingCount = 2;
+	flagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &flagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(engine->_device, &layoutInfo, nullptr, &bindlessLayout) != VK_SUCCESS) {
+		LOG_FATAL("Failed to create bindless descriptor set layout");
+	}
+
+	//update after bind sets need their own pool
+	VkDescriptorPoolSize poolSizes[2] = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxBindlessTextures },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+	};
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	if (vkCreateDescriptorPool(engine->_device, &poolInfo, nullptr, &bindlessPool) != VK_SUCCESS) {
+		LOG_FATAL("Failed to create bindless descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = bindlessPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &bindlessLayout;
+	if (vkAllocateDescriptorSets(engine->_device, &allocInfo, &bindlessSet) != VK_SUCCESS) {
+		LOG_FATAL("Failed to allocate bindless descriptor set");
+	}
+
+	//written from the cpu on material creation, fixed size so the set never changes
+	vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::Materials);
+	materialBuffer = engine->create_buffer(sizeof(GPUMaterialData) * MAX_BINDLESS_MATERIALS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	void* data;
+	vmaMapMemory(engine->_allocator, materialBuffer._allocation, &data);
+	mappedMaterials = (GPUMaterialData*)data;
+
+	VkDescriptorBufferInfo materialInfo = materialBuffer.get_info();
+	VkWriteDescriptorSet write = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bindlessSet, &materialInfo, 1);
+	vkUpdateDescriptorSets(engine->_device, 1, &write, 0, nullptr);
+
+	LOG_INFO("Bindless materials with {} texture slots", maxBindlessTextures);
+}
+
+uint32_t vkutil::MaterialSystem::register_bindless_texture(const SampledTexture& texture)
+{
+	//textures are shared by many materials, write each one once
+	for (uint32_t i = 0; i < bindlessTextures.size(); i++)
+	{
+		if (bindlessTextures[i].view == texture.view && bindlessTextures[i].sampler == texture.sampler)
+		{
+			return i;
+		}
+	}
+	if (bindlessTextures.size() >= maxBindlessTextures)
+	{
+		LOG_FATAL("Bindless texture array is full, {} textures", maxBindlessTextures);
+		return 0;
+	}
+
+	uint32_t index = static_cast<uint32_t>(bindlessTextures.size());
+	bindlessTextures.push_back(texture);
+
+	VkDescriptorImageInfo imageInfo;
+	imageInfo.sampler = texture.sampler;
+	imageInfo.imageView = texture.view;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, bindlessSet, &imageInfo, 0);
+	write.dstArrayElement = index;
+	vkUpdateDescriptorSets(engine->_device, 1, &write, 0, nullptr);
+
+	return index;
+}
+
+ShaderEffect* build_effect(VulkanEngine* eng,std::string_view vertexShader, std::string_view fragmentShader, VkDescriptorSetLayout materialLayout = VK_NULL_HANDLE) {
 	ShaderEffect::ReflectionOverrides overrides[] = {
 		{"sceneData", VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC},
 		{"cameraData", VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC}
@@ -146,7 +257,8 @@ ShaderEffect* build_effect(VulkanEngine* eng,std::string_view vertexShader, std:
 		ShaderModule* fragShaderModule = eng->_shaderCache.get_shader(VulkanEngine::shader_path(fragmentShader));
 		effect->add_stage(fragShaderModule, VK_SHADER_STAGE_FRAGMENT_BIT);
 	}
-	
+	//set 2 is the material set
+	effect->externalLayouts[2] = materialLayout;
 
 	effect->reflect_layout(eng->_device, overrides, 2);
 	
@@ -159,7 +271,10 @@ void vkutil::MaterialSystem::build_default_templates()
 	fill_builders();
 
 	//default shader effects : reflect descriptor
-	ShaderEffect* texturedLit = build_effect(engine,  "tri_mesh_ssbo_instanced.vert.spv" ,"textured_lit.frag.spv" );
+	//bindless: the textured shaders index the global material set instead of a set per material
+	ShaderEffect* texturedLit = bindless ?
+		build_effect(engine, "tri_mesh_ssbo_instanced.vert.spv", "textured_lit_bindless.frag.spv", bindlessLayout) :
+		build_effect(engine,  "tri_mesh_ssbo_instanced.vert.spv" ,"textured_lit.frag.spv" );
 	ShaderEffect* defaultLit = build_effect(engine, "tri_mesh_ssbo_instanced.vert.spv" , "default_lit.frag.spv" );
 	ShaderEffect* opaqueShadowcast = build_effect(engine, "tri_mesh_ssbo_instanced_shadowcast.vert.spv","");
 
@@ -248,7 +363,12 @@ vkutil::ShaderPass* vkutil::MaterialSystem::build_shader(VkRenderPass renderPass
 
 	pipbuilder.setShaders(effect);
 
-	pass->pipeline = pipbuilder.build_pipeline(engine->_device, renderPass);
+	//compiled on a worker thread, the engine waits for every pipeline at the end of init_pipelines
+	VkDevice device = engine->_device;
+	VkPipelineCache cache = engine->_pipelineCache.get();
+	engine->_pipelineCache.compile([=]() mutable {
+		pass->pipeline = pipbuilder.build_pipeline(device, renderPass, cache);
+	});
 
 	return pass;
 }
@@ -274,7 +394,29 @@ vkutil::Material* vkutil::MaterialSystem::build_material(const std::string& mate
 		newMat->passSets[MeshpassType::DirectionalShadow] = VK_NULL_HANDLE;
 		newMat->textures = info.textures;
 
+		if (bindless && info.baseTemplate.find("textured") == 0)
+		{
+			if (bindlessMaterialCount >= MAX_BINDLESS_MATERIALS)
+			{
+				LOG_FATAL("Bindless material buffer is full, {} materials", MAX_BINDLESS_MATERIALS);
+			}
+			else
+			{
+				newMat->bindlessIndex = bindlessMaterialCount++;
 
+				GPUMaterialData data = {};
+				data.albedoTexture = info.textures.size() > 0 ? register_bindless_texture(info.textures[0]) : 0;
+				mappedMaterials[newMat->bindlessIndex] = data;
+			}
+			//every bindless material shares one set, so batches only split on pipeline and mesh
+			newMat->passSets[MeshpassType::Forward] = bindlessSet;
+			newMat->passSets[MeshpassType::Transparency] = bindlessSet;
+
+			LOG_INFO("Built New Bindless Material {}", materialName);
+			materialCache[info] = (newMat);
+			materials[materialName] = newMat;
+			return newMat;
+		}
 	
 		auto& db = vkutil::DescriptorBuilder::begin(engine->_descriptorLayoutCache, engine->_descriptorAllocator);
 
@@ -352,6 +494,12 @@ void vkutil::MaterialSystem::fill_builders()
 }
 
 void vkutil::MaterialSystem::cleanup() {
+	if (bindless) {
+		vmaUnmapMemory(engine->_allocator, materialBuffer._allocation);
+		vmaDestroyBuffer(engine->_allocator, materialBuffer._buffer, materialBuffer._allocation);
+		vkDestroyDescriptorPool(engine->_device, bindlessPool, nullptr);
+		vkDestroyDescriptorSetLayout(engine->_device, bindlessLayout, nullptr);
+	}
 	/*if (forwardBuilder._pipelineLayout != VK_NULL_HANDLE) {
 		vkDestroyPipelineLayout(engine->_device, forwardBuilder._pipelineLayout, nullptr);
 		std::cout << " destroy forward pipeline layout" << std::endl;
@@ -25,7 +25,7 @@ public:
 	VkPipelineMultisampleStateCreateInfo _multisampling;
 	VkPipelineLayout _pipelineLayout;
 	VkPipelineDepthStencilStateCreateInfo _depthStencil;
-	VkPipeline build_pipeline(VkDevice device, VkRenderPass pass);
+	VkPipeline build_pipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache = VK_NULL_HANDLE);
 	void clear_vertex_input();
 	//get pipeline layout and shader stages
 	void setShaders(struct ShaderEffect* effect);
@@ -52,7 +52,7 @@ public:
 
 	VkPipelineShaderStageCreateInfo  _shaderStage;
 	VkPipelineLayout _pipelineLayout;
-	VkPipeline build_pipeline(VkDevice device);
+	VkPipeline build_pipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
 };
 struct ShaderEffect;
 class VulkanEngine;
@@ -122,9 +122,21 @@ namespace vkutil {
 		size_t hash() const;
 	};
 
+	//bindless material parameters, one per material in the material buffer
+	struct GPUMaterialData {
+		uint32_t albedoTexture;//index in the bindless texture array
+		uint32_t padding[3];
+	};
+
+	//array size of the bindless textures, clamped to the device limit
+	constexpr uint32_t MAX_BINDLESS_TEXTURES = 4096;
+	constexpr uint32_t MAX_BINDLESS_MATERIALS = 4096;
+
 	struct Material {
 		EffectTemplate* original;
+		//in bindless mode every pass set is the global bindless set
 		PerPassData<VkDescriptorSet> passSets;
+		uint32_t bindlessIndex{ 0 };//entry in the material buffer
 		
 		std::vector<SampledTexture> textures;
 
@@ -148,6 +160,20 @@ namespace vkutil {
 		void fill_builders();
 	private:
 
+		//one set for all materials: texture array at binding 0, material buffer at binding 1
+		void init_bindless();
+		uint32_t register_bindless_texture(const SampledTexture& texture);
+
+		bool bindless{ false };
+		VkDescriptorSetLayout bindlessLayout{ VK_NULL_HANDLE };
+		VkDescriptorPool bindlessPool{ VK_NULL_HANDLE };
+		VkDescriptorSet bindlessSet{ VK_NULL_HANDLE };
+		AllocatedBuffer<GPUMaterialData> materialBuffer;
+		GPUMaterialData* mappedMaterials{ nullptr };
+		uint32_t bindlessMaterialCount{ 0 };
+		uint32_t maxBindlessTextures{ 0 };
+		std::vector<SampledTexture> bindlessTextures;
+
 		struct MaterialInfoHash
 		{
 
@@ -2,6 +2,11 @@
 #include "SDL.h"
 
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/constants.hpp>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "logger.h"
 void PlayerCamera::process_input_event(SDL_Event* ev)
 {
 	//when press key......
@@ -140,3 +145,89 @@ glm::mat4 PlayerCamera::get_rotation_matrix()
 	//return composite result
 	return pitch_rot;
 }
+
+bool CameraPath::load(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		LOG_ERROR("Failed to open camera path {}", path);
+		return false;
+	}
+
+	keys.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+		Key key;
+		std::istringstream stream(line);
+		if (stream >> key.position.x >> key.position.y >> key.position.z >> key.pitch >> key.yaw)
+		{
+			keys.push_back(key);
+		}
+	}
+
+	if (keys.empty())
+	{
+		LOG_ERROR("Camera path {} has no keys", path);
+		return false;
+	}
+	LOG_INFO("Loaded camera path {} with {} keys", path, keys.size());
+	return true;
+}
+
+bool CameraPath::save(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file << "# x y z pitch yaw\n";
+	for (const Key& key : keys)
+	{
+		file << key.position.x << " " << key.position.y << " " << key.position.z << " " << key.pitch << " " << key.yaw << "\n";
+	}
+	return file.good();
+}
+
+CameraPath CameraPath::orbit(glm::vec3 center, float radius)
+{
+	//the camera looks down -z rotated by yaw, so it faces center from this position
+	constexpr int KEY_COUNT = 16;
+	CameraPath path;
+	for (int i = 0; i <= KEY_COUNT; i++)
+	{
+		float angle = glm::two_pi<float>() * i / KEY_COUNT;
+
+		Key key;
+		key.position = center + radius * glm::vec3(-sin(angle), 0.f, cos(angle));
+		key.pitch = -0.2f;
+		key.yaw = angle;
+		path.keys.push_back(key);
+	}
+	return path;
+}
+
+void CameraPath::apply(PlayerCamera& camera, float t) const
+{
+	if (keys.empty())
+	{
+		return;
+	}
+
+	float position = glm::clamp(t, 0.f, 1.f) * (keys.size() - 1);
+	size_t first = std::min(static_cast<size_t>(position), keys.size() - 1);
+	size_t second = std::min(first + 1, keys.size() - 1);
+	float blend = position - first;
+
+	camera.position = glm::mix(keys[first].position, keys[second].position, blend);
+	camera.pitch = glm::mix(keys[first].pitch, keys[second].pitch, blend);
+	camera.yaw = glm::mix(keys[first].yaw, keys[second].yaw, blend);
+	camera.velocity = glm::vec3(0.f);
+}
@@ -7,6 +7,8 @@
 
 #include <SDL_events.h>
 #include <glm/glm.hpp>
+#include <vector>
+#include <string>
 
 
 struct PlayerCamera {
@@ -28,4 +30,22 @@ struct PlayerCamera {
 	glm::mat4 get_view_matrix();
 	glm::mat4 get_projection_matrix(bool bReverse = true);
 	glm::mat4 get_rotation_matrix();
+};
+
+//scripted camera of headless runs, linear between keyframes
+struct CameraPath {
+	struct Key {
+		glm::vec3 position;
+		float pitch;
+		float yaw;
+	};
+	std::vector<Key> keys;
+
+	//text file, one key per line: x y z pitch yaw. lines starting with # are skipped
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+	//a full turn around center, looking at it
+	static CameraPath orbit(glm::vec3 center, float radius);
+	//t from 0 to 1 over the whole path
+	void apply(PlayerCamera& camera, float t) const;
 };
\ No newline at end of file
@@ -34,6 +34,7 @@ namespace vkutil {
 		freePools = usedPools;
 		usedPools.clear();
 		currentPool = VK_NULL_HANDLE;
+		writeCount = 0;
 	}
 
 	bool DescriptorAllocator::allocate(VkDescriptorSet* set, VkDescriptorSetLayout layout)
@@ -197,6 +198,16 @@ namespace vkutil {
 		return builder;
 	}
 
+	vkutil::DescriptorBuilder DescriptorBuilder::begin(DescriptorLayoutCache* layoutCache, DescriptorSetCache* setCache)
+	{
+		DescriptorBuilder builder;
+
+		builder.cache = layoutCache;
+		builder.alloc = &setCache->allocator;
+		builder.setCache = setCache;
+		return builder;
+	}
+
 
 	vkutil::DescriptorBuilder& DescriptorBuilder::bind_buffer(uint32_t binding, VkDescriptorBufferInfo* bufferInfo, VkDescriptorType type, VkShaderStageFlags stageFlags)
 	{
@@ -249,6 +260,31 @@ namespace vkutil {
 		return *this;
 	}
 
+	vkutil::DescriptorBuilder& DescriptorBuilder::bind_images(uint32_t binding, VkDescriptorImageInfo* imageInfos, uint32_t count, VkDescriptorType type, VkShaderStageFlags stageFlags)
+	{
+		VkDescriptorSetLayoutBinding newBinding{};
+
+		newBinding.descriptorCount = count;
+		newBinding.descriptorType = type;
+		newBinding.pImmutableSamplers = nullptr;
+		newBinding.stageFlags = stageFlags;
+		newBinding.binding = binding;
+
+		bindings.push_back(newBinding);
+
+		VkWriteDescriptorSet newWrite{};
+		newWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		newWrite.pNext = nullptr;
+
+		newWrite.descriptorCount = count;
+		newWrite.descriptorType = type;
+		newWrite.pImageInfo = imageInfos;
+		newWrite.dstBinding = binding;
+
+		writes.push_back(newWrite);
+		return *this;
+	}
+
 	bool DescriptorBuilder::build(VkDescriptorSet& set, VkDescriptorSetLayout& layout)
 	{
 		//build layout first
@@ -261,6 +297,40 @@ namespace vkutil {
 
 		layout = cache->create_descriptor_layout(&layoutInfo);
 
+		DescriptorSetCache::DescriptorSetKey key;
+		std::vector<VkBuffer> boundBuffers;
+		if (setCache)
+		{
+			key.layout = layout;
+			for (const VkWriteDescriptorSet& w : writes) {
+				key.resources.push_back(uint64_t(w.dstBinding) | uint64_t(w.descriptorType) << 32);
+				key.resources.push_back(w.descriptorCount);
+				for (uint32_t i = 0; i < w.descriptorCount; i++)
+				{
+					if (w.pBufferInfo)
+					{
+						key.resources.push_back(uint64_t(w.pBufferInfo[i].buffer));
+						key.resources.push_back(w.pBufferInfo[i].offset);
+						key.resources.push_back(w.pBufferInfo[i].range);
+						boundBuffers.push_back(w.pBufferInfo[i].buffer);
+					}
+					else if (w.pImageInfo)
+					{
+						key.resources.push_back(uint64_t(w.pImageInfo[i].imageView));
+						key.resources.push_back(uint64_t(w.pImageInfo[i].sampler));
+						key.resources.push_back(w.pImageInfo[i].imageLayout);
+					}
+				}
+			}
+
+			auto it = setCache->setCache.find(key);
+			if (it != setCache->setCache.end())
+			{
+				set = it->second.set;
+				setCache->stats.hits++;
+				return true;
+			}
+		}
 
 		//allocate descriptor
 		bool success = alloc->allocate(&set, layout);
@@ -270,10 +340,20 @@ namespace vkutil {
 
 		for (VkWriteDescriptorSet& w : writes) {
 			w.dstSet = set;
+			alloc->writeCount += w.descriptorCount;
 		}
 
 		vkUpdateDescriptorSets(alloc->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 
+		if (setCache)
+		{
+			setCache->stats.misses++;
+			for (VkWriteDescriptorSet& w : writes) {
+				setCache->stats.writes += w.descriptorCount;
+			}
+			setCache->setCache[key] = { set, boundBuffers };
+		}
+
 		return true;
 	}
 
@@ -285,6 +365,73 @@ namespace vkutil {
 	}
 
 
+	void DescriptorSetCache::init(VkDevice newDevice)
+	{
+		allocator.init(newDevice);
+	}
+
+	void DescriptorSetCache::cleanup()
+	{
+		setCache.clear();
+		allocator.cleanup();
+	}
+
+	void DescriptorSetCache::invalidate(VkBuffer buffer)
+	{
+		for (auto it = setCache.begin(); it != setCache.end();)
+		{
+			const std::vector<VkBuffer>& buffers = it->second.buffers;
+			if (std::find(buffers.begin(), buffers.end(), buffer) != buffers.end())
+			{
+				it = setCache.erase(it);
+				staleSets++;
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	DescriptorAllocator DescriptorSetCache::retire()
+	{
+		DescriptorAllocator retired = allocator;
+
+		allocator = DescriptorAllocator{};
+		allocator.init(retired.device);
+		setCache.clear();
+		staleSets = 0;
+
+		return retired;
+	}
+
+	DescriptorSetCache::Stats DescriptorSetCache::take_stats()
+	{
+		Stats result = stats;
+		stats = {};
+		return result;
+	}
+
+	bool DescriptorSetCache::DescriptorSetKey::operator==(const DescriptorSetKey& other) const
+	{
+		return layout == other.layout && resources == other.resources;
+	}
+
+	size_t DescriptorSetCache::DescriptorSetKey::hash() const
+	{
+		using std::size_t;
+		using std::hash;
+
+		size_t result = hash<uint64_t>()(uint64_t(layout));
+
+		for (uint64_t r : resources)
+		{
+			//boost hash_combine, the order of the resources matters
+			result ^= hash<uint64_t>()(r) + 0x9e3779b9 + (result << 6) + (result >> 2);
+		}
+
+		return result;
+	}
+
 	bool DescriptorLayoutCache::DescriptorLayoutInfo::operator==(const DescriptorLayoutInfo& other) const
 	{
 		if (other.bindings.size() != bindings.size())
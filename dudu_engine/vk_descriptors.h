@@ -39,6 +39,8 @@ namespace vkutil {
 		void cleanup();
 
 		VkDevice device;
+		//descriptors written to sets of this allocator since the last reset_pools
+		uint32_t writeCount{ 0 };
 	private:
 		VkDescriptorPool grab_pool();
 
@@ -83,14 +85,80 @@ namespace vkutil {
 	};
 
 
+	//descriptor sets reused across frames, keyed by the layout and every bound resource
+	//a set stays valid until one of its buffers is invalidated, images are expected to live as long as the cache
+	class DescriptorSetCache {
+	public:
+		void init(VkDevice newDevice);
+		void cleanup();
+
+		//forget every set that binds the buffer, call it before the buffer is replaced or destroyed
+		//the forgotten sets are not freed, frames in flight can still use them
+		void invalidate(VkBuffer buffer);
+
+		//forgotten sets still held by the pools
+		uint32_t stale_sets() const { return staleSets; }
+
+		//start over on fresh pools and an empty cache. the returned allocator holds every set handed out so far,
+		//clean it up once the frames in flight are done with them
+		DescriptorAllocator retire();
+
+		struct Stats {
+			uint32_t hits;
+			uint32_t misses;
+			uint32_t writes;//descriptors written for the misses
+		};
+		//counts since the last call
+		Stats take_stats();
+
+		size_t size() const { return setCache.size(); }
+
+	private:
+		friend class DescriptorBuilder;
+
+		struct DescriptorSetKey {
+			VkDescriptorSetLayout layout;
+			//binding, type, count then the handles, offsets and ranges of every bound resource
+			std::vector<uint64_t> resources;
+
+			bool operator==(const DescriptorSetKey& other) const;
+
+			size_t hash() const;
+		};
+
+		struct DescriptorSetKeyHash
+		{
+
+			std::size_t operator()(const DescriptorSetKey& k) const
+			{
+				return k.hash();
+			}
+		};
+
+		struct CachedSet {
+			VkDescriptorSet set;
+			std::vector<VkBuffer> buffers;
+		};
+
+		std::unordered_map<DescriptorSetKey, CachedSet, DescriptorSetKeyHash> setCache;
+		DescriptorAllocator allocator;
+		Stats stats{};
+		uint32_t staleSets{ 0 };
+	};
+
+
 	class DescriptorBuilder {
 	public:
 
 		static DescriptorBuilder begin(DescriptorLayoutCache* layoutCache, DescriptorAllocator* allocator );
+		//build returns the cached set when the same resources were bound before, and only writes new sets
+		static DescriptorBuilder begin(DescriptorLayoutCache* layoutCache, DescriptorSetCache* setCache);
 
 		DescriptorBuilder& bind_buffer(uint32_t binding, VkDescriptorBufferInfo* bufferInfo, VkDescriptorType type, VkShaderStageFlags stageFlags);
 
 		DescriptorBuilder& bind_image(uint32_t binding, VkDescriptorImageInfo* imageInfo, VkDescriptorType type, VkShaderStageFlags stageFlags);
+		//array binding, imageInfos points to count infos
+		DescriptorBuilder& bind_images(uint32_t binding, VkDescriptorImageInfo* imageInfos, uint32_t count, VkDescriptorType type, VkShaderStageFlags stageFlags);
 
 		bool build(VkDescriptorSet& set, VkDescriptorSetLayout& layout);
 		bool build(VkDescriptorSet& set);
@@ -102,6 +170,7 @@ namespace vkutil {
 
 		DescriptorLayoutCache* cache;
 		DescriptorAllocator* alloc;
+		DescriptorSetCache* setCache{ nullptr };
 	};
 }
 
@@ -14,6 +14,8 @@
 #include <fstream>
 #include <chrono>
 #include <sstream>
+#include <thread>
+#include <algorithm>
 #include "vk_textures.h"
 #include "vk_shaders.h"
 
@@ -26,7 +28,7 @@
 #include "prefab_asset.h"
 #include "material_asset.h"
 
-#include "Tracy.hpp"
+#include "vk_trace.h"
 #include "TracyVulkan.hpp"
 #include "vk_profiler.h"
 
@@ -45,13 +47,77 @@ AutoCVar_Int CVAR_OcclusionCullGPU("culling.enableOcclusionGPU", "Perform occlus
 AutoCVar_Int CVAR_CamLock("camera.lock", "Locks the camera", true, CVarFlags::EditCheckbox);
 AutoCVar_Int CVAR_OutputIndirectToFile("culling.outputIndirectBufferToFile", "output the indirect data to a file. Autoresets", 0, CVarFlags::EditCheckbox);
 
+AutoCVar_Int CVAR_TwoPhaseOcclusion("culling.twoPhase", "Occlusion cull against this frame depth: draw last frame visible objects, build the depth pyramid, then draw the newly visible ones", 1, CVarFlags::EditCheckbox);
+
 AutoCVar_Float CVAR_DrawDistance("gpu.drawDistance", "Distance cull", 5000);
 
 AutoCVar_Int CVAR_FreezeShadows("gpu.freezeShadows", "Stop the rendering of shadows", 0, CVarFlags::EditCheckbox);
 
+AutoCVar_Int CVAR_ParallelRecord("gpu.parallelRecord", "Record the shadow and forward passes into secondary command buffers on worker threads", 1, CVarFlags::EditCheckbox);
+
+AutoCVar_Int CVAR_AsyncCompute("gpu.asyncCompute", "Cull the forward passes and build the depth pyramid on a dedicated compute queue, read at startup", 0, CVarFlags::EditCheckbox);
+
+AutoCVar_Int CVAR_FramesInFlight("gpu.framesInFlight", "Frames the cpu records ahead of the gpu, 1 to 4. Fewer for latency, more for throughput", 2);
+
+AutoCVar_Int CVAR_TransferQueue("gpu.transferQueue", "Stream textures and meshes on a dedicated transfer queue, read at startup", 1, CVarFlags::EditCheckbox);
+
+AutoCVar_Int CVAR_Bindless("gpu.bindless", "One descriptor set with every material texture, read at startup", 1, CVarFlags::EditCheckbox);
+
+//declared in vk_engine_scenerender.cpp
+CVarHandle_Int CVAR_ShadowcastHandle("gpu.shadowcast");
+
 
 constexpr bool bUseValidationLayers = true;
 
+//semaphores of a submit, binary ones mixed with the upload and frame timelines
+struct SubmitSemaphores {
+	std::vector<VkSemaphore> semaphores;
+	std::vector<VkPipelineStageFlags> stages;
+	std::vector<uint64_t> values;//ignored for binary semaphores
+	std::vector<VkSemaphore> signalSemaphores;
+	std::vector<uint64_t> signalValues;
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+
+	//nothing acquired comes with no stages and value 0, it is skipped
+	void add(VkSemaphore semaphore, VkPipelineStageFlags stage, uint64_t value = 0)
+	{
+		if (semaphore == VK_NULL_HANDLE || stage == 0)
+		{
+			return;
+		}
+		semaphores.push_back(semaphore);
+		stages.push_back(stage);
+		values.push_back(value);
+	}
+
+	void signal(VkSemaphore semaphore, uint64_t value = 0)
+	{
+		if (semaphore == VK_NULL_HANDLE)
+		{
+			return;
+		}
+		signalSemaphores.push_back(semaphore);
+		signalValues.push_back(value);
+	}
+
+	//the submit keeps pointers into this, it has to outlive vkQueueSubmit
+	void apply(VkSubmitInfo& submit)
+	{
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(values.size());
+		timelineInfo.pWaitSemaphoreValues = values.data();
+		timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+		timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+		submit.pNext = &timelineInfo;
+		submit.waitSemaphoreCount = static_cast<uint32_t>(semaphores.size());
+		submit.pWaitSemaphores = semaphores.data();
+		submit.pWaitDstStageMask = stages.data();
+		submit.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+		submit.pSignalSemaphores = signalSemaphores.data();
+	}
+};
+
 //we want to immediately abort when there is an error. In normal engines this would give an error message to the user, or perform a dump of state.
 using namespace std;
 #define VK_CHECK(x)                                                 \
@@ -77,18 +143,22 @@ void VulkanEngine::init()
 	LOG_INFO("Engine Init");
 
 	// We initialize SDL and create a window with it. 
-	SDL_Init(SDL_INIT_VIDEO);
-	LOG_SUCCESS("SDL inited");
-	SDL_WindowFlags window_flags = (SDL_WINDOW_VULKAN);
-
-	_window = SDL_CreateWindow(
-		"Engine Demo!",
-		SDL_WINDOWPOS_UNDEFINED,
-		SDL_WINDOWPOS_UNDEFINED,
-		_windowExtent.width,
-		_windowExtent.height,
-		window_flags
-	);
+	//headless runs have no window, surface or swapchain
+	if (!_headless)
+	{
+		SDL_Init(SDL_INIT_VIDEO);
+		LOG_SUCCESS("SDL inited");
+		SDL_WindowFlags window_flags = (SDL_WINDOW_VULKAN);
+
+		_window = SDL_CreateWindow(
+			"Engine Demo!",
+			SDL_WINDOWPOS_UNDEFINED,
+			SDL_WINDOWPOS_UNDEFINED,
+			_windowExtent.width,
+			_windowExtent.height,
+			window_flags
+		);
+	}
 
 	//_renderables.reserve(10000);
 	//reserve 1000 meshs
@@ -105,9 +175,15 @@ void VulkanEngine::init()
 		});
 	//initailizes shader cache (device)
 	_shaderCache.init(_device);
+	_shaderCache.load_bundle(shader_path("shaders.bundle"));
 	_mainDeletionQueue.push_function([=]() {
 		_shaderCache.cleanup();
 		
+		});
+	//pipelines of the last run, saved again on shutdown
+	_pipelineCache.init(_device, _gpuProperties, "pipeline_cache.bin");
+	_mainDeletionQueue.push_function([=]() {
+		_pipelineCache.cleanup();
 		});
 	//register pass type based mesh types
 	_renderScene.init();
@@ -127,9 +203,13 @@ void VulkanEngine::init()
 
 	init_sync_structures();
 
+	calibrate_trace_clock();
+
 	init_descriptors();
 
 	init_pipelines();
+	//first run, or some .spv changed since the bundle was written
+	_shaderCache.save_bundle();
 
 	LOG_INFO("Engine Initialized, starting Load");
 	
@@ -142,7 +222,10 @@ void VulkanEngine::init()
 
 	LOG_INFO("Scene and Material initializated");
 
-	init_imgui();
+	if (!_headless)
+	{
+		init_imgui();
+	}
 	
 	adjust_image_layout();
 
@@ -153,6 +236,11 @@ void VulkanEngine::init()
 	_isInitialized = true;
 
 	_camera = {};
+	//the camera follows camera.lock when it changes instead of reading it every frame
+	_camera.bLocked = CVAR_CamLock.Get();
+	_camLockListener = CVarSystem::Get()->AddListener("camera.lock", [this](const char*) {
+		_camera.bLocked = CVAR_CamLock.Get();
+	});
 	//Sponza 
 	_camera.position = { 800.f,800.f,0.f };
 
@@ -176,15 +264,26 @@ void VulkanEngine::cleanup()
 		//make sure the gpu has stopped doing its things
 		LOG_INFO("Cleanup resource");
 		vkDeviceWaitIdle(_device);
-		for (auto& frame : _frames)
-		{
-			vkWaitForFences(_device, 1, &frame._renderFence, true, 1000000000);
-		}
+		vktrace::finish();
+		CVarSystem::Get()->RemoveListener(_camLockListener);
+		VkSemaphoreWaitInfo waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &_frameTimeline;
+		waitInfo.pValues = &_frameTimelineValue;
+		vkWaitSemaphores(_device, &waitInfo, 1000000000);
 		for (auto& frame : _frames)
 		{
 			//frame.
 			frame.dynamicDescriptorAllocator->cleanup();
-			vmaDestroyBuffer(_allocator, frame.debugOutputBuffer._buffer, frame.debugOutputBuffer._allocation);
+			if (frame.debugOutputBuffer._buffer != VK_NULL_HANDLE)
+			{
+				vmaDestroyBuffer(_allocator, frame.debugOutputBuffer._buffer, frame.debugOutputBuffer._allocation);
+			}
+			if (frame._cullReadbackBuffer._buffer != VK_NULL_HANDLE)
+			{
+				vmaDestroyBuffer(_allocator, frame._cullReadbackBuffer._buffer, frame._cullReadbackBuffer._allocation);
+			}
 			frame.dynamicData.cleanup(_allocator, frame.dynamicData.source);
 			//vmaDestroyBuffer(_allocator, frame.dynamicData.source._buffer, frame.dynamicData.source._allocation);
 
@@ -214,6 +313,7 @@ void VulkanEngine::cleanup()
 		}
 
 		_descriptorAllocator->cleanup();
+		_descriptorSetCache->cleanup();
 		_descriptorLayoutCache->cleanup();
 
 		vmaDestroyAllocator(_allocator);
@@ -222,11 +322,17 @@ void VulkanEngine::cleanup()
 		if (_debug_messenger) {
 			vkb::destroy_debug_utils_messenger(_instance, _debug_messenger);
 		}
-		vkDestroySurfaceKHR(_instance, _surface, nullptr);
+		if (!_headless)
+		{
+			vkDestroySurfaceKHR(_instance, _surface, nullptr);
+		}
 
 		vkDestroyInstance(_instance, nullptr);
 
-		SDL_DestroyWindow(_window);
+		if (!_headless)
+		{
+			SDL_DestroyWindow(_window);
+		}
 		LOG_SUCCESS("Empty all resource");
 	}
 }
@@ -234,25 +340,32 @@ void VulkanEngine::cleanup()
 
 void VulkanEngine::draw()
 {
+	vktrace::begin_frame(_frameNumber);
 	ZoneScopedN("Engine Draw");
+	vkutil::CpuScopeTimer cpuTimer(_profiler, "Draw");
 
-	ImGui::Render();
+	if (!_headless)
+	{
+		ImGui::Render();
+	}
 
 	{
-		ZoneScopedN("Fence Wait");
-		//wait until the gpu has finished rendering the last frame. Timeout of 1 second
-		VK_CHECK(vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true, 1000000000));
-		VK_CHECK(vkResetFences(_device, 1, &get_current_frame()._renderFence));
+		//wait until the gpu has finished the frame that last used this slot, its resources are retired after it
+		begin_frame();
 
 		//reflesh 3 render pass(forward pass,shadow pass,transparency pass)
-		_renderScene.build_batches();
+		{
+			vkutil::CpuScopeTimer batchTimer(_profiler, "Build Batches");
+			_renderScene.build_batches();
+		}
 	
-		//reset push buffer (dynamic data) wait re-fill data
-		get_current_frame().dynamicData.reset();
-		//check the debug data
-		void* data;		
-		vmaMapMemory(_allocator, get_current_frame().debugOutputBuffer._allocation, &data);
-		for (int i =1 ; i <   get_current_frame().debugDataNames.size();i++)
+		//check the debug data, the buffer only exists while culling.outputIndirectBufferToFile is on
+		void* data = nullptr;
+		if (get_current_frame().debugOutputBuffer._buffer != VK_NULL_HANDLE)
+		{
+			vmaMapMemory(_allocator, get_current_frame().debugOutputBuffer._allocation, &data);
+		}
+		for (int i =1 ; data && i <   get_current_frame().debugDataNames.size();i++)
 		{
 			//debug data storage range
 			uint32_t begin = get_current_frame().debugDataOffsets[i-1];
@@ -279,9 +392,9 @@ void VulkanEngine::draw()
 				//GPUindirectObject <- renderable batches convert
 				for (int o = 0; o < objectCount; o++)
 				{
-					out.print("DRAW: {} ------------ \n", o);
+					out.print("DRAW: {} LOD: {} ------------ \n", o / MAX_MESH_LODS, o % MAX_MESH_LODS);
 					//renderable object in one batch(GPUindirectObject) count
-					out.print("	OG Count: {} \n", _renderScene._forwardPass.batches[o].count);
+					out.print("	OG Count: {} \n", _renderScene._forwardPass.batches[o / MAX_MESH_LODS].count);
 					//instancing draw object count
 					out.print("	Visible Count: {} \n", objects[o].command.instanceCount);
 					out.print("	First: {} \n", objects[o].command.firstInstance);
@@ -293,17 +406,22 @@ void VulkanEngine::draw()
 			}
 		}
 
-		vmaUnmapMemory(_allocator, get_current_frame().debugOutputBuffer._allocation);
+		if (data)
+		{
+			vmaUnmapMemory(_allocator, get_current_frame().debugOutputBuffer._allocation);
+			//the gpu is done with this slot, drop the buffer once no more dumps are asked for
+			if (!CVAR_OutputIndirectToFile.Get())
+			{
+				vmaDestroyBuffer(_allocator, get_current_frame().debugOutputBuffer._buffer, get_current_frame().debugOutputBuffer._allocation);
+				get_current_frame().debugOutputBuffer = {};
+			}
+		}
 		
 		get_current_frame().debugDataNames.clear();
 		get_current_frame().debugDataOffsets.clear();
 
 		get_current_frame().debugDataNames.push_back("");
 		get_current_frame().debugDataOffsets.push_back(0);
-
-		//clear previous frame souce flush memory
-		get_current_frame()._frameDeletionQueue.flush();
-		get_current_frame().dynamicDescriptorAllocator->reset_pools();
 	}
 
 	//clear previous frame souce flush memory
@@ -314,6 +432,12 @@ void VulkanEngine::draw()
 	//we can safely reset the command buffer to begin recording again.
 	VK_CHECK(vkResetCommandBuffer(get_current_frame()._mainCommandBuffer, 0));
 	uint32_t swapchainImageIndex;
+	if (_headless)
+	{
+		//one offscreen image per frame slot, it is free once the slot is
+		swapchainImageIndex = _frameIndex;
+	}
+	else
 	{
 		ZoneScopedN("Aquire Image");
 		//request image and index from the swapchain
@@ -325,10 +449,28 @@ void VulkanEngine::draw()
 	//naming it cmd for shorter writing
 	VkCommandBuffer cmd = get_current_frame()._mainCommandBuffer;
 
+	//async compute submits the uploads and the shadow pass first, then the forward culls on the compute queue
+	//cmd only keeps the forward pass. without it everything goes into cmd
+	VkCommandBuffer prepareCmd = cmd;
+	VkCommandBuffer shadowCmd = cmd;
+	VkCommandBuffer cullCmd = cmd;
+	if (_asyncCompute)
+	{
+		prepareCmd = get_current_frame()._prepareCommandBuffer;
+		shadowCmd = get_current_frame()._shadowCommandBuffer;
+		cullCmd = get_current_frame()._computeCommandBuffer;
+	}
+
 	//begin the command buffer recording. We will use this command buffer exactly once, so we want to let vulkan know that
 	VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+	if (_asyncCompute)
+	{
+		VK_CHECK(vkBeginCommandBuffer(prepareCmd, &cmdBeginInfo));
+		VK_CHECK(vkBeginCommandBuffer(shadowCmd, &cmdBeginInfo));
+		VK_CHECK(vkBeginCommandBuffer(cullCmd, &cmdBeginInfo));
+	}
 
 	//make a clear-color from frame number. This will flash with a 120 frame period.
 	VkClearValue clearValue;
@@ -336,7 +478,21 @@ void VulkanEngine::draw()
 	clearValue.color = { { 0.1f, 0.1f, 0.1f, 1.0f } };
 	
 	//get timestamp and state from query pool
-	_profiler->grab_queries(cmd);
+	_profiler->grab_queries(prepareCmd);
+	read_pass_statistics();
+
+	//first and last command of the frame on the graphics queue, the gap to the last frame is the gpu wait
+	vkCmdResetQueryPool(prepareCmd, get_current_frame()._timestampPool, 0, 2);
+	vkCmdWriteTimestamp(prepareCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, get_current_frame()._timestampPool, 0);
+
+	//take over what the upload queue finished streaming, the submits wait for its timeline value
+	vkutil::UploadQueue::Acquire graphicsUploads = _uploadQueue.acquire(prepareCmd, _graphicsQueueFamily);
+	vkutil::UploadQueue::Acquire computeUploads;
+	if (_asyncCompute)
+	{
+		computeUploads = _uploadQueue.acquire(cullCmd, _computeQueueFamily);
+	}
+	_uploadQueue.retire();
 
 	{
 
@@ -348,20 +504,34 @@ void VulkanEngine::draw()
 
 		vkutil::VulkanScopeTimer timer(cmd, _profiler, "All Frame");
 
+		//the pyramid of the last frame depth has to be there before the forward culls
+		if (_asyncCompute && _depthReleased)
 		{
-			vkutil::VulkanScopeTimer timer2(cmd, _profiler, "Ready Frame");
+			acquire_depth(cullCmd);
+			reduce_depth(cullCmd);
+		}
+
+		{
+			vkutil::VulkanScopeTimer timer2(prepareCmd, _profiler, "Ready Frame");
+			vkutil::CpuScopeTimer cpuTimer2(_profiler, "Ready Frame");
 			// ready for scene objects and pass copy to GPU using upload pipeline
 			// reflesh indirect object source array and update pass indirect indices array 
-			ready_mesh_draw(cmd);
+			ready_mesh_draw(prepareCmd);
+			begin_cull_readback();
 
 			
 			//copy clear dirty objects array to draw indirect objects array
 			//set and binding barriers
-			ready_cull_data(_renderScene._forwardPass, cmd);
-			ready_cull_data(_renderScene._transparentForwardPass, cmd);
-			ready_cull_data(_renderScene._shadowPass, cmd);
+			ready_cull_data(_renderScene._forwardPass, cullCmd);
+			ready_cull_data(_renderScene._transparentForwardPass, cullCmd);
+			if (_asyncCompute)
+			{
+				vkCmdPipelineBarrier(cullCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, cullReadyBarriers.size(), cullReadyBarriers.data(), 0, nullptr);
+				cullReadyBarriers.clear();
+			}
+			ready_cull_data(_renderScene._shadowPass, shadowCmd);
 
-			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, cullReadyBarriers.size(), cullReadyBarriers.data(), 0, nullptr);
+			vkCmdPipelineBarrier(shadowCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, cullReadyBarriers.size(), cullReadyBarriers.data(), 0, nullptr);
 		}
 
 		//Before execute pass rendering, execute cull compute pipeline, cull unuseful data
@@ -372,9 +542,26 @@ void VulkanEngine::draw()
 		forwardCull.occlusionCull = true;
 		forwardCull.drawDist = CVAR_DrawDistance.Get();
 		forwardCull.aabb = false;
+		forwardCull.lod = true;
+		forwardCull.phase = CullPhase::Single;
+
+		//the meshlet path culls against the last frame pyramid only
+		//so does async compute, the pyramid is built on the compute queue one frame later
+		bool twoPhase = CVAR_TwoPhaseOcclusion.Get() && forwardCull.occlusionCull && !_renderScene._forwardPass.useMeshlets && !_asyncCompute;
+		if (twoPhase)
 		{
+			//transparent objects are culled in the late phase only
+			forwardCull.phase = CullPhase::Early;
 			execute_compute_cull(cmd, _renderScene._forwardPass, forwardCull);
-			execute_compute_cull(cmd, _renderScene._transparentForwardPass, forwardCull);
+		}
+		else {
+			execute_compute_cull(cullCmd, _renderScene._forwardPass, forwardCull);
+			execute_compute_cull(cullCmd, _renderScene._transparentForwardPass, forwardCull);
+		}
+
+		if (_asyncCompute)
+		{
+			release_cull_results(cullCmd, cmd);
 		}
 
 		glm::vec3 extent = _mainLight.shadowExtent * 10.f;
@@ -388,6 +575,9 @@ void VulkanEngine::draw()
 		shadowCull.occlusionCull = false;
 		shadowCull.drawDist = 9999999;
 		shadowCull.aabb = true;
+		//the shadow pass has no screen size to pick a lod from
+		shadowCull.lod = false;
+		shadowCull.phase = CullPhase::Single;
 
 		glm::vec3 aabbcenter = _mainLight.lightPosition;
 		glm::vec3 aabbextent = _mainLight.shadowExtent * 1.5f;
@@ -395,81 +585,385 @@ void VulkanEngine::draw()
 		shadowCull.aabbmin = aabbcenter - aabbextent;
 
 		{
-			vkutil::VulkanScopeTimer timer2(cmd, _profiler, "Shadow Cull");
+			vkutil::VulkanScopeTimer timer2(shadowCmd, _profiler, "Shadow Cull");
 
-			if (*CVarSystem::Get()->GetIntCVar("gpu.shadowcast"))
+			//the shadow cull has no occlusion test, it stays on the graphics queue in front of the shadow pass
+			if (CVAR_ShadowcastHandle.Get())
 			{
-				execute_compute_cull(cmd, _renderScene._shadowPass, shadowCull);
+				execute_compute_cull(shadowCmd, _renderScene._shadowPass, shadowCull);
 			}
 		}
 
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, postCullBarriers.size(), postCullBarriers.data(), 0, nullptr);
+		//the commands are read at the draw indirect stage, the instance ids by the vertex shader
+		vkCmdPipelineBarrier(shadowCmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, postCullBarriers.size(), postCullBarriers.data(), 0, nullptr);
 
+		_recordParallel = _supportsParallelRecord && CVAR_ParallelRecord.Get();
+		if (_recordParallel)
+		{
+			vkutil::CpuScopeTimer recordTimer(_profiler, "Record Parallel");
+			record_passes_parallel(twoPhase);
+		}
 
 		//execute pass rendering
-		shadow_pass(cmd);
-		
-		forward_pass(clearValue, cmd);
+		shadow_pass(shadowCmd);
+		if (CVAR_ShadowcastHandle.Get())
+		{
+			readback_cull_results(shadowCmd, _renderScene._shadowPass, true);
+		}
 		
-		reduce_depth(cmd);
+		if (twoPhase)
+		{
+			forward_pass(clearValue, cmd, CullPhase::Early);
+			//the late cull resets the commands, the early ones are copied first
+			readback_cull_results(cmd, _renderScene._forwardPass, true);
+
+			reduce_depth(cmd);
+
+			forwardCull.phase = CullPhase::Late;
+			execute_late_cull(cmd, forwardCull);
+
+			forward_pass(clearValue, cmd, CullPhase::Late);
+			readback_cull_results(cmd, _renderScene._forwardPass, false);
+			readback_cull_results(cmd, _renderScene._transparentForwardPass, true);
+		}
+		else {
+			forward_pass(clearValue, cmd, CullPhase::Single);
+			readback_cull_results(cmd, _renderScene._forwardPass, true);
+			readback_cull_results(cmd, _renderScene._transparentForwardPass, true);
+
+			//async compute reduces it at the start of the next frame
+			if (_asyncCompute)
+			{
+				release_depth(cmd);
+			}
+			else
+			{
+				reduce_depth(cmd);
+			}
+		}
 
 		copy_render_to_swapchain(swapchainImageIndex, cmd);
 	}
 
 	TracyVkCollect(_graphicsQueueContext, get_current_frame()._mainCommandBuffer);
+	if (_asyncCompute)
+	{
+		TracyVkCollect(_computeQueueContext, cullCmd);
+	}
+
+	{
+		vkutil::DescriptorSetCache::Stats setStats = _descriptorSetCache->take_stats();
+		stats.descriptorWrites = static_cast<int>(setStats.writes + get_current_frame().dynamicDescriptorAllocator->writeCount);
+		stats.descriptorSetsReused = static_cast<int>(setStats.hits);
+		stats.descriptorSetsCached = static_cast<int>(_descriptorSetCache->size());
+	}
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, get_current_frame()._timestampPool, 1);
 
 	//finalize the command buffer (we can no longer add commands, but it can now be executed)
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
+	if (_asyncCompute)
+	{
+		ZoneScopedN("Async Cull Submit");
+
+		VK_CHECK(vkEndCommandBuffer(prepareCmd));
+		VK_CHECK(vkEndCommandBuffer(shadowCmd));
+		VK_CHECK(vkEndCommandBuffer(cullCmd));
+
+		//the uploads release the culls, the shadow pass runs next to them
+		SubmitSemaphores prepareWaits;
+		prepareWaits.add(_uploadQueue.timeline(), graphicsUploads.stages, graphicsUploads.value);
+
+		VkSubmitInfo prepareSubmits[] = { vkinit::submit_info(&prepareCmd), vkinit::submit_info(&shadowCmd) };
+		prepareWaits.apply(prepareSubmits[0]);
+		prepareSubmits[0].signalSemaphoreCount = 1;
+		prepareSubmits[0].pSignalSemaphores = &get_current_frame()._cullReadySemaphore;
+
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 2, prepareSubmits, VK_NULL_HANDLE));
+
+		//the depth of the last frame is handed over by its forward pass
+		SubmitSemaphores cullWaits;
+		cullWaits.add(get_current_frame()._cullReadySemaphore, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		if (_depthReleased)
+		{
+			cullWaits.add(get_last_frame()._depthReleaseSemaphore, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		}
+		cullWaits.add(_uploadQueue.timeline(), computeUploads.stages, computeUploads.value);
+
+		VkSubmitInfo cullSubmit = vkinit::submit_info(&cullCmd);
+		cullWaits.apply(cullSubmit);
+		cullSubmit.signalSemaphoreCount = 1;
+		cullSubmit.pSignalSemaphores = &get_current_frame()._cullDoneSemaphore;
+
+		VK_CHECK(vkQueueSubmit(_computeQueue, 1, &cullSubmit, VK_NULL_HANDLE));
+	}
+
 	//prepare the submission to the queue. 
 	//we want to wait on the _presentSemaphore, as that semaphore is signaled when the swapchain is ready
 	//we will signal the _renderSemaphore, to signal that rendering has finished
+	//and the next value of the frame timeline, the frame is retired once it is reached
 
 	VkSubmitInfo submit = vkinit::submit_info(&cmd);
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-	submit.pWaitDstStageMask = &waitStage;
+	//async compute: the forward pass also waits for the culls, and hands the depth over to the next frame culls
+	//without it the uploads are acquired in cmd, so it waits for them too
+	SubmitSemaphores semaphores;
+	if (!_headless)
+	{
+		semaphores.add(get_current_frame()._presentSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		semaphores.signal(get_current_frame()._renderSemaphore);
+	}
+	if (_asyncCompute)
+	{
+		semaphores.add(get_current_frame()._cullDoneSemaphore, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+	}
+	else
+	{
+		semaphores.add(_uploadQueue.timeline(), graphicsUploads.stages, graphicsUploads.value);
+	}
 
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &get_current_frame()._presentSemaphore;
+	get_current_frame()._timelineValue = ++_frameTimelineValue;
+	get_current_frame()._retired = false;
+	semaphores.signal(_frameTimeline, get_current_frame()._timelineValue);
+	if (_asyncCompute)
+	{
+		semaphores.signal(get_current_frame()._depthReleaseSemaphore);
+	}
 
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &get_current_frame()._renderSemaphore;
+	semaphores.apply(submit);
 	{
 		ZoneScopedN("Queue Submit");
+		vkutil::CpuScopeTimer submitTimer(_profiler, "Queue Submit");
 		//submit command buffer to the queue and execute it.
-		// _renderFence will now block until the graphic commands finish execution
-		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, get_current_frame()._renderFence));
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, VK_NULL_HANDLE));
 
+		_depthReleased = _asyncCompute;
 	}
 	//prepare present
 	// this will put the image we just rendered to into the visible window.
 	// we want to wait on the _renderSemaphore for that, 
 	// as its necessary that drawing commands have finished before the image is displayed to the user
-	VkPresentInfoKHR presentInfo = vkinit::present_info();
+	if (!_headless)
+	{
+		VkPresentInfoKHR presentInfo = vkinit::present_info();
 
-	presentInfo.pSwapchains = &_swapchain;
-	presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &_swapchain;
+		presentInfo.swapchainCount = 1;
 
-	presentInfo.pWaitSemaphores = &get_current_frame()._renderSemaphore;
-	presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &get_current_frame()._renderSemaphore;
+		presentInfo.waitSemaphoreCount = 1;
 
-	presentInfo.pImageIndices = &swapchainImageIndex;
+		presentInfo.pImageIndices = &swapchainImageIndex;
 
-	{
 		ZoneScopedN("Queue Present");
 		VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
-
 	}
 	//increase the number of frames drawn
 	_frameNumber++;
+	advance_frame();
+}
+
+void VulkanEngine::begin_frame()
+{
+	ZoneScopedN("Frame Wait");
+	vkutil::CpuScopeTimer cpuTimer(_profiler, "Frame Wait");
+
+	FrameData& frame = get_current_frame();
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		//Timeout of 1 second
+		VkSemaphoreWaitInfo waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &_frameTimeline;
+		waitInfo.pValues = &frame._timelineValue;
+		VK_CHECK(vkWaitSemaphores(_device, &waitInfo, 1000000000));
+
+		auto end = std::chrono::high_resolution_clock::now();
+		stats.cpuWait = std::chrono::duration<float, std::milli>(end - start).count();
+	}
+
+	_memory.update(static_cast<uint32_t>(_frameTimelineValue));
+
+	if (alloctrack::enabled())
+	{
+		alloctrack::Counters heap = alloctrack::heap();
+		alloctrack::Counters device = alloctrack::device();
+		stats.heapAllocations = static_cast<int>((heap - _heapCounters).allocations);
+		stats.heapBytes = (heap - _heapCounters).bytes;
+		stats.deviceAllocations = static_cast<int>((device - _deviceCounters).allocations);
+		stats.deviceBytes = (device - _deviceCounters).bytes;
+		_heapCounters = heap;
+		_deviceCounters = device;
+	}
+
+	//retire in submission order, every frame measures the gpu idle time against the one before
+	uint64_t done = 0;
+	VK_CHECK(vkGetSemaphoreCounterValue(_device, _frameTimeline, &done));
+
+	std::vector<FrameData*> finished;
+	for (FrameData& other : _frames)
+	{
+		if (!other._retired && other._timelineValue <= done)
+		{
+			finished.push_back(&other);
+		}
+	}
+	std::sort(finished.begin(), finished.end(), [](FrameData* a, FrameData* b) {
+		return a->_timelineValue < b->_timelineValue;
+	});
+
+	for (FrameData* other : finished)
+	{
+		retire_frame(*other);
+	}
+}
+
+void VulkanEngine::retire_frame(FrameData& frame)
+{
+	uint64_t timestamps[2];
+	if (vkGetQueryPoolResults(_device, frame._timestampPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	{
+		if (_lastFrameEnd != 0)
+		{
+			uint64_t idle = timestamps[0] > _lastFrameEnd ? timestamps[0] - _lastFrameEnd : 0;
+			stats.gpuWait = static_cast<float>((double(idle) * _gpuProperties.limits.timestampPeriod) / 1000000.0);
+		}
+		_lastFrameEnd = timestamps[1];
+	}
+
+	//instances the cull left in the commands of the passes
+	if (!frame._cullReadbacks.empty())
+	{
+		for (FrameData::CullReadback& readback : frame._cullReadbacks)
+		{
+			PassStats& passStats = stats.passes[readback.pass];
+			passStats.instances = 0;
+			passStats.visibleInstances = 0;
+			passStats.indirectCommands = 0;
+			passStats.indirectDraws = 0;
+		}
+
+		vmaInvalidateAllocation(_allocator, frame._cullReadbackBuffer._allocation, 0, VK_WHOLE_SIZE);
+		void* data;
+		vmaMapMemory(_allocator, frame._cullReadbackBuffer._allocation, &data);
+		for (FrameData::CullReadback& readback : frame._cullReadbacks)
+		{
+			PassStats& passStats = stats.passes[readback.pass];
+			GPUIndirectObject* objects = reinterpret_cast<GPUIndirectObject*>(static_cast<uint8_t*>(data) + readback.offset);
+			for (uint32_t i = 0; i < readback.commandCount; i++)
+			{
+				passStats.visibleInstances += objects[i].command.instanceCount;
+				passStats.indirectDraws += objects[i].command.instanceCount > 0 ? 1 : 0;
+			}
+			passStats.instances += readback.instances;
+			passStats.indirectCommands += readback.commandCount;
+		}
+		vmaUnmapMemory(_allocator, frame._cullReadbackBuffer._allocation);
+		frame._cullReadbacks.clear();
+	}
+
+	//reset push buffer (dynamic data) wait re-fill data
+	frame.dynamicData.reset();
+	//clear previous frame souce flush memory
+	frame._frameDeletionQueue.flush();
+	frame.dynamicDescriptorAllocator->reset_pools();
+
+	frame._retired = true;
 }
 
+void VulkanEngine::begin_cull_readback()
+{
+	FrameData& frame = get_current_frame();
+	frame._cullReadbacks.clear();
+
+	//the forward pass is copied twice with two phase occlusion
+	size_t commands = (_renderScene._forwardPass.batches.size() * 2 + _renderScene._transparentForwardPass.batches.size() + _renderScene._shadowPass.batches.size()) * MAX_MESH_LODS;
+	size_t size = std::max(commands, size_t(1)) * sizeof(GPUIndirectObject);
+	if (frame._cullReadbackBuffer._size < size)
+	{
+		vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::FrameData);
+		reallocate_buffer(frame._cullReadbackBuffer, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+	}
+}
 
-void VulkanEngine::forward_pass(VkClearValue clearValue, VkCommandBuffer cmd)
+void VulkanEngine::readback_cull_results(VkCommandBuffer cmd, RenderScene::MeshPass& pass, bool countInstances)
 {
-	vkutil::VulkanScopeTimer timer(cmd, _profiler, "Forward Pass");
-	vkutil::VulkanPipelineStatRecorder timer2(cmd, _profiler, "Forward Primitives");
+	//meshlet passes cull into one command per meshlet instead
+	if (pass.batches.size() == 0 || pass.useMeshlets) return;
+
+	FrameData& frame = get_current_frame();
+	uint32_t commandCount = static_cast<uint32_t>(pass.batches.size() * MAX_MESH_LODS);
+	VkDeviceSize offset = 0;
+	if (!frame._cullReadbacks.empty())
+	{
+		offset = frame._cullReadbacks.back().offset + frame._cullReadbacks.back().commandCount * sizeof(GPUIndirectObject);
+	}
+	if (offset + commandCount * sizeof(GPUIndirectObject) > frame._cullReadbackBuffer._size) return;
+
+	//the cull wrote the commands for the indirect read only
+	VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.drawIndirectBuffer._buffer, _graphicsQueueFamily);
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	VkBufferCopy copy;
+	copy.srcOffset = 0;
+	copy.dstOffset = offset;
+	copy.size = commandCount * sizeof(GPUIndirectObject);
+	vkCmdCopyBuffer(cmd, pass.drawIndirectBuffer._buffer, frame._cullReadbackBuffer._buffer, 1, &copy);
+
+	//the next reset of the commands waits for the copy
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	FrameData::CullReadback readback;
+	readback.pass = pass.type;
+	readback.offset = offset;
+	readback.commandCount = commandCount;
+	readback.instances = countInstances ? static_cast<uint32_t>(pass.flat_batches.size()) : 0;
+	frame._cullReadbacks.push_back(readback);
+}
+
+void VulkanEngine::read_pass_statistics()
+{
+	auto read = [&](MeshpassType type, std::initializer_list<const char*> names) {
+		PassStats& passStats = stats.passes[type];
+		passStats.inputPrimitives = 0;
+		passStats.vertexInvocations = 0;
+		passStats.clippingPrimitives = 0;
+		passStats.fragmentInvocations = 0;
+		for (const char* name : names)
+		{
+			auto it = _profiler->pipelineStats.find(name);
+			if (it == _profiler->pipelineStats.end()) continue;
+
+			passStats.inputPrimitives += it->second.inputPrimitives;
+			passStats.vertexInvocations += it->second.vertexInvocations;
+			passStats.clippingPrimitives += it->second.clippingPrimitives;
+			passStats.fragmentInvocations += it->second.fragmentInvocations;
+		}
+	};
+	read(MeshpassType::Forward, { "Forward Pass", "Forward Pass Late" });
+	read(MeshpassType::Transparency, { "Transparent Pass" });
+	read(MeshpassType::DirectionalShadow, { "Shadow Pass" });
+}
+
+void VulkanEngine::advance_frame()
+{
+	//a smaller count leaves frames in the unused slots, begin_frame still retires them
+	_framesInFlight = std::clamp(CVAR_FramesInFlight.Get(), 1, static_cast<int>(MAX_FRAMES_IN_FLIGHT));
+
+	_lastFrameIndex = _frameIndex;
+	_frameIndex = (_frameIndex + 1) % _framesInFlight;
+}
+
+
+void VulkanEngine::forward_pass(VkClearValue clearValue, VkCommandBuffer cmd, CullPhase phase)
+{
+	bool latePhase = phase == CullPhase::Late;
+	vkutil::VulkanScopeTimer timer(cmd, _profiler, latePhase ? "Forward Pass Late" : "Forward Pass");
+	vkutil::CpuScopeTimer cpuTimer(_profiler, latePhase ? "Forward Pass Late" : "Forward Pass");
 	//clear depth at 0
 	VkClearValue depthClear;
 	depthClear.depthStencil.depth = 0.f;
@@ -477,7 +971,8 @@ void VulkanEngine::forward_pass(VkClearValue clearValue, VkCommandBuffer cmd)
 	//start the main renderpass. 
 	//We will use the clear color from above, and the framebuffer of the index the swapchain gave us
 	//! forwardFrameBuffer include two imageview !
-	VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(_renderPass, _windowExtent, _forwardFramebuffer/*_framebuffers[swapchainImageIndex]*/);
+	//the late pass loads the early pass targets, clear values are ignored
+	VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(latePhase ? _forwardLatePass : _renderPass, _windowExtent, _forwardFramebuffer/*_framebuffers[swapchainImageIndex]*/);
 
 	//connect clear values
 	rpInfo.clearValueCount = 2;
@@ -485,7 +980,32 @@ void VulkanEngine::forward_pass(VkClearValue clearValue, VkCommandBuffer cmd)
 	VkClearValue clearValues[] = { clearValue, depthClear };
 
 	rpInfo.pClearValues = &clearValues[0];
-	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(cmd, &rpInfo, _recordParallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+	if (_recordParallel)
+	{
+		//the draws and imgui were recorded on the workers, the subpass only executes them
+		std::vector<VkCommandBuffer>& secondaries = phase == CullPhase::Early ? _forwardEarlySecondaries : _forwardSecondaries;
+		if (!secondaries.empty())
+		{
+			vkutil::VulkanPipelineStatRecorder passStats(cmd, _profiler, latePhase ? "Forward Pass Late" : "Forward Pass");
+			vkCmdExecuteCommands(cmd, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+		}
+		if (phase != CullPhase::Early)
+		{
+			if (!_transparentSecondaries.empty())
+			{
+				vkutil::VulkanPipelineStatRecorder passStats(cmd, _profiler, "Transparent Pass");
+				vkCmdExecuteCommands(cmd, static_cast<uint32_t>(_transparentSecondaries.size()), _transparentSecondaries.data());
+			}
+			if (_imguiSecondary != VK_NULL_HANDLE)
+			{
+				vkCmdExecuteCommands(cmd, 1, &_imguiSecondary);
+			}
+		}
+		vkCmdEndRenderPass(cmd);
+		return;
+	}
 
 	VkViewport viewport;
 	viewport.x = 0.0f;
@@ -512,11 +1032,27 @@ void VulkanEngine::forward_pass(VkClearValue clearValue, VkCommandBuffer cmd)
 	{
 		TracyVkZone(_graphicsQueueContext, get_current_frame()._mainCommandBuffer, "Forward Pass");
 		//draw_objects_forward(cmd, _renderScene._transparentForwardPass);
-		draw_objects_forward(cmd, _renderScene._forwardPass);
-		draw_objects_forward(cmd, _renderScene._transparentForwardPass);
+		{
+			vkutil::VulkanPipelineStatRecorder passStats(cmd, _profiler, latePhase ? "Forward Pass Late" : "Forward Pass");
+			//the late phase adds its draws, its objects were counted in the early phase
+			int earlyObjects = stats.objects;
+			draw_objects_forward(cmd, _renderScene._forwardPass);
+			if (latePhase)
+			{
+				stats.objects = earlyObjects;
+			}
+		}
+
+		//transparent objects and ui go on top of everything, so they wait for the late phase
+		if (phase != CullPhase::Early)
+		{
+			vkutil::VulkanPipelineStatRecorder passStats(cmd, _profiler, "Transparent Pass");
+			draw_objects_forward(cmd, _renderScene._transparentForwardPass);
+		}
 	}
 
 	//imgui draw meau UI
+	if (phase != CullPhase::Early && !_headless)
 	{
 		TracyVkZone(_graphicsQueueContext, get_current_frame()._mainCommandBuffer, "Imgui Draw");
 		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
@@ -532,9 +1068,10 @@ void VulkanEngine::shadow_pass(VkCommandBuffer cmd)
 	
 
 	vkutil::VulkanScopeTimer timer(cmd, _profiler, "Shadow Pass");
-	vkutil::VulkanPipelineStatRecorder timer2(cmd, _profiler, "Shadow Primitives");
+	vkutil::CpuScopeTimer cpuTimer(_profiler, "Shadow Pass");
+	vkutil::VulkanPipelineStatRecorder timer2(cmd, _profiler, "Shadow Pass");
 	if (CVAR_FreezeShadows.Get()) return;
-	if (!*CVarSystem::Get()->GetIntCVar("gpu.shadowcast"))
+	if (!CVAR_ShadowcastHandle.Get())
 	{
 		return;
 	}
@@ -550,7 +1087,17 @@ void VulkanEngine::shadow_pass(VkCommandBuffer cmd)
 	VkClearValue clearValues[] = { depthClear };
 
 	rpInfo.pClearValues = &clearValues[0];
-	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(cmd, &rpInfo, _recordParallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+	if (_recordParallel)
+	{
+		if (!_shadowSecondaries.empty())
+		{
+			vkCmdExecuteCommands(cmd, static_cast<uint32_t>(_shadowSecondaries.size()), _shadowSecondaries.data());
+		}
+		vkCmdEndRenderPass(cmd);
+		return;
+	}
 
 	VkViewport viewport;
 	viewport.x = 0.0f;
@@ -576,7 +1123,7 @@ void VulkanEngine::shadow_pass(VkCommandBuffer cmd)
 
 	if(_renderScene._shadowPass.batches.size() > 0)
 	{
-		TracyVkZone(_graphicsQueueContext, get_current_frame()._mainCommandBuffer, "Shadow  Pass");
+		TracyVkZone(_graphicsQueueContext, cmd, "Shadow  Pass");
 		draw_objects_shadow(cmd, _renderScene._shadowPass);
 	}
 
@@ -620,7 +1167,7 @@ void VulkanEngine::copy_render_to_swapchain(uint32_t swapchainImageIndex, VkComm
 	sourceImage.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 	VkDescriptorSet blitSet;
-	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
 		.bind_image(0, &sourceImage, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 		.build(blitSet);
 
@@ -644,6 +1191,10 @@ void VulkanEngine::run()
 	
 	start = std::chrono::system_clock::now();
 	end = std::chrono::system_clock::now();
+
+	//camera keys of every frame, replayed later by run_headless
+	CameraPath recordedPath;
+
 	//main loop
 	while (!bQuit)
 	{
@@ -728,10 +1279,18 @@ void VulkanEngine::run()
 
 				ImGui::Text("Frametimes: %f ms",stats.frametime);
 				ImGui::Text("FPS: %f", 1.0f / (stats.frametime / 1000.0f));
+				ImGui::Text("CPU wait: %f ms GPU wait: %f ms", stats.cpuWait, stats.gpuWait);
 				ImGui::Text("Objects: %d", stats.objects);
 				ImGui::Text("Drawcalls: %d", stats.drawcalls);
 				ImGui::Text("Batches: %d", stats.draws);
 				ImGui::Text("Triangles: %d", stats.triangles);
+				ImGui::Text("Descriptor writes: %d", stats.descriptorWrites);
+				ImGui::Text("Descriptor sets reused: %d (%d cached)", stats.descriptorSetsReused, stats.descriptorSetsCached);
+				if (alloctrack::enabled())
+				{
+					ImGui::Text("Heap allocations: %d (%llu KB)", stats.heapAllocations, (unsigned long long)(stats.heapBytes / 1024));
+					ImGui::Text("Device allocations: %d (%llu KB)", stats.deviceAllocations, (unsigned long long)(stats.deviceBytes / 1024));
+				}
 
 				CVAR_OutputIndirectToFile.Set(false);
 				if (ImGui::Button("Output Indirect"))
@@ -746,49 +1305,134 @@ void VulkanEngine::run()
 				{
 					ImGui::Text("TIME %s %f ms", k.c_str(), v);
 				}
-				for (auto& [k, v] : _profiler->stats)
+				ImGui::Separator();
+				auto passStatsText = [&](const char* name, MeshpassType type) {
+					PassStats& passStats = stats.passes[type];
+					ImGui::Text("%s: %llu primitives, %llu vertex and %llu fragment invocations", name, (unsigned long long)passStats.clippingPrimitives,
+						(unsigned long long)passStats.vertexInvocations, (unsigned long long)passStats.fragmentInvocations);
+					ImGui::Text("    %u of %u instances visible, %u culled, %u of %u indirect commands drawn", passStats.visibleInstances, passStats.instances,
+						passStats.instances - std::min(passStats.visibleInstances, passStats.instances), passStats.indirectDraws, passStats.indirectCommands);
+				};
+				passStatsText("Forward", MeshpassType::Forward);
+				passStatsText("Transparent", MeshpassType::Transparency);
+				passStatsText("Shadow", MeshpassType::DirectionalShadow);
+				for (auto& [k, v] : _profiler->cpuAllocations)
 				{
-					ImGui::Text("STAT %s %d", k.c_str(), v);
+					ImGui::Text("ALLOC %.*s %llu (%llu KB)", static_cast<int>(k.size()), k.data(), (unsigned long long)v.allocations, (unsigned long long)(v.bytes / 1024));
 				}
 
+				ImGui::Separator();
+				_memory.draw_imgui();
 
 				ImGui::End();
 			}
 
+			update_objects();
 			{
-				ZoneScopedNC("Flag Objects", tracy::Color::Blue);
-				//test flagging some objects for changes
-
-				int N_changes = 1000;
-				for (int i = 0; i < N_changes; i++)
-				{
-					int rng = rand() % _renderScene.renderables.size();
-
-					Handle<RenderObject> h;
-					h.handle = rng;
-					_renderScene.update_object(h);
-				}
-				_camera.bLocked = CVAR_CamLock.Get();
 				//change camera position
 				_camera.update_camera(stats.frametime);
 				// direction light position
 				_mainLight.lightPosition = _camera.position;
 			}
+			if (!_recordPathFile.empty())
+			{
+				recordedPath.keys.push_back({ _camera.position, _camera.pitch, _camera.yaw });
+			}
 
 			draw();
+			_profiler->end_cpu_frame();
+		}
+	}
+
+	if (!_recordPathFile.empty())
+	{
+		if (recordedPath.save(_recordPathFile))
+		{
+			LOG_SUCCESS("Saved {} camera keys to {}", recordedPath.keys.size(), _recordPathFile);
+		}
+		else
+		{
+			LOG_ERROR("Failed to save the camera path to {}", _recordPathFile);
 		}
 	}
 }
 
+void VulkanEngine::run_headless(std::function<void(int frame)> onFrame)
+{
+	LOG_INFO("Starting Headless Loop, {} frames", _headlessFrames);
+
+	CameraPath path;
+	if (_cameraPathFile.empty() || !path.load(_cameraPathFile))
+	{
+		path = CameraPath::orbit(_camera.position, 300.f);
+	}
+
+	std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+	double totalTime = 0;
+
+	for (int frame = 0; frame < _headlessFrames; frame++)
+	{
+		ZoneScopedN("Main Loop");
+		start = std::chrono::high_resolution_clock::now();
+
+		//same cpu work as the window loop, the camera follows the path instead of the input
+		update_objects();
+
+		path.apply(_camera, _headlessFrames > 1 ? float(frame) / float(_headlessFrames - 1) : 0.f);
+		_mainLight.lightPosition = _camera.position;
+
+		draw();
+
+		end = std::chrono::high_resolution_clock::now();
+		stats.frametime = std::chrono::duration<float, std::milli>(end - start).count();
+		totalTime += stats.frametime;
+		_profiler->end_cpu_frame();
+
+		if (onFrame)
+		{
+			onFrame(frame);
+		}
+	}
+
+	vkDeviceWaitIdle(_device);
+	LOG_SUCCESS("Headless run done, {} frames, {:.3f} ms average", _headlessFrames, _headlessFrames > 0 ? totalTime / _headlessFrames : 0.0);
+}
+
+void VulkanEngine::update_objects()
+{
+	ZoneScopedNC("Flag Objects", tracy::Color::Blue);
+	vkutil::CpuScopeTimer cpuTimer(_profiler, "Update Objects");
+	//test flagging some objects for changes
+
+	int N_changes = 1000;
+	for (int i = 0; i < N_changes; i++)
+	{
+		int rng = rand() % _renderScene.renderables.size();
+
+		Handle<RenderObject> h;
+		h.handle = rng;
+		_renderScene.update_object(h);
+	}
+}
+
 FrameData& VulkanEngine::get_current_frame()
 {
-	return _frames[_frameNumber % FRAME_OVERLAP];
+	return _frames[_frameIndex];
 }
 
 
 FrameData& VulkanEngine::get_last_frame()
 {
-	return _frames[(_frameNumber - 1) % 2];
+	return _frames[_lastFrameIndex];
+}
+
+tracy::VkCtx* VulkanEngine::queue_context(VkCommandBuffer cmd)
+{
+	if (_asyncCompute && cmd == get_current_frame()._computeCommandBuffer)
+	{
+		return _computeQueueContext;
+	}
+	return _graphicsQueueContext;
 }
 
 
@@ -839,10 +1483,12 @@ void VulkanEngine::init_vulkan()
 	
 	vkb::InstanceBuilder builder;
 	//make the vulkan instance, with basic debug features
+	//headless instances skip the surface extensions, so they run on software drivers such as lavapipe
 	auto inst_ret = builder.set_app_name("Example Vulkan Application")
 		.require_api_version(1, 2, 0)
 		.request_validation_layers(bUseValidationLayers)
 		.use_default_debug_messenger()
+		.set_headless(_headless)
 		.build();
 
 
@@ -854,9 +1500,12 @@ void VulkanEngine::init_vulkan()
 	_instance = vkb_inst.instance;
 	_debug_messenger = vkb_inst.debug_messenger;
 	
-	SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
+	if (!_headless)
+	{
+		SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
 
-	LOG_SUCCESS("SDL Surface initialized");
+		LOG_SUCCESS("SDL Surface initialized");
+	}
 
 	//use vkbootstrap to select a gpu. 
 	//We want a gpu that can write to the SDL surface and supports vulkan 1.2
@@ -868,25 +1517,76 @@ void VulkanEngine::init_vulkan()
 	feats.drawIndirectFirstInstance = true;
 	feats.samplerAnisotropy = true;
 	selector.set_required_features(feats);
+	selector.set_minimum_version(1, 2);
+	if (!_headless)
+	{
+		selector.set_surface(_surface);
+	}
 
 	vkb::PhysicalDevice physicalDevice = selector
-		.set_minimum_version(1, 2)
-		.set_surface(_surface)
 		//.add_required_extension(VK_EXT_SAMPLER_FILTER_MINMAX_EXTENSION_NAME)
 		//.add_required_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)
+		.add_desired_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)
 		.select()
 		.value();
 
-	LOG_SUCCESS("GPU found");
+	//enabled by the selector when present
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, extensions.data());
+	bool memoryBudget = std::any_of(extensions.begin(), extensions.end(), [](const VkExtensionProperties& e) {
+		return strcmp(e.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+	});
+
+	LOG_SUCCESS("GPU found: {}", physicalDevice.properties.deviceName);
 
 	//create the final vulkan device
 
-	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
+	//vkCmdDrawIndexedIndirectCount is core in 1.2 but still behind the drawIndirectCount feature
+	VkPhysicalDeviceVulkan12Features supported12 = {};
+	supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
 
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &supported12;
+	vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &supportedFeatures);
 
-	
+	//secondary command buffers run inside the pipeline statistics queries of the passes
+	_supportsParallelRecord = supportedFeatures.features.inheritedQueries == VK_TRUE;
+	physicalDevice.features.inheritedQueries = supportedFeatures.features.inheritedQueries;
+
+	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
+
+	_supportsDrawIndirectCount = supported12.drawIndirectCount == VK_TRUE;
+
+	//bindless materials index a partially bound texture array with a per draw material index
+	_supportsBindless = supported12.descriptorIndexing
+		&& supported12.runtimeDescriptorArray
+		&& supported12.descriptorBindingPartiallyBound
+		&& supported12.shaderSampledImageArrayNonUniformIndexing
+		&& supported12.descriptorBindingSampledImageUpdateAfterBind;
+
+	VkPhysicalDeviceVulkan12Features features12 = {};
+	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features12.drawIndirectCount = supported12.drawIndirectCount;
+	//core in 1.2, the upload queue counts its submits with it
+	features12.timelineSemaphore = VK_TRUE;
+	if (_supportsBindless)
+	{
+		features12.descriptorIndexing = VK_TRUE;
+		features12.runtimeDescriptorArray = VK_TRUE;
+		features12.descriptorBindingPartiallyBound = VK_TRUE;
+		features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	}
+	deviceBuilder.add_pNext(&features12);
 
 	vkb::Device vkbDevice = deviceBuilder.build().value();
+
+	LOG_INFO("Draw indirect count {}", _supportsDrawIndirectCount ? "supported" : "not supported");
+	LOG_INFO("Bindless textures {}", _supportsBindless ? "supported" : "not supported");
+	LOG_INFO("Parallel command recording {}", _supportsParallelRecord ? "supported" : "not supported");
 	
 	// Get the VkDevice handle used in the rest of a vulkan application
 	_device = vkbDevice.device;
@@ -896,17 +1596,88 @@ void VulkanEngine::init_vulkan()
 	_graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	//a compute family without graphics, the culls recorded there run next to the shadow pass
+	//the profiler writes timestamps on it, so the family has to support them
+	auto computeQueue = vkbDevice.get_queue(vkb::QueueType::compute);
+	auto computeFamily = vkbDevice.get_queue_index(vkb::QueueType::compute);
+	if (CVAR_AsyncCompute.Get() && computeQueue.has_value() && computeFamily.has_value())
+	{
+		uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(_chosenGPU, &familyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(_chosenGPU, &familyCount, families.data());
+
+		if (families[computeFamily.value()].timestampValidBits > 0)
+		{
+			_asyncCompute = true;
+			_computeQueue = computeQueue.value();
+			_computeQueueFamily = computeFamily.value();
+		}
+	}
+	LOG_INFO("Async compute {}", _asyncCompute ? "enabled" : "disabled, culling on the graphics queue");
+
+	//uploads signal a timeline semaphore, the frames wait on it instead of a fence per upload
+	_transferQueue = _graphicsQueue;
+	_transferQueueFamily = _graphicsQueueFamily;
+	auto transferQueue = vkbDevice.get_queue(vkb::QueueType::transfer);
+	auto transferFamily = vkbDevice.get_queue_index(vkb::QueueType::transfer);
+	if (CVAR_TransferQueue.Get() && transferQueue.has_value() && transferFamily.has_value())
+	{
+		_transferQueue = transferQueue.value();
+		_transferQueueFamily = transferFamily.value();
+	}
+	LOG_INFO("Uploads on the {} queue", _transferQueueFamily != _graphicsQueueFamily ? "transfer" : "graphics");
+
 	//initialize the memory allocator
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = _chosenGPU;
 	allocatorInfo.device = _device;
 	allocatorInfo.instance = _instance;
+	allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_2;
+	if (memoryBudget)
+	{
+		allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
+
+	VmaDeviceMemoryCallbacks memoryCallbacks = {};
+	if (alloctrack::enabled())
+	{
+		alloctrack::fill_vma_callbacks(memoryCallbacks);
+		allocatorInfo.pDeviceMemoryCallbacks = &memoryCallbacks;
+	}
 	vmaCreateAllocator(&allocatorInfo, &_allocator);
 
+	_memory.init(_chosenGPU, _allocator, memoryBudget);
+
 
 	
 	vkGetPhysicalDeviceProperties(_chosenGPU, &_gpuProperties);
 
+	//the single pass depth pyramid reduces 2x2 blocks with subgroup quad operations
+	VkPhysicalDeviceSubgroupProperties subgroupProperties = {};
+	subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+	//update after bind limits for the bindless texture array
+	VkPhysicalDeviceVulkan12Properties properties12 = {};
+	properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+	subgroupProperties.pNext = &properties12;
+
+	VkPhysicalDeviceProperties2 gpuProperties2 = {};
+	gpuProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	gpuProperties2.pNext = &subgroupProperties;
+	vkGetPhysicalDeviceProperties2(_chosenGPU, &gpuProperties2);
+
+	//combined image samplers count against both the sampler and the sampled image limits
+	_maxBindlessTextures = std::min({
+		properties12.maxDescriptorSetUpdateAfterBindSampledImages, properties12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		properties12.maxDescriptorSetUpdateAfterBindSamplers, properties12.maxPerStageDescriptorUpdateAfterBindSamplers });
+
+	_supportsSinglePassReduce = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT)
+		&& (subgroupProperties.supportedOperations & VK_SUBGROUP_FEATURE_QUAD_BIT)
+		&& subgroupProperties.subgroupSize >= 4;
+
+	LOG_INFO("The gpu has a subgroup size of {}, single pass depth pyramid {}", subgroupProperties.subgroupSize, _supportsSinglePassReduce ? "supported" : "not supported");
+
 	LOG_INFO("The gpu has a minimum buffer alignement of {}", _gpuProperties.limits.minUniformBufferOffsetAlignment);
 	VkSampleCountFlags counts = _gpuProperties.limits.framebufferColorSampleCounts & _gpuProperties.limits.framebufferDepthSampleCounts;
 	if (counts & VK_SAMPLE_COUNT_64_BIT) { msaaSampleCount = VK_SAMPLE_COUNT_64_BIT; }
@@ -945,31 +1716,74 @@ uint32_t getImageMipLevels(uint32_t width, uint32_t height)
 
 	return result;
 }
+void VulkanEngine::init_offscreen_images()
+{
+	//stand in for the swapchain, one image per frame slot so a slot never waits on another
+	_swachainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+
+	VkExtent3D imageExtent = {
+		_windowExtent.width,
+		_windowExtent.height,
+		1
+	};
+
+	VkImageCreateInfo img_info = vkinit::image_create_info(_swachainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, imageExtent);
+
+	VmaAllocationCreateInfo img_allocinfo = {};
+	img_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	vkutil::tag_allocation(img_allocinfo, vkutil::MemoryCategory::RenderTargets);
+
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		AllocatedImage image;
+		VK_CHECK(vmaCreateImage(_allocator, &img_info, &img_allocinfo, &image._image, &image._allocation, nullptr));
+
+		//the views are destroyed with the framebuffers, like the swapchain ones
+		VkImageViewCreateInfo view_info = vkinit::imageview_create_info(_swachainImageFormat, image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+		VK_CHECK(vkCreateImageView(_device, &view_info, nullptr, &image._defaultView));
+
+		_swapchainImages.push_back(image._image);
+		_swapchainImageViews.push_back(image._defaultView);
+
+		_mainDeletionQueue.push_function([=]() {
+			vmaDestroyImage(_allocator, image._image, image._allocation);
+			});
+	}
+
+	LOG_INFO("Headless, rendering into {} offscreen images", MAX_FRAMES_IN_FLIGHT);
+}
+
 void VulkanEngine::init_swapchain()
 {
+	if (_headless)
+	{
+		init_offscreen_images();
+	}
+	else
+	{
+		vkb::SwapchainBuilder swapchainBuilder{ _chosenGPU,_device,_surface };
 
-	vkb::SwapchainBuilder swapchainBuilder{ _chosenGPU,_device,_surface };
+		vkb::Swapchain vkbSwapchain = swapchainBuilder
+			.use_default_format_selection()
+			//use vsync present mode
+			.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
+			.set_desired_extent(_windowExtent.width, _windowExtent.height)
 
-	vkb::Swapchain vkbSwapchain = swapchainBuilder
-		.use_default_format_selection()
-		//use vsync present mode
-		.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
-		.set_desired_extent(_windowExtent.width, _windowExtent.height)
-		
-		.build()
-		.value();
+			.build()
+			.value();
 
-	//store swapchain and its related images
-	_swapchain = vkbSwapchain.swapchain;
+		//store swapchain and its related images
+		_swapchain = vkbSwapchain.swapchain;
 
-	_mainDeletionQueue.push_function([=]() {
-		vkDestroySwapchainKHR(_device, _swapchain, nullptr);
-		});
+		_mainDeletionQueue.push_function([=]() {
+			vkDestroySwapchainKHR(_device, _swapchain, nullptr);
+			});
 
-	_swapchainImages = vkbSwapchain.get_images().value();
-	_swapchainImageViews = vkbSwapchain.get_image_views().value();
+		_swapchainImages = vkbSwapchain.get_images().value();
+		_swapchainImageViews = vkbSwapchain.get_image_views().value();
 
-	_swachainImageFormat = vkbSwapchain.image_format;
+		_swachainImageFormat = vkbSwapchain.image_format;
+	}
 	//color resource image
 	VkExtent3D renderImageExtent = {
 			_windowExtent.width,
@@ -984,6 +1798,7 @@ void VulkanEngine::init_swapchain()
 	reimg_allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 	//allocate and create the color resource image
+	vkutil::tag_allocation(reimg_allocinfo, vkutil::MemoryCategory::RenderTargets);
 	VK_CHECK(vmaCreateImage(_allocator, &re_info, &reimg_allocinfo, &_colorResourceImage._image, &_colorResourceImage._allocation, nullptr));
 	
 	//build a color resource image-view to use for rendering
@@ -1007,6 +1822,7 @@ void VulkanEngine::init_swapchain()
 		dimg_allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 		//allocate and create the undeal raw image
+		vkutil::tag_allocation(dimg_allocinfo, vkutil::MemoryCategory::RenderTargets);
 		VK_CHECK(vmaCreateImage(_allocator, &ri_info, &dimg_allocinfo, &_rawRenderImage._image, &_rawRenderImage._allocation, nullptr));
 
 		//build a raw image-view for the depth image to use for rendering
@@ -1050,6 +1866,7 @@ void VulkanEngine::init_swapchain()
 		//dimg_info.samples = msaaSampleCount;
 
 		//allocate and create the image
+		vkutil::tag_allocation(dimg_allocinfo, vkutil::MemoryCategory::RenderTargets);
 		VK_CHECK(vmaCreateImage(_allocator, &dimg_info, &dimg_allocinfo, &_depthImage._image, &_depthImage._allocation, nullptr));
 
 
@@ -1070,6 +1887,7 @@ void VulkanEngine::init_swapchain()
 		VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, shadowExtent);
 		//dimg_info.samples = msaaSampleCount;
 		//allocate and create the image
+		vkutil::tag_allocation(dimg_allocinfo, vkutil::MemoryCategory::ShadowMap);
 		VK_CHECK(vmaCreateImage(_allocator, &dimg_info, &dimg_allocinfo, &_shadowImage._image, &_shadowImage._allocation, nullptr));
 
 		//build a image-view for the depth image to use for rendering
@@ -1110,6 +1928,7 @@ void VulkanEngine::init_swapchain()
 	//pyramidInfo.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
 
 	//allocate and create the image
+	vkutil::tag_allocation(dimg_allocinfo, vkutil::MemoryCategory::RenderTargets);
 	VK_CHECK(vmaCreateImage(_allocator, &pyramidInfo, &dimg_allocinfo, &_depthPyramid._image, &_depthPyramid._allocation, nullptr));
 
 	//build a image-view for the depth image to use for rendering
@@ -1140,6 +1959,12 @@ void VulkanEngine::init_swapchain()
 		depthPyramidMips[i] = pyramid;
 		assert(depthPyramidMips[i]);
 	}
+
+	vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::RenderTargets);
+	_depthReduceCounterBuffer = create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	_mainDeletionQueue.push_function([=]() {
+		vmaDestroyBuffer(_allocator, _depthReduceCounterBuffer._buffer, _depthReduceCounterBuffer._allocation);
+		});
 	
 
 	VkSamplerCreateInfo createInfo = {};
@@ -1266,8 +2091,31 @@ void VulkanEngine::init_forward_renderpass()
 
 	VK_CHECK(vkCreateRenderPass(_device, &render_pass_info, nullptr, &_renderPass));
 
+	//late pass of two phase occlusion, keeps what the early pass drew
+	//reduce_depth leaves the depth image as an attachment again
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	//the early pass color and depth writes land before the late pass loads and writes them
+	VkSubpassDependency lateDependency = {};
+	lateDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	lateDependency.dstSubpass = 0;
+	lateDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	lateDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	lateDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	lateDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	render_pass_info.dependencyCount = 1;
+	render_pass_info.pDependencies = &lateDependency;
+
+	VK_CHECK(vkCreateRenderPass(_device, &render_pass_info, nullptr, &_forwardLatePass));
+
 	_mainDeletionQueue.push_function([=]() {
 		vkDestroyRenderPass(_device, _renderPass, nullptr);
+		vkDestroyRenderPass(_device, _forwardLatePass, nullptr);
 		});
 }
 
@@ -1290,6 +2138,7 @@ void VulkanEngine::init_copy_renderpass()
 	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	//offscreen images are never presented, the present layout needs the swapchain extension
 	VkAttachmentDescription colorAttachmentResolve{};
 	colorAttachmentResolve.format = _swachainImageFormat;
 	colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -1298,7 +2147,7 @@ void VulkanEngine::init_copy_renderpass()
 	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachmentResolve.finalLayout = _headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference color_attachment_ref = {};
 	color_attachment_ref.attachment = 0;
@@ -1444,12 +2293,20 @@ void VulkanEngine::init_framebuffers()
 
 void VulkanEngine::init_commands()
 {
+	//main thread records the compute work and imgui, the workers share the passes
+	_recordWorkerCount = std::clamp(std::thread::hardware_concurrency(), 2u, MAX_RECORD_WORKERS + 1) - 1;
+	LOG_INFO("Recording passes on {} worker threads", _recordWorkerCount);
+	_recordWorkers.init(_recordWorkerCount);
+	_mainDeletionQueue.push_function([=]() {
+		_recordWorkers.cleanup();
+		});
+
 	//create a command pool for commands submitted to the graphics queue.
 	//we also want the pool to allow for resetting of individual command buffers
 	VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-	//create command pool per frame(double buffer)
-	for (int i = 0; i < FRAME_OVERLAP; i++) {
+	//create command pool per frame slot
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 
 
 		VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_frames[i]._commandPool));
@@ -1463,7 +2320,34 @@ void VulkanEngine::init_commands()
 			vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
 		});
 
-		
+		if (_asyncCompute)
+		{
+			VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._prepareCommandBuffer));
+			VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._shadowCommandBuffer));
+
+			VkCommandPoolCreateInfo computePoolInfo = vkinit::command_pool_create_info(_computeQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+			VK_CHECK(vkCreateCommandPool(_device, &computePoolInfo, nullptr, &_frames[i]._computeCommandPool));
+
+			VkCommandBufferAllocateInfo computeAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._computeCommandPool, 1);
+			VK_CHECK(vkAllocateCommandBuffers(_device, &computeAllocInfo, &_frames[i]._computeCommandBuffer));
+
+			_mainDeletionQueue.push_function([=]() {
+				vkDestroyCommandPool(_device, _frames[i]._computeCommandPool, nullptr);
+			});
+		}
+
+		//secondary command buffers are allocated on demand and reset with the whole pool every frame
+		VkCommandPoolCreateInfo recordPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		_frames[i]._recordContexts.resize(_recordWorkerCount + 1);
+		for (RecordContext& context : _frames[i]._recordContexts)
+		{
+			VK_CHECK(vkCreateCommandPool(_device, &recordPoolInfo, nullptr, &context._commandPool));
+
+			VkCommandPool pool = context._commandPool;
+			_mainDeletionQueue.push_function([=]() {
+				vkDestroyCommandPool(_device, pool, nullptr);
+			});
+		}
 	}
 	//Profiler register physical device, logical device,graphics queue and command buffer
 	_graphicsQueueContext = TracyVkContext(_chosenGPU, _device, _graphicsQueue, _frames[0]._mainCommandBuffer);
@@ -1471,6 +2355,14 @@ void VulkanEngine::init_commands()
 		TracyVkDestroy(_graphicsQueueContext);
 		std::cout << " desctroy Tracy profiler" << std::endl;
 		});
+
+	if (_asyncCompute)
+	{
+		_computeQueueContext = TracyVkContext(_chosenGPU, _device, _computeQueue, _frames[0]._computeCommandBuffer);
+		_mainDeletionQueue.push_function([=]() {
+			TracyVkDestroy(_computeQueueContext);
+			});
+	}
 	
 	VkCommandPoolCreateInfo uploadCommandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily);
 	
@@ -1481,26 +2373,48 @@ void VulkanEngine::init_commands()
 	_mainDeletionQueue.push_function([=]() {
 		vkDestroyCommandPool(_device, _uploadContext._commandPool, nullptr);
 		});
+
+	_uploadQueue.init(_device, _allocator, _transferQueue, _transferQueueFamily);
+	_mainDeletionQueue.push_function([=]() {
+		_uploadQueue.cleanup();
+		});
 }
 
 void VulkanEngine::init_sync_structures()
 {
 	//create syncronization structures
-	//one fence to control when the gpu has finished rendering the frame,
-	//and 2 semaphores to syncronize rendering with swapchain
-	//we want the [fence to start signalled] so we can wait on it on the first frame
-	//VK_FENCE_CREATE_SIGNALED_BIT->fence to start signalled
-	VkFenceCreateInfo fenceCreateInfo = vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
+	//one timeline semaphore to control when the gpu has finished rendering a frame,
+	//and 2 semaphores per frame to syncronize rendering with swapchain
+	//the timeline starts at 0, so the first frames of every slot do not wait
+	VkSemaphoreTypeCreateInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo timelineCreateInfo = vkinit::semaphore_create_info();
+	timelineCreateInfo.pNext = &timelineInfo;
+
+	VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr, &_frameTimeline));
+	_mainDeletionQueue.push_function([=]() {
+		vkDestroySemaphore(_device, _frameTimeline, nullptr);
+		});
+
+	_framesInFlight = std::clamp(CVAR_FramesInFlight.Get(), 1, static_cast<int>(MAX_FRAMES_IN_FLIGHT));
+	LOG_INFO("{} frames in flight", _framesInFlight);
 
 	VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
 
-	for (int i = 0; i < FRAME_OVERLAP; i++) {
+	VkQueryPoolCreateInfo timestampPoolInfo = {};
+	timestampPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	timestampPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	timestampPoolInfo.queryCount = 2;
 
-		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_frames[i]._renderFence));
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+
+		VK_CHECK(vkCreateQueryPool(_device, &timestampPoolInfo, nullptr, &_frames[i]._timestampPool));
 
-		//enqueue the destruction of the fence
 		_mainDeletionQueue.push_function([=]() {
-			vkDestroyFence(_device, _frames[i]._renderFence, nullptr);
+			vkDestroyQueryPool(_device, _frames[i]._timestampPool, nullptr);
 			});
 
 
@@ -1512,6 +2426,20 @@ void VulkanEngine::init_sync_structures()
 			vkDestroySemaphore(_device, _frames[i]._presentSemaphore, nullptr);
 			vkDestroySemaphore(_device, _frames[i]._renderSemaphore, nullptr);
 			});
+
+		//async compute orders the 3 submissions of a frame with semaphores, the render fence covers all of them
+		if (_asyncCompute)
+		{
+			VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._cullReadySemaphore));
+			VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._cullDoneSemaphore));
+			VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._depthReleaseSemaphore));
+
+			_mainDeletionQueue.push_function([=]() {
+				vkDestroySemaphore(_device, _frames[i]._cullReadySemaphore, nullptr);
+				vkDestroySemaphore(_device, _frames[i]._cullDoneSemaphore, nullptr);
+				vkDestroySemaphore(_device, _frames[i]._depthReleaseSemaphore, nullptr);
+				});
+		}
 	}
 
 
@@ -1527,6 +2455,8 @@ void VulkanEngine::init_sync_structures()
 void VulkanEngine::init_pipelines()
 {	
 	_materialSystem = new vkutil::MaterialSystem();
+	//the material layout is baked into the pipelines, so the mode can only change at startup
+	_useBindless = _supportsBindless && CVAR_Bindless.Get();
 	//initailize material system before initailize pipeline
 	_materialSystem->init(this);
 	//_materialSystem->build_default_templates();
@@ -1568,7 +2498,9 @@ void VulkanEngine::init_pipelines()
 
 	pipelineBuilder._depthStencil = vkinit::depth_stencil_create_info(false, false, VK_COMPARE_OP_ALWAYS);
 
-	_blitPipeline = pipelineBuilder.build_pipeline(_device, _copyPass);
+	_pipelineCache.compile([=]() mutable {
+		_blitPipeline = pipelineBuilder.build_pipeline(_device, _copyPass, _pipelineCache.get());
+	});
 	_blitLayout = blitEffect->builtLayout;
 
 	_mainDeletionQueue.push_function([=]() {
@@ -1583,15 +2515,35 @@ void VulkanEngine::init_pipelines()
 	//load the compute shaders and build related pipeline
 	load_compute_shader(shader_path("indirect_cull.comp.spv").c_str(), _cullPipeline, _cullLayout);
 
+	load_compute_shader(shader_path("indirect_compact.comp.spv").c_str(), _compactDrawPipeline, _compactDrawLayout);
+
 	load_compute_shader(shader_path("depthReduce.comp.spv").c_str(), _depthReducePipeline, _depthReduceLayout);
 
+	//without quad operations reduce_depth keeps the dispatch per level
+	if (_supportsSinglePassReduce)
+	{
+		load_compute_shader(shader_path("depthReduceSinglePass.comp.spv").c_str(), _depthReduceSinglePassPipeline, _depthReduceSinglePassLayout);
+	}
+
 	load_compute_shader(shader_path("sparse_upload.comp.spv").c_str(), _sparseUploadPipeline, _sparseUploadLayout);
+
+	load_compute_shader(shader_path("meshlet_cull.comp.spv").c_str(), _meshletCullPipeline, _meshletCullLayout);
+
+	//every pipeline above was compiled on a worker thread
+	size_t pipelineCount = _pipelineCache.wait();
+	LOG_SUCCESS("Built {} pipelines in {:.2f} ms, pipeline cache {}", pipelineCount, _pipelineCache.compile_time_ms(), _pipelineCache.loaded_size() > 0 ? "warm" : "cold");
+	_pipelineCache.save();
 }
 
 bool VulkanEngine::load_compute_shader(const char* shaderPath, VkPipeline& pipeline, VkPipelineLayout& layout)
 {
-	ShaderModule computeModule;
-	computeModule = *_shaderCache.get_shader(shaderPath);
+	ShaderModule* loadedModule = _shaderCache.get_shader(shaderPath);
+	if (!loadedModule)
+	{
+		LOG_FATAL("Failed to load compute shader {}", shaderPath);
+		return false;
+	}
+	ShaderModule computeModule = *loadedModule;
 
 	//if (!vkutil::load_shader_module(_device, shaderPath, &computeModule))
 
@@ -1611,11 +2563,14 @@ bool VulkanEngine::load_compute_shader(const char* shaderPath, VkPipeline& pipel
 
 
 	layout = computeEffect->builtLayout;
-	pipeline = computeBuilder.build_pipeline(_device);
+	//pipeline is an engine member, written once the worker finishes
+	_pipelineCache.compile([=, &pipeline]() mutable {
+		pipeline = computeBuilder.build_pipeline(_device, _pipelineCache.get());
+	});
 	//computeEffect->cleanup(_device);
 	//vkDestroyShaderModule(_device, computeModule.module, nullptr);
 	//delete computeEffect;
-	_mainDeletionQueue.push_function([=]() {
+	_mainDeletionQueue.push_function([=, &pipeline]() {
 		vkDestroyPipeline(_device, pipeline, nullptr);
 		vkDestroyPipelineLayout(_device, layout, nullptr);
 		computeEffect->cleanup(_device);
@@ -1630,18 +2585,22 @@ void VulkanEngine::load_meshes()
 {
 	Mesh triMesh{};
 	triMesh.bounds.valid = false;
+	//positions are quantized inside the bounds box even when the bounds arent used for culling
+	triMesh.bounds.origin = { 0.f,0.f, 0.0f };
+	triMesh.bounds.extents = { 1.f,1.f, 0.0f };
+	triMesh.bounds.radius = 1.f;
 	//make the array 3 vertices long
 	triMesh._vertices.resize(3);
 
 	//vertex positions
-	triMesh._vertices[0].position = { 1.f,1.f, 0.0f };
-	triMesh._vertices[1].position = { -1.f,1.f, 0.0f };
-	triMesh._vertices[2].position = { 0.f,-1.f, 0.0f };
+	triMesh._vertices[0].pack_position({ 1.f,1.f, 0.0f }, triMesh.bounds);
+	triMesh._vertices[1].pack_position({ -1.f,1.f, 0.0f }, triMesh.bounds);
+	triMesh._vertices[2].pack_position({ 0.f,-1.f, 0.0f }, triMesh.bounds);
 
 	//vertex colors, all green
-	triMesh._vertices[0].color = { 0.f,1.f, 0.0f }; //pure green
-	triMesh._vertices[1].color = { 0.f,1.f, 0.0f }; //pure green
-	triMesh._vertices[2].color = { 0.f,1.f, 0.0f }; //pure green
+	triMesh._vertices[0].pack_color({ 0.f,1.f, 0.0f }); //pure green
+	triMesh._vertices[1].pack_color({ 0.f,1.f, 0.0f }); //pure green
+	triMesh._vertices[2].pack_color({ 0.f,1.f, 0.0f }); //pure green
 	//we dont care about the vertex normals
 	upload_mesh(triMesh);
 	_meshes["triangle"] = triMesh;
@@ -1711,6 +2670,7 @@ void VulkanEngine::upload_mesh(Mesh& mesh)
 	//let the VMA library know that this data should be writeable by CPU, but also readable by GPU
 	VmaAllocationCreateInfo vmaallocInfo = {};
 	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	vkutil::tag_allocation(vmaallocInfo, vkutil::MemoryCategory::Meshes);
 
 	AllocatedBufferUntyped stagingBuffer;
 
@@ -1826,10 +2786,25 @@ void VulkanEngine::init_scene()
 	//	}
 	//}
 
-	//scene object 1 Sponza
-	glm::mat4 sponzaMatrix = glm::scale(glm::mat4{ 1.0 }, glm::vec3(1));;
+	//scene object 1 Sponza, or a grid of _scenePrefab when _sceneGrid is set
+	if (_sceneGrid <= 0)
+	{
+		glm::mat4 sponzaMatrix = glm::scale(glm::mat4{ 1.0 }, glm::vec3(_sceneScale));
+
+		load_prefab(asset_path(_scenePrefab).c_str(), sponzaMatrix);
+	}
+	else
+	{
+		for (int x = -_sceneGrid; x <= _sceneGrid; x++) {
+			for (int y = -_sceneGrid; y <= _sceneGrid; y++) {
 
-	load_prefab(asset_path("Sponza.pfb").c_str(), sponzaMatrix);
+				glm::mat4 translation = glm::translate(glm::mat4{ 1.0 }, glm::vec3(x * _sceneSpacing, 0, y * _sceneSpacing));
+				glm::mat4 scale = glm::scale(glm::mat4{ 1.0 }, glm::vec3(_sceneScale));
+
+				load_prefab(asset_path(_scenePrefab).c_str(), (translation * scale));
+			}
+		}
+	}
 
 	//scene object 2 TopDownScifi
 	/*glm::mat4 unrealFixRotation = glm::rotate(glm::radians(-90.f), glm::vec3{ 1,0,0 });
@@ -1889,7 +2864,7 @@ void VulkanEngine::ready_cull_data(RenderScene::MeshPass& pass, VkCommandBuffer
 	}
 	VkBufferCopy indirectCopy;
 	indirectCopy.dstOffset = 0;
-	indirectCopy.size = pass.batches.size() * sizeof(GPUIndirectObject);
+	indirectCopy.size = pass.batches.size() * MAX_MESH_LODS * sizeof(GPUIndirectObject);
 	indirectCopy.srcOffset = 0;
 	vkCmdCopyBuffer(cmd, pass.clearIndirectBuffer._buffer, pass.drawIndirectBuffer._buffer, 1, &indirectCopy);
 
@@ -1901,9 +2876,52 @@ void VulkanEngine::ready_cull_data(RenderScene::MeshPass& pass, VkCommandBuffer
 		cullReadyBarriers.push_back(barrier);
 		//vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
 	}
+
+	//a new visibility buffer starts with everything hidden, the late cull finds the visible objects
+	if (pass.needsVisibilityClear && pass.visibilityBuffer._buffer != VK_NULL_HANDLE)
+	{
+		vkCmdFillBuffer(cmd, pass.visibilityBuffer._buffer, 0, VK_WHOLE_SIZE, 0);
+
+		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.visibilityBuffer._buffer, _graphicsQueueFamily);
+		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		cullReadyBarriers.push_back(barrier);
+		pass.needsVisibilityClear = false;
+	}
+
+	//meshlet draws are appended per batch, so the commands and the counters start from zero every frame
+	if (pass.useMeshlets)
+	{
+		vkCmdFillBuffer(cmd, pass.meshletIndirectBuffer._buffer, 0, pass.meshletInstanceCount * sizeof(GPUIndirectObject), 0);
+		vkCmdFillBuffer(cmd, pass.meshletCountBuffer._buffer, 0, pass.batches.size() * sizeof(uint32_t), 0);
+
+		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.meshletIndirectBuffer._buffer, _graphicsQueueFamily);
+		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		VkBufferMemoryBarrier barrier2 = vkinit::buffer_barrier(pass.meshletCountBuffer._buffer, _graphicsQueueFamily);
+		barrier2.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+		barrier2.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		cullReadyBarriers.push_back(barrier);
+		cullReadyBarriers.push_back(barrier2);
+	}
+
+	//the compaction appends to the multibatch ranges, counters start from zero every frame
+	if (pass.useDrawCount)
+	{
+		vkCmdFillBuffer(cmd, pass.drawCountBuffer._buffer, 0, pass.batches.size() * sizeof(uint32_t), 0);
+
+		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.drawCountBuffer._buffer, _graphicsQueueFamily);
+		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		cullReadyBarriers.push_back(barrier);
+	}
 }
 
-AllocatedBufferUntyped VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags)
+AllocatedBufferUntyped VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags, bool shareQueues)
 {
 	//allocate vertex buffer
 	VkBufferCreateInfo bufferInfo = {};
@@ -1913,11 +2931,21 @@ AllocatedBufferUntyped VulkanEngine::create_buffer(size_t allocSize, VkBufferUsa
 
 	bufferInfo.usage = usage;
 
+	//inputs of the culling are read by the shadow pass while the compute queue culls, no ownership transfer can cover that
+	uint32_t queueFamilies[] = { _graphicsQueueFamily, _computeQueueFamily };
+	if (shareQueues && _asyncCompute)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = queueFamilies;
+	}
+
 
 	//let the VMA library know that this data should be writeable by CPU, but also readable by GPU
 	VmaAllocationCreateInfo vmaallocInfo = {};
 	vmaallocInfo.usage = memoryUsage;
 	vmaallocInfo.requiredFlags = required_flags;
+	vkutil::tag_allocation(vmaallocInfo);
 	AllocatedBufferUntyped newBuffer;
 
 	//allocate the buffer
@@ -1930,9 +2958,22 @@ AllocatedBufferUntyped VulkanEngine::create_buffer(size_t allocSize, VkBufferUsa
 }
 
 
-void VulkanEngine::reallocate_buffer(AllocatedBufferUntyped& buffer, size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags /*= 0*/)
+void VulkanEngine::reallocate_buffer(AllocatedBufferUntyped& buffer, size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags /*= 0*/, bool shareQueues /*= false*/)
 {
-	AllocatedBufferUntyped newBuffer = create_buffer(allocSize, usage, memoryUsage, required_flags);
+	AllocatedBufferUntyped newBuffer = create_buffer(allocSize, usage, memoryUsage, required_flags, shareQueues);
+
+	//cached sets that bind the old buffer are rebuilt on next use
+	_descriptorSetCache->invalidate(buffer._buffer);
+
+	//the pools only free sets all at once, past a number of forgotten sets the cache moves to new pools
+	//and the old ones go once the frames that can still bind their sets are done
+	if (_descriptorSetCache->stale_sets() > MAX_STALE_DESCRIPTOR_SETS)
+	{
+		vkutil::DescriptorAllocator retired = _descriptorSetCache->retire();
+		get_current_frame()._frameDeletionQueue.push_function([=]() mutable {
+			retired.cleanup();
+		});
+	}
 
 	get_current_frame()._frameDeletionQueue.push_function([=]() {
 		//NOTICE: destroy previous buffer,not current new buffer 
@@ -1989,6 +3030,31 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& f
 	vkResetCommandPool(_device, _uploadContext._commandPool, 0);
 }
 
+void VulkanEngine::calibrate_trace_clock()
+{
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 1;
+
+	VkQueryPool pool;
+	VK_CHECK(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &pool));
+
+	//the timestamp is taken somewhere inside the submit, its middle is close enough for a trace
+	uint64_t cpuBefore = vktrace::now();
+	immediate_submit([&](VkCommandBuffer cmd) {
+		vkCmdResetQueryPool(cmd, pool, 0, 1);
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, 0);
+		});
+	uint64_t cpuAfter = vktrace::now();
+
+	uint64_t gpuTicks = 0;
+	vkGetQueryPoolResults(_device, pool, 0, 1, sizeof(uint64_t), &gpuTicks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	vkDestroyQueryPool(_device, pool, nullptr);
+
+	vktrace::calibrate_gpu(static_cast<uint64_t>(double(gpuTicks) * _gpuProperties.limits.timestampPeriod), cpuBefore + (cpuAfter - cpuBefore) / 2);
+}
+
 
 bool VulkanEngine::load_prefab(const char* path, glm::mat4 root)
 {
@@ -2307,12 +3373,17 @@ void VulkanEngine::unmap_buffer(AllocatedBufferUntyped& buffer)
 
 void VulkanEngine::init_descriptors()
 {
+	vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::FrameData);
+
 	_descriptorAllocator = new vkutil::DescriptorAllocator{};
 	_descriptorAllocator->init(_device);
 
 	_descriptorLayoutCache = new vkutil::DescriptorLayoutCache{};
 	_descriptorLayoutCache->init(_device);
 
+	_descriptorSetCache = new vkutil::DescriptorSetCache{};
+	_descriptorSetCache->init(_device);
+
 	//create texture binding info
 	VkDescriptorSetLayoutBinding textureBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
 
@@ -2326,23 +3397,20 @@ void VulkanEngine::init_descriptors()
 	_singleTextureSetLayout = _descriptorLayoutCache->create_descriptor_layout(&set3info);
 
 
-	const size_t sceneParamBufferSize = FRAME_OVERLAP * pad_uniform_buffer_size(sizeof(GPUSceneData));
+	const size_t sceneParamBufferSize = MAX_FRAMES_IN_FLIGHT * pad_uniform_buffer_size(sizeof(GPUSceneData));
 
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
 		_frames[i].dynamicDescriptorAllocator = new vkutil::DescriptorAllocator{};
 		_frames[i].dynamicDescriptorAllocator->init(_device);
 
 		//1 megabyte of dynamic data buffer
-		auto dynamicDataBuffer = create_buffer(1000000, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		auto dynamicDataBuffer = create_buffer(1000000, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, 0, true);
 		//map dynamic buffer to push buffer 
 		_frames[i].dynamicData.init(_allocator, dynamicDataBuffer, _gpuProperties.limits.minUniformBufferOffsetAlignment); 
 
-		//20 megabyte of debug output
-		//debugeOutputBuffer->storage indirect draw command,draw object id and draw batches info
-		//debugeOutputBuffer -> GPUindirectObject * sizeof(GPUindirectObject)
-		_frames[i].debugOutputBuffer = create_buffer(200000000, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+		//the 200 megabyte debug output buffer is created by the cull when a dump is requested
 	}
 }
 
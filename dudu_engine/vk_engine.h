@@ -11,6 +11,11 @@
 #include <vk_mesh.h>
 #include <vk_scene.h>
 #include <vk_shaders.h>
+#include <vk_pipeline_cache.h>
+#include <vk_upload.h>
+#include <vk_workers.h>
+#include <alloc_tracker.h>
+#include <vk_memory.h>
 #include <vk_pushbuffer.h>
 #include <player_camera.h>
 #include <unordered_map>
@@ -92,14 +97,35 @@ struct MeshObject {
 };
 
 
+//secondary command buffers of one recording thread, the pool is only used by that thread
+struct RecordContext {
+	VkCommandPool _commandPool;
+	std::vector<VkCommandBuffer> _secondaryBuffers;
+	uint32_t _usedBuffers{ 0 };
+};
+
 struct FrameData {
 	VkSemaphore _presentSemaphore, _renderSemaphore;
-	VkFence _renderFence;
+	//frame timeline value signaled by the last submit of this frame, its resources are free once it is reached
+	uint64_t _timelineValue{ 0 };
+	bool _retired{ true };
+	//gpu start and end of the frame on the graphics queue
+	VkQueryPool _timestampPool{ VK_NULL_HANDLE };
 
 	DeletionQueue _frameDeletionQueue;
 
 	VkCommandPool _commandPool;
 	VkCommandBuffer _mainCommandBuffer;
+
+	//one per recording worker, the last one belongs to the main thread
+	std::vector<RecordContext> _recordContexts;
+
+	//async compute only: uploads and the shadow pass are submitted ahead of the culling on the compute queue
+	VkCommandBuffer _prepareCommandBuffer{ VK_NULL_HANDLE }, _shadowCommandBuffer{ VK_NULL_HANDLE };
+	VkCommandPool _computeCommandPool{ VK_NULL_HANDLE };
+	VkCommandBuffer _computeCommandBuffer{ VK_NULL_HANDLE };
+	//uploads done -> culling, culling done -> forward pass, forward pass done -> depth reduction of the next frame
+	VkSemaphore _cullReadySemaphore{ VK_NULL_HANDLE }, _cullDoneSemaphore{ VK_NULL_HANDLE }, _depthReleaseSemaphore{ VK_NULL_HANDLE };
 	
 	vkutil::PushBuffer dynamicData;
 	//AllocatedBufferUntyped dynamicDataBuffer;
@@ -111,6 +137,16 @@ struct FrameData {
 
 	std::vector<uint32_t> debugDataOffsets;
 	std::vector<std::string> debugDataNames;
+
+	//indirect commands of the culled passes, copied after their draws and read once the frame is retired
+	struct CullReadback {
+		MeshpassType pass;
+		VkDeviceSize offset;
+		uint32_t commandCount;
+		uint32_t instances;//0 when another readback of the same pass counted them
+	};
+	std::vector<CullReadback> _cullReadbacks;
+	AllocatedBufferUntyped _cullReadbackBuffer;
 };
 
 
@@ -139,15 +175,52 @@ struct GPUObjectData {
 	glm::mat4 modelMatrix;
 	glm::vec4 origin_rad; // bounds
 	glm::vec4 extents;  // bounds
+	glm::vec4 quantizeMin; // mesh space box the vertex positions are quantized in
+	glm::vec4 quantizeRange;
+	uint32_t materialIndex; // bindless material, kept as an integer so it is never treated as a float
+	uint32_t pad[3];
 };
 
 
+//gpu side numbers of a mesh pass, they lag by the frames in flight
+struct PassStats {
+	//pipeline statistics, both forward phases summed
+	uint64_t inputPrimitives{ 0 };
+	uint64_t vertexInvocations{ 0 };
+	uint64_t clippingPrimitives{ 0 };
+	uint64_t fragmentInvocations{ 0 };
+	//from the cull results, 0 for meshlet passes
+	uint32_t instances{ 0 };
+	uint32_t visibleInstances{ 0 };
+	uint32_t indirectCommands{ 0 };//commands recorded, empty ones included
+	uint32_t indirectDraws{ 0 };//commands with instances left after culling
+};
+
 struct EngineStats {
 	float frametime;
 	int objects;
 	int drawcalls;
 	int draws;
 	int triangles;
+	int descriptorWrites;//per frame, cached and frame allocated sets
+	int descriptorSetsReused;
+	int descriptorSetsCached;
+	float cpuWait{ 0 };//ms the cpu waited for a free frame
+	float gpuWait{ 0 };//ms the graphics queue idled before the frame, lags by the frames in flight
+	//allocations since the last frame, 0 unless built with DUDU_TRACK_ALLOCATIONS
+	int heapAllocations{ 0 };
+	uint64_t heapBytes{ 0 };
+	int deviceAllocations{ 0 };
+	uint64_t deviceBytes{ 0 };
+	vkutil::PerPassData<PassStats> passes;
+};
+
+//descriptor sets and dynamic offsets of a mesh pass
+//built on the main thread, so the draws can be recorded on any thread
+struct PassDrawData {
+	VkDescriptorSet globalSet;
+	VkDescriptorSet objectDataSet;
+	std::vector<uint32_t> dynamicOffsets;
 };
 
 
@@ -166,7 +239,7 @@ struct /*alignas(16)*/DrawCullData
 	glm::mat4 viewMat;
 	float P00, P11, znear, zfar; // symmetric projection parameters
 	float frustum[4]; // data for left/right/top/bottom frustum planes
-	float lodBase, lodStep; // lod distance i = base * pow(step, i)
+	float lodBase, lodStep; // lod i starts at projected radius base / pow(step, i - 1)
 	float pyramidWidth, pyramidHeight; // depth pyramid size in texels
 
 	uint32_t drawCount;
@@ -182,7 +255,25 @@ struct /*alignas(16)*/DrawCullData
 	float aabbmax_x;
 	float aabbmax_y;
 	float aabbmax_z;
-	
+
+	int cullPhase;//CullPhase
+};
+
+//push constants of meshlet_cull.comp, 128 bytes
+struct MeshletCullData
+{
+	glm::mat4 viewMat;
+	float P00, P11, znear, zfar; // symmetric projection parameters
+	float frustum[4]; // data for left/right/top/bottom frustum planes
+	float pyramidWidth, pyramidHeight; // depth pyramid size in texels
+
+	uint32_t meshletCount;
+
+	int cullingEnabled;
+	int occlusionEnabled;
+	int coneCullEnabled;
+	int distanceCheck;
+	int padding;
 };
 
 //struct EngineConfig {
@@ -204,6 +295,13 @@ struct DirectionalLight {
 
 	glm::mat4 get_view();
 };
+//two phase occlusion culling (culling.twoPhase)
+enum class CullPhase : int {
+	Single = 0,//occlusion against the pyramid of the last frame
+	Early = 1,//objects visible last frame, no occlusion test
+	Late = 2,//the rest against the pyramid of the early phase depth, updates the visibility bits
+};
+
 struct CullParams {
 	glm::mat4 viewmat;
 	glm::mat4 projmat;
@@ -211,10 +309,17 @@ struct CullParams {
 	bool frustrumCull;
 	float drawDist;
 	bool aabb;
+	bool lod;//pick the mesh lod in the cull, needs a perspective projection
+	CullPhase phase;
 	glm::vec3 aabbmin;
 	glm::vec3 aabbmax;
 };
-constexpr unsigned int FRAME_OVERLAP = 2;
+//frames the cpu can record ahead of the gpu, gpu.framesInFlight picks 1 to this at runtime
+constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 4;
+//secondary command buffer recording threads, the main thread is not counted
+constexpr uint32_t MAX_RECORD_WORKERS = 8;
+//invalidated descriptor sets left in the cache pools before the cache moves to fresh pools
+constexpr uint32_t MAX_STALE_DESCRIPTOR_SETS = 256;
 const int MAX_OBJECTS = 150000;
 class VulkanEngine {
 public:
@@ -234,18 +339,45 @@ public:
 
 	VkPhysicalDeviceProperties _gpuProperties;
 
-	FrameData _frames[FRAME_OVERLAP];
+	FrameData _frames[MAX_FRAMES_IN_FLIGHT];
+
+	//every frame signals the next value, frames are waited on and retired by it
+	VkSemaphore _frameTimeline;
+	uint64_t _frameTimelineValue{ 0 };
+	uint32_t _framesInFlight{ 2 };
+	uint32_t _frameIndex{ 0 };
+	uint32_t _lastFrameIndex{ 0 };
+	//gpu timestamp of the end of the last retired frame
+	uint64_t _lastFrameEnd{ 0 };
+	//allocation totals at the start of the last frame
+	alloctrack::Counters _heapCounters;
+	alloctrack::Counters _deviceCounters;
 	
 	VkQueue _graphicsQueue;
 	uint32_t _graphicsQueueFamily;
 	
 	tracy::VkCtx* _graphicsQueueContext;
 
+	//forward culling and depth reduction on a queue family without graphics, decided at startup
+	bool _asyncCompute{ false };
+	VkQueue _computeQueue;
+	uint32_t _computeQueueFamily{ VK_QUEUE_FAMILY_IGNORED };
+	tracy::VkCtx* _computeQueueContext{ nullptr };
+	//the last frame handed its depth image to the compute queue for the reduction
+	bool _depthReleased{ false };
+
+	//texture and mesh streaming, a transfer family when there is one, the graphics queue otherwise
+	VkQueue _transferQueue;
+	uint32_t _transferQueueFamily;
+	vkutil::UploadQueue _uploadQueue;
+
 	VkRenderPass _renderPass;
+	//same attachments as _renderPass but loaded, draws on top of the early phase of two phase occlusion
+	VkRenderPass _forwardLatePass;
 	VkRenderPass _shadowPass;
 	VkRenderPass _copyPass;
 
-	VkSurfaceKHR _surface;
+	VkSurfaceKHR _surface{ VK_NULL_HANDLE };
 	VkSwapchainKHR _swapchain;
 	VkFormat _swachainImageFormat;
 
@@ -282,8 +414,10 @@ public:
 	
 	vkutil::DescriptorAllocator* _descriptorAllocator;
 	vkutil::DescriptorLayoutCache* _descriptorLayoutCache;
+	vkutil::DescriptorSetCache* _descriptorSetCache;
 	vkutil::VulkanProfiler* _profiler;
 	vkutil::MaterialSystem* _materialSystem;
+	vkutil::MemoryAccounting _memory;
 
 	VkDescriptorSetLayout _singleTextureSetLayout;
 
@@ -298,17 +432,53 @@ public:
 	UploadContext _uploadContext;
 
 	PlayerCamera _camera;
+	//updates _camera.bLocked when camera.lock changes
+	uint32_t _camLockListener{ 0 };
 	DirectionalLight _mainLight;
 
 	VkPipeline _cullPipeline;
 	VkPipelineLayout _cullLayout;
 
+	//packs the non empty cull commands for vkCmdDrawIndexedIndirectCount
+	VkPipeline _compactDrawPipeline;
+	VkPipelineLayout _compactDrawLayout;
+	bool _supportsDrawIndirectCount{ false };
+
+	//parallel recording keeps the pass pipeline statistics queries active across vkCmdExecuteCommands
+	bool _supportsParallelRecord{ false };
+	uint32_t _recordWorkerCount{ 1 };
+	//_recordWorkerCount threads, started with the command pools
+	vkutil::WorkerPool _recordWorkers;
+	//secondaries of this frame, filled by record_passes_parallel
+	bool _recordParallel{ false };
+	std::vector<VkCommandBuffer> _shadowSecondaries;
+	std::vector<VkCommandBuffer> _forwardEarlySecondaries;
+	std::vector<VkCommandBuffer> _forwardSecondaries;
+	//separate from the forward ones so each pass gets its own pipeline statistics query
+	std::vector<VkCommandBuffer> _transparentSecondaries;
+	VkCommandBuffer _imguiSecondary{ VK_NULL_HANDLE };
+
+	//descriptor indexing support for the bindless material set
+	bool _supportsBindless{ false };
+	bool _useBindless{ false };
+	uint32_t _maxBindlessTextures{ 0 };
+
 	VkPipeline _depthReducePipeline;
 	VkPipelineLayout _depthReduceLayout;
 
+	//whole depth pyramid in one dispatch, only built when the gpu has subgroup quad operations in compute
+	VkPipeline _depthReduceSinglePassPipeline{ VK_NULL_HANDLE };
+	VkPipelineLayout _depthReduceSinglePassLayout{ VK_NULL_HANDLE };
+	VkDescriptorSet _depthReduceSinglePassSet{ VK_NULL_HANDLE };
+	AllocatedBuffer<uint32_t> _depthReduceCounterBuffer;//finished workgroups
+	bool _supportsSinglePassReduce{ false };
+
 	VkPipeline _sparseUploadPipeline;
 	VkPipelineLayout _sparseUploadLayout;
 
+	VkPipeline _meshletCullPipeline;
+	VkPipelineLayout _meshletCullLayout;
+
 	VkPipeline _blitPipeline;
 	VkPipelineLayout _blitLayout;
 
@@ -327,24 +497,64 @@ public:
 	//initializes everything in the engine
 	void init();
 
+	//no window, surface or swapchain, frames go to offscreen images (--headless). set before init
+	bool _headless{ false };
+	//frames run_headless draws along the camera path
+	int _headlessFrames{ 1000 };
+	//camera keyframes, an orbit around the start position when empty
+	std::string _cameraPathFile;
+	//run saves the camera of every frame there when set, in the format of _cameraPathFile
+	std::string _recordPathFile;
+
+	//prefab init_scene loads, a (2*grid+1)^2 grid of it spaced on x and z when _sceneGrid > 0. set before init
+	std::string _scenePrefab{ "Sponza.pfb" };
+	int _sceneGrid{ 0 };
+	float _sceneSpacing{ 50.f };
+	float _sceneScale{ 1.f };
+
 	//shuts down the engine
 	void cleanup();
 
 	//draw loop
 	void draw();
 
-	void forward_pass(VkClearValue clearValue, VkCommandBuffer cmd);
+	//early phase draws opaque objects only, late phase draws on top of it
+	void forward_pass(VkClearValue clearValue, VkCommandBuffer cmd, CullPhase phase);
 
 	void shadow_pass(VkCommandBuffer cmd);
 	
 
 	//run main loop
 	void run();
+	//fixed number of frames along a scripted camera path, no input and no ui
+	//onFrame is called after each frame, stats and profiler timings are those of that frame
+	void run_headless(std::function<void(int frame)> onFrame = nullptr);
+	//flags random objects as changed every frame, so the batching has work to do
+	void update_objects();
 	
 	FrameData& get_current_frame();
 	FrameData& get_last_frame();
 
+	//waits until the current frame slot is free and retires every finished frame
+	void begin_frame();
+	//frees the per frame resources, the frame timeline reached its value
+	void retire_frame(FrameData& frame);
+	//moves to the next slot, with the frames in flight count read from gpu.framesInFlight
+	void advance_frame();
+
+	//sizes the cull readback buffer of the current frame for every pass
+	void begin_cull_readback();
+	//copy the indirect commands of pass once it drew, countInstances on the first readback of the pass in the frame
+	void readback_cull_results(VkCommandBuffer cmd, RenderScene::MeshPass& pass, bool countInstances);
+	//pipeline statistics of the profiler into stats.passes
+	void read_pass_statistics();
+
+	//tracy context of the queue cmd is submitted to, the culls are recorded for both queues
+	tracy::VkCtx* queue_context(VkCommandBuffer cmd);
+
 	ShaderCache _shaderCache;
+	//persistent pipeline cache, pipelines are compiled in parallel on it
+	vkutil::PipelineCache _pipelineCache;
 
 	std::unordered_map<std::string, Mesh> _meshes;
 	std::unordered_map<std::string, Texture> _loadedTextures;
@@ -357,25 +567,58 @@ public:
 	//our draw function
 	void draw_objects_forward(VkCommandBuffer cmd, RenderScene::MeshPass& pass);
 
-	void execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshPass& pass, VkDescriptorSet ObjectDataSet, std::vector<uint32_t> dynamic_offsets, VkDescriptorSet GlobalSet);
+	PassDrawData prepare_forward_draw(RenderScene::MeshPass& pass);
+
+	//records the multibatches [firstMultibatch, endMultibatch) of the pass
+	void execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshPass& pass, VkDescriptorSet ObjectDataSet, std::vector<uint32_t> dynamic_offsets, VkDescriptorSet GlobalSet,
+		EngineStats& passStats, size_t firstMultibatch = 0, size_t endMultibatch = SIZE_MAX);
 
 	void draw_objects_shadow(VkCommandBuffer cmd, RenderScene::MeshPass& pass);
+
+	PassDrawData prepare_shadow_draw(RenderScene::MeshPass& pass);
+
+	//record the shadow, forward and transparent draws into secondary command buffers, split across the workers
+	//shadow_pass and forward_pass then only execute them
+	void record_passes_parallel(bool twoPhase);
+
+	VkCommandBuffer begin_secondary(RecordContext& context, VkRenderPass renderPass, VkFramebuffer framebuffer);
 	
 	void reduce_depth(VkCommandBuffer cmd);
 
+	void reduce_depth_single_pass(VkCommandBuffer cmd);
+
 	void execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPass& pass,CullParams& params);
 
+	void execute_meshlet_cull(VkCommandBuffer cmd, RenderScene::MeshPass& pass, CullParams& params);
+
+	void execute_draw_compaction(VkCommandBuffer cmd, RenderScene::MeshPass& pass);
+
 	void ready_cull_data(RenderScene::MeshPass& pass, VkCommandBuffer cmd);
 
-	AllocatedBufferUntyped create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags = 0);
+	//reset the forward commands after the early draw and cull again against the new depth pyramid
+	void execute_late_cull(VkCommandBuffer cmd, CullParams& params);
+
+	//async compute: move the cull results of postCullBarriers, and the depth and pyramid the culls read, from the compute queue to the graphics queue
+	void release_cull_results(VkCommandBuffer computeCmd, VkCommandBuffer graphicsCmd);
+
+	//async compute: the forward pass hands its depth image over, the next frame reduces it on the compute queue
+	void release_depth(VkCommandBuffer graphicsCmd);
 
-	void reallocate_buffer(AllocatedBufferUntyped&buffer,size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags = 0);
+	void acquire_depth(VkCommandBuffer computeCmd);
+
+	//shareQueues: read by both the graphics and the compute queue at the same time when async compute is on
+	AllocatedBufferUntyped create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags = 0, bool shareQueues = false);
+
+	void reallocate_buffer(AllocatedBufferUntyped&buffer,size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkMemoryPropertyFlags required_flags = 0, bool shareQueues = false);
 
 
 	size_t pad_uniform_buffer_size(size_t originalSize);
 
 	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
 
+	//lines the gpu timers of the trace capture up with its cpu zones
+	void calibrate_trace_clock();
+
 	bool load_prefab(const char* path, glm::mat4 root);
 
 	static std::string asset_path(std::string_view path);
@@ -396,6 +639,8 @@ private:
 	void init_vulkan();
 
 	void init_swapchain();
+	//headless stand in for the swapchain images
+	void init_offscreen_images();
 
 	void init_forward_renderpass();
 
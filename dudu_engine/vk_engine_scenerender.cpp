@@ -10,31 +10,63 @@
 #include "vk_textures.h"
 #include "vk_shaders.h"
 
-#include "Tracy.hpp"
+#include "vk_trace.h"
 #include "TracyVulkan.hpp"
 #include "vk_profiler.h"
 #include "cvars.h"
+#include "imgui.h"
+#include "imgui_impl_vulkan.h"
+
+#include <algorithm>
+#include <cstring>
 
 AutoCVar_Int CVAR_FreezeCull("culling.freeze", "Locks culling", 0, CVarFlags::EditCheckbox);
 
 AutoCVar_Int CVAR_Shadowcast("gpu.shadowcast", "Use shadowcasting", 1, CVarFlags::EditCheckbox);
 
+AutoCVar_Int CVAR_MeshletCull("culling.meshlets", "Cull and draw the forward pass per meshlet", 0, CVarFlags::EditCheckbox);
+
+AutoCVar_Int CVAR_MeshletConeCull("culling.meshletCone", "Backface cone test on meshlets", 1, CVarFlags::EditCheckbox);
+
+AutoCVar_Int CVAR_LodSelect("culling.lod", "Pick the mesh lod from the projected size", 1, CVarFlags::EditCheckbox);
+AutoCVar_Float CVAR_LodBase("culling.lodBase", "Projected radius (fraction of half the screen height) under which lod 1 is used", 0.25f);
+AutoCVar_Float CVAR_LodStep("culling.lodStep", "Projected radius ratio between two lods", 2.f);
+
+AutoCVar_Int CVAR_DrawIndirectCount("culling.drawIndirectCount", "Compact the culled draws and skip the empty ones with vkCmdDrawIndexedIndirectCount", 1, CVarFlags::EditCheckbox);
+
+AutoCVar_Int CVAR_SinglePassPyramid("culling.singlePassPyramid", "Build the depth pyramid in one dispatch with subgroup operations", 0, CVarFlags::EditCheckbox);
+
 AutoCVar_Float CVAR_ShadowBias("gpu.shadowBias", "Distance cull", 5.25f);
 AutoCVar_Float CVAR_SlopeBias("gpu.shadowBiasSlope", "Distance cull", 4.75f);
 
+//declared in vk_engine.cpp
+CVarHandle_Int CVAR_OutputIndirectHandle("culling.outputIndirectBufferToFile");
+CVarHandle_Int CVAR_FreezeShadowsHandle("gpu.freezeShadows");
+
 
 glm::vec4 normalizePlane(glm::vec4 p)
 {
 	return p / glm::length(glm::vec3(p));
 }
 
+inline uint32_t getGroupCount(uint32_t threadCount, uint32_t localSize)
+{
+	return (threadCount + localSize - 1) / localSize;
+}
+
 void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPass& pass,CullParams& params )
 {
 	if (CVAR_FreezeCull.Get()) return;
 	
 	if (pass.batches.size() == 0) return;
+
+	if (pass.useMeshlets)
+	{
+		execute_meshlet_cull(cmd, pass, params);
+		return;
+	}
 	//1.build descriptor set (source access interface),cull compute need source data
-	TracyVkZone(_graphicsQueueContext, cmd, "Cull Dispatch");
+	TracyVkZone(queue_context(cmd), cmd, "Cull Dispatch");
 	VkDescriptorBufferInfo objectBufferInfo = _renderScene.objectDataBuffer.get_info();
 
 	VkDescriptorBufferInfo dynamicInfo = get_current_frame().dynamicData.source.get_info();
@@ -46,6 +78,8 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 
 	VkDescriptorBufferInfo indirectInfo = pass.drawIndirectBuffer.get_info();
 
+	VkDescriptorBufferInfo visibilityInfo = pass.visibilityBuffer.get_info();
+
 	VkDescriptorImageInfo depthPyramid;
 	depthPyramid.sampler = _depthSampler;
 	depthPyramid.imageView = _depthPyramid._defaultView;
@@ -53,13 +87,14 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 
 
 	VkDescriptorSet COMPObjectDataSet;
-	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
 		.bind_buffer(0, &objectBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.bind_buffer(1, &indirectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.bind_buffer(2, &instanceInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.bind_buffer(3, &finalInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.bind_image(4, &depthPyramid, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.bind_buffer(5, &dynamicInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(6, &visibilityInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.build(COMPObjectDataSet);
 
 	//2.initialize cull compute params, binding descriptor set to compute pipeline and push constance
@@ -80,10 +115,12 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 	cullData.frustum[3] = frustumY.z;
 	cullData.drawCount = static_cast<uint32_t>(pass.flat_batches.size());
 	cullData.cullingEnabled = params.frustrumCull;
-	cullData.lodEnabled = false;
-	cullData.occlusionEnabled = params.occlusionCull;
-	cullData.lodBase = 10.f;
-	cullData.lodStep = 1.5f;
+	cullData.lodEnabled = params.lod && CVAR_LodSelect.Get();
+	//the early phase has no pyramid of this frame yet, it trusts last frame visibility instead
+	cullData.occlusionEnabled = params.occlusionCull && params.phase != CullPhase::Early;
+	cullData.cullPhase = static_cast<int>(params.phase);
+	cullData.lodBase = CVAR_LodBase.GetFloat();
+	cullData.lodStep = std::max(CVAR_LodStep.GetFloat(), 1.01f);
 	cullData.pyramidWidth = static_cast<float>(depthPyramidWidth);
 	cullData.pyramidHeight = static_cast<float>(depthPyramidHeight);
 	cullData.viewMat = params.viewmat;//get_view_matrix();
@@ -114,12 +151,18 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 	
 	vkCmdDispatch(cmd, static_cast<uint32_t>((pass.flat_batches.size() / 256)+1), 1, 1);
 
+	if (pass.useDrawCount)
+	{
+		execute_draw_compaction(cmd, pass);
+	}
+
 
 	//barrier the 2 buffers we just wrote for culling, the indirect draw one, and the instances one, so that they can be read well when rendering the pass
 	{
+		//the instance ids are a storage buffer of the vertex shader
 		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.compactedInstanceBuffer._buffer, _graphicsQueueFamily);
 		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
 		VkBufferMemoryBarrier barrier2 = vkinit::buffer_barrier(pass.drawIndirectBuffer._buffer, _graphicsQueueFamily);	
 		barrier2.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
@@ -132,12 +175,18 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 		
 	}
 	//from gpu re-write debug info to cpu
-	if (*CVarSystem::Get()->GetIntCVar("culling.outputIndirectBufferToFile"))
+	if (CVAR_OutputIndirectHandle.Get())
 	{
+		//created on the first dump of this frame slot, read back and freed once the slot comes around again
+		if (get_current_frame().debugOutputBuffer._buffer == VK_NULL_HANDLE)
+		{
+			vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::FrameData);
+			get_current_frame().debugOutputBuffer = create_buffer(200000000, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+		}
 		uint32_t offset = get_current_frame().debugDataOffsets.back();
 		VkBufferCopy debugCopy;
 		debugCopy.dstOffset = offset;
-		debugCopy.size = pass.batches.size() * sizeof(GPUIndirectObject);
+		debugCopy.size = pass.batches.size() * MAX_MESH_LODS * sizeof(GPUIndirectObject);
 		debugCopy.srcOffset = 0;
 		vkCmdCopyBuffer(cmd, pass.drawIndirectBuffer._buffer, get_current_frame().debugOutputBuffer._buffer, 1, &debugCopy);
 		get_current_frame().debugDataOffsets.push_back(offset + static_cast<uint32_t>(debugCopy.size));
@@ -145,12 +194,257 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 	}
 }
 
+void VulkanEngine::execute_draw_compaction(VkCommandBuffer cmd, RenderScene::MeshPass& pass)
+{
+	TracyVkZone(queue_context(cmd), cmd, "Draw Compaction");
+
+	//instance counts are final once the cull dispatch is done
+	VkBufferMemoryBarrier cullBarrier = vkinit::buffer_barrier(pass.drawIndirectBuffer._buffer, _graphicsQueueFamily);
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &cullBarrier, 0, nullptr);
+
+	VkDescriptorBufferInfo indirectInfo = pass.drawIndirectBuffer.get_info();
+
+	VkDescriptorBufferInfo compactedInfo = pass.compactedDrawBuffer.get_info();
+
+	VkDescriptorBufferInfo countInfo = pass.drawCountBuffer.get_info();
+
+	VkDescriptorSet COMPCompactSet;
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
+		.bind_buffer(0, &indirectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(1, &compactedInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(2, &countInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build(COMPCompactSet);
+
+	uint32_t drawCount = static_cast<uint32_t>(pass.batches.size() * MAX_MESH_LODS);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _compactDrawPipeline);
+
+	vkCmdPushConstants(cmd, _compactDrawLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &drawCount);
+
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _compactDrawLayout, 0, 1, &COMPCompactSet, 0, nullptr);
+
+	vkCmdDispatch(cmd, getGroupCount(drawCount, 256), 1, 1);
+
+	//the packed commands and the counts are read by the draw
+	{
+		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.compactedDrawBuffer._buffer, _graphicsQueueFamily);
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+		VkBufferMemoryBarrier barrier2 = vkinit::buffer_barrier(pass.drawCountBuffer._buffer, _graphicsQueueFamily);
+		barrier2.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier2.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+		postCullBarriers.push_back(barrier);
+		postCullBarriers.push_back(barrier2);
+	}
+}
+
+void VulkanEngine::execute_late_cull(VkCommandBuffer cmd, CullParams& params)
+{
+	vkutil::VulkanScopeTimer timer(cmd, _profiler, "Late Cull");
+
+	RenderScene::MeshPass& pass = _renderScene._forwardPass;
+
+	postCullBarriers.clear();
+	cullReadyBarriers.clear();
+
+	//the early draw has to be done with the commands and the instance ids before they are reset
+	if (pass.clearIndirectBuffer._buffer != VK_NULL_HANDLE)
+	{
+		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.drawIndirectBuffer._buffer, _graphicsQueueFamily);
+		barrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		VkBufferMemoryBarrier barrier2 = vkinit::buffer_barrier(pass.compactedInstanceBuffer._buffer, _graphicsQueueFamily);
+		barrier2.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier2.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+		std::vector<VkBufferMemoryBarrier> barriers = { barrier,barrier2 };
+
+		//the early draw read the packed commands too
+		if (pass.useDrawCount)
+		{
+			VkBufferMemoryBarrier barrier3 = vkinit::buffer_barrier(pass.compactedDrawBuffer._buffer, _graphicsQueueFamily);
+			barrier3.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+			barrier3.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+			VkBufferMemoryBarrier barrier4 = vkinit::buffer_barrier(pass.drawCountBuffer._buffer, _graphicsQueueFamily);
+			barrier4.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+			barrier4.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+			barriers.push_back(barrier3);
+			barriers.push_back(barrier4);
+		}
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+	}
+
+	ready_cull_data(pass, cmd);
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, cullReadyBarriers.size(), cullReadyBarriers.data(), 0, nullptr);
+
+	execute_compute_cull(cmd, pass, params);
+
+	CullParams transparentCull = params;
+	transparentCull.phase = CullPhase::Single;
+	execute_compute_cull(cmd, _renderScene._transparentForwardPass, transparentCull);
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, postCullBarriers.size(), postCullBarriers.data(), 0, nullptr);
+
+	//visibility bits written here are read by the early cull of the next frame
+	VkBufferMemoryBarrier visibilityBarrier = vkinit::buffer_barrier(pass.visibilityBuffer._buffer, _graphicsQueueFamily);
+	visibilityBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	visibilityBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &visibilityBarrier, 0, nullptr);
+}
+
+void VulkanEngine::release_cull_results(VkCommandBuffer computeCmd, VkCommandBuffer graphicsCmd)
+{
+	//release and acquire are the same barrier, the compute side keeps the writes and the graphics side the reads
+	std::vector<VkBufferMemoryBarrier> releaseBarriers = postCullBarriers;
+	std::vector<VkBufferMemoryBarrier> acquireBarriers = postCullBarriers;
+	for (size_t i = 0; i < postCullBarriers.size(); i++)
+	{
+		releaseBarriers[i].srcQueueFamilyIndex = _computeQueueFamily;
+		releaseBarriers[i].dstQueueFamilyIndex = _graphicsQueueFamily;
+		releaseBarriers[i].dstAccessMask = 0;
+
+		acquireBarriers[i].srcQueueFamilyIndex = _computeQueueFamily;
+		acquireBarriers[i].dstQueueFamilyIndex = _graphicsQueueFamily;
+		acquireBarriers[i].srcAccessMask = 0;
+	}
+
+	//the depth acquired by this frame's culls and the pyramid reduced from it go back to the graphics queue,
+	//the depth as an attachment for the forward pass
+	std::vector<VkImageMemoryBarrier> releaseImages;
+	std::vector<VkImageMemoryBarrier> acquireImages;
+	VkPipelineStageFlags imageStages = 0;
+	if (_depthReleased)
+	{
+		VkImageMemoryBarrier depthBarrier = vkinit::image_barrier(_depthImage._image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+		depthBarrier.srcQueueFamilyIndex = _computeQueueFamily;
+		depthBarrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+
+		VkImageMemoryBarrier pyramidBarrier = vkinit::image_barrier(_depthPyramid._image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+		pyramidBarrier.srcQueueFamilyIndex = _computeQueueFamily;
+		pyramidBarrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+
+		releaseImages = { depthBarrier, pyramidBarrier };
+		acquireImages = { depthBarrier, pyramidBarrier };
+		for (size_t i = 0; i < releaseImages.size(); i++)
+		{
+			releaseImages[i].dstAccessMask = 0;
+			acquireImages[i].srcAccessMask = 0;
+		}
+		imageStages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	}
+
+	vkCmdPipelineBarrier(computeCmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(), static_cast<uint32_t>(releaseImages.size()), releaseImages.data());
+
+	//the graphics submit waits for the culls at the draw indirect stage, the instance ids are read by the vertex shader
+	vkCmdPipelineBarrier(graphicsCmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | imageStages, 0, 0, nullptr, static_cast<uint32_t>(acquireBarriers.size()), acquireBarriers.data(), static_cast<uint32_t>(acquireImages.size()), acquireImages.data());
+
+	postCullBarriers.clear();
+}
+
+void VulkanEngine::execute_meshlet_cull(VkCommandBuffer cmd, RenderScene::MeshPass& pass, CullParams& params)
+{
+	TracyVkZone(queue_context(cmd), cmd, "Meshlet Cull Dispatch");
+	vkutil::VulkanScopeTimer timer(cmd, _profiler, "Meshlet Cull");
+
+	VkDescriptorBufferInfo objectBufferInfo = _renderScene.objectDataBuffer.get_info();
+
+	VkDescriptorBufferInfo meshletInfo = _renderScene.mergedMeshletBuffer.get_info();
+
+	VkDescriptorBufferInfo instanceInfo = pass.meshletInstanceBuffer.get_info();
+
+	VkDescriptorBufferInfo indirectInfo = pass.meshletIndirectBuffer.get_info();
+
+	VkDescriptorBufferInfo countInfo = pass.meshletCountBuffer.get_info();
+
+	VkDescriptorBufferInfo visibleInfo = pass.meshletVisibleBuffer.get_info();
+
+	VkDescriptorImageInfo depthPyramid;
+	depthPyramid.sampler = _depthSampler;
+	depthPyramid.imageView = _depthPyramid._defaultView;
+	depthPyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkDescriptorSet COMPMeshletSet;
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
+		.bind_buffer(0, &objectBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(1, &meshletInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(2, &instanceInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(3, &indirectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(4, &countInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(5, &visibleInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_image(6, &depthPyramid, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build(COMPMeshletSet);
+
+	glm::mat4 projection = params.projmat;
+	glm::mat4 projectionT = transpose(projection);
+
+	glm::vec4 frustumX = normalizePlane(projectionT[3] + projectionT[0]); // x + w < 0
+	glm::vec4 frustumY = normalizePlane(projectionT[3] + projectionT[1]); // y + w < 0
+
+	MeshletCullData cullData = {};
+	cullData.viewMat = params.viewmat;
+	cullData.P00 = projection[0][0];
+	cullData.P11 = projection[1][1];
+	cullData.znear = 0.1f;
+	cullData.zfar = params.drawDist;
+	cullData.frustum[0] = frustumX.x;
+	cullData.frustum[1] = frustumX.z;
+	cullData.frustum[2] = frustumY.y;
+	cullData.frustum[3] = frustumY.z;
+	cullData.pyramidWidth = static_cast<float>(depthPyramidWidth);
+	cullData.pyramidHeight = static_cast<float>(depthPyramidHeight);
+	cullData.meshletCount = pass.meshletInstanceCount;
+	cullData.cullingEnabled = params.frustrumCull;
+	cullData.occlusionEnabled = params.occlusionCull;
+	cullData.coneCullEnabled = CVAR_MeshletConeCull.Get();
+	cullData.distanceCheck = params.drawDist <= 10000;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletCullPipeline);
+
+	vkCmdPushConstants(cmd, _meshletCullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullData), &cullData);
+
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletCullLayout, 0, 1, &COMPMeshletSet, 0, nullptr);
+
+	vkCmdDispatch(cmd, getGroupCount(pass.meshletInstanceCount, 256), 1, 1);
+
+	//the draw commands and the object ids are read by the forward pass
+	{
+		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.meshletVisibleBuffer._buffer, _graphicsQueueFamily);
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		VkBufferMemoryBarrier barrier2 = vkinit::buffer_barrier(pass.meshletIndirectBuffer._buffer, _graphicsQueueFamily);
+		barrier2.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier2.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+		VkBufferMemoryBarrier barrier3 = vkinit::buffer_barrier(pass.meshletCountBuffer._buffer, _graphicsQueueFamily);
+		barrier3.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier3.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+		postCullBarriers.push_back(barrier);
+		postCullBarriers.push_back(barrier2);
+		postCullBarriers.push_back(barrier3);
+	}
+}
+
 #include <future>
 void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 {
 	
-	TracyVkZone(_graphicsQueueContext, get_current_frame()._mainCommandBuffer, "Data Refresh");
+	TracyVkZone(_graphicsQueueContext, cmd, "Data Refresh");
 	ZoneScopedNC("Draw Upload", tracy::Color::Blue);
+	//the buffers mapped and copied from every frame, the gpu side ones set their own category
+	vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::Staging);
 	//1. ready for render scene object
 	//prepare for upload object data to gpu
 	if (_renderScene.dirtyObjects.size() > 0)
@@ -160,7 +454,8 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 		size_t copySize = _renderScene.renderables.size() * sizeof(GPUObjectData);
 		if (_renderScene.objectDataBuffer._size < copySize)
 		{
-			reallocate_buffer(_renderScene.objectDataBuffer, copySize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			vkutil::MemoryScope sceneScope(vkutil::MemoryCategory::Scene);
+			reallocate_buffer(_renderScene.objectDataBuffer, copySize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, 0, true);
 		}
 
 		//if 80% of the objects are dirty, then just reupload the whole thing
@@ -245,6 +540,7 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 
 			VkDescriptorBufferInfo targetInfo = _renderScene.objectDataBuffer.get_info();
 
+			//the source buffers only live for this frame, so this set is not cached
 			VkDescriptorSet COMPObjectDataSet;
 			vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
 				.bind_buffer(0, &indexData, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
@@ -276,23 +572,80 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 	{
 		//per-pass
 		auto& pass = *passes[p];
+		vkutil::MemoryScope passScope(vkutil::MemoryCategory::Passes);
 
 
 		//reallocate the gpu side buffers if needed
 
-		if (pass.drawIndirectBuffer._size < pass.batches.size() * sizeof(GPUIndirectObject))
+		//one command per lod level of every batch
+		if (pass.drawIndirectBuffer._size < pass.batches.size() * MAX_MESH_LODS * sizeof(GPUIndirectObject))
 		{
-			reallocate_buffer(pass.drawIndirectBuffer, pass.batches.size() * sizeof(GPUIndirectObject), VK_BUFFER_USAGE_TRANSFER_SRC_BIT |VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			reallocate_buffer(pass.drawIndirectBuffer, pass.batches.size() * MAX_MESH_LODS * sizeof(GPUIndirectObject), VK_BUFFER_USAGE_TRANSFER_SRC_BIT |VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 		}
 
-		if (pass.compactedInstanceBuffer._size < pass.flat_batches.size() * sizeof(uint32_t))
+		//every lod command of a batch has room for all its instances
+		if (pass.compactedInstanceBuffer._size < pass.flat_batches.size() * MAX_MESH_LODS * sizeof(uint32_t))
 		{
-			reallocate_buffer(pass.compactedInstanceBuffer, pass.flat_batches.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			reallocate_buffer(pass.compactedInstanceBuffer, pass.flat_batches.size() * MAX_MESH_LODS * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 		}
 
 		if (pass.passObjectsBuffer._size < pass.flat_batches.size() * sizeof(GPUInstance))
 		{
-			reallocate_buffer(pass.passObjectsBuffer, pass.flat_batches.size() * sizeof(GPUInstance), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			reallocate_buffer(pass.passObjectsBuffer, pass.flat_batches.size() * sizeof(GPUInstance), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, 0, true);
+		}
+
+		//visibility bits are indexed by object id, a new buffer starts cleared so the late cull fills it in one frame
+		size_t visibilitySize = std::max<size_t>((_renderScene.renderables.size() + 31) / 32, 1) * sizeof(uint32_t);
+		if (pass.visibilityBuffer._size < visibilitySize)
+		{
+			reallocate_buffer(pass.visibilityBuffer, visibilitySize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			pass.needsVisibilityClear = true;
+		}
+
+		//meshlet culling only runs on the opaque forward pass, it needs the merged meshlet buffer
+		bool useMeshlets = CVAR_MeshletCull.Get() && pass.type == MeshpassType::Forward
+			&& pass.meshletInstanceCount > 0 && _renderScene.mergedMeshletBuffer._buffer != VK_NULL_HANDLE;
+		//meshlet instances are only filled by the instance refresh, switching the cvar on needs one
+		if (useMeshlets != pass.useMeshlets)
+		{
+			pass.needsInstanceRefresh = true;
+		}
+		pass.useMeshlets = useMeshlets;
+
+		//the meshlet path already writes its draws packed per batch
+		pass.useDrawCount = CVAR_DrawIndirectCount.Get() && _supportsDrawIndirectCount && !pass.useMeshlets;
+
+		if (pass.useDrawCount)
+		{
+			if (pass.compactedDrawBuffer._size < pass.batches.size() * MAX_MESH_LODS * sizeof(GPUIndirectObject))
+			{
+				reallocate_buffer(pass.compactedDrawBuffer, pass.batches.size() * MAX_MESH_LODS * sizeof(GPUIndirectObject), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			}
+			if (pass.drawCountBuffer._size < pass.batches.size() * sizeof(uint32_t))
+			{
+				reallocate_buffer(pass.drawCountBuffer, pass.batches.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			}
+		}
+
+		if (pass.useMeshlets)
+		{
+			if (pass.meshletInstanceBuffer._size < pass.meshletInstanceCount * sizeof(GPUMeshletInstance))
+			{
+				reallocate_buffer(pass.meshletInstanceBuffer, pass.meshletInstanceCount * sizeof(GPUMeshletInstance), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, 0, true);
+				pass.needsInstanceRefresh = true;
+			}
+			if (pass.meshletIndirectBuffer._size < pass.meshletInstanceCount * sizeof(GPUIndirectObject))
+			{
+				reallocate_buffer(pass.meshletIndirectBuffer, pass.meshletInstanceCount * sizeof(GPUIndirectObject), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			}
+			if (pass.meshletVisibleBuffer._size < pass.meshletInstanceCount * sizeof(uint32_t))
+			{
+				reallocate_buffer(pass.meshletVisibleBuffer, pass.meshletInstanceCount * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			}
+			if (pass.meshletCountBuffer._size < pass.batches.size() * sizeof(uint32_t))
+			{
+				reallocate_buffer(pass.meshletCountBuffer, pass.batches.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			}
 		}
 	}
 
@@ -315,7 +668,9 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 			ZoneScopedNC("Refresh Indirect Buffer", tracy::Color::Red);
 			//newbuffer = direct buffer ->VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
 			//drawIndirectBuffer
-			AllocatedBuffer<GPUIndirectObject> newBuffer = create_buffer(sizeof(GPUIndirectObject) * pass.batches.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			//the forward culls copy it on the compute queue, it stays as the clear buffer of the pass
+			vkutil::MemoryScope passScope(vkutil::MemoryCategory::Passes);
+			AllocatedBuffer<GPUIndirectObject> newBuffer = create_buffer(sizeof(GPUIndirectObject) * pass.batches.size() * MAX_MESH_LODS, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, 0, true);
 
 			GPUIndirectObject* indirect = map_buffer(newBuffer);
 
@@ -386,6 +741,39 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 
 			uploadBarriers.push_back(barrier);
 
+			//meshlet instances share the refresh of the object instances
+			if (pass.useMeshlets)
+			{
+				ZoneScopedNC("Refresh Meshlet Instances", tracy::Color::Red);
+
+				AllocatedBuffer<GPUMeshletInstance> meshletBuffer = create_buffer(sizeof(GPUMeshletInstance) * pass.meshletInstanceCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+				GPUMeshletInstance* meshletData = map_buffer(meshletBuffer);
+				async_calls.push_back(std::async(std::launch::async, [=] {
+
+					pScene->fill_meshletInstancesArray(meshletData, *ppass);
+
+				}));
+				unmaps.push_back(meshletBuffer);
+
+				get_current_frame()._frameDeletionQueue.push_function([=]() {
+
+					vmaDestroyBuffer(_allocator, meshletBuffer._buffer, meshletBuffer._allocation);
+					});
+
+				VkBufferCopy meshletCopy;
+				meshletCopy.dstOffset = 0;
+				meshletCopy.size = pass.meshletInstanceCount * sizeof(GPUMeshletInstance);
+				meshletCopy.srcOffset = 0;
+				vkCmdCopyBuffer(cmd, meshletBuffer._buffer, pass.meshletInstanceBuffer._buffer, 1, &meshletCopy);
+
+				VkBufferMemoryBarrier meshletBarrier = vkinit::buffer_barrier(pass.meshletInstanceBuffer._buffer, _graphicsQueueFamily);
+				meshletBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+				meshletBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+				uploadBarriers.push_back(meshletBarrier);
+			}
+
 			pass.needsInstanceRefresh = false;
 		}
 	}
@@ -410,6 +798,16 @@ void VulkanEngine::draw_objects_forward(VkCommandBuffer cmd, RenderScene::MeshPa
 	if (pass.batches.size() <= 0) return;
 
 	ZoneScopedNC("DrawObjects", tracy::Color::Blue);
+
+	PassDrawData drawData = prepare_forward_draw(pass);
+
+	vkCmdSetDepthBias(cmd, 0, 0, 0);
+
+	execute_draw_commands(cmd, pass, drawData.objectDataSet, drawData.dynamicOffsets, drawData.globalSet, stats);
+}
+
+PassDrawData VulkanEngine::prepare_forward_draw(RenderScene::MeshPass& pass)
+{
 	//make a model view matrix for rendering the object
 	//camera view
 	glm::mat4 view = _camera.get_view_matrix();
@@ -455,7 +853,8 @@ void VulkanEngine::draw_objects_forward(VkCommandBuffer cmd, RenderScene::MeshPa
 	camInfo.range = sizeof(GPUCameraData);
 	//std::cout << " forward cameraInfo.range:" << sizeof(GPUCameraData) << std::endl;
 
-	VkDescriptorBufferInfo instanceInfo = pass.compactedInstanceBuffer.get_info();
+	//meshlet draws index their own object id array
+	VkDescriptorBufferInfo instanceInfo = pass.useMeshlets ? pass.meshletVisibleBuffer.get_info() : pass.compactedInstanceBuffer.get_info();
 
 
 	VkDescriptorImageInfo shadowImage;
@@ -464,29 +863,31 @@ void VulkanEngine::draw_objects_forward(VkCommandBuffer cmd, RenderScene::MeshPa
 	shadowImage.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 	VkDescriptorSet GlobalSet;
-	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
 		.bind_buffer(0, &camInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT)
 		.bind_buffer(1, &sceneInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT| VK_SHADER_STAGE_FRAGMENT_BIT)
 		.bind_image(2, &shadowImage, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 		.build(GlobalSet);
 
 	VkDescriptorSet ObjectDataSet;
-	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
 		.bind_buffer(0, &objectBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
 		.bind_buffer(1, &instanceInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
 		.build(ObjectDataSet);
-	vkCmdSetDepthBias(cmd, 0, 0, 0);
 
-	std::vector<uint32_t> dynamic_offsets;
-	dynamic_offsets.push_back(camera_data_offset);
-	dynamic_offsets.push_back(scene_data_offset);
+	PassDrawData drawData;
+	drawData.globalSet = GlobalSet;
+	drawData.objectDataSet = ObjectDataSet;
+	drawData.dynamicOffsets.push_back(camera_data_offset);
+	drawData.dynamicOffsets.push_back(scene_data_offset);
 	//std::cout << "forward scene_data_offset:" << scene_data_offset << std::endl;
 	//std::cout << "forward camera_data_offset:"<<camera_data_offset << std::endl;
-	execute_draw_commands(cmd, pass, ObjectDataSet, dynamic_offsets, GlobalSet);
+	return drawData;
 }
 
 
-void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshPass& pass, VkDescriptorSet ObjectDataSet, std::vector<uint32_t> dynamic_offsets, VkDescriptorSet GlobalSet)
+void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshPass& pass, VkDescriptorSet ObjectDataSet, std::vector<uint32_t> dynamic_offsets, VkDescriptorSet GlobalSet,
+	EngineStats& passStats, size_t firstMultibatch, size_t endMultibatch)
 {
 	if(pass.batches.size() > 0)
 	{
@@ -499,14 +900,20 @@ void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshP
 		VkDeviceSize offset = 0;
 		vkCmdBindVertexBuffers(cmd, 0, 1, &_renderScene.mergedVertexBuffer._buffer, &offset);
 
-		vkCmdBindIndexBuffer(cmd, _renderScene.mergedIndexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindIndexBuffer(cmd, _renderScene.mergedIndexBuffer._buffer, 0, _renderScene.mergedIndexType);
 
-		stats.objects = static_cast<uint32_t>(pass.flat_batches.size());
-		for (int i = 0; i < pass.multibatches.size(); i++)
+		endMultibatch = std::min(endMultibatch, pass.multibatches.size());
+		for (size_t i = firstMultibatch; i < endMultibatch; i++)
 		{
 			auto& multibatch = pass.multibatches[i];
 			auto& instanceDraw = pass.batches[multibatch.first];
 
+			//instances of this slice only, the workers' counts add up to the pass
+			for (uint32_t b = multibatch.first; b < multibatch.first + multibatch.count; b++)
+			{
+				passStats.objects += pass.batches[b].count;
+			}
+
 			VkPipeline newPipeline = instanceDraw.material.shaderPass->pipeline;
 			VkPipelineLayout newLayout = instanceDraw.material.shaderPass->layout;
 			VkDescriptorSet newMaterialSet = instanceDraw.material.materialSet;
@@ -537,7 +944,7 @@ void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshP
 					VkDeviceSize offset = 0;
 					vkCmdBindVertexBuffers(cmd, 0, 1, &_renderScene.mergedVertexBuffer._buffer, &offset);
 
-					vkCmdBindIndexBuffer(cmd, _renderScene.mergedIndexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+					vkCmdBindIndexBuffer(cmd, _renderScene.mergedIndexBuffer._buffer, 0, _renderScene.mergedIndexType);
 					lastMesh = nullptr;
 				}
 			}
@@ -555,17 +962,39 @@ void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshP
 
 			bool bHasIndices = drawMesh->_indices.size() > 0;
 			if (!bHasIndices) {
-				stats.draws++;
-				stats.triangles += static_cast<int32_t>(drawMesh->_vertices.size() / 3) * instanceDraw.count;
+				passStats.draws++;
+				passStats.triangles += static_cast<int32_t>(drawMesh->_vertices.size() / 3) * instanceDraw.count;
 				vkCmdDraw(cmd, static_cast<uint32_t>(drawMesh->_vertices.size()), instanceDraw.count, 0, instanceDraw.first);
 			}
+			else if (pass.useMeshlets) {
+				passStats.triangles += static_cast<int32_t>(drawMesh->get_lod(0).indexCount / 3) * instanceDraw.count;
+
+				//meshlet commands of a multibatch are contiguous, slots past the visible ones stay zeroed
+				auto& lastDraw = pass.batches[multibatch.first + multibatch.count - 1];
+				uint32_t drawCount = lastDraw.meshletFirst + lastDraw.meshletCount - instanceDraw.meshletFirst;
+
+				vkCmdDrawIndexedIndirect(cmd, pass.meshletIndirectBuffer._buffer, instanceDraw.meshletFirst * sizeof(GPUIndirectObject), drawCount, sizeof(GPUIndirectObject));
+
+				passStats.draws++;
+				passStats.drawcalls += drawCount;
+			}
 			else {
-				stats.triangles += static_cast<int32_t>(drawMesh->_indices.size() / 3) * instanceDraw.count;
+				//lod 0 triangles, the cpu doesnt know which levels the cull picked
+				passStats.triangles += static_cast<int32_t>(drawMesh->get_lod(0).indexCount / 3) * instanceDraw.count;
 
-				vkCmdDrawIndexedIndirect(cmd, pass.drawIndirectBuffer._buffer, multibatch.first * sizeof(GPUIndirectObject), multibatch.count, sizeof(GPUIndirectObject));
+				if (pass.useDrawCount)
+				{
+					//only the non empty commands, packed at the front of the multibatch range
+					vkCmdDrawIndexedIndirectCount(cmd, pass.compactedDrawBuffer._buffer, multibatch.first * MAX_MESH_LODS * sizeof(GPUIndirectObject),
+						pass.drawCountBuffer._buffer, multibatch.first * sizeof(uint32_t), multibatch.count * MAX_MESH_LODS, sizeof(GPUIndirectObject));
+				}
+				else
+				{
+					vkCmdDrawIndexedIndirect(cmd, pass.drawIndirectBuffer._buffer, multibatch.first * MAX_MESH_LODS * sizeof(GPUIndirectObject), multibatch.count * MAX_MESH_LODS, sizeof(GPUIndirectObject));
+				}
 
-				stats.draws++;
-				stats.drawcalls += instanceDraw.count;
+				passStats.draws++;
+				passStats.drawcalls += instanceDraw.count;
 			}
 		}
 	}
@@ -574,7 +1003,16 @@ void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshP
 void VulkanEngine::draw_objects_shadow(VkCommandBuffer cmd, RenderScene::MeshPass& pass)
 {
 	ZoneScopedNC("DrawObjects", tracy::Color::Blue);
-	
+
+	PassDrawData drawData = prepare_shadow_draw(pass);
+
+	vkCmdSetDepthBias(cmd, CVAR_ShadowBias.GetFloat(), 0, CVAR_SlopeBias.GetFloat());
+
+	execute_draw_commands(cmd, pass, drawData.objectDataSet, drawData.dynamicOffsets, drawData.globalSet, stats);
+}
+
+PassDrawData VulkanEngine::prepare_shadow_draw(RenderScene::MeshPass& pass)
+{
 	glm::mat4 view = _mainLight.get_view();
 
 	glm::mat4 projection = _mainLight.get_projection();
@@ -599,22 +1037,184 @@ void VulkanEngine::draw_objects_shadow(VkCommandBuffer cmd, RenderScene::MeshPas
 
 
 	VkDescriptorSet GlobalSet;
-	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
 		.bind_buffer(0, &camInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT)
 		.build(GlobalSet);
 
 	VkDescriptorSet ObjectDataSet;
-	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+	vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
 		.bind_buffer(0, &objectBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
 		.bind_buffer(1, &instanceInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
 		.build(ObjectDataSet);
 
-	vkCmdSetDepthBias(cmd, CVAR_ShadowBias.GetFloat(), 0, CVAR_SlopeBias.GetFloat());
-
-	std::vector<uint32_t> dynamic_offsets;
-	dynamic_offsets.push_back(camera_data_offset);
+	PassDrawData drawData;
+	drawData.globalSet = GlobalSet;
+	drawData.objectDataSet = ObjectDataSet;
+	drawData.dynamicOffsets.push_back(camera_data_offset);
 	//std::cout << "shadow camera_data_offset:" << camera_data_offset << std::endl;
-	execute_draw_commands(cmd, pass, ObjectDataSet, dynamic_offsets, GlobalSet);
+	return drawData;
+}
+
+VkCommandBuffer VulkanEngine::begin_secondary(RecordContext& context, VkRenderPass renderPass, VkFramebuffer framebuffer)
+{
+	if (context._usedBuffers == context._secondaryBuffers.size())
+	{
+		VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(context._commandPool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		VkCommandBuffer newBuffer;
+		vkAllocateCommandBuffers(_device, &allocInfo, &newBuffer);
+		context._secondaryBuffers.push_back(newBuffer);
+	}
+	VkCommandBuffer cmd = context._secondaryBuffers[context._usedBuffers++];
+
+	VkCommandBufferInheritanceInfo inheritance = {};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.renderPass = renderPass;
+	inheritance.subpass = 0;
+	inheritance.framebuffer = framebuffer;
+	//the pass pipeline statistics query of the profiler stays active in the primary
+	inheritance.pipelineStatistics = vkutil::PIPELINE_STATISTICS;
+
+	VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+	beginInfo.pInheritanceInfo = &inheritance;
+	vkBeginCommandBuffer(cmd, &beginInfo);
+
+	return cmd;
+}
+
+void VulkanEngine::record_passes_parallel(bool twoPhase)
+{
+	ZoneScopedNC("Record Passes", tracy::Color::Blue);
+
+	FrameData& frame = get_current_frame();
+	for (RecordContext& context : frame._recordContexts)
+	{
+		vkResetCommandPool(_device, context._commandPool, 0);
+		context._usedBuffers = 0;
+	}
+	_shadowSecondaries.clear();
+	_forwardEarlySecondaries.clear();
+	_forwardSecondaries.clear();
+	_transparentSecondaries.clear();
+
+	//one job per pass and phase, every worker records its slice of the multibatches
+	struct RecordJob {
+		const char* name;
+		RenderScene::MeshPass* pass;
+		PassDrawData drawData;
+		VkRenderPass renderPass;
+		VkFramebuffer framebuffer;
+		VkExtent2D extent;
+		bool shadowBias;
+		bool countObjects;//the late opaque phase draws the objects of the early one again
+		std::vector<VkCommandBuffer>* output;
+		std::vector<VkCommandBuffer> slices;
+		std::vector<EngineStats> sliceStats;
+	};
+	std::vector<RecordJob> jobs;
+
+	auto add_job = [&](const char* name, RenderScene::MeshPass& pass, const PassDrawData& drawData, VkRenderPass renderPass, VkFramebuffer framebuffer,
+		VkExtent2D extent, bool shadowBias, bool countObjects, std::vector<VkCommandBuffer>& output) {
+		RecordJob job{ name, &pass, drawData, renderPass, framebuffer, extent, shadowBias, countObjects, &output };
+		job.slices.resize(_recordWorkerCount, VK_NULL_HANDLE);
+		job.sliceStats.resize(_recordWorkerCount, EngineStats{});
+		jobs.push_back(std::move(job));
+	};
+
+	//dynamic data and descriptor sets are not thread safe, build them before going wide
+	bool shadows = !CVAR_FreezeShadowsHandle.Get() && CVAR_Shadowcast.Get() && _renderScene._shadowPass.batches.size() > 0;
+	if (shadows)
+	{
+		add_job("Shadow Pass", _renderScene._shadowPass, prepare_shadow_draw(_renderScene._shadowPass), _shadowPass, _shadowFramebuffer, _shadowExtent, true, true, _shadowSecondaries);
+	}
+	if (_renderScene._forwardPass.batches.size() > 0)
+	{
+		PassDrawData forwardData = prepare_forward_draw(_renderScene._forwardPass);
+		if (twoPhase)
+		{
+			add_job("Forward Pass", _renderScene._forwardPass, forwardData, _renderPass, _forwardFramebuffer, _windowExtent, false, true, _forwardEarlySecondaries);
+			add_job("Forward Pass Late", _renderScene._forwardPass, forwardData, _forwardLatePass, _forwardFramebuffer, _windowExtent, false, false, _forwardSecondaries);
+		}
+		else
+		{
+			add_job("Forward Pass", _renderScene._forwardPass, forwardData, _renderPass, _forwardFramebuffer, _windowExtent, false, true, _forwardSecondaries);
+		}
+	}
+	VkRenderPass lastForwardPass = twoPhase ? _forwardLatePass : _renderPass;
+	if (_renderScene._transparentForwardPass.batches.size() > 0)
+	{
+		add_job("Transparent Pass", _renderScene._transparentForwardPass, prepare_forward_draw(_renderScene._transparentForwardPass), lastForwardPass, _forwardFramebuffer, _windowExtent, false, true, _transparentSecondaries);
+	}
+
+	_recordWorkers.dispatch([&](uint32_t w) {
+		RecordContext& context = frame._recordContexts[w];
+		for (RecordJob& job : jobs)
+		{
+			size_t count = job.pass->multibatches.size();
+			size_t first = count * w / _recordWorkerCount;
+			size_t end = count * (w + 1) / _recordWorkerCount;
+			if (first == end) continue;
+
+			ZoneScopedNC("Record Secondary", tracy::Color::Blue);
+			ZoneText(job.name, strlen(job.name));
+			vktrace::Zone jobZone(job.name, "job");
+
+			VkCommandBuffer cmd = begin_secondary(context, job.renderPass, job.framebuffer);
+
+			VkViewport viewport{ 0.f, 0.f, (float)job.extent.width, (float)job.extent.height, 0.f, 1.f };
+			VkRect2D scissor{ { 0, 0 }, job.extent };
+			vkCmdSetViewport(cmd, 0, 1, &viewport);
+			vkCmdSetScissor(cmd, 0, 1, &scissor);
+			if (job.shadowBias)
+			{
+				vkCmdSetDepthBias(cmd, CVAR_ShadowBias.GetFloat(), 0, CVAR_SlopeBias.GetFloat());
+			}
+			else
+			{
+				vkCmdSetDepthBias(cmd, 0, 0, 0);
+			}
+
+			execute_draw_commands(cmd, *job.pass, job.drawData.objectDataSet, job.drawData.dynamicOffsets, job.drawData.globalSet, job.sliceStats[w], first, end);
+
+			vkEndCommandBuffer(cmd);
+			job.slices[w] = cmd;
+		}
+	});
+
+	//imgui goes on top of the last forward phase, recorded here while the workers run
+	//headless runs have no imgui context
+	VkCommandBuffer imguiCmd = VK_NULL_HANDLE;
+	if (!_headless)
+	{
+		ZoneScopedNC("Record Imgui", tracy::Color::Blue);
+		imguiCmd = begin_secondary(frame._recordContexts[_recordWorkerCount], lastForwardPass, _forwardFramebuffer);
+		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), imguiCmd);
+		vkEndCommandBuffer(imguiCmd);
+	}
+
+	_recordWorkers.wait();
+
+	//slices keep the multibatch order, so the transparent sorting survives
+	stats.drawcalls = 0;
+	stats.draws = 0;
+	stats.objects = 0;
+	stats.triangles = 0;
+	for (RecordJob& job : jobs)
+	{
+		for (uint32_t w = 0; w < _recordWorkerCount; w++)
+		{
+			if (job.slices[w] == VK_NULL_HANDLE) continue;
+
+			job.output->push_back(job.slices[w]);
+			stats.drawcalls += job.sliceStats[w].drawcalls;
+			stats.draws += job.sliceStats[w].draws;
+			stats.triangles += job.sliceStats[w].triangles;
+			if (job.countObjects)
+			{
+				stats.objects += job.sliceStats[w].objects;
+			}
+		}
+	}
+	_imguiSecondary = imguiCmd;
 }
 
 
@@ -623,21 +1223,37 @@ struct alignas(16) DepthReduceData
 {
 	glm::vec2 imageSize;
 };
-inline uint32_t getGroupCount(uint32_t threadCount, uint32_t localSize)
+
+//must match MAX_LEVELS of depthReduceSinglePass.comp
+constexpr int MAX_SINGLE_PASS_PYRAMID_LEVELS = 13;
+
+struct DepthReduceSinglePassData
 {
-	return (threadCount + localSize - 1) / localSize;
-}
+	glm::ivec2 imageSize;//level 0 size
+	int levelCount;
+	uint32_t groupCount;
+};
 
 void VulkanEngine::reduce_depth(VkCommandBuffer cmd)
 {
+	if (CVAR_SinglePassPyramid.Get() && _depthReduceSinglePassPipeline != VK_NULL_HANDLE && depthPyramidLevels <= MAX_SINGLE_PASS_PYRAMID_LEVELS)
+	{
+		reduce_depth_single_pass(cmd);
+		return;
+	}
+
 	vkutil::VulkanScopeTimer timer(cmd, _profiler, "Depth Reduce");
 
-	VkImageMemoryBarrier depthReadBarriers[] =
+	//on the compute queue the depth is already in read layout, acquire_depth did the transition
+	if (!_asyncCompute)
 	{
-		vkinit::image_barrier(_depthImage._image, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
-	};
+		VkImageMemoryBarrier depthReadBarriers[] =
+		{
+			vkinit::image_barrier(_depthImage._image, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
+		};
 
-	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, depthReadBarriers);
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, depthReadBarriers);
+	}
 
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReducePipeline);
 
@@ -663,7 +1279,7 @@ void VulkanEngine::reduce_depth(VkCommandBuffer cmd)
 		}
 
 		VkDescriptorSet depthSet;
-		vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+		vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorSetCache)
 			.bind_image(0, &destTarget, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT)
 			.bind_image(1, &sourceTarget, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
 			.build(depthSet);
@@ -689,10 +1305,117 @@ void VulkanEngine::reduce_depth(VkCommandBuffer cmd)
 
 		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &reduceBarrier);
 	}
+	//the compute queue keeps the depth, the next forward pass starts from an undefined layout
+	if (_asyncCompute)
+	{
+		return;
+	}
+
 	//Configure and bind the barrier, 
 	//in order to wait for the shader to fully write the data to the entry depth pyram image
 	VkImageMemoryBarrier depthWriteBarrier = vkinit::image_barrier(_depthImage._image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
 
 	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &depthWriteBarrier);
 
-}
\ No newline at end of file
+}
+
+void VulkanEngine::release_depth(VkCommandBuffer graphicsCmd)
+{
+	//same transition as reduce_depth, it is done once for both queues
+	VkImageMemoryBarrier release = vkinit::image_barrier(_depthImage._image, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+	release.srcQueueFamilyIndex = _graphicsQueueFamily;
+	release.dstQueueFamilyIndex = _computeQueueFamily;
+
+	vkCmdPipelineBarrier(graphicsCmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &release);
+}
+
+void VulkanEngine::acquire_depth(VkCommandBuffer computeCmd)
+{
+	VkImageMemoryBarrier acquire = vkinit::image_barrier(_depthImage._image, 0, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+	acquire.srcQueueFamilyIndex = _graphicsQueueFamily;
+	acquire.dstQueueFamilyIndex = _computeQueueFamily;
+
+	vkCmdPipelineBarrier(computeCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &acquire);
+}
+
+void VulkanEngine::reduce_depth_single_pass(VkCommandBuffer cmd)
+{
+	vkutil::VulkanScopeTimer timer(cmd, _profiler, "Depth Reduce Single Pass");
+
+	//the last workgroup to finish builds the small levels, reset the counter
+	vkCmdFillBuffer(cmd, _depthReduceCounterBuffer._buffer, 0, sizeof(uint32_t), 0);
+
+	VkBufferMemoryBarrier counterBarrier = vkinit::buffer_barrier(_depthReduceCounterBuffer._buffer, _graphicsQueueFamily);
+	counterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	VkImageMemoryBarrier reduceBarriers[] =
+	{
+		//previous frame culling read the pyramid
+		vkinit::image_barrier(_depthPyramid._image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT),
+		vkinit::image_barrier(_depthImage._image, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
+	};
+
+	//on the compute queue the depth is already in read layout and fragment stages dont exist
+	VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	uint32_t reduceBarrierCount = 1;
+	if (!_asyncCompute)
+	{
+		srcStages |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		reduceBarrierCount = 2;
+	}
+
+	vkCmdPipelineBarrier(cmd, srcStages, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 1, &counterBarrier, reduceBarrierCount, reduceBarriers);
+
+	//images never change after init, so the set is built once
+	if (_depthReduceSinglePassSet == VK_NULL_HANDLE)
+	{
+		VkDescriptorImageInfo sourceTarget;
+		sourceTarget.sampler = _depthSampler;
+		sourceTarget.imageView = _depthImage._defaultView;
+		sourceTarget.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		//every array element has to be valid, unused levels repeat the last one and are never written
+		VkDescriptorImageInfo destTargets[MAX_SINGLE_PASS_PYRAMID_LEVELS];
+		for (int i = 0; i < MAX_SINGLE_PASS_PYRAMID_LEVELS; i++)
+		{
+			destTargets[i].sampler = _depthSampler;
+			destTargets[i].imageView = depthPyramidMips[std::min(i, depthPyramidLevels - 1)];
+			destTargets[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		}
+
+		VkDescriptorBufferInfo counterInfo = _depthReduceCounterBuffer.get_info();
+
+		vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, _descriptorAllocator)
+			.bind_image(0, &sourceTarget, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_images(1, destTargets, MAX_SINGLE_PASS_PYRAMID_LEVELS, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_buffer(2, &counterInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.build(_depthReduceSinglePassSet);
+	}
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReduceSinglePassPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReduceSinglePassLayout, 0, 1, &_depthReduceSinglePassSet, 0, nullptr);
+
+	//a group reduces a 64x64 tile down to one texel
+	uint32_t groupsX = getGroupCount(depthPyramidWidth, 64);
+	uint32_t groupsY = getGroupCount(depthPyramidHeight, 64);
+
+	DepthReduceSinglePassData reduceData;
+	reduceData.imageSize = glm::ivec2(depthPyramidWidth, depthPyramidHeight);
+	reduceData.levelCount = depthPyramidLevels;
+	reduceData.groupCount = groupsX * groupsY;
+
+	vkCmdPushConstants(cmd, _depthReduceSinglePassLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(reduceData), &reduceData);
+	vkCmdDispatch(cmd, groupsX, groupsY, 1);
+
+	VkImageMemoryBarrier pyramidReadBarrier = vkinit::image_barrier(_depthPyramid._image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &pyramidReadBarrier);
+
+	if (_asyncCompute)
+	{
+		return;
+	}
+
+	VkImageMemoryBarrier depthWriteBarrier = vkinit::image_barrier(_depthImage._image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, 0, 0, 0, 1, &depthWriteBarrier);
+}
@@ -0,0 +1,301 @@
+﻿#include <vk_memory.h>
+#include <fstream>
+#include "json.hpp"
+#include "imgui.h"
+#include "cvars.h"
+#include "logger.h"
+#include "vk_trace.h"
+
+AutoCVar_Float CVAR_MemoryWarning("gpu.memoryWarning", "Warn when a memory heap uses this fraction of its budget", 0.9, CVarFlags::EditFloatDrag);
+
+namespace vkutil {
+
+	namespace {
+		thread_local MemoryCategory currentCategory = MemoryCategory::Untagged;
+
+		//the panel report walks every allocation, once a second is enough
+		constexpr uint32_t REPORT_REFRESH_FRAMES = 60;
+
+		double to_mb(VkDeviceSize bytes)
+		{
+			return double(bytes) / (1024.0 * 1024.0);
+		}
+
+		MemoryCategory parse_category(const std::string& name)
+		{
+			for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+			{
+				if (name == memory_category_name(static_cast<MemoryCategory>(i)))
+				{
+					return static_cast<MemoryCategory>(i);
+				}
+			}
+			return MemoryCategory::Untagged;
+		}
+
+		//allocations are the objects with a Type and a Size, free ranges have the FREE type
+		void collect_allocations(const nlohmann::json& node, MemoryReport& report, MemoryHeapUsage& heap)
+		{
+			if (node.is_object() && node.contains("Type") && node.contains("Size") && node["Type"].is_string())
+			{
+				if (node["Type"] == "FREE") return;
+
+				MemoryCategory category = MemoryCategory::Untagged;
+				if (node.contains("UserData") && node["UserData"].is_string())
+				{
+					category = parse_category(node["UserData"].get<std::string>());
+				}
+				VkDeviceSize size = node["Size"].get<VkDeviceSize>();
+				size_t index = static_cast<size_t>(category);
+
+				report.categoryBytes[index] += size;
+				report.categoryAllocations[index]++;
+				heap.categories[index] += size;
+				return;
+			}
+
+			if (node.is_object() || node.is_array())
+			{
+				for (auto& child : node)
+				{
+					collect_allocations(child, report, heap);
+				}
+			}
+		}
+	}
+
+	const char* memory_category_name(MemoryCategory category)
+	{
+		switch (category)
+		{
+		case MemoryCategory::Untagged: return "untagged";
+		case MemoryCategory::Meshes: return "meshes";
+		case MemoryCategory::Scene: return "scene";
+		case MemoryCategory::Passes: return "passes";
+		case MemoryCategory::Textures: return "textures";
+		case MemoryCategory::RenderTargets: return "render targets";
+		case MemoryCategory::ShadowMap: return "shadow map";
+		case MemoryCategory::FrameData: return "frame data";
+		case MemoryCategory::Staging: return "staging";
+		case MemoryCategory::Materials: return "materials";
+		default: return "untagged";
+		}
+	}
+
+	MemoryScope::MemoryScope(MemoryCategory category)
+	{
+		previous = currentCategory;
+		currentCategory = category;
+	}
+
+	MemoryScope::~MemoryScope()
+	{
+		currentCategory = previous;
+	}
+
+	MemoryCategory current_memory_category()
+	{
+		return currentCategory;
+	}
+
+	void tag_allocation(VmaAllocationCreateInfo& info, MemoryCategory category)
+	{
+		//vma keeps its own copy of the string, the json stats print it
+		info.flags |= VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+		info.pUserData = const_cast<char*>(memory_category_name(category));
+	}
+
+	void MemoryAccounting::init(VkPhysicalDevice gpu, VmaAllocator _allocator, bool hasBudgetExtension)
+	{
+		allocator = _allocator;
+		budgetExtension = hasBudgetExtension;
+		vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProperties);
+		heapWarned.resize(memoryProperties.memoryHeapCount, false);
+
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+		{
+			const VkMemoryHeap& heap = memoryProperties.memoryHeaps[i];
+			LOG_INFO("Memory heap {}: {:.0f} MB{}", i, to_mb(heap.size), (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " device local" : "");
+		}
+		LOG_INFO("Memory budget {}", budgetExtension ? "from VK_EXT_memory_budget" : "estimated, VK_EXT_memory_budget not supported");
+	}
+
+	void MemoryAccounting::query_heaps(std::vector<MemoryHeapUsage>& heaps) const
+	{
+		VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+		vmaGetBudget(allocator, budgets);
+
+		heaps.resize(memoryProperties.memoryHeapCount);
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+		{
+			MemoryHeapUsage& heap = heaps[i];
+			heap.size = memoryProperties.memoryHeaps[i].size;
+			heap.deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			heap.budget = budgets[i].budget;
+			heap.usage = budgets[i].usage;
+			heap.blockBytes = budgets[i].blockBytes;
+			heap.allocationBytes = budgets[i].allocationBytes;
+		}
+	}
+
+	void MemoryAccounting::update(uint32_t frameIndex)
+	{
+		ZoneScopedNC("Memory Budget", tracy::Color::Grey);
+
+		//vma refreshes the budget of the extension every few frames
+		lastFrame = frameIndex;
+		vmaSetCurrentFrameIndex(allocator, frameIndex);
+
+		std::vector<MemoryHeapUsage> heaps;
+		query_heaps(heaps);
+
+		float warning = CVAR_MemoryWarning.GetFloat();
+		highestUsage = 0;
+		for (uint32_t i = 0; i < heaps.size(); i++)
+		{
+			if (heaps[i].budget == 0) continue;
+
+			float usage = float(double(heaps[i].usage) / double(heaps[i].budget));
+			highestUsage = std::max(highestUsage, usage);
+
+			if (usage >= warning && !heapWarned[i])
+			{
+				LOG_WARNING("Memory heap {} at {:.0f}% of its budget, {:.0f} MB of {:.0f} MB", i, usage * 100.f, to_mb(heaps[i].usage), to_mb(heaps[i].budget));
+				heapWarned[i] = true;
+			}
+			//a bit of hysteresis so a heap hovering at the limit does not spam
+			else if (usage < warning * 0.95f)
+			{
+				heapWarned[i] = false;
+			}
+		}
+	}
+
+	MemoryReport MemoryAccounting::build_report() const
+	{
+		ZoneScopedNC("Memory Report", tracy::Color::Grey);
+
+		MemoryReport report;
+		query_heaps(report.heaps);
+
+		char* statsString = nullptr;
+		vmaBuildStatsString(allocator, &statsString, VK_TRUE);
+		nlohmann::json stats = nlohmann::json::parse(statsString, nullptr, false);
+		vmaFreeStatsString(allocator, statsString);
+
+		if (stats.is_discarded())
+		{
+			LOG_ERROR("Failed to parse the vma stats");
+			return report;
+		}
+
+		//both sections are keyed "Type N" by memory type
+		for (const char* section : { "DedicatedAllocations", "DefaultPools" })
+		{
+			if (!stats.contains(section)) continue;
+
+			for (auto& [key, value] : stats[section].items())
+			{
+				uint32_t memoryType = static_cast<uint32_t>(std::stoul(key.substr(key.find(' ') + 1)));
+				uint32_t heapIndex = memoryProperties.memoryTypes[memoryType].heapIndex;
+				collect_allocations(value, report, report.heaps[heapIndex]);
+			}
+		}
+		return report;
+	}
+
+	bool MemoryAccounting::dump_json(const std::string& path) const
+	{
+		MemoryReport report = build_report();
+
+		nlohmann::json j;
+		nlohmann::json categories;
+		for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+		{
+			if (report.categoryAllocations[i] == 0) continue;
+
+			nlohmann::json category;
+			category["bytes"] = report.categoryBytes[i];
+			category["allocations"] = report.categoryAllocations[i];
+			categories[memory_category_name(static_cast<MemoryCategory>(i))] = category;
+		}
+		j["categories"] = categories;
+
+		nlohmann::json heaps = nlohmann::json::array();
+		for (const MemoryHeapUsage& heap : report.heaps)
+		{
+			nlohmann::json h;
+			h["size"] = heap.size;
+			h["budget"] = heap.budget;
+			h["usage"] = heap.usage;
+			h["blockBytes"] = heap.blockBytes;
+			h["allocationBytes"] = heap.allocationBytes;
+			h["deviceLocal"] = heap.deviceLocal;
+
+			nlohmann::json perCategory;
+			for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+			{
+				if (heap.categories[i] == 0) continue;
+				perCategory[memory_category_name(static_cast<MemoryCategory>(i))] = heap.categories[i];
+			}
+			h["categories"] = perCategory;
+			heaps.push_back(h);
+		}
+		j["heaps"] = heaps;
+		j["budgetExtension"] = budgetExtension;
+
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			LOG_ERROR("Failed to write the memory report {}", path);
+			return false;
+		}
+		file << j.dump(1, '\t');
+		LOG_SUCCESS("Wrote the memory report to {}", path);
+		return true;
+	}
+
+	void MemoryAccounting::draw_imgui()
+	{
+		if (!ImGui::CollapsingHeader("Memory"))
+		{
+			return;
+		}
+
+		if (!hasReport || lastFrame - lastReportFrame >= REPORT_REFRESH_FRAMES)
+		{
+			lastReport = build_report();
+			lastReportFrame = lastFrame;
+			hasReport = true;
+		}
+
+		for (size_t i = 0; i < lastReport.heaps.size(); i++)
+		{
+			MemoryHeapUsage& heap = lastReport.heaps[i];
+			float usage = heap.budget > 0 ? float(double(heap.usage) / double(heap.budget)) : 0.f;
+
+			ImGui::Text("Heap %d%s: %.1f / %.1f MB budget (%.0f%%), %.1f MB in blocks", int(i), heap.deviceLocal ? " (device)" : "",
+				to_mb(heap.usage), to_mb(heap.budget), usage * 100.f, to_mb(heap.blockBytes));
+			ImGui::ProgressBar(usage, ImVec2(-1, 0));
+
+			for (size_t c = 0; c < MEMORY_CATEGORY_COUNT; c++)
+			{
+				if (heap.categories[c] == 0) continue;
+				ImGui::Text("    %s %.1f MB", memory_category_name(static_cast<MemoryCategory>(c)), to_mb(heap.categories[c]));
+			}
+		}
+
+		ImGui::Separator();
+		for (size_t c = 0; c < MEMORY_CATEGORY_COUNT; c++)
+		{
+			if (lastReport.categoryAllocations[c] == 0) continue;
+			ImGui::Text("%s: %.1f MB in %u allocations", memory_category_name(static_cast<MemoryCategory>(c)),
+				to_mb(lastReport.categoryBytes[c]), lastReport.categoryAllocations[c]);
+		}
+
+		if (ImGui::Button("Dump Memory Report"))
+		{
+			dump_json("memory_report.json");
+		}
+	}
+}
@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <vk_types.h>
+#include <array>
+#include <string>
+#include <vector>
+
+namespace vkutil {
+
+	//what a device allocation is used for, stored as the vma user data string of the allocation
+	enum class MemoryCategory : uint8_t {
+		Untagged,
+		Meshes,//per mesh vertex and index buffers
+		Scene,//merged mesh buffers and object data
+		Passes,//indirect, instance and cull buffers of the mesh passes
+		Textures,
+		RenderTargets,//color, depth, depth pyramid and offscreen images
+		ShadowMap,
+		FrameData,//per frame uniform and debug buffers
+		Staging,
+		Materials,
+		Count
+	};
+
+	constexpr size_t MEMORY_CATEGORY_COUNT = static_cast<size_t>(MemoryCategory::Count);
+
+	const char* memory_category_name(MemoryCategory category);
+
+	//allocations made on this thread inside the scope are tagged with category, unless tagged explicitly
+	class MemoryScope {
+	public:
+		MemoryScope(MemoryCategory category);
+		~MemoryScope();
+	private:
+		MemoryCategory previous;
+	};
+
+	MemoryCategory current_memory_category();
+
+	//call on the create info right before vmaCreateBuffer/vmaCreateImage
+	void tag_allocation(VmaAllocationCreateInfo& info, MemoryCategory category = current_memory_category());
+
+	struct MemoryHeapUsage {
+		VkDeviceSize size{ 0 };
+		VkDeviceSize budget{ 0 };//from VK_EXT_memory_budget, an estimate of 80% of the heap without it
+		VkDeviceSize usage{ 0 };//whole process, other vulkan users included when the extension is there
+		VkDeviceSize blockBytes{ 0 };//vkAllocateMemory blocks of our allocator
+		VkDeviceSize allocationBytes{ 0 };//used part of the blocks
+		bool deviceLocal{ false };
+		std::array<VkDeviceSize, MEMORY_CATEGORY_COUNT> categories{};
+	};
+
+	struct MemoryReport {
+		std::vector<MemoryHeapUsage> heaps;
+		std::array<VkDeviceSize, MEMORY_CATEGORY_COUNT> categoryBytes{};
+		std::array<uint32_t, MEMORY_CATEGORY_COUNT> categoryAllocations{};
+	};
+
+	//device memory usage per category and per heap, and warnings when a heap gets close to its budget
+	class MemoryAccounting {
+	public:
+		void init(VkPhysicalDevice gpu, VmaAllocator allocator, bool hasBudgetExtension);
+
+		//cheap, call every frame. warns once each time a heap crosses the warning ratio
+		void update(uint32_t frameIndex);
+
+		//walks every allocation of vma, slow with many allocations. call on demand
+		MemoryReport build_report() const;
+
+		bool dump_json(const std::string& path) const;
+
+		//panel of the debug menu, rebuilds the report every refreshFrames frames while open
+		void draw_imgui();
+
+		//usage / budget of the fullest heap, at the last update
+		float highest_usage() const { return highestUsage; }
+	private:
+		void query_heaps(std::vector<MemoryHeapUsage>& heaps) const;
+
+		VmaAllocator allocator{ VK_NULL_HANDLE };
+		VkPhysicalDeviceMemoryProperties memoryProperties{};
+		bool budgetExtension{ false };
+
+		std::vector<bool> heapWarned;
+		float highestUsage{ 0 };
+
+		MemoryReport lastReport;
+		uint32_t lastFrame{ 0 };
+		uint32_t lastReportFrame{ 0 };
+		bool hasReport{ false };
+	};
+}
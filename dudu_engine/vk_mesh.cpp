@@ -1,10 +1,13 @@
 ﻿#include <vk_mesh.h>
 #include <iostream>
 #include <chrono>
+#include <cfloat>
+#include <algorithm>
 #include <asset_loader.h>
 #include <mesh_asset.h>
 #include "glm/common.hpp"
-#include "glm/detail/func_geometric.inl"
+#include "glm/gtc/packing.hpp"
+#include "glm/geometric.hpp"
 #include "logger.h"
 
 VertexInputDescription Vertex::get_vertex_description()
@@ -23,7 +26,7 @@ VertexInputDescription Vertex::get_vertex_description()
 	VkVertexInputAttributeDescription positionAttribute = {};
 	positionAttribute.binding = 0;
 	positionAttribute.location = 0;
-	positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_UNORM;//VK_FORMAT_R32G32B32_SFLOAT;
 	positionAttribute.offset = offsetof(Vertex, position);
 
 	//Normal will be stored at Location 1
@@ -37,14 +40,14 @@ VertexInputDescription Vertex::get_vertex_description()
 	VkVertexInputAttributeDescription colorAttribute = {};
 	colorAttribute.binding = 0;
 	colorAttribute.location = 2;
-	colorAttribute.format = VK_FORMAT_R8G8B8_UNORM;//VK_FORMAT_R32G32B32_SFLOAT;
+	colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;//VK_FORMAT_R32G32B32_SFLOAT;
 	colorAttribute.offset = offsetof(Vertex, color);
 
 	//UV will be stored at Location 2
 	VkVertexInputAttributeDescription uvAttribute = {};
 	uvAttribute.binding = 0;
 	uvAttribute.location = 3;
-	uvAttribute.format = VK_FORMAT_R32G32_SFLOAT;
+	uvAttribute.format = VK_FORMAT_R16G16_SFLOAT;//VK_FORMAT_R32G32_SFLOAT;
 	uvAttribute.offset = offsetof(Vertex, uv);
 
 
@@ -95,6 +98,18 @@ vec3 OctNormalDecode(vec2 encN)
 }
 
 
+void Vertex::pack_position(glm::vec3 p, const RenderBounds& bounds)
+{
+	glm::vec3 range = bounds.quantize_range();
+	glm::vec3 unorm = (p - bounds.quantize_min()) / glm::max(range, glm::vec3(FLT_MIN));
+	unorm = glm::clamp(unorm, 0.f, 1.f);
+
+	position.x = static_cast<uint16_t>(glm::round(unorm.x * 65535.f));
+	position.y = static_cast<uint16_t>(glm::round(unorm.y * 65535.f));
+	position.z = static_cast<uint16_t>(glm::round(unorm.z * 65535.f));
+	position.w = 0;
+}
+
 void Vertex::pack_normal(glm::vec3 n)
 {
 	vec2 oct = OctNormalEncode(n);
@@ -108,6 +123,58 @@ void Vertex::pack_color(glm::vec3 c)
 	color.r = static_cast<uint8_t>(c.x * 255);
 	color.g = static_cast<uint8_t>(c.y * 255);
 	color.b = static_cast<uint8_t>(c.z * 255);
+	color.a = 255;
+}
+
+void Vertex::pack_uv(glm::vec2 t)
+{
+	uv.x = glm::packHalf1x16(t.x);
+	uv.y = glm::packHalf1x16(t.y);
+}
+
+void Mesh::fill_vertex_data(const assets::Vertex_f32_PNCV* unpackedVertices)
+{
+	for (int i = 0; i < _vertices.size(); i++) {
+
+		const assets::Vertex_f32_PNCV& v = unpackedVertices[i];
+
+		_vertices[i].pack_position(vec3(v.position[0], v.position[1], v.position[2]), bounds);
+		//code 3d normal to 2d normal
+		_vertices[i].pack_normal(vec3(v.normal[0], v.normal[1], v.normal[2]));
+		//code RGB [0,1] to RGB[0,255]
+		_vertices[i].pack_color(vec3(v.color[0], v.color[1], v.color[2]));
+		_vertices[i].pack_uv(vec2(v.uv[0], v.uv[1]));
+	}
+}
+
+void Mesh::fill_vertex_data(const assets::Vertex_P32N8C8V16* unpackedVertices)
+{
+	for (int i = 0; i < _vertices.size(); i++) {
+
+		const assets::Vertex_P32N8C8V16& v = unpackedVertices[i];
+
+		_vertices[i].pack_position(vec3(v.position[0], v.position[1], v.position[2]), bounds);
+		//normal is stored as n * 0.5 + 0.5
+		vec3 normal = vec3(v.normal[0], v.normal[1], v.normal[2]) / 255.f * 2.f - 1.f;
+		_vertices[i].pack_normal(normal);
+
+		_vertices[i].color = glm::vec<4, uint8_t>(v.color[0], v.color[1], v.color[2], 255);
+		_vertices[i].uv = glm::vec<2, uint16_t>(v.uv[0], v.uv[1]);
+	}
+}
+
+void Mesh::fill_vertex_data(const assets::Vertex_P16N8C8V16* unpackedVertices)
+{
+	//same layout and quantization box as the runtime vertex, only widen the position
+	for (int i = 0; i < _vertices.size(); i++) {
+
+		const assets::Vertex_P16N8C8V16& v = unpackedVertices[i];
+
+		_vertices[i].position = glm::vec<4, uint16_t>(v.position[0], v.position[1], v.position[2], 0);
+		_vertices[i].oct_normal = glm::vec<2, uint8_t>(v.normal[0], v.normal[1]);
+		_vertices[i].color = glm::vec<4, uint8_t>(v.color[0], v.color[1], v.color[2], v.color[3]);
+		_vertices[i].uv = glm::vec<2, uint16_t>(v.uv[0], v.uv[1]);
+	}
 }
 
 bool Mesh::load_from_meshasset(const char* filename)
@@ -120,22 +187,24 @@ bool Mesh::load_from_meshasset(const char* filename)
 	auto loadend = std::chrono::high_resolution_clock::now();
 	auto diff = loadend - loadstart;
 	if (!loaded) {
-		std::cout << "Error when loading mesh " << filename << std::endl;;
+		LOG_ERROR("Error when loading mesh {}", filename);
 		return false;
 	}
 
-	std::cout << "Load mesh from AssertFile took " << std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count() / 1000000.0 << "ms" << std::endl;
+	LOG_INFO("Load mesh from AssertFile took {} ms", std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count() / 1000000.0);
 
 	assets::MeshInfo meshinfo = assets::read_mesh_info(&file);
 
 
 	std::vector<char> vertexBuffer;
 	std::vector<char> indexBuffer;
+	std::vector<assets::Meshlet> meshletBuffer;
 
 	vertexBuffer.resize(meshinfo.vertexBuferSize);
 	indexBuffer.resize(meshinfo.indexBuferSize);
+	meshletBuffer.resize(meshinfo.meshletBufferSize / sizeof(assets::Meshlet));
 
-	assets::unpack_mesh(&meshinfo, file.binaryBlob.data(), file.binaryBlob.size(), vertexBuffer.data(), indexBuffer.data());
+	assets::unpack_mesh(&meshinfo, file.binaryBlob.data(), file.binaryBlob.size(), vertexBuffer.data(), indexBuffer.data(), (char*)meshletBuffer.data());
 
 	bounds.extents.x = meshinfo.bounds.extents[0];
 	bounds.extents.y = meshinfo.bounds.extents[1];
@@ -150,11 +219,26 @@ bool Mesh::load_from_meshasset(const char* filename)
 
 	_vertices.clear();
 	_indices.clear();
+	_meshlets.clear();
+	_lods.clear();
+
+	//cpu side indices stay 32 bit, merge_meshes picks the gpu index type
+	if (meshinfo.indexSize == sizeof(uint16_t))
+	{
+		uint16_t* unpacked_indices = (uint16_t*)indexBuffer.data();
 
-	_indices.resize(indexBuffer.size() / sizeof(uint32_t));
-	for (int i = 0; i < _indices.size(); i++) {
+		_indices.resize(indexBuffer.size() / sizeof(uint16_t));
+		for (int i = 0; i < _indices.size(); i++) {
+			_indices[i] = unpacked_indices[i];
+		}
+	}
+	else {
 		uint32_t* unpacked_indices = (uint32_t*)indexBuffer.data();
-		_indices[i] = unpacked_indices[i];
+
+		_indices.resize(indexBuffer.size() / sizeof(uint32_t));
+		for (int i = 0; i < _indices.size(); i++) {
+			_indices[i] = unpacked_indices[i];
+		}
 	}
 
 	if (meshinfo.vertexFormat == assets::VertexFormat::PNCV_F32)
@@ -162,21 +246,56 @@ bool Mesh::load_from_meshasset(const char* filename)
 		assets::Vertex_f32_PNCV* unpackedVertices = (assets::Vertex_f32_PNCV*)vertexBuffer.data();
 
 		_vertices.resize(vertexBuffer.size() / sizeof(assets::Vertex_f32_PNCV));
-		fill_vertex_data(_vertices, unpackedVertices);
+		fill_vertex_data(unpackedVertices);
 	}
 	else if (meshinfo.vertexFormat == assets::VertexFormat::P32N8C8V16)
 	{
 		assets::Vertex_P32N8C8V16* unpackedVertices = (assets::Vertex_P32N8C8V16*)vertexBuffer.data();
 
 		_vertices.resize(vertexBuffer.size() / sizeof(assets::Vertex_P32N8C8V16));
-		fill_vertex_data(_vertices, unpackedVertices);
+		fill_vertex_data(unpackedVertices);
+	}
+	else if (meshinfo.vertexFormat == assets::VertexFormat::P16N8C8V16)
+	{
+		assets::Vertex_P16N8C8V16* unpackedVertices = (assets::Vertex_P16N8C8V16*)vertexBuffer.data();
+
+		_vertices.resize(vertexBuffer.size() / sizeof(assets::Vertex_P16N8C8V16));
+		fill_vertex_data(unpackedVertices);
+	}
+
+	//meshlet index ranges are relative to this mesh, merge_meshes rebases them
+	_meshlets.resize(meshletBuffer.size());
+	for (int i = 0; i < _meshlets.size(); i++) {
+		assets::Meshlet& m = meshletBuffer[i];
+
+		_meshlets[i].sphereBounds = glm::vec4(m.center[0], m.center[1], m.center[2], m.radius);
+		_meshlets[i].cone = glm::vec4(m.coneAxis[0], m.coneAxis[1], m.coneAxis[2], m.coneCutoff);
+		_meshlets[i].firstIndex = m.firstIndex;
+		_meshlets[i].indexCount = m.indexCount;
+		_meshlets[i].vertexOffset = 0;
+		_meshlets[i].padding = 0;
 	}
 
+	//extra levels past what the cull shader can pick are dropped
+	for (auto& lod : meshinfo.lods) {
+		if (_lods.size() == MAX_MESH_LODS) break;
+
+		_lods.push_back({ lod.firstIndex, lod.indexCount });
+	}
 	
 	if (logMeshUpload)
 	{
-		LOG_SUCCESS("Loaded mesh {} : Verts={}, Tris={}", filename, _vertices.size(), _indices.size() / 3);
+		LOG_SUCCESS("Loaded mesh {} : Verts={}, Tris={}, Meshlets={}, Lods={}", filename, _vertices.size(), get_lod(0).indexCount / 3, _meshlets.size(), lod_count());
 	}
 
 	return true;
 }
+
+MeshLod Mesh::get_lod(uint32_t level) const
+{
+	if (_lods.empty())
+	{
+		return { 0, static_cast<uint32_t>(_indices.size()) };
+	}
+	return _lods[std::min(level, static_cast<uint32_t>(_lods.size()) - 1)];
+}
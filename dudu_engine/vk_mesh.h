@@ -4,6 +4,13 @@
 #include <vector>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+namespace assets {
+	struct Vertex_f32_PNCV;
+	struct Vertex_P32N8C8V16;
+	struct Vertex_P16N8C8V16;
+}
 
 constexpr bool logMeshUpload = false;
 
@@ -17,17 +24,24 @@ struct VertexInputDescription {
 
 
 
+struct RenderBounds;
+
+//compact vertex, 18 bytes
 struct Vertex {
 
-	glm::vec3 position;
+	//16 bit unorm inside the mesh bounds box, the vertex shader scales it back with GPUObjectData
+	glm::vec<4, uint16_t> position;//w unused
 	//glm::vec3 normal;
 	glm::vec<2, uint8_t> oct_normal;//color;
-	glm::vec<3, uint8_t> color;
-	glm::vec2 uv;
+	glm::vec<4, uint8_t> color;//a unused
+	//half float
+	glm::vec<2, uint16_t> uv;
 	static VertexInputDescription get_vertex_description();
 
+	void pack_position(glm::vec3 p, const RenderBounds& bounds);
 	void pack_normal(glm::vec3 n);
 	void pack_color(glm::vec3 c);
+	void pack_uv(glm::vec2 t);
 };
 //
 struct RenderBounds {
@@ -35,39 +49,53 @@ struct RenderBounds {
 	float radius;
 	glm::vec3 extents;
 	bool valid;
+
+	//box the vertex positions are quantized in
+	glm::vec3 quantize_min() const { return origin - extents; }
+	glm::vec3 quantize_range() const { return extents * 2.f; }
+};
+//meshlet data as the cull shader reads it (meshlet_cull.comp)
+struct Meshlet {
+	glm::vec4 sphereBounds;//center-radius, mesh space
+	glm::vec4 cone;//axis-cutoff, mesh space. cutoff >= 1 disables the cone test
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t vertexOffset;
+	uint32_t padding;
+};
+//lod levels per mesh, the cull shader keeps one indirect command per level (indirect_cull.comp MAX_LODS)
+constexpr uint32_t MAX_MESH_LODS = 4;
+
+//index range of a lod level, every level shares the vertex buffer
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
 };
 struct Mesh {
 	std::vector<Vertex> _vertices;
+	//all lod levels back to back, level 0 first
 	std::vector<uint32_t> _indices;
+	//empty when the mesh asset was baked without meshlets, meshlets only cover lod 0
+	std::vector<Meshlet> _meshlets;
+	//empty when the mesh has a single level
+	std::vector<MeshLod> _lods;
 
 	AllocatedBuffer<Vertex> _vertexBuffer;
 	AllocatedBuffer<uint32_t> _indexBuffer;
 
 	RenderBounds bounds;
 
+	//mesh local indices fit in 16 bits
+	bool fits_short_indices() const { return _vertices.size() <= 65536; }
+
+	uint32_t lod_count() const { return _lods.empty() ? 1 : static_cast<uint32_t>(_lods.size()); }
+	//levels past the last one return the coarsest level
+	MeshLod get_lod(uint32_t level) const;
+
 	bool load_from_meshasset(const char* filename);
 
-	template<typename T>
-	void fill_vertex_data(std::vector<Vertex>& _vertices, T& unpackedVertices) {
-		for (int i = 0; i < _vertices.size(); i++) {
-
-			_vertices[i].position.x = unpackedVertices[i].position[0];
-			_vertices[i].position.y = unpackedVertices[i].position[1];
-			_vertices[i].position.z = unpackedVertices[i].position[2];
-
-			vec3 normal = vec3(
-				unpackedVertices[i].normal[0],
-				unpackedVertices[i].normal[1],
-				unpackedVertices[i].normal[2]);
-			//code 3d normal to 2d normal
-			_vertices[i].pack_normal(normal);
-			//code RGB [0,1] to RGB[0,255]
-			_vertices[i].pack_color(vec3{ unpackedVertices[i].color[0] ,unpackedVertices[i].color[1] ,unpackedVertices[i].color[2] });
-
-			//uv.y = 1-uv.y
-			_vertices[i].uv.x = unpackedVertices[i].uv[0];
-			_vertices[i].uv.y = unpackedVertices[i].uv[1];
-			//_vertices[i].uv.y = 1 - unpackedVertices[i].uv[1];
-		}
-	}
+	//convert the asset vertex formats to the runtime vertex, bounds has to be loaded first
+	void fill_vertex_data(const assets::Vertex_f32_PNCV* unpackedVertices);
+	void fill_vertex_data(const assets::Vertex_P32N8C8V16* unpackedVertices);
+	void fill_vertex_data(const assets::Vertex_P16N8C8V16* unpackedVertices);
 };
\ No newline at end of file
@@ -0,0 +1,163 @@
+﻿#include <vk_pipeline_cache.h>
+#include <fstream>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include "logger.h"
+
+namespace vkutil {
+
+	//"DDPC"
+	constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43504444;
+
+	void PipelineCache::init(VkDevice _device, const VkPhysicalDeviceProperties& properties, const std::string& path)
+	{
+		device = _device;
+		deviceProperties = properties;
+		filePath = path;
+		maxBuilds = std::max(1u, std::thread::hardware_concurrency());
+
+		std::vector<char> data;
+		std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+		if (file.is_open())
+		{
+			size_t fileSize = static_cast<size_t>(file.tellg());
+			file.seekg(0);
+
+			FileHeader header;
+			file.read((char*)&header, sizeof(FileHeader));
+			//a truncated or padded file would hand the driver a partial blob
+			if (file && header.magic == PIPELINE_CACHE_MAGIC && sizeof(FileHeader) + header.dataSize != fileSize)
+			{
+				LOG_WARNING("Pipeline cache {} has {} bytes but its header says {}, starting empty", filePath, fileSize, sizeof(FileHeader) + header.dataSize);
+			}
+			else if (file && header.magic == PIPELINE_CACHE_MAGIC)
+			{
+				data.resize(header.dataSize);
+				file.read(data.data(), header.dataSize);
+				if (!file || !validate(header, data))
+				{
+					LOG_WARNING("Pipeline cache {} is from another device or driver, starting empty", filePath);
+					data.clear();
+				}
+			}
+		}
+
+		VkPipelineCacheCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		info.initialDataSize = data.size();
+		info.pInitialData = data.empty() ? nullptr : data.data();
+
+		if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS)
+		{
+			//a cache the driver refuses is not fatal, build without initial data
+			info.initialDataSize = 0;
+			info.pInitialData = nullptr;
+			data.clear();
+			vkCreatePipelineCache(device, &info, nullptr, &cache);
+		}
+		loadedSize = data.size();
+
+		LOG_INFO("Pipeline cache loaded {} bytes from {}", loadedSize, filePath);
+	}
+
+	bool PipelineCache::validate(const FileHeader& header, const std::vector<char>& data) const
+	{
+		if (header.vendorID != deviceProperties.vendorID
+			|| header.deviceID != deviceProperties.deviceID
+			|| header.driverVersion != deviceProperties.driverVersion
+			|| memcmp(header.uuid, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		{
+			return false;
+		}
+
+		//the driver blob carries its own header, check it as well
+		VkPipelineCacheHeaderVersionOne blobHeader;
+		if (data.size() < sizeof(blobHeader))
+		{
+			return false;
+		}
+		memcpy(&blobHeader, data.data(), sizeof(blobHeader));
+
+		return blobHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+			&& blobHeader.vendorID == deviceProperties.vendorID
+			&& blobHeader.deviceID == deviceProperties.deviceID
+			&& memcmp(blobHeader.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	bool PipelineCache::save()
+	{
+		size_t size = 0;
+		if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+		{
+			return false;
+		}
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+		{
+			return false;
+		}
+
+		FileHeader header;
+		header.magic = PIPELINE_CACHE_MAGIC;
+		header.dataSize = static_cast<uint32_t>(size);
+		header.vendorID = deviceProperties.vendorID;
+		header.deviceID = deviceProperties.deviceID;
+		header.driverVersion = deviceProperties.driverVersion;
+		memcpy(header.uuid, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+		std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			LOG_ERROR("Failed to write pipeline cache {}", filePath);
+			return false;
+		}
+		file.write((const char*)&header, sizeof(FileHeader));
+		file.write(data.data(), size);
+
+		LOG_INFO("Pipeline cache saved {} bytes to {}", size, filePath);
+		return true;
+	}
+
+	void PipelineCache::compile(std::function<void()>&& build)
+	{
+		if (!compiling)
+		{
+			compiling = true;
+			compileStart = std::chrono::high_resolution_clock::now();
+		}
+		//no more builds in flight than hardware threads, the oldest pending one is waited on first
+		if (builds.size() - waitedBuilds >= maxBuilds)
+		{
+			builds[waitedBuilds++].get();
+		}
+		builds.push_back(std::async(std::launch::async, std::move(build)));
+	}
+
+	size_t PipelineCache::wait()
+	{
+		size_t count = builds.size();
+		for (size_t i = waitedBuilds; i < builds.size(); i++)
+		{
+			builds[i].get();
+		}
+		builds.clear();
+		waitedBuilds = 0;
+
+		if (compiling)
+		{
+			auto end = std::chrono::high_resolution_clock::now();
+			compileTime += std::chrono::duration<double, std::milli>(end - compileStart).count();
+			compiling = false;
+		}
+		return count;
+	}
+
+	void PipelineCache::cleanup()
+	{
+		wait();
+		save();
+		vkDestroyPipelineCache(device, cache, nullptr);
+		cache = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <string>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <chrono>
+
+namespace vkutil {
+
+	//persistent VkPipelineCache plus the pipeline builds that run on it
+	//the cache file starts with a small header so data from another gpu or driver is thrown away
+	class PipelineCache {
+	public:
+
+		void init(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& path);
+
+		//saves the cache to disk and destroys it
+		void cleanup();
+
+		bool save();
+
+		VkPipelineCache get() const { return cache; }
+
+		//run a pipeline build on a worker thread, vkCreate*Pipelines is thread safe on the same cache
+		//blocks once there are as many builds in flight as hardware threads
+		void compile(std::function<void()>&& build);
+
+		//wait for every pending build, returns the number of builds waited on
+		size_t wait();
+
+		//time from the first compile to the last finished build
+		double compile_time_ms() const { return compileTime; }
+
+		//bytes loaded from disk, 0 when the cache started empty
+		size_t loaded_size() const { return loadedSize; }
+	private:
+
+		struct FileHeader {
+			uint32_t magic;
+			uint32_t dataSize;
+			uint32_t vendorID;
+			uint32_t deviceID;
+			uint32_t driverVersion;
+			uint8_t uuid[VK_UUID_SIZE];
+		};
+
+		bool validate(const FileHeader& header, const std::vector<char>& data) const;
+
+		VkDevice device{ VK_NULL_HANDLE };
+		VkPipelineCache cache{ VK_NULL_HANDLE };
+		VkPhysicalDeviceProperties deviceProperties{};
+		std::string filePath;
+		size_t loadedSize{ 0 };
+
+		std::vector<std::future<void>> builds;
+		//builds before this index are already finished
+		size_t waitedBuilds{ 0 };
+		size_t maxBuilds{ 1 };
+		bool compiling{ false };
+		std::chrono::time_point<std::chrono::high_resolution_clock> compileStart;
+		double compileTime{ 0 };
+	};
+}
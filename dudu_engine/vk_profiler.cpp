@@ -1,4 +1,5 @@
 ﻿#include <vk_profiler.h>
+#include <vk_trace.h>
 #include <algorithm>
 
 namespace vkutil {
@@ -25,8 +26,7 @@ namespace vkutil {
 		queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
 		for (int i = 0; i < QUERY_FRAME_OVERLAP; i++)
 		{
-			//focus on clipping invocations
-			queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT;
+			queryPoolInfo.pipelineStatistics = PIPELINE_STATISTICS;
 			vkCreateQueryPool(device, &queryPoolInfo, NULL, &queryFrames[i].statPool);
 			queryFrames[i].statLast = 0;
 		}
@@ -35,19 +35,9 @@ namespace vkutil {
 
 	void VulkanProfiler::grab_queries(VkCommandBuffer cmd)
 	{
-		int frame = currentFrame;//fram index increasing
+		//read back the pool that is reused by this frame, the wait bit never stalls on a frame in flight
 		currentFrame = (currentFrame + 1) % QUERY_FRAME_OVERLAP;
-		//std::cout << "current frame :" << frame << std::endl;
-		//std::cout << "next frame :" << currentFrame << std::endl;
-		//vkCmdResetQueryPool(cmd, queryFrames[currentFrame].timerPool, 0, queryFrames[currentFrame].timerLast);
-		queryFrames[currentFrame].timerLast = 0;
-		queryFrames[currentFrame].frameTimers.clear();
-		//queryFrames[frame].frameTimers.clear();
-
-		//vkCmdResetQueryPool(cmd, queryFrames[currentFrame].statPool, 0, queryFrames[currentFrame].statLast);
-		queryFrames[currentFrame].statLast = 0;
-		queryFrames[currentFrame].statRecorders.clear();
-		//queryFrames[frame].statRecorders.clear();
+		int frame = currentFrame;
 
 		//QueryFrameState& state = queryFrames[frame];
 		//query state -> storage timestamp query result state
@@ -70,8 +60,9 @@ namespace vkutil {
 				// which also returns the state of the result (ready) in the result
 				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
 		}
+		//one value per statistic bit and query
 		std::vector<uint64_t> statresults;
-		statresults.resize(queryFrames[frame].statLast);
+		statresults.resize(queryFrames[frame].statLast * PIPELINE_STATISTIC_COUNT);
 		if (queryFrames[frame].statLast != 0)
 		{
 			// We use vkGetQueryResults to copy the results into a host visible buffer
@@ -82,7 +73,7 @@ namespace vkutil {
 				queryFrames[frame].statLast,
 				statresults.size() * sizeof(uint64_t),
 				statresults.data(),
-				sizeof(uint64_t),
+				sizeof(uint64_t) * PIPELINE_STATISTIC_COUNT,
 				// Store results a 64 bit values and wait until the results have been finished
 				// If you don't want to wait, you can use VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
 				// which also returns the state of the result (ready) in the result
@@ -97,14 +88,35 @@ namespace vkutil {
 			uint64_t timestamp = end - begin;
 			//store timing queries as miliseconds
 			timing[timer.name] = (double(timestamp) * period) / 1000000.0;
+			vktrace::gpu_zone(timer.name, static_cast<uint64_t>(double(begin) * period), static_cast<uint64_t>(double(end) * period));
+		}
+		//passes that were skipped this frame drop out
+		if (!queryFrames[frame].statRecorders.empty())
+		{
+			pipelineStats.clear();
 		}
 		for (auto& st : queryFrames[frame].statRecorders)
 		{
-			uint64_t result = statresults[st.query];
+			uint64_t* result = &statresults[st.query * PIPELINE_STATISTIC_COUNT];
+
+			PipelineStats pipeline;
+			pipeline.inputPrimitives = result[0];
+			pipeline.vertexInvocations = result[1];
+			pipeline.clippingInvocations = result[2];
+			pipeline.clippingPrimitives = result[3];
+			pipeline.fragmentInvocations = result[4];
+			pipelineStats[st.name] = pipeline;
 
-			stats[st.name] = static_cast<int32_t>(result);
+			stats[st.name] = static_cast<int32_t>(pipeline.clippingInvocations);
 		}
-		//currentFrame = (currentFrame + 1) % QUERY_FRAME_OVERLAP;
+
+		//vkCmdResetQueryPool(cmd, queryFrames[currentFrame].timerPool, 0, queryFrames[currentFrame].timerLast);
+		queryFrames[currentFrame].timerLast = 0;
+		queryFrames[currentFrame].frameTimers.clear();
+
+		//vkCmdResetQueryPool(cmd, queryFrames[currentFrame].statPool, 0, queryFrames[currentFrame].statLast);
+		queryFrames[currentFrame].statLast = 0;
+		queryFrames[currentFrame].statRecorders.clear();
 	}
 
 
@@ -117,6 +129,29 @@ namespace vkutil {
 		}
 		std::cout << " destroy query pool" << std::endl;
 	}
+	void VulkanProfiler::end_cpu_frame()
+	{
+		//a timer that stopped running would keep its old value in every later frame
+		for (auto it = cpuTiming.begin(); it != cpuTiming.end();)
+		{
+			auto last = cpuTimingFrame.find(it->first);
+			if (last == cpuTimingFrame.end() || last->second != cpuFrame)
+			{
+				cpuAllocations.erase(it->first);
+				if (last != cpuTimingFrame.end())
+				{
+					cpuTimingFrame.erase(last);
+				}
+				it = cpuTiming.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+		cpuFrame++;
+	}
+
 	//get state from storage state map
 	double VulkanProfiler::get_stat(const std::string& name)
 	{
@@ -226,4 +261,26 @@ namespace vkutil {
 		profiler->add_stat(timer);
 	}
 
+	CpuScopeTimer::CpuScopeTimer(VulkanProfiler* pf, const char* _name)
+	{
+		profiler = pf;
+		name = _name;
+		start = std::chrono::high_resolution_clock::now();
+		startHeap = alloctrack::heap();
+	}
+
+	CpuScopeTimer::~CpuScopeTimer()
+	{
+		auto end = std::chrono::high_resolution_clock::now();
+		alloctrack::Counters allocations = alloctrack::heap() - startHeap;
+
+		std::string_view key = name;
+		profiler->cpuTiming[key] = std::chrono::duration<double, std::milli>(end - start).count();
+		profiler->cpuTimingFrame[key] = profiler->cpuFrame;
+		if (alloctrack::enabled())
+		{
+			profiler->cpuAllocations[key] = allocations;
+		}
+	}
+
 }
\ No newline at end of file
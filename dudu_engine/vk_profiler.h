@@ -7,11 +7,28 @@
 #include <vector>
 #include <array>
 #include <unordered_map>
+#include <string_view>
+#include <chrono>
+#include <alloc_tracker.h>
 
 
 namespace vkutil {
 	class VulkanProfiler;
 
+	//counters of every pipeline statistics query, the results come back in the order of the bits
+	constexpr VkQueryPipelineStatisticFlags PIPELINE_STATISTICS = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+	constexpr uint32_t PIPELINE_STATISTIC_COUNT = 5;
+
+	struct PipelineStats {
+		uint64_t inputPrimitives{ 0 };
+		uint64_t vertexInvocations{ 0 };
+		uint64_t clippingInvocations{ 0 };//primitives that reached the clipper, after the vertex stages
+		uint64_t clippingPrimitives{ 0 };//primitives out of the clipper
+		uint64_t fragmentInvocations{ 0 };
+	};
+
 	struct ScopeTimer {
 		uint32_t startTimestamp;
 		uint32_t endTimestamp;
@@ -43,6 +60,17 @@ namespace vkutil {
 		VkCommandBuffer cmd;
 		StatRecorder timer;
 	};
+	//cpu side of VulkanScopeTimer, the milliseconds go to VulkanProfiler::cpuTiming
+	class CpuScopeTimer {
+	public:
+		CpuScopeTimer(VulkanProfiler* pf, const char* name);
+		~CpuScopeTimer();
+	private:
+		VulkanProfiler* profiler;
+		const char* name;
+		std::chrono::high_resolution_clock::time_point start;
+		alloctrack::Counters startHeap;
+	};
 	//create query pool and get pipeline state info 
 	class VulkanProfiler {
 	public:
@@ -52,6 +80,9 @@ namespace vkutil {
 
 		void grab_queries(VkCommandBuffer cmd);
 
+		//called once the frame is drawn, drops the cpu timers that did not run in it
+		void end_cpu_frame();
+
 		void cleanup();
 
 		double get_stat(const std::string& name);
@@ -65,10 +96,22 @@ namespace vkutil {
 		uint32_t get_stat_id();
 
 		std::unordered_map<std::string, double> timing;
+		//clipping invocations of the pipeline statistics queries
 		std::unordered_map<std::string, int32_t> stats;
+		//every counter of the queries of the last frame read back
+		std::unordered_map<std::string, PipelineStats> pipelineStats;
+		//cpu timers of the current or last finished frame, unlike timing they are not delayed
+		//keyed by a view of the name so a timer does not build a string every frame, timers pass string literals
+		//views hash and compare the text, the same literal merged or not across translation units is one zone
+		std::unordered_map<std::string_view, double> cpuTiming;
+		//heap allocations inside the cpu timers, from every thread. empty unless built with DUDU_TRACK_ALLOCATIONS
+		std::unordered_map<std::string_view, alloctrack::Counters> cpuAllocations;
 	private:
+		friend class CpuScopeTimer;
 
-		
+		//frame each cpu timer last ran in
+		std::unordered_map<std::string_view, uint64_t> cpuTimingFrame;
+		uint64_t cpuFrame{ 0 };
 
 		struct QueryFrameState {
 			std::vector<ScopeTimer> frameTimers;
@@ -80,7 +123,8 @@ namespace vkutil {
 			uint32_t statLast;
 		};
 
-		static constexpr int QUERY_FRAME_OVERLAP = 3;
+		//one more than the engine frames in flight, the pool read back is always from a finished frame
+		static constexpr int QUERY_FRAME_OVERLAP = 5;
 
 		
 
@@ -1,6 +1,7 @@
 ﻿#include <vk_scene.h>
 #include <vk_engine.h>
-#include "Tracy.hpp"
+#include <vk_initializers.h>
+#include "vk_trace.h"
 #include "logger.h"
 
 void RenderScene::init()
@@ -36,9 +37,18 @@ Handle<RenderObject> RenderScene::register_object(MeshObject* object)
 	//create new RenderObject handle-> renderables list index
 	//render object handle = object id <- update scene object function
 	Handle<RenderObject> handle;
-	handle.handle = static_cast<uint32_t>(renderables.size());
-	
-	renderables.push_back(newObj);
+	if (freeObjects.size() > 0)
+	{
+		handle = freeObjects.back();
+		freeObjects.pop_back();
+		renderables[handle.handle] = newObj;
+	}
+	else
+	{
+		handle.handle = static_cast<uint32_t>(renderables.size());
+
+		renderables.push_back(newObj);
+	}
 
 	//push object to forward pass resource set or shadow pass resource set based flag(bDrawForwardPass|bDrawShadowPass)
 	//Assigned to different renderable object set based on the transparency property of the object
@@ -86,6 +96,34 @@ void RenderScene::register_object_batch(MeshObject* first, uint32_t count)
 	}
 }
 
+void RenderScene::remove_object(Handle<RenderObject> objectID)
+{
+	RenderObject* object = get_object(objectID);
+	//a second remove would put the handle in freeObjects twice, and two new objects would share it
+	if (object->removed)
+	{
+		LOG_WARNING("Render object {} is removed twice", objectID.handle);
+		return;
+	}
+
+	for (MeshpassType type : { MeshpassType::Forward, MeshpassType::DirectionalShadow, MeshpassType::Transparency })
+	{
+		if (object->passIndices[type] != -1)
+		{
+			Handle<PassObject> obj;
+			obj.handle = object->passIndices[type];
+
+			get_mesh_pass(type)->objectsToDelete.push_back(obj);
+
+			object->passIndices[type] = -1;
+		}
+	}
+
+	//it can still be in unbatchedObjects, refresh_pass skips it there
+	object->removed = true;
+	removedObjects.push_back(objectID);
+}
+
 void RenderScene::update_transform(Handle<RenderObject> objectID, const glm::mat4& localToWorld)
 {
 	get_object(objectID)->transformMatrix = localToWorld;
@@ -157,6 +195,12 @@ void RenderScene::write_object(GPUObjectData* target, Handle<RenderObject> objec
 	object.origin_rad = glm::vec4(renderable->bounds.origin, renderable->bounds.radius);
 	object.extents = glm::vec4(renderable->bounds.extents, renderable->bounds.valid ? 1.f : 0.f);
 
+	const RenderBounds& meshBounds = get_mesh(renderable->meshID)->original->bounds;
+	object.quantizeMin = glm::vec4(meshBounds.quantize_min(), 0.f);
+	object.quantizeRange = glm::vec4(meshBounds.quantize_range(), 0.f);
+	object.materialIndex = get_material(renderable->material)->bindlessIndex;
+	object.pad[0] = object.pad[1] = object.pad[2] = 0;
+
 	memcpy(target, &object, sizeof(GPUObjectData));
 }
 //fill entry renderable object list to GPU object struct
@@ -178,19 +222,34 @@ void RenderScene::fill_indirectArray(GPUIndirectObject* data, MeshPass& pass)
 {
 	ZoneScopedNC("Fill Indirect", tracy::Color::Red);
 	int dataIndex = 0;
+	uint32_t multibatchIndex = 0;
 	for (int i = 0; i < pass.batches.size(); i++) {
 
 		auto& batch = pass.batches[i];
 
-		data[dataIndex].command.firstInstance = batch.first;//i;
-		data[dataIndex].command.instanceCount = 0;
-		data[dataIndex].command.firstIndex = get_mesh(batch.meshID)->firstIndex;
-		data[dataIndex].command.vertexOffset = get_mesh(batch.meshID)->firstVertex;
-		data[dataIndex].command.indexCount = get_mesh(batch.meshID)->indexCount;
-		data[dataIndex].objectID = 0;
-		data[dataIndex].batchID = i;
+		DrawMesh* mesh = get_mesh(batch.meshID);
+
+		//multibatches cover the batches in order
+		while (multibatchIndex + 1 < pass.multibatches.size() && pass.multibatches[multibatchIndex + 1].first <= uint32_t(i))
+		{
+			multibatchIndex++;
+		}
 
-		dataIndex++;
+		//one command per lod level, the cull shader picks the level of every instance
+		//every level gets room for all the batch instances
+		for (uint32_t lod = 0; lod < MAX_MESH_LODS; lod++)
+		{
+			data[dataIndex].command.firstInstance = batch.first * MAX_MESH_LODS + lod * batch.count;
+			data[dataIndex].command.instanceCount = 0;
+			data[dataIndex].command.firstIndex = mesh->lods[lod].firstIndex;
+			data[dataIndex].command.vertexOffset = mesh->firstVertex;
+			data[dataIndex].command.indexCount = mesh->lods[lod].indexCount;
+			data[dataIndex].objectID = 0;
+			data[dataIndex].batchID = i;
+			data[dataIndex].multibatchFirst = pass.multibatches[multibatchIndex].first;
+
+			dataIndex++;
+		}
 	}
 }
 //when pass has been changed bacthes array,need to reupload(fill) batches
@@ -219,6 +278,31 @@ void RenderScene::fill_instancesArray(GPUInstance* data, MeshPass& pass)
 	}
 }
 
+//meshlet instances of a batch are laid out object by object, same order as the batch draw commands
+void RenderScene::fill_meshletInstancesArray(GPUMeshletInstance* data, MeshPass& pass)
+{
+	ZoneScopedNC("Fill Meshlet Instances", tracy::Color::Red);
+	int dataIndex = 0;
+	for (int i = 0; i < pass.batches.size(); i++) {
+
+		auto& batch = pass.batches[i];
+		DrawMesh* mesh = get_mesh(batch.meshID);
+
+		for (int b = 0; b < batch.count; b++)
+		{
+			uint32_t objectID = pass.get(pass.flat_batches[b + batch.first].object)->original.handle;
+			for (uint32_t m = 0; m < mesh->meshletCount; m++)
+			{
+				data[dataIndex].objectID = objectID;
+				data[dataIndex].meshletID = mesh->firstMeshlet + m;
+				data[dataIndex].batchID = i;
+				data[dataIndex].drawOffset = batch.meshletFirst;
+				dataIndex++;
+			}
+		}
+	}
+}
+
 void RenderScene::clear_dirty_objects()
 {
 	for (auto obj : dirtyObjects)
@@ -244,12 +328,16 @@ void RenderScene::build_batches()
 	refresh_pass(&_transparentForwardPass);
 	refresh_pass(&_shadowPass);
 #endif
-	
+
+	//no pass references the removed objects anymore
+	freeObjects.insert(freeObjects.end(), removedObjects.begin(), removedObjects.end());
+	removedObjects.clear();
 }
 //Copy Mesh data in scene mesh array to GPU buffer(created)
 void RenderScene::merge_meshes(VulkanEngine* engine)
 {
 	ZoneScopedNC("Mesh Merge", tracy::Color::Magenta)
+	vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::Meshes);
 	size_t total_vertices = 0;
 	size_t total_indices = 0;
 	//Vertex count and index Count is konwed in mesh flat array
@@ -262,15 +350,95 @@ void RenderScene::merge_meshes(VulkanEngine* engine)
 		total_vertices += m.vertexCount;
 		total_indices += m.indexCount;
 
+		for (uint32_t lod = 0; lod < MAX_MESH_LODS; lod++)
+		{
+			m.lods[lod] = m.original->get_lod(lod);
+			m.lods[lod].firstIndex += m.firstIndex;
+		}
+
 		m.isMerged = true;
 	}
 
 	mergedVertexBuffer = engine->create_buffer(total_vertices * sizeof(Vertex), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
 		VMA_MEMORY_USAGE_GPU_ONLY);
 
-	mergedIndexBuffer = engine->create_buffer(total_indices * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	mergedIndexType = VK_INDEX_TYPE_UINT16;
+	for (auto& m : meshes)
+	{
+		if (!m.original->fits_short_indices())
+		{
+			mergedIndexType = VK_INDEX_TYPE_UINT32;
+			break;
+		}
+	}
+	size_t indexSize = mergedIndexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+
+	mergedIndexBuffer = engine->create_buffer(total_indices * indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 		VMA_MEMORY_USAGE_GPU_ONLY);
 
+	//the per mesh buffers hold 32 bit indices, 16 bit ones are narrowed from the cpu copy
+	AllocatedBuffer<uint16_t> shortIndexStaging;
+	if (mergedIndexType == VK_INDEX_TYPE_UINT16)
+	{
+		vkutil::MemoryScope stagingScope(vkutil::MemoryCategory::Staging);
+		shortIndexStaging = engine->create_buffer(std::max(total_indices, size_t(1)) * sizeof(uint16_t), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+		uint16_t* indexData = engine->map_buffer(shortIndexStaging);
+		for (auto& m : meshes)
+		{
+			for (uint32_t i = 0; i < m.indexCount; i++)
+			{
+				indexData[m.firstIndex + i] = static_cast<uint16_t>(m.original->_indices[i]);
+			}
+		}
+		engine->unmap_buffer(shortIndexStaging);
+	}
+
+	LOG_INFO("Merged {} meshes: {} vertices, {} indices at {} bits", meshes.size(), total_vertices, total_indices, indexSize * 8);
+
+	//gather meshlets, rebased to the merged index and vertex buffers
+	//a mesh baked without meshlets is covered by a single meshlet with the cone test disabled
+	std::vector<Meshlet> merged_meshlets;
+	for (auto& m : meshes)
+	{
+		m.firstMeshlet = static_cast<uint32_t>(merged_meshlets.size());
+
+		if (m.original->_meshlets.size() > 0)
+		{
+			for (Meshlet meshlet : m.original->_meshlets)
+			{
+				meshlet.firstIndex += m.firstIndex;
+				meshlet.vertexOffset = m.firstVertex;
+				merged_meshlets.push_back(meshlet);
+			}
+		}
+		else {
+			Meshlet meshlet;
+			meshlet.sphereBounds = glm::vec4(m.original->bounds.origin, m.original->bounds.radius);
+			meshlet.cone = glm::vec4(0.f, 0.f, 1.f, 1.f);
+			meshlet.firstIndex = m.lods[0].firstIndex;
+			meshlet.indexCount = m.lods[0].indexCount;
+			meshlet.vertexOffset = m.firstVertex;
+			meshlet.padding = 0;
+			merged_meshlets.push_back(meshlet);
+		}
+		m.meshletCount = static_cast<uint32_t>(merged_meshlets.size()) - m.firstMeshlet;
+	}
+
+	size_t meshletBufferSize = std::max(merged_meshlets.size(), size_t(1)) * sizeof(Meshlet);
+	//read by the meshlet cull only, the upload hands it over to the queue that culls
+	mergedMeshletBuffer = engine->create_buffer(meshletBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_MEMORY_USAGE_GPU_ONLY);
+
+	AllocatedBuffer<Meshlet> meshletStaging;
+	{
+		vkutil::MemoryScope stagingScope(vkutil::MemoryCategory::Staging);
+		meshletStaging = engine->create_buffer(meshletBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	}
+	Meshlet* meshletData = engine->map_buffer(meshletStaging);
+	memcpy(meshletData, merged_meshlets.data(), merged_meshlets.size() * sizeof(Meshlet));
+	engine->unmap_buffer(meshletStaging);
+
 	/*engine->_mainDeletionQueue.push_function([=, &engine]() {
 		if (mergedVertexBuffer._buffer != VK_NULL_HANDLE) {
 			vmaDestroyBuffer(engine->_allocator, mergedVertexBuffer._buffer, mergedVertexBuffer._allocation);
@@ -281,7 +449,14 @@ void RenderScene::merge_meshes(VulkanEngine* engine)
 		std::cout << " destroy merged vertex buffers and index buffers" << std::endl;
 		});*/
 
-	engine->immediate_submit([&](VkCommandBuffer cmd)
+	//streamed on the upload queue, the staging buffers are freed by it once the copies are done
+	std::vector<AllocatedBufferUntyped> stagingBuffers = { meshletStaging };
+	if (shortIndexStaging._buffer != VK_NULL_HANDLE)
+	{
+		stagingBuffers.push_back(shortIndexStaging);
+	}
+
+	engine->_uploadQueue.submit([&](VkCommandBuffer cmd)
 	{
 		for (auto& m : meshes)
 		{
@@ -292,19 +467,57 @@ void RenderScene::merge_meshes(VulkanEngine* engine)
 
 			vkCmdCopyBuffer(cmd, m.original->_vertexBuffer._buffer, mergedVertexBuffer._buffer, 1, &vertexCopy);
 
+			if (mergedIndexType == VK_INDEX_TYPE_UINT32)
+			{
+				VkBufferCopy indexCopy;
+				indexCopy.dstOffset = m.firstIndex * sizeof(uint32_t);
+				indexCopy.size = m.indexCount * sizeof(uint32_t);
+				indexCopy.srcOffset = 0;
+
+				vkCmdCopyBuffer(cmd, m.original->_indexBuffer._buffer, mergedIndexBuffer._buffer, 1, &indexCopy);
+			}
+		}
+
+		if (mergedIndexType == VK_INDEX_TYPE_UINT16 && total_indices > 0)
+		{
 			VkBufferCopy indexCopy;
-			indexCopy.dstOffset = m.firstIndex * sizeof(uint32_t);
-			indexCopy.size = m.indexCount * sizeof(uint32_t);
+			indexCopy.dstOffset = 0;
+			indexCopy.size = total_indices * sizeof(uint16_t);
 			indexCopy.srcOffset = 0;
 
-			vkCmdCopyBuffer(cmd, m.original->_indexBuffer._buffer, mergedIndexBuffer._buffer, 1, &indexCopy);
+			vkCmdCopyBuffer(cmd, shortIndexStaging._buffer, mergedIndexBuffer._buffer, 1, &indexCopy);
 		}
-	});
-	
+
+		if (merged_meshlets.size() > 0)
+		{
+			VkBufferCopy meshletCopy;
+			meshletCopy.dstOffset = 0;
+			meshletCopy.size = merged_meshlets.size() * sizeof(Meshlet);
+			meshletCopy.srcOffset = 0;
+
+			vkCmdCopyBuffer(cmd, meshletStaging._buffer, mergedMeshletBuffer._buffer, 1, &meshletCopy);
+		}
+
+		VkBufferMemoryBarrier vertexBarrier = vkinit::buffer_barrier(mergedVertexBuffer._buffer, VK_QUEUE_FAMILY_IGNORED);
+		vertexBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vertexBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		engine->_uploadQueue.release(cmd, vertexBarrier, engine->_graphicsQueueFamily, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+		VkBufferMemoryBarrier indexBarrier = vkinit::buffer_barrier(mergedIndexBuffer._buffer, VK_QUEUE_FAMILY_IGNORED);
+		indexBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		indexBarrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+		engine->_uploadQueue.release(cmd, indexBarrier, engine->_graphicsQueueFamily, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+		VkBufferMemoryBarrier meshletBarrier = vkinit::buffer_barrier(mergedMeshletBuffer._buffer, VK_QUEUE_FAMILY_IGNORED);
+		meshletBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		meshletBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		engine->_uploadQueue.release(cmd, meshletBarrier, engine->_asyncCompute ? engine->_computeQueueFamily : engine->_graphicsQueueFamily, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	}, std::move(stagingBuffers));
 }
 
 void RenderScene::refresh_pass(MeshPass* pass)
 {
+	ZoneScopedNC("Refresh Pass", tracy::Color::Blue);
 	pass->needsIndirectRefresh = true;
 	pass->needsInstanceRefresh = true;
 
@@ -378,6 +591,10 @@ void RenderScene::refresh_pass(MeshPass* pass)
 		new_objects.reserve(pass->unbatchedObjects.size());
 		for (auto o : pass->unbatchedObjects)
 		{
+			if (get_object(o)->removed)
+			{
+				continue;
+			}
 			RenderScene::PassObject newObject;
 
 			newObject.original = o;
@@ -489,6 +706,16 @@ void RenderScene::refresh_pass(MeshPass* pass)
 
 		build_indirect_batches(pass,pass->batches,pass->flat_batches);
 
+		//meshlet draw ranges follow the batch order, one command slot per object meshlet
+		uint32_t meshletDraws = 0;
+		for (auto& batch : pass->batches)
+		{
+			batch.meshletFirst = meshletDraws;
+			batch.meshletCount = batch.count * get_mesh(batch.meshID)->meshletCount;
+			meshletDraws += batch.meshletCount;
+		}
+		pass->meshletInstanceCount = meshletDraws;
+
 		//flatten batches into multibatch
 		Multibatch newbatch;
 		pass->multibatches.clear();
@@ -621,6 +848,10 @@ void RenderScene::flush(VulkanEngine* engine) {
 		vmaDestroyBuffer(engine->_allocator, mergedIndexBuffer._buffer, mergedIndexBuffer._allocation);
 		std::cout << " destroy merged index buffers" << std::endl;
 	}
+	if (mergedMeshletBuffer._buffer != VK_NULL_HANDLE) {
+		vmaDestroyBuffer(engine->_allocator, mergedMeshletBuffer._buffer, mergedMeshletBuffer._allocation);
+		std::cout << " destroy merged meshlet buffers" << std::endl;
+	}
 	if (this->objectDataBuffer._buffer) {
 		vmaDestroyBuffer(engine->_allocator, objectDataBuffer._buffer, objectDataBuffer._allocation);
 		std::cout << " destroy scene object data buffer" << std::endl;
@@ -690,6 +921,14 @@ Handle<DrawMesh> RenderScene::getMeshHandle(Mesh* m)
 		newMesh.firstVertex = 0;
 		newMesh.vertexCount = static_cast<uint32_t>(m->_vertices.size());
 		newMesh.indexCount = static_cast<uint32_t>(m->_indices.size());
+		newMesh.isMerged = false;
+		newMesh.firstMeshlet = 0;
+		newMesh.meshletCount = std::max(static_cast<uint32_t>(m->_meshlets.size()), 1u);
+		newMesh.lodCount = m->lod_count();
+		for (uint32_t lod = 0; lod < MAX_MESH_LODS; lod++)
+		{
+			newMesh.lods[lod] = m->get_lod(lod);
+		}
 
 		meshes.push_back(newMesh);
 
@@ -720,4 +959,25 @@ void RenderScene::MeshPass::cleanup(class VulkanEngine* engine) {
 	if (this->drawIndirectBuffer._buffer) {
 		vmaDestroyBuffer(engine->_allocator, drawIndirectBuffer._buffer, drawIndirectBuffer._allocation);
 	}
+	if (this->compactedDrawBuffer._buffer) {
+		vmaDestroyBuffer(engine->_allocator, compactedDrawBuffer._buffer, compactedDrawBuffer._allocation);
+	}
+	if (this->drawCountBuffer._buffer) {
+		vmaDestroyBuffer(engine->_allocator, drawCountBuffer._buffer, drawCountBuffer._allocation);
+	}
+	if (this->visibilityBuffer._buffer) {
+		vmaDestroyBuffer(engine->_allocator, visibilityBuffer._buffer, visibilityBuffer._allocation);
+	}
+	if (this->meshletInstanceBuffer._buffer) {
+		vmaDestroyBuffer(engine->_allocator, meshletInstanceBuffer._buffer, meshletInstanceBuffer._allocation);
+	}
+	if (this->meshletIndirectBuffer._buffer) {
+		vmaDestroyBuffer(engine->_allocator, meshletIndirectBuffer._buffer, meshletIndirectBuffer._allocation);
+	}
+	if (this->meshletCountBuffer._buffer) {
+		vmaDestroyBuffer(engine->_allocator, meshletCountBuffer._buffer, meshletCountBuffer._allocation);
+	}
+	if (this->meshletVisibleBuffer._buffer) {
+		vmaDestroyBuffer(engine->_allocator, meshletVisibleBuffer._buffer, meshletVisibleBuffer._allocation);
+	}
 }
\ No newline at end of file
@@ -32,6 +32,7 @@ struct GPUIndirectObject {
 	VkDrawIndexedIndirectCommand command;
 	uint32_t objectID;
 	uint32_t batchID;
+	uint32_t multibatchFirst;//first batch of the multibatch, where the draw count compaction puts the command
 };
 
 struct DrawMesh {
@@ -39,6 +40,12 @@ struct DrawMesh {
 	uint32_t firstIndex;
 	uint32_t indexCount;
 	uint32_t vertexCount;
+	//meshlet range in the merged meshlet buffer, meshes without meshlets get one covering the whole mesh
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	//lod ranges in the merged index buffer, slots past lodCount repeat the coarsest level
+	uint32_t lodCount;
+	MeshLod lods[MAX_MESH_LODS];
 	bool isMerged;//merged flag determine whether batch merged or not
 
 	Mesh* original;//
@@ -59,6 +66,8 @@ struct RenderObject {
 	glm::mat4 transformMatrix;
 
 	RenderBounds bounds;
+
+	bool removed{ false };//handle waits in RenderScene::freeObjects until it is registered again
 };
 
 struct GPUInstance {
@@ -66,6 +75,14 @@ struct GPUInstance {
 	uint32_t batchID;
 };
 
+//one entry per (object, meshlet) pair in a pass
+struct GPUMeshletInstance {
+	uint32_t objectID;
+	uint32_t meshletID;
+	uint32_t batchID;
+	uint32_t drawOffset;//first meshlet draw command of the batch
+};
+
 
 class RenderScene {
 public:
@@ -102,6 +119,9 @@ public:
 		PassMaterial material;
 		uint32_t first;
 		uint32_t count;
+		//range of meshlet draw commands, count * mesh meshlet count
+		uint32_t meshletFirst;
+		uint32_t meshletCount;
 	};
 	
 	struct Multibatch {
@@ -148,6 +168,23 @@ public:
 		AllocatedBuffer<GPUIndirectObject> drawIndirectBuffer;
 		AllocatedBuffer<GPUIndirectObject> clearIndirectBuffer;
 
+		//draw count path, non empty commands packed at the front of every multibatch range
+		AllocatedBuffer<GPUIndirectObject> compactedDrawBuffer;
+		AllocatedBuffer<uint32_t> drawCountBuffer;//indexed by the first batch of the multibatch
+		bool useDrawCount = false;
+
+		//meshlet cull path, draws are written compacted per batch and the rest of the range stays zeroed
+		AllocatedBuffer<GPUMeshletInstance> meshletInstanceBuffer;
+		AllocatedBuffer<GPUIndirectObject> meshletIndirectBuffer;
+		AllocatedBuffer<uint32_t> meshletCountBuffer;//visible meshlets per batch
+		AllocatedBuffer<uint32_t> meshletVisibleBuffer;//object id per meshlet draw
+		uint32_t meshletInstanceCount = 0;
+		bool useMeshlets = false;
+
+		//one bit per object id, set when the late cull found the object visible. read by the next early cull
+		AllocatedBuffer<uint32_t> visibilityBuffer;
+		bool needsVisibilityClear = true;
+
 		PassObject* get(Handle<PassObject> handle);
 
 		MeshpassType type;
@@ -174,12 +211,16 @@ public:
 
 	void register_object_batch(MeshObject* first, uint32_t count);
 
+	//takes the object out of every pass, the handle is reused by register_object after the next build_batches
+	void remove_object(Handle<RenderObject> objectID);
+
 	void update_transform(Handle<RenderObject> objectID,const glm::mat4 &localToWorld);
 	void update_object(Handle<RenderObject> objectID);
 	
 	void fill_objectData(GPUObjectData* data);
 	void fill_indirectArray(GPUIndirectObject* data, MeshPass& pass);
 	void fill_instancesArray(GPUInstance* data, MeshPass& pass);
+	void fill_meshletInstancesArray(GPUMeshletInstance* data, MeshPass& pass);
 
 	void write_object(GPUObjectData* target, Handle<RenderObject> objectID);
 	
@@ -205,6 +246,11 @@ public:
 
 	std::vector<Handle<RenderObject>> dirtyObjects;
 
+	//removed this frame, the passes still reference them until build_batches
+	std::vector<Handle<RenderObject>> removedObjects;
+	//removed and batched out, free for register_object
+	std::vector<Handle<RenderObject>> freeObjects;
+
 	MeshPass* get_mesh_pass(MeshpassType name);
 
 	//_forwardPass is not a real vulkan renderpass 
@@ -222,7 +268,10 @@ public:
 	
 
 	AllocatedBuffer<Vertex> mergedVertexBuffer;
-	AllocatedBuffer<uint32_t> mergedIndexBuffer;
+	//16 bit when every merged mesh has few enough vertices, indices are relative to the draw vertexOffset
+	AllocatedBufferUntyped mergedIndexBuffer;
+	VkIndexType mergedIndexType{ VK_INDEX_TYPE_UINT32 };
+	AllocatedBuffer<Meshlet> mergedMeshletBuffer;
 
 	AllocatedBuffer<GPUObjectData> objectDataBuffer;
 };
@@ -11,6 +11,70 @@
 
 #include <sstream>
 #include <iostream>
+#include <cstring>
+
+//"DREF" and "DSBN"
+constexpr uint32_t REFLECTION_MAGIC = 0x46455244;
+constexpr uint32_t BUNDLE_MAGIC = 0x4e425344;
+constexpr uint32_t REFLECTION_VERSION = 1;
+
+//appends native endian values to a blob
+struct BlobWriter {
+	std::vector<char> data;
+
+	void put(uint32_t value)
+	{
+		const char* bytes = (const char*)&value;
+		data.insert(data.end(), bytes, bytes + sizeof(uint32_t));
+	}
+	void put(const void* bytes, size_t size)
+	{
+		put(static_cast<uint32_t>(size));
+		data.insert(data.end(), (const char*)bytes, (const char*)bytes + size);
+	}
+};
+
+//reads a blob back, every read is bounds checked
+struct BlobReader {
+	const char* data;
+	size_t size;
+	size_t offset{ 0 };
+
+	bool get(uint32_t& value)
+	{
+		if (offset + sizeof(uint32_t) > size) return false;
+		memcpy(&value, data + offset, sizeof(uint32_t));
+		offset += sizeof(uint32_t);
+		return true;
+	}
+	//size prefixed byte range, points into the blob
+	bool get(const char*& bytes, uint32_t& length)
+	{
+		if (!get(length) || offset + length > size) return false;
+		bytes = data + offset;
+		offset += length;
+		return true;
+	}
+};
+
+static bool create_shader_module(VkDevice device, const std::vector<uint32_t>& code, VkShaderModule* outModule)
+{
+	//create a new shader module, using the buffer we loaded
+	VkShaderModuleCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.pNext = nullptr;
+
+	//codeSize has to be in bytes, so multply the ints in the buffer by size of int to know the real size of the buffer
+	createInfo.codeSize = code.size() * sizeof(uint32_t);
+	createInfo.pCode = code.data();
+
+	//check that the creation goes well.
+	if (vkCreateShaderModule(device, &createInfo, nullptr, outModule) != VK_SUCCESS) {
+		LOG_ERROR("Failed create shader module!");
+		return false;
+	}
+	return true;
+}
 
 bool vkutil::load_shader_module(VkDevice device,const char* filePath, ShaderModule* outShaderModule)
 {
@@ -39,19 +103,28 @@ bool vkutil::load_shader_module(VkDevice device,const char* filePath, ShaderModu
 	//now that the file is loaded into the buffer, we can close it
 	file.close();
 
-	//create a new shader module, using the buffer we loaded
-	VkShaderModuleCreateInfo createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.pNext = nullptr;
+	//reflection cache next to the spir-v, only valid for the exact same code
+	uint32_t codeHash = hash_spirv(buffer);
+	std::string reflectionPath = std::string(filePath) + ".refl";
+
+	bool cached = false;
+	std::ifstream reflectionFile(reflectionPath, std::ios::ate | std::ios::binary);
+	if (reflectionFile.is_open()) {
+		std::vector<char> blob((size_t)reflectionFile.tellg());
+		reflectionFile.seekg(0);
+		reflectionFile.read(blob.data(), blob.size());
+		cached = unpack_shader_reflection(blob.data(), blob.size(), codeHash, outShaderModule->reflection);
+	}
+	if (!cached) {
+		outShaderModule->reflection = reflect_shader_module(buffer);
 
-	//codeSize has to be in bytes, so multply the ints in the buffer by size of int to know the real size of the buffer
-	createInfo.codeSize = buffer.size() * sizeof(uint32_t);
-	createInfo.pCode = buffer.data();
+		std::vector<char> blob = pack_shader_reflection(outShaderModule->reflection, codeHash);
+		std::ofstream outFile(reflectionPath, std::ios::binary | std::ios::trunc);
+		outFile.write(blob.data(), blob.size());
+	}
 
-	//check that the creation goes well.
 	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-		LOG_ERROR("Failed create shader module!");
+	if (!create_shader_module(device, buffer, &shaderModule)) {
 		return false;
 	}
 
@@ -60,31 +133,150 @@ bool vkutil::load_shader_module(VkDevice device,const char* filePath, ShaderModu
 	return true;	
 }
 
+ShaderReflection vkutil::reflect_shader_module(const std::vector<uint32_t>& code)
+{
+	ShaderReflection reflection;
+
+	//using spirv-reflect libraries
+	SpvReflectShaderModule spvmodule;
+	SpvReflectResult result = spvReflectCreateShaderModule(code.size() * sizeof(uint32_t), code.data(), &spvmodule);
+	if (result != SPV_REFLECT_RESULT_SUCCESS) {
+		throw std::runtime_error("Failed to create spv reflect shader module!");
+	}
+	reflection.stage = static_cast<VkShaderStageFlagBits>(spvmodule.shader_stage);
+
+	//descriptor sets
+	uint32_t count = 0;
+	result = spvReflectEnumerateDescriptorSets(&spvmodule, &count, NULL);
+	assert(result == SPV_REFLECT_RESULT_SUCCESS);
+
+	std::vector<SpvReflectDescriptorSet*> sets(count);
+	result = spvReflectEnumerateDescriptorSets(&spvmodule, &count, sets.data());
+	assert(result == SPV_REFLECT_RESULT_SUCCESS);
+	//loop all extracted descriptor sets
+	for (size_t i_set = 0; i_set < sets.size(); ++i_set) {
+
+		const SpvReflectDescriptorSet& refl_set = *(sets[i_set]);
+		//loop all binding points and get descriptor info
+		for (uint32_t i_binding = 0; i_binding < refl_set.binding_count; ++i_binding) {
+			const SpvReflectDescriptorBinding& refl_binding = *(refl_set.bindings[i_binding]);
+
+			ShaderReflection::Binding binding;
+			binding.set = refl_set.set;
+			binding.binding = refl_binding.binding;
+			binding.type = static_cast<VkDescriptorType>(refl_binding.descriptor_type);
+			binding.count = 1;
+			for (uint32_t i_dim = 0; i_dim < refl_binding.array.dims_count; ++i_dim) {
+				binding.count *= refl_binding.array.dims[i_dim];
+			}
+			binding.name = refl_binding.name;
+
+			reflection.bindings.push_back(binding);
+		}
+	}
+
+	//pushconstants	
+	result = spvReflectEnumeratePushConstantBlocks(&spvmodule, &count, NULL);
+	assert(result == SPV_REFLECT_RESULT_SUCCESS);
+
+	std::vector<SpvReflectBlockVariable*> pconstants(count);
+	result = spvReflectEnumeratePushConstantBlocks(&spvmodule, &count, pconstants.data());
+	assert(result == SPV_REFLECT_RESULT_SUCCESS);
+
+	if (count > 0) {
+		reflection.pushConstantOffset = pconstants[0]->offset;
+		reflection.pushConstantSize = pconstants[0]->size;
+	}
+
+	spvReflectDestroyShaderModule(&spvmodule);
+
+	return reflection;
+}
+
+std::vector<char> vkutil::pack_shader_reflection(const ShaderReflection& reflection, uint32_t codeHash)
+{
+	BlobWriter writer;
+	writer.put(REFLECTION_MAGIC);
+	writer.put(REFLECTION_VERSION);
+	writer.put(codeHash);
+	writer.put(static_cast<uint32_t>(reflection.stage));
+	writer.put(reflection.pushConstantOffset);
+	writer.put(reflection.pushConstantSize);
+	writer.put(static_cast<uint32_t>(reflection.bindings.size()));
+	for (auto& b : reflection.bindings) {
+		writer.put(b.set);
+		writer.put(b.binding);
+		writer.put(static_cast<uint32_t>(b.type));
+		writer.put(b.count);
+		writer.put(b.name.data(), b.name.size());
+	}
+	return std::move(writer.data);
+}
+
+bool vkutil::unpack_shader_reflection(const char* data, size_t size, uint32_t codeHash, ShaderReflection& outReflection)
+{
+	BlobReader reader{ data, size };
+
+	uint32_t magic, version, hash, stage, bindingCount;
+	if (!reader.get(magic) || !reader.get(version) || !reader.get(hash)
+		|| magic != REFLECTION_MAGIC || version != REFLECTION_VERSION || hash != codeHash) {
+		return false;
+	}
+
+	ShaderReflection reflection;
+	if (!reader.get(stage) || !reader.get(reflection.pushConstantOffset) || !reader.get(reflection.pushConstantSize) || !reader.get(bindingCount)) {
+		return false;
+	}
+	reflection.stage = static_cast<VkShaderStageFlagBits>(stage);
+
+	reflection.bindings.resize(bindingCount);
+	for (auto& b : reflection.bindings) {
+		uint32_t type, nameLength;
+		const char* name;
+		if (!reader.get(b.set) || !reader.get(b.binding) || !reader.get(type) || !reader.get(b.count) || !reader.get(name, nameLength)) {
+			return false;
+		}
+		b.type = static_cast<VkDescriptorType>(type);
+		b.name.assign(name, nameLength);
+	}
+
+	outReflection = std::move(reflection);
+	return true;
+}
+
 // FNV-1a 32bit hashing algorithm.
-constexpr uint32_t fnv1a_32(char const* s, std::size_t count)
+static uint32_t fnv1a_32(uint32_t hash, const void* data, size_t size)
 {
-	return ((count ? fnv1a_32(s, count - 1) : 2166136261u) ^ s[count]) * 16777619u;
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
 }
-uint32_t vkutil::hash_descriptor_layout_info(VkDescriptorSetLayoutCreateInfo* info)
+constexpr uint32_t FNV_OFFSET_BASIS = 2166136261u;
+
+uint32_t vkutil::hash_spirv(const std::vector<uint32_t>& code)
 {
-	//we are going to put all the data into a string and then hash the string
-	std::stringstream ss;
+	return fnv1a_32(FNV_OFFSET_BASIS, code.data(), code.size() * sizeof(uint32_t));
+}
 
-	ss << info->flags;
-	ss << info->bindingCount;
+uint32_t vkutil::hash_descriptor_layout_info(VkDescriptorSetLayoutCreateInfo* info)
+{
+	//hash the fields directly, no need to go through a string
+	uint32_t hash = FNV_OFFSET_BASIS;
+	hash = fnv1a_32(hash, &info->flags, sizeof(info->flags));
+	hash = fnv1a_32(hash, &info->bindingCount, sizeof(info->bindingCount));
 
 	for (auto i = 0u; i < info->bindingCount; i++) {
 		const VkDescriptorSetLayoutBinding &binding = info->pBindings[i];
 
-		ss << binding.binding;
-		ss << binding.descriptorCount;
-		ss << binding.descriptorType;
-		ss << binding.stageFlags;
+		hash = fnv1a_32(hash, &binding.binding, sizeof(binding.binding));
+		hash = fnv1a_32(hash, &binding.descriptorCount, sizeof(binding.descriptorCount));
+		hash = fnv1a_32(hash, &binding.descriptorType, sizeof(binding.descriptorType));
+		hash = fnv1a_32(hash, &binding.stageFlags, sizeof(binding.stageFlags));
 	}
 
-	auto str = ss.str();
-
-	return fnv1a_32(str.c_str(),str.length());
+	return hash;
 }
 
 void ShaderEffect::add_stage(ShaderModule* shaderModule, VkShaderStageFlagBits stage)
@@ -106,79 +298,51 @@ void ShaderEffect::reflect_layout(VkDevice device, ReflectionOverrides* override
 	//push constants
 	std::vector<VkPushConstantRange> constant_ranges;
 
+	//reflection was done once per module when it was loaded
 	for (auto& s : stages) {	
+		const ShaderReflection& reflection = s.shaderModule->reflection;
 
-		//using spirv-reflect libraries
-		//descriptor sets
-		SpvReflectShaderModule spvmodule;
-		SpvReflectResult result = spvReflectCreateShaderModule(s.shaderModule->code.size() * sizeof(uint32_t), s.shaderModule->code.data(), &spvmodule);
-		if (result != SPV_REFLECT_RESULT_SUCCESS) {
-			throw std::runtime_error("Failed to create spv reflect shader module!");
-		}
-		uint32_t count = 0;
-		result = spvReflectEnumerateDescriptorSets(&spvmodule, &count, NULL);
-		assert(result == SPV_REFLECT_RESULT_SUCCESS);
-
-		std::vector<SpvReflectDescriptorSet*> sets(count);
-		result = spvReflectEnumerateDescriptorSets(&spvmodule, &count, sets.data());
-		assert(result == SPV_REFLECT_RESULT_SUCCESS);	
-		//loop all extracted descriptor sets
-		for (size_t i_set = 0; i_set < sets.size(); ++i_set) {
-			
-			const SpvReflectDescriptorSet& refl_set = *(sets[i_set]);
-
-			DescriptorSetLayoutData layout = {};
-			//refl_set.binding_count how much binding points
-			//loop all binding points and get descriptor info
-			layout.bindings.resize(refl_set.binding_count);
-			for (uint32_t i_binding = 0; i_binding < refl_set.binding_count; ++i_binding) {
-				const SpvReflectDescriptorBinding& refl_binding = *(refl_set.bindings[i_binding]);
-				VkDescriptorSetLayoutBinding& layout_binding = layout.bindings[i_binding];
-				layout_binding.binding = refl_binding.binding;
-				layout_binding.descriptorType = static_cast<VkDescriptorType>(refl_binding.descriptor_type);
-
-				for (int ov = 0; ov < overrideCount; ov++)
-				{
-					if (strcmp(refl_binding.name, overrides[ov].name) == 0) {
-						layout_binding.descriptorType = overrides[ov].overridenType;
-					}
-				}
+		for (auto& refl_binding : reflection.bindings) {
 
-				layout_binding.descriptorCount = 1;
-				for (uint32_t i_dim = 0; i_dim < refl_binding.array.dims_count; ++i_dim) {
-					layout_binding.descriptorCount *= refl_binding.array.dims[i_dim];
-				}
-				layout_binding.stageFlags = static_cast<VkShaderStageFlagBits>(spvmodule.shader_stage);
+			VkDescriptorSetLayoutBinding layout_binding = {};
+			layout_binding.binding = refl_binding.binding;
+			layout_binding.descriptorType = refl_binding.type;
 
-				ReflectedBinding reflected;
-				reflected.binding = layout_binding.binding;
-				reflected.set = refl_set.set;
-				reflected.type = layout_binding.descriptorType;
-
-				bindings[refl_binding.name] = reflected;
+			for (int ov = 0; ov < overrideCount; ov++)
+			{
+				if (strcmp(refl_binding.name.c_str(), overrides[ov].name) == 0) {
+					layout_binding.descriptorType = overrides[ov].overridenType;
+				}
 			}
-			//set number : pipeline layout binding points
-			layout.set_number = refl_set.set;
-			layout.create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-			layout.create_info.bindingCount = refl_set.binding_count;//current set include descriptor count
-			layout.create_info.pBindings = layout.bindings.data();
 
-			set_layouts.push_back(layout);
+			layout_binding.descriptorCount = refl_binding.count;
+			layout_binding.stageFlags = reflection.stage;
+
+			ReflectedBinding reflected;
+			reflected.binding = layout_binding.binding;
+			reflected.set = refl_binding.set;
+			reflected.type = layout_binding.descriptorType;
+
+			bindings[refl_binding.name] = reflected;
+
+			//one layout data per set number of this stage
+			auto layout = std::find_if(set_layouts.begin(), set_layouts.end(), [&](const DescriptorSetLayoutData& l) {
+				return l.set_number == refl_binding.set;
+			});
+			if (layout == set_layouts.end()) {
+				DescriptorSetLayoutData newLayout = {};
+				newLayout.set_number = refl_binding.set;
+				set_layouts.push_back(newLayout);
+				layout = set_layouts.end() - 1;
+			}
+			layout->bindings.push_back(layout_binding);
 		}
 
 		//pushconstants	
-		
-		result = spvReflectEnumeratePushConstantBlocks(&spvmodule, &count, NULL);
-		assert(result == SPV_REFLECT_RESULT_SUCCESS);
-
-		std::vector<SpvReflectBlockVariable*> pconstants(count);
-		result = spvReflectEnumeratePushConstantBlocks(&spvmodule, &count, pconstants.data());
-		assert(result == SPV_REFLECT_RESULT_SUCCESS);
-
-		if (count > 0) {
+		if (reflection.pushConstantSize > 0) {
 			VkPushConstantRange pcs{};
-			pcs.offset = pconstants[0]->offset;
-			pcs.size = pconstants[0]->size;
+			pcs.offset = reflection.pushConstantOffset;
+			pcs.size = reflection.pushConstantSize;
 			pcs.stageFlags = s.stage;
 
 			constant_ranges.push_back(pcs);
@@ -187,7 +351,6 @@ void ShaderEffect::reflect_layout(VkDevice device, ReflectionOverrides* override
 
 
 	
-
 	std::array<DescriptorSetLayoutData,4> merged_layouts;
 	
 	for (int i = 0; i < 4; i++) {
@@ -242,7 +405,11 @@ void ShaderEffect::reflect_layout(VkDevice device, ReflectionOverrides* override
 		
 		//setHash[] array storage layout hased create info 
 		//setLayout[] array storage real VkDescriptorSetLayout objects
-		if (ly.create_info.bindingCount > 0) {
+		if (externalLayouts[i] != VK_NULL_HANDLE) {
+			setHashes[i] = 0;
+			setLayouts[i] = externalLayouts[i];
+		}
+		else if (ly.create_info.bindingCount > 0) {
 			setHashes[i] = vkutil::hash_descriptor_layout_info(&ly.create_info);
 			vkCreateDescriptorSetLayout(device, &ly.create_info, nullptr, &setLayouts[i]);
 			//std::cout << "***********************create dptorSetLayout" << std::endl;
@@ -293,7 +460,7 @@ void ShaderEffect::cleanup(VkDevice device) {
 		uint32_t validCount = 0;
 		for (size_t i = 0; i < setLayouts.size(); i++) {
 			auto dptorSetLayout = setLayouts[i];
-			if (dptorSetLayout) {
+			if (dptorSetLayout && dptorSetLayout != externalLayouts[i]) {
 				vkDestroyDescriptorSetLayout(device, dptorSetLayout, nullptr);
 				validCount++;
 			}
@@ -474,11 +641,28 @@ ShaderModule* ShaderCache::get_shader(const std::string& path)
 	{	
 		ShaderModule newShader;
 
-		bool result = vkutil::load_shader_module(_device, path.c_str(), &newShader);
-		if (!result)
+		//bundle entries are used as long as the .spv did not change after the bundle was written
+		auto entry = bundle_entries.find(path);
+		std::error_code ec;
+		if (entry != bundle_entries.end() && std::filesystem::last_write_time(path, ec) <= bundle_time)
+		{
+			if (!create_shader_module(_device, entry->second.code, &newShader.module))
+			{
+				return nullptr;
+			}
+			newShader.code = std::move(entry->second.code);
+			newShader.reflection = std::move(entry->second.reflection);
+			bundle_entries.erase(entry);
+		}
+		else
 		{
-			std::cout << "Error when compiling shader " << path << std::endl;
-			return nullptr;
+			bool result = vkutil::load_shader_module(_device, path.c_str(), &newShader);
+			if (!result)
+			{
+				std::cout << "Error when compiling shader " << path << std::endl;
+				return nullptr;
+			}
+			bundle_dirty = true;
 		}
 
 		module_cache[path] = newShader;
@@ -486,6 +670,87 @@ ShaderModule* ShaderCache::get_shader(const std::string& path)
 	return &module_cache[path];
 }
 
+bool ShaderCache::load_bundle(const std::string& path)
+{
+	bundle_path = path;
+
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open()) {
+		LOG_INFO("No shader bundle at {}, loading shader files", path);
+		return false;
+	}
+
+	std::vector<char> data((size_t)file.tellg());
+	file.seekg(0);
+	file.read(data.data(), data.size());
+	file.close();
+
+	BlobReader reader{ data.data(), data.size() };
+	uint32_t magic, version, count;
+	if (!reader.get(magic) || !reader.get(version) || !reader.get(count)
+		|| magic != BUNDLE_MAGIC || version != REFLECTION_VERSION) {
+		LOG_WARNING("Shader bundle {} is invalid, loading shader files", path);
+		return false;
+	}
+
+	std::unordered_map<std::string, BundleEntry> entries;
+	for (uint32_t i = 0; i < count; i++) {
+		const char* name;
+		const char* code;
+		const char* reflection;
+		uint32_t nameLength, codeSize, reflectionSize;
+		if (!reader.get(name, nameLength) || !reader.get(code, codeSize) || !reader.get(reflection, reflectionSize)) {
+			LOG_WARNING("Shader bundle {} is truncated, loading shader files", path);
+			return false;
+		}
+
+		BundleEntry entry;
+		entry.code.resize(codeSize / sizeof(uint32_t));
+		memcpy(entry.code.data(), code, entry.code.size() * sizeof(uint32_t));
+		if (!vkutil::unpack_shader_reflection(reflection, reflectionSize, vkutil::hash_spirv(entry.code), entry.reflection)) {
+			continue;
+		}
+		entries[std::string(name, nameLength)] = std::move(entry);
+	}
+
+	std::error_code ec;
+	bundle_time = std::filesystem::last_write_time(path, ec);
+	bundle_entries = std::move(entries);
+
+	LOG_INFO("Loaded shader bundle {} with {} shaders", path, bundle_entries.size());
+	return true;
+}
+
+bool ShaderCache::save_bundle()
+{
+	if (!bundle_dirty || bundle_path.empty()) {
+		return false;
+	}
+
+	BlobWriter writer;
+	writer.put(BUNDLE_MAGIC);
+	writer.put(REFLECTION_VERSION);
+	writer.put(static_cast<uint32_t>(module_cache.size()));
+	for (auto& [name, shader] : module_cache) {
+		std::vector<char> reflection = vkutil::pack_shader_reflection(shader.reflection, vkutil::hash_spirv(shader.code));
+
+		writer.put(name.data(), name.size());
+		writer.put(shader.code.data(), shader.code.size() * sizeof(uint32_t));
+		writer.put(reflection.data(), reflection.size());
+	}
+
+	std::ofstream file(bundle_path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		LOG_ERROR("Failed to write shader bundle {}", bundle_path);
+		return false;
+	}
+	file.write(writer.data.data(), writer.data.size());
+	bundle_dirty = false;
+
+	LOG_INFO("Saved shader bundle {} with {} shaders", bundle_path, module_cache.size());
+	return true;
+}
+
 void ShaderCache::cleanup() {
 	uint32_t shaderCount = 0;
 	uint32_t VaildShaderCount = 0;
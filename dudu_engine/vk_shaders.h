@@ -9,17 +9,47 @@
 #include <unordered_map>
 
 #include <vk_descriptors.h>
+#include <string>
+#include <filesystem>
+
+//reflection of a single spir-v module, before the overrides of the shader effect
+struct ShaderReflection {
+	struct Binding {
+		uint32_t set;
+		uint32_t binding;
+		VkDescriptorType type;
+		uint32_t count;//0 for runtime arrays
+		std::string name;
+	};
+	VkShaderStageFlagBits stage;
+	std::vector<Binding> bindings;
+	//size 0 means no push constants
+	uint32_t pushConstantOffset{ 0 };
+	uint32_t pushConstantSize{ 0 };
+};
 
 struct ShaderModule {
 	std::vector<uint32_t> code;//storage shader code(spirv)
 	VkShaderModule module;
+	ShaderReflection reflection;
 };
 namespace vkutil {
 	
 
 	//loads a shader module from a spir-v file. Returns false if it errors	
+	//reflection comes from the .refl file next to the .spv, it is written on the first load
 	bool load_shader_module(VkDevice device, const char* filePath, ShaderModule* outShaderModule);
 
+	//run spirv-reflect over the code
+	ShaderReflection reflect_shader_module(const std::vector<uint32_t>& code);
+
+	//compact binary form of the reflection, tagged with a hash of the spir-v it came from
+	std::vector<char> pack_shader_reflection(const ShaderReflection& reflection, uint32_t codeHash);
+	//fails when the blob is malformed or belongs to other code
+	bool unpack_shader_reflection(const char* data, size_t size, uint32_t codeHash, ShaderReflection& outReflection);
+
+	uint32_t hash_spirv(const std::vector<uint32_t>& code);
+
 	uint32_t hash_descriptor_layout_info(VkDescriptorSetLayoutCreateInfo* info);
 }
 
@@ -51,6 +81,8 @@ struct ShaderEffect {
 	};
 	std::unordered_map<std::string, ReflectedBinding> bindings;
 	std::array<VkDescriptorSetLayout, 4> setLayouts;
+	//layouts owned by someone else, used instead of the reflected ones and not destroyed in cleanup
+	std::array<VkDescriptorSetLayout, 4> externalLayouts{};
 	std::array<uint32_t, 4> setHashes;
 private:
 	struct ShaderStage {
@@ -104,7 +136,23 @@ public:
 
 	void init(VkDevice device) { _device = device; };
 	void cleanup();
+
+	//packed code and reflection of every shader, read with a single file read
+	//entries older than their .spv are loaded from the file instead
+	bool load_bundle(const std::string& path);
+	//rewrite the bundle when shaders were loaded outside of it
+	bool save_bundle();
 private:
+	struct BundleEntry {
+		std::vector<uint32_t> code;
+		ShaderReflection reflection;
+	};
+
 	VkDevice _device;
 	std::unordered_map<std::string, ShaderModule> module_cache;
+
+	std::string bundle_path;
+	std::filesystem::file_time_type bundle_time;
+	std::unordered_map<std::string, BundleEntry> bundle_entries;
+	bool bundle_dirty{ false };
 };
\ No newline at end of file
@@ -1,6 +1,6 @@
 ﻿#include <vk_textures.h>
-#include <iostream>
 #include <chrono>
+#include "logger.h"
 
 #include <vk_initializers.h>
 
@@ -10,7 +10,7 @@
 #include <SDL_filesystem.h>
 #include "texture_asset.h"
 #include "asset_loader.h"
-#include "Tracy.hpp"
+#include "vk_trace.h"
 
 //No recommend ! load speed slowly
 //load image directly from disk file(no compressioned binary file<AsserFile>)
@@ -24,17 +24,18 @@ bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, Alloca
 	auto loadend = std::chrono::high_resolution_clock::now();
 	auto diff = loadend - loadstart;
 	if (!pixels) {
-		std::cout << "Failed to load texture file " << file << std::endl;
+		LOG_ERROR("Failed to load texture file {}", file);
 		return false;
 	}
 
-	std::cout << "Load texture from disk file took " << std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count() / 1000000.0 << "ms" << std::endl;
+	LOG_INFO("Load texture from disk file took {} ms", std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count() / 1000000.0);
 
 	void* pixel_ptr = pixels;
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
 
 	VkFormat image_format = VK_FORMAT_R8G8B8A8_UNORM;
 
+	vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::Staging);
 	AllocatedBufferUntyped stagingBuffer = engine.create_buffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
 
 	void* data;
@@ -49,10 +50,7 @@ bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, Alloca
 	//only upload mipLevel == 1 texture
 	outImage =  upload_image(texWidth, texHeight, image_format, engine, stagingBuffer);
 
-
-	vmaDestroyBuffer(engine._allocator, stagingBuffer._buffer, stagingBuffer._allocation);
-
-	std::cout << "Texture loaded succesfully " << file << std::endl;
+	LOG_SUCCESS("Texture loaded succesfully {}", file);
 
 	
 	return true;
@@ -68,11 +66,11 @@ bool vkutil::load_image_from_asset(VulkanEngine& engine, const char* filename, A
 	auto diff = loadend - loadstart;
 
 	if (!loaded) {
-		std::cout << "Error when loading texture " << filename << std::endl;
+		LOG_ERROR("Error when loading texture {}", filename);
 		return false;
 	}
 
-	std::cout << "Load texture from AssertFile took " << std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count() / 1000000.0 << "ms" << std::endl;
+	LOG_INFO("Load texture from AssertFile took {} ms", std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count() / 1000000.0);
 
 	assets::TextureInfo textureInfo = assets::read_texture_info(&file);
 
@@ -87,6 +85,7 @@ bool vkutil::load_image_from_asset(VulkanEngine& engine, const char* filename, A
 		return false;
 	}
 
+	vkutil::MemoryScope memoryScope(vkutil::MemoryCategory::Staging);
 	AllocatedBufferUntyped stagingBuffer = engine.create_buffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_UNKNOWN, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
 	
 	std::vector<MipmapInfo> mips;
@@ -112,8 +111,6 @@ bool vkutil::load_image_from_asset(VulkanEngine& engine, const char* filename, A
 
 	outImage = upload_image_mipmapped(textureInfo.pages[0].width, textureInfo.pages[0].height, image_format, engine, stagingBuffer,mips);
 
-	vmaDestroyBuffer(engine._allocator, stagingBuffer._buffer, stagingBuffer._allocation);
-
 	return true;
 }
 
@@ -130,12 +127,13 @@ AllocatedImage vkutil::upload_image(int texWidth, int texHeight, VkFormat image_
 
 	VmaAllocationCreateInfo dimg_allocinfo = {};
 	dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	vkutil::tag_allocation(dimg_allocinfo, vkutil::MemoryCategory::Textures);
 
 	//allocate and create the image
 	vmaCreateImage(engine._allocator, &dimg_info, &dimg_allocinfo, &newImage._image, &newImage._allocation, nullptr);
 
-	//transition image to transfer-receiver	
-	engine.immediate_submit([&](VkCommandBuffer cmd) {
+	//transition image to transfer-receiver, the upload queue frees the staging buffer once the copy is done
+	engine._uploadQueue.submit([&](VkCommandBuffer cmd) {
 		VkImageSubresourceRange range;
 		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		range.baseMipLevel = 0;
@@ -179,9 +177,9 @@ AllocatedImage vkutil::upload_image(int texWidth, int texHeight, VkFormat image_
 		imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 		imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-		//barrier the image into the shader readable layout
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
-		});
+		//barrier the image into the shader readable layout, handed over to the graphics queue
+		engine._uploadQueue.release(cmd, imageBarrier_toReadable, engine._graphicsQueueFamily, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		}, { stagingBuffer });
 
 
 	//build a default imageview
@@ -217,12 +215,13 @@ AllocatedImage vkutil::upload_image_mipmapped(int texWidth, int texHeight, VkFor
 
 	VmaAllocationCreateInfo dimg_allocinfo = {};
 	dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	vkutil::tag_allocation(dimg_allocinfo, vkutil::MemoryCategory::Textures);
 
 	//allocate and create the image
 	vmaCreateImage(engine._allocator, &dimg_info, &dimg_allocinfo, &newImage._image, &newImage._allocation, nullptr);
 
-	//transition image to transfer-receiver	
-	engine.immediate_submit([&](VkCommandBuffer cmd) {
+	//transition image to transfer-receiver, the upload queue frees the staging buffer once the copy is done
+	engine._uploadQueue.submit([&](VkCommandBuffer cmd) {
 		VkImageSubresourceRange range;
 		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		range.baseMipLevel = 0;
@@ -273,9 +272,9 @@ AllocatedImage vkutil::upload_image_mipmapped(int texWidth, int texHeight, VkFor
 		imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 		imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-		//barrier the image into the shader readable layout
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
-	});
+		//barrier the image into the shader readable layout, handed over to the graphics queue
+		engine._uploadQueue.release(cmd, imageBarrier_toReadable, engine._graphicsQueueFamily, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}, { stagingBuffer });
 
 
 
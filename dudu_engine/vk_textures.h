@@ -17,6 +17,7 @@ namespace vkutil {
 	bool load_image_from_asset(VulkanEngine& engine, const char* file, AllocatedImage& outImage);
 
 
+	//the copies run on the upload queue without waiting, it takes the staging buffer and destroys it when they are done
 	AllocatedImage upload_image(int texWidth, int texHeight, VkFormat image_format, VulkanEngine& engine, AllocatedBufferUntyped& stagingBuffer);
 
 	AllocatedImage upload_image_mipmapped(int texWidth, int texHeight, VkFormat image_format, VulkanEngine& engine, AllocatedBufferUntyped& stagingBuffer, std::vector<MipmapInfo> mips);
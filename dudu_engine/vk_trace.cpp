@@ -0,0 +1,258 @@
+﻿#include <vk_trace.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <unordered_set>
+#include <algorithm>
+#include "logger.h"
+
+namespace vktrace {
+
+	namespace {
+		struct Event {
+			const char* name;
+			const char* category;
+			uint64_t start;
+			uint64_t duration;
+		};
+
+		//one per thread that recorded a zone, the lock is only contended while writing the file
+		struct ThreadEvents {
+			uint32_t tid;
+			std::mutex lock;
+			std::vector<Event> events;
+		};
+
+		//gpu timers are read back this many frames after their cpu frame, the profiler keeps 5 pools
+		constexpr int GPU_READBACK_FRAMES = 6;
+
+		const auto clockStart = std::chrono::steady_clock::now();
+
+		std::atomic<bool> recording{ false };
+		//the gpu zones of the range are still coming in
+		std::atomic<bool> draining{ false };
+
+		std::mutex stateLock;
+		std::string outputPath;
+		int firstFrame{ -1 };
+		int lastFrame{ -1 };
+		int writeFrame{ -1 };
+		uint64_t captureStart{ 0 };
+		uint64_t captureEnd{ 0 };
+		std::vector<uint64_t> frameStarts;
+		std::vector<int> frameNumbers;
+
+		std::vector<std::unique_ptr<ThreadEvents>> threads;
+		thread_local ThreadEvents* threadEvents = nullptr;
+
+		ThreadEvents gpuEvents;
+		int64_t gpuToCpu{ 0 };
+		//gpu timer names are std::string, kept here so the events can point at them
+		std::unordered_set<std::string> gpuNames;
+
+		ThreadEvents& this_thread_events()
+		{
+			if (!threadEvents)
+			{
+				std::lock_guard<std::mutex> guard(stateLock);
+				threads.push_back(std::make_unique<ThreadEvents>());
+				threads.back()->tid = static_cast<uint32_t>(threads.size());
+				threadEvents = threads.back().get();
+			}
+			return *threadEvents;
+		}
+
+		void write_event(std::ofstream& file, bool& first, const Event& e, int pid, uint32_t tid)
+		{
+			//names are code literals, they never need escaping
+			file << (first ? "\n" : ",\n");
+			file << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"ts\":" << e.start / 1000.0
+				<< ",\"dur\":" << e.duration / 1000.0 << ",\"pid\":" << pid << ",\"tid\":" << tid << "}";
+			first = false;
+		}
+
+		void write_metadata(std::ofstream& file, bool& first, const char* kind, int pid, uint32_t tid, const std::string& name)
+		{
+			file << (first ? "\n" : ",\n");
+			file << "{\"name\":\"" << kind << "\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+			first = false;
+		}
+
+		//stateLock held
+		void write_capture()
+		{
+			std::ofstream file(outputPath);
+			if (!file.is_open())
+			{
+				LOG_ERROR("Failed to write the trace {}", outputPath);
+				return;
+			}
+
+			size_t eventCount = 0;
+			bool first = true;
+			//ts and dur are microseconds with nanosecond decimals, the default 6 significant digits lose them after a second
+			file << std::fixed << std::setprecision(3);
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+			write_metadata(file, first, "process_name", 1, 0, "CPU");
+			write_metadata(file, first, "process_name", 2, 0, "GPU");
+			write_metadata(file, first, "thread_name", 2, 0, "Timers");
+
+			for (auto& thread : threads)
+			{
+				std::lock_guard<std::mutex> guard(thread->lock);
+				if (thread->events.empty()) continue;
+
+				write_metadata(file, first, "thread_name", 1, thread->tid, fmt::format("Thread {}", thread->tid));
+				for (const Event& e : thread->events)
+				{
+					write_event(file, first, e, 1, thread->tid);
+				}
+				eventCount += thread->events.size();
+				thread->events.clear();
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(gpuEvents.lock);
+				for (const Event& e : gpuEvents.events)
+				{
+					//the pools read back during the range still hold timers of frames before it
+					if (e.start < captureStart || e.start > captureEnd) continue;
+					write_event(file, first, e, 2, 0);
+					eventCount++;
+				}
+				gpuEvents.events.clear();
+			}
+
+			for (size_t i = 0; i < frameStarts.size(); i++)
+			{
+				file << ",\n{\"name\":\"Frame " << frameNumbers[i] << "\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" << frameStarts[i] / 1000.0 << ",\"pid\":1,\"tid\":0}";
+			}
+			file << "\n]}\n";
+
+			LOG_SUCCESS("Wrote {} trace events of frames {} to {} to {}", eventCount, firstFrame, lastFrame - 1, outputPath);
+			frameStarts.clear();
+			frameNumbers.clear();
+			outputPath.clear();
+		}
+	}
+
+	void configure(const std::string& path, int _firstFrame, int frameCount)
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		outputPath = path;
+		firstFrame = std::max(_firstFrame, 0);
+		lastFrame = firstFrame + std::max(frameCount, 1);
+		writeFrame = lastFrame + GPU_READBACK_FRAMES;
+	}
+
+	bool capturing()
+	{
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	void begin_frame(int frameNumber)
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		if (outputPath.empty()) return;
+
+		if (frameNumber == firstFrame)
+		{
+			//zones that closed after an earlier capture was written
+			for (auto& thread : threads)
+			{
+				std::lock_guard<std::mutex> threadGuard(thread->lock);
+				thread->events.clear();
+			}
+			captureStart = now();
+			recording = true;
+			draining = true;
+			LOG_INFO("Trace capture started at frame {}", frameNumber);
+		}
+		else if (frameNumber == lastFrame)
+		{
+			captureEnd = now();
+			recording = false;
+		}
+		else if (frameNumber == writeFrame)
+		{
+			draining = false;
+			write_capture();
+			return;
+		}
+
+		if (recording)
+		{
+			frameStarts.push_back(now());
+			frameNumbers.push_back(frameNumber);
+		}
+	}
+
+	void finish()
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		if (outputPath.empty()) return;
+		if (!draining)
+		{
+			LOG_WARNING("Trace capture of frame {} never started, no trace written", firstFrame);
+			return;
+		}
+
+		if (recording)
+		{
+			captureEnd = now();
+			recording = false;
+			lastFrame = firstFrame + static_cast<int>(frameStarts.size());
+		}
+		draining = false;
+		write_capture();
+	}
+
+	uint64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - clockStart).count();
+	}
+
+	void calibrate_gpu(uint64_t gpuNanoseconds, uint64_t cpuNanoseconds)
+	{
+		std::lock_guard<std::mutex> guard(gpuEvents.lock);
+		gpuToCpu = static_cast<int64_t>(cpuNanoseconds) - static_cast<int64_t>(gpuNanoseconds);
+	}
+
+	void gpu_zone(const std::string& name, uint64_t beginNanoseconds, uint64_t endNanoseconds)
+	{
+		if (!draining.load(std::memory_order_relaxed)) return;
+
+		std::lock_guard<std::mutex> guard(gpuEvents.lock);
+		const char* stored = gpuNames.insert(name).first->c_str();
+
+		Event e;
+		e.name = stored;
+		e.category = "gpu";
+		e.start = static_cast<uint64_t>(static_cast<int64_t>(beginNanoseconds) + gpuToCpu);
+		e.duration = endNanoseconds > beginNanoseconds ? endNanoseconds - beginNanoseconds : 0;
+		gpuEvents.events.push_back(e);
+	}
+
+	Zone::Zone(const char* _name, const char* _category)
+	{
+		name = _name;
+		category = _category;
+		recording = capturing();
+		start = recording ? now() : 0;
+	}
+
+	Zone::~Zone()
+	{
+		//a zone open when the capture stops is still kept whole
+		if (!recording) return;
+
+		Event e{ name, category, start, now() - start };
+		ThreadEvents& events = this_thread_events();
+		std::lock_guard<std::mutex> guard(events.lock);
+		events.events.push_back(e);
+	}
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Tracy.hpp"
+
+//offline capture of cpu zones, record jobs and gpu timers, written as chrome trace event json
+//the file opens in chrome://tracing and in the perfetto ui, nothing needs a live tracy connection
+namespace vktrace {
+
+	//zone events of a frame range, start at firstFrame and keep frameCount frames
+	//the gpu timers come back a few frames late, the file is written once they are in or on finish
+	void configure(const std::string& path, int firstFrame, int frameCount);
+
+	//true while cpu zones are recorded
+	bool capturing();
+
+	//called at the start of every frame, starts and stops the capture
+	void begin_frame(int frameNumber);
+
+	//writes the capture if it is still open, at shutdown
+	void finish();
+
+	//nanoseconds on the clock of every event
+	uint64_t now();
+
+	//pairs a gpu timestamp with the cpu time it was taken at, gpu zones are moved on the cpu clock with it
+	void calibrate_gpu(uint64_t gpuNanoseconds, uint64_t cpuNanoseconds);
+
+	//gpu timer read back by the profiler, in nanoseconds of the gpu clock
+	void gpu_zone(const std::string& name, uint64_t beginNanoseconds, uint64_t endNanoseconds);
+
+	//name and category must outlive the capture, string literals
+	class Zone {
+	public:
+		Zone(const char* name, const char* category = "cpu");
+		~Zone();
+	private:
+		const char* name;
+		const char* category;
+		uint64_t start;
+		bool recording;
+	};
+}
+
+//the tracy zones are recorded as well, include this header instead of Tracy.hpp
+#undef ZoneScopedN
+#undef ZoneScopedNC
+#define ZoneScopedN(name) ZoneNamedN(___tracy_scoped_zone, name, true); vktrace::Zone ___trace_zone(name);
+#define ZoneScopedNC(name, color) ZoneNamedNC(___tracy_scoped_zone, name, color, true); vktrace::Zone ___trace_zone(name);
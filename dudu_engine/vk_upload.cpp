@@ -0,0 +1,226 @@
+﻿#include <vk_upload.h>
+#include <algorithm>
+#include <vk_initializers.h>
+#include "logger.h"
+#include "vk_trace.h"
+
+namespace vkutil {
+
+	void UploadQueue::init(VkDevice _device, VmaAllocator _allocator, VkQueue _queue, uint32_t _queueFamily)
+	{
+		device = _device;
+		allocator = _allocator;
+		queue = _queue;
+		queueFamily = _queueFamily;
+
+		//command buffers are freed one by one once their upload is done
+		VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(queueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to create the upload command pool");
+		}
+
+		VkSemaphoreTypeCreateInfo typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+		semaphoreInfo.pNext = &typeInfo;
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to create the upload timeline semaphore");
+		}
+	}
+
+	void UploadQueue::cleanup()
+	{
+		wait(submitted);
+		retire();
+
+		vkDestroyCommandPool(device, pool, nullptr);
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+
+	uint64_t UploadQueue::submit(std::function<void(VkCommandBuffer cmd)>&& function, std::vector<AllocatedBufferUntyped> stagingBuffers)
+	{
+		ZoneScopedNC("Upload Submit", tracy::Color::White);
+
+		retire();
+
+		VkCommandBuffer cmd;
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(pool, 1);
+		if (vkAllocateCommandBuffers(device, &cmdAllocInfo, &cmd) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to allocate an upload command buffer");
+		}
+
+		VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		vkBeginCommandBuffer(cmd, &cmdBeginInfo);
+
+		//release calls inside the function tag their acquires with this value
+		submitted++;
+		function(cmd);
+
+		vkEndCommandBuffer(cmd);
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &submitted;
+
+		VkSubmitInfo submitInfo = vkinit::submit_info(&cmd);
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+
+		if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to submit an upload");
+		}
+
+		Submission submission;
+		submission.value = submitted;
+		submission.cmd = cmd;
+		submission.stagingSize = 0;
+		for (AllocatedBufferUntyped& buffer : stagingBuffers)
+		{
+			submission.stagingSize += buffer._size;
+		}
+		submission.stagingBuffers = std::move(stagingBuffers);
+
+		stagingInFlight += submission.stagingSize;
+		inFlight.push_back(std::move(submission));
+
+		//loading faster than the queue copies, let the oldest uploads finish before staging more
+		while (stagingInFlight > MAX_UPLOAD_STAGING && inFlight.size() > 1)
+		{
+			wait(inFlight.front().value);
+			retire();
+		}
+
+		return submitted;
+	}
+
+	void UploadQueue::release(VkCommandBuffer cmd, VkImageMemoryBarrier barrier, uint32_t dstFamily, VkPipelineStageFlags dstStage)
+	{
+		//same family, a plain barrier and the timeline wait are enough
+		if (dstFamily == queueFamily)
+		{
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			return;
+		}
+
+		//release and acquire repeat the layout change, the release keeps the writes and the acquire the reads
+		barrier.srcQueueFamilyIndex = queueFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+
+		PendingAcquire pending;
+		pending.family = dstFamily;
+		pending.stage = dstStage;
+		pending.value = submitted;
+		pending.isImage = true;
+		pending.image = barrier;
+		pending.image.srcAccessMask = 0;
+		acquires.push_back(pending);
+
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	void UploadQueue::release(VkCommandBuffer cmd, VkBufferMemoryBarrier barrier, uint32_t dstFamily, VkPipelineStageFlags dstStage)
+	{
+		if (dstFamily == queueFamily)
+		{
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			return;
+		}
+
+		barrier.srcQueueFamilyIndex = queueFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+
+		PendingAcquire pending;
+		pending.family = dstFamily;
+		pending.stage = dstStage;
+		pending.value = submitted;
+		pending.isImage = false;
+		pending.buffer = barrier;
+		pending.buffer.srcAccessMask = 0;
+		acquires.push_back(pending);
+
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+
+	UploadQueue::Acquire UploadQueue::acquire(VkCommandBuffer cmd, uint32_t family)
+	{
+		Acquire result;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+
+		for (size_t i = 0; i < acquires.size();)
+		{
+			PendingAcquire& pending = acquires[i];
+			if (pending.family != family)
+			{
+				i++;
+				continue;
+			}
+
+			if (pending.isImage)
+			{
+				imageBarriers.push_back(pending.image);
+			}
+			else
+			{
+				bufferBarriers.push_back(pending.buffer);
+			}
+			result.value = std::max(result.value, pending.value);
+			result.stages |= pending.stage;
+
+			acquires[i] = acquires.back();
+			acquires.pop_back();
+		}
+
+		if (result.value != 0)
+		{
+			//the semaphore wait is on the same stages, so the acquire chains after it
+			vkCmdPipelineBarrier(cmd, result.stages, result.stages, 0, 0, nullptr,
+				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+		}
+		return result;
+	}
+
+	void UploadQueue::wait(uint64_t value)
+	{
+		ZoneScopedNC("Upload Wait", tracy::Color::Red);
+
+		VkSemaphoreWaitInfo waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &semaphore;
+		waitInfo.pValues = &value;
+
+		vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+	}
+
+	void UploadQueue::retire()
+	{
+		uint64_t done = 0;
+		vkGetSemaphoreCounterValue(device, semaphore, &done);
+
+		while (!inFlight.empty() && inFlight.front().value <= done)
+		{
+			Submission& submission = inFlight.front();
+
+			vkFreeCommandBuffers(device, pool, 1, &submission.cmd);
+			for (AllocatedBufferUntyped& buffer : submission.stagingBuffers)
+			{
+				vmaDestroyBuffer(allocator, buffer._buffer, buffer._allocation);
+			}
+			stagingInFlight -= submission.stagingSize;
+
+			inFlight.pop_front();
+		}
+	}
+}
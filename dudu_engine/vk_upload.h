@@ -0,0 +1,82 @@
+﻿#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <deque>
+#include <functional>
+
+namespace vkutil {
+
+	//staging memory kept alive by uploads in flight, submit waits for the oldest ones past it
+	constexpr size_t MAX_UPLOAD_STAGING = 256 * 1024 * 1024;
+
+	//texture and mesh uploads on their own queue, a transfer only family when the gpu has one
+	//a timeline semaphore counts the finished uploads, nothing waits on a fence per upload
+	//resources are released to the family that uses them, the frame acquires them and waits for the timeline value
+	class UploadQueue {
+	public:
+
+		//what a submit has to wait for before using the acquired resources
+		struct Acquire {
+			uint64_t value{ 0 };//0 when nothing was acquired
+			VkPipelineStageFlags stages{ 0 };//first use of the resources, the semaphore wait goes there
+		};
+
+		void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily);
+
+		//waits for every upload and frees them
+		void cleanup();
+
+		//record and submit an upload without waiting for it, returns the timeline value signaled once it is done
+		//the staging buffers are destroyed after that
+		uint64_t submit(std::function<void(VkCommandBuffer cmd)>&& function, std::vector<AllocatedBufferUntyped> stagingBuffers = {});
+
+		//last barrier of an upload, recorded inside submit. dstStage is the first use on the dstFamily queue
+		//when dstFamily is another family this is the release half, acquire records the other one
+		void release(VkCommandBuffer cmd, VkImageMemoryBarrier barrier, uint32_t dstFamily, VkPipelineStageFlags dstStage);
+		void release(VkCommandBuffer cmd, VkBufferMemoryBarrier barrier, uint32_t dstFamily, VkPipelineStageFlags dstStage);
+
+		//record the acquire half of everything released to family since the last call
+		Acquire acquire(VkCommandBuffer cmd, uint32_t family);
+
+		//blocks until the timeline reaches value
+		void wait(uint64_t value);
+
+		//free command buffers and staging buffers of finished uploads
+		void retire();
+
+		VkSemaphore timeline() const { return semaphore; }
+
+		uint32_t family() const { return queueFamily; }
+	private:
+
+		struct Submission {
+			uint64_t value;
+			VkCommandBuffer cmd;
+			std::vector<AllocatedBufferUntyped> stagingBuffers;
+			size_t stagingSize;
+		};
+
+		struct PendingAcquire {
+			uint32_t family;
+			VkPipelineStageFlags stage;
+			uint64_t value;
+			bool isImage;
+			VkImageMemoryBarrier image;
+			VkBufferMemoryBarrier buffer;
+		};
+
+		VkDevice device{ VK_NULL_HANDLE };
+		VmaAllocator allocator{ VK_NULL_HANDLE };
+		VkQueue queue{ VK_NULL_HANDLE };
+		uint32_t queueFamily{ 0 };
+		VkCommandPool pool{ VK_NULL_HANDLE };
+		VkSemaphore semaphore{ VK_NULL_HANDLE };
+
+		//value of the last submit, the one being recorded while inside submit
+		uint64_t submitted{ 0 };
+		std::deque<Submission> inFlight;
+		size_t stagingInFlight{ 0 };
+		std::vector<PendingAcquire> acquires;
+	};
+}
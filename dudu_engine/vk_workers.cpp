@@ -0,0 +1,67 @@
+﻿#include <vk_workers.h>
+
+namespace vkutil {
+
+	void WorkerPool::init(uint32_t count)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			threads.emplace_back([this, i]() { worker_loop(i); });
+		}
+	}
+
+	void WorkerPool::cleanup()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (std::thread& t : threads)
+		{
+			t.join();
+		}
+		threads.clear();
+	}
+
+	void WorkerPool::dispatch(std::function<void(uint32_t worker)>&& task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			current = std::move(task);
+			pending = size();
+			generation++;
+		}
+		wake.notify_all();
+	}
+
+	void WorkerPool::wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&]() { return pending == 0; });
+	}
+
+	void WorkerPool::worker_loop(uint32_t worker)
+	{
+		uint64_t seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&]() { return stopping || generation != seen; });
+				if (stopping) return;
+				seen = generation;
+			}
+
+			//the task is only replaced after wait, so it is read without the lock
+			current(worker);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pending == 0)
+			{
+				done.notify_all();
+			}
+		}
+	}
+}
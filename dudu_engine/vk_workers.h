@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+namespace vkutil {
+
+	//threads started once and reused every frame, instead of spawning new ones per task
+	//dispatch runs the task once on every worker, wait blocks until all of them returned
+	class WorkerPool {
+	public:
+		void init(uint32_t count);
+
+		//joins the threads, call it with nothing dispatched
+		void cleanup();
+
+		//task(worker) with worker from 0 to size()-1. one dispatch at a time, wait before the next one
+		void dispatch(std::function<void(uint32_t worker)>&& task);
+
+		void wait();
+
+		uint32_t size() const { return static_cast<uint32_t>(threads.size()); }
+	private:
+		void worker_loop(uint32_t worker);
+
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+
+		std::function<void(uint32_t)> current;
+		//bumped by every dispatch, a worker runs the task once per value
+		uint64_t generation{ 0 };
+		uint32_t pending{ 0 };
+		bool stopping{ false };
+	};
+}
@@ -0,0 +1,150 @@
+//glsl version 4.5
+#version 450
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+//bindless variant of textured_lit.frag, every material texture lives in one array
+
+//shader input
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 texCoord;
+layout (location = 2) in vec3 inNormal;
+
+layout (location = 3) in vec4 inShadowCoord;
+layout (location = 4) flat in uint inMaterial;
+//output write
+layout (location = 0) out vec4 outFragColor;
+
+layout(set = 0, binding = 1) uniform  SceneData{   
+    vec4 fogColor; // w is for exponent
+	vec4 fogDistances; //x for min, y for max, zw unused.
+	vec4 ambientColor;
+	vec4 sunlightDirection; //w for sun power
+	vec4 sunlightColor; //alpha for shadow blend, 0 to disable shadows
+	mat4 sunlightShadowMatrix;
+} sceneData;
+
+
+
+
+layout(set = 0, binding = 2) uniform sampler2DShadow  shadowSampler;
+
+//GPUMaterialData in material_system.h
+struct MaterialData{
+	uint albedoTexture;
+	uint padding0;
+	uint padding1;
+	uint padding2;
+};
+
+//all material textures, partially bound
+layout(set = 2, binding = 0) uniform sampler2D textures[];
+
+layout(set = 2, binding = 1) readonly buffer MaterialBuffer{   
+
+	MaterialData materials[];
+} materialBuffer;
+#define SHADOW_FACTOR 0.1
+
+float textureProj(vec4 P, vec2 offset)
+{
+	float shadow = 1.0;
+	//execute perspective division 
+	vec4 shadowCoord = P / P.w;
+	//4D shadow coord :(s,t,p,q)->(x,y,z,w)
+	//vulkan standard vector space x=[-1,1],y=[1,-1],z=[0,1]
+	//xoy :from [-1,1][1,-1] to [0,1][0,1]
+	shadowCoord.st = shadowCoord.st * 0.5 + 0.5;
+	
+	if (shadowCoord.z > -1.0 && shadowCoord.z < 1.0) 
+	{
+		vec3 sc = vec3(vec2(shadowCoord.st + offset),shadowCoord.z);
+		shadow =  texture(shadowSampler, sc);		
+	}
+	return shadow;
+}
+// 9 imad (+ 6 iops with final shuffle)
+uvec3 pcg3d(uvec3 v) {
+
+    v = v * 1664525u + 1013904223u;
+
+    v.x += v.y*v.z;
+    v.y += v.z*v.x;
+    v.z += v.x*v.y;
+
+    v ^= v >> 16u;
+
+    v.x += v.y*v.z;
+    v.y += v.z*v.x;
+    v.z += v.x*v.y;
+
+    return v;
+}
+//sc -> shadow coord
+float filterPCF(vec4 sc)
+{
+	ivec2 texDim = textureSize(shadowSampler, 0);
+	float scale = 2;
+	float dx = scale * 1.0 / float(texDim.x);
+	float dy = scale * 1.0 / float(texDim.y);
+
+	float shadowFactor = 0.0;
+	int count = 0;
+	int range = 2;
+
+	vec2 s = gl_FragCoord.xy;
+	
+	uvec4 u = uvec4(s, uint(s.x) ^ uint(s.y), uint(s.x) + uint(s.y));
+    vec3 rand = pcg3d(u.xyz);//vec3(1,0,0);//
+	rand = normalize(rand);
+
+
+	//sc.x += dx * rand.z;
+    //sc.y += dy * rand.y;
+	vec2 dirA = normalize(rand.xy);
+	vec2 dirB = normalize(vec2(-dirA.y,dirA.x));
+	
+	dirA *= dx;
+	dirB *= dy;
+	for (int x = -range; x <= range; x++)
+	{
+		for (int y = -range; y <= range; y++)
+		{
+			shadowFactor += textureProj(sc,dirA*x + dirB*y);
+			count++;
+		}	
+	}
+	return shadowFactor / count;
+
+}
+
+void main() 
+{
+	//objects of one draw can use different materials
+	uint albedo = materialBuffer.materials[inMaterial].albedoTexture;
+	vec4 albedoColor = texture(textures[nonuniformEXT(albedo)],texCoord);
+	vec3 color = albedoColor.xyz;
+	
+	float lightAngle = clamp(dot(inNormal, -sceneData.sunlightDirection.xyz),0.f,1.f);
+
+	float shadow = 0;
+
+	if(sceneData.sunlightColor.w > 0.01)
+	{
+		shadow = 1;
+	}
+	else //only attempt shadowsample in normals that point towards light
+	if(lightAngle > 0.01)
+	{
+		//soft shadow boundary
+		shadow = mix(0.f,1.f , filterPCF(inShadowCoord / inShadowCoord.w));
+	}
+
+
+	
+	vec3 lightColor = sceneData.sunlightColor.xyz * lightAngle;
+	vec3 ambient = color * sceneData.ambientColor.xyz;
+	vec3 diffuse = lightColor * color * shadow;
+
+	outFragColor = vec4(diffuse+ ambient,albedoColor.a);
+}
\ No newline at end of file
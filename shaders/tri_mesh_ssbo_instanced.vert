@@ -1,5 +1,5 @@
 #version 450
-layout (location = 0) in vec3 vPosition;
+layout (location = 0) in vec3 vPosition;//unorm inside the mesh bounds box
 layout (location = 1) in vec2 vOctNormal;
 layout (location = 2) in vec3 vColor;
 layout (location = 3) in vec2 vTexCoord;
@@ -8,6 +8,7 @@ layout (location = 0) out vec3 outColor;
 layout (location = 1) out vec2 texCoord;
 layout (location = 2) out vec3 outNormal;
 layout(location = 3) out vec4 ShadowCoord;
+layout(location = 4) flat out uint outMaterial;//bindless material index
 layout(set = 0, binding = 0) uniform  CameraBuffer{   
     mat4 view;
     mat4 proj;
@@ -29,6 +30,12 @@ struct ObjectData{
 	mat4 model;
 vec4 spherebounds;
 vec4 extents;
+vec4 quantizeMin;//mesh space box of the 16 bit positions
+vec4 quantizeRange;
+uint materialIndex;//bindless material
+uint pad0;
+uint pad1;
+uint pad2;
 }; 
 
 
@@ -64,12 +71,15 @@ void main()
 	
 	vec3 vNormal = OctNormalDecode(vOctNormal);
 
+	vec3 position = objectBuffer.objects[index].quantizeMin.xyz + vPosition * objectBuffer.objects[index].quantizeRange.xyz;
+
 	mat4 modelMatrix = objectBuffer.objects[index].model;
 	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
-	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
+	gl_Position = transformMatrix * vec4(position, 1.0f);
 	outNormal = normalize((modelMatrix * vec4(vNormal,0.f)).xyz);
 	outColor = vColor;
 	texCoord = vTexCoord;
+	outMaterial = objectBuffer.objects[index].materialIndex;
 
-	ShadowCoord = sceneData.sunlightShadowMatrix * (modelMatrix* vec4(vPosition, 1.0f)  );
+	ShadowCoord = sceneData.sunlightShadowMatrix * (modelMatrix* vec4(position, 1.0f)  );
 }
@@ -1,5 +1,5 @@
 #version 450
-layout (location = 0) in vec3 vPosition;
+layout (location = 0) in vec3 vPosition;//unorm inside the mesh bounds box
 layout (location = 1) in vec2 vOctNormal;
 layout (location = 2) in vec3 vColor;
 layout (location = 3) in vec2 vTexCoord;
@@ -17,6 +17,12 @@ struct ObjectData{
 	mat4 model;
 vec4 spherebounds;
 vec4 extents;
+vec4 quantizeMin;//mesh space box of the 16 bit positions
+vec4 quantizeRange;
+uint materialIndex;
+uint pad0;
+uint pad1;
+uint pad2;
 }; 
 
 //all object matrices
@@ -34,10 +40,12 @@ layout(set = 1, binding = 1) readonly buffer InstanceBuffer{
 void main() 
 {	
 	uint index = instanceBuffer.IDs[gl_InstanceIndex];
+	//quantized position -> model space
+	vec3 position = objectBuffer.objects[index].quantizeMin.xyz + vPosition * objectBuffer.objects[index].quantizeRange.xyz;
 	//modelMatrix -> obj from model space to world space
 	mat4 modelMatrix = objectBuffer.objects[index].model;
 	//transformMatrix -> obj from world space to light space
 	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
-	gl_Position = transformMatrix * vec4(vPosition, 1.0f);	
+	gl_Position = transformMatrix * vec4(position, 1.0f);	
 
 }